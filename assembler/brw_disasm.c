@@ -392,7 +392,8 @@ static const char * const sampler_target_format[4] = {
 };
 
 
-static int column;
+/* Of the line being formatted, on this thread */
+static __thread int column;
 
 static int string (FILE *file, const char *string)
 {
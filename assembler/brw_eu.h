@@ -403,7 +403,8 @@ brw_set_3src_src2(struct brw_compile *p,
 
 /* brw_eu_compact.c */
 void brw_init_compaction_tables(struct intel_context *intel);
-void brw_compact_instructions(struct brw_compile *p);
+bool brw_compact_instructions(struct brw_compile *p, const unsigned *align,
+			      unsigned *offsets);
 void brw_uncompact_instruction(struct intel_context *intel,
 			       struct brw_instruction *dst,
 			       struct brw_compact_instruction *src);
@@ -37,11 +37,13 @@
  * instruction in 8 bytes using some lookup tables for various fields.
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "brw_compat.h"
 #include "brw_context.h"
 #include "brw_eu.h"
+#include "ralloc.h"
 
 static const uint32_t gen6_control_index_table[32] = {
    0b00000000000000000,
@@ -323,10 +325,61 @@ static const uint32_t gen7_src_index_table[32] = {
    0b010110001000
 };
 
-static const uint32_t *control_index_table;
-static const uint32_t *datatype_table;
-static const uint32_t *subreg_table;
-static const uint32_t *src_index_table;
+/**
+ * The tables for the generation being compiled for on this thread, along
+ * with maps from their entries back to their index.
+ */
+#define COMPACTION_MAP_SIZE 64
+
+struct compaction_map {
+   uint32_t key[COMPACTION_MAP_SIZE];
+   int8_t index[COMPACTION_MAP_SIZE]; /* -1 for empty slots */
+};
+
+static __thread int compaction_gen;
+static __thread const uint32_t *control_index_table;
+static __thread const uint32_t *datatype_table;
+static __thread const uint32_t *subreg_table;
+static __thread const uint32_t *src_index_table;
+static __thread struct compaction_map control_index_map;
+static __thread struct compaction_map datatype_map;
+static __thread struct compaction_map subreg_map;
+static __thread struct compaction_map src_index_map;
+
+static inline unsigned
+compaction_hash(uint32_t key)
+{
+   return (key * 2654435761u) >> 26;
+}
+
+/* Open addressing, so that equal entries keep the first index */
+static void
+init_compaction_map(struct compaction_map *map, const uint32_t *table)
+{
+   memset(map->index, -1, sizeof(map->index));
+
+   for (int i = 0; i < 32; i++) {
+      unsigned h = compaction_hash(table[i]);
+
+      while (map->index[h] >= 0)
+         h = (h + 1) % COMPACTION_MAP_SIZE;
+
+      map->key[h] = table[i];
+      map->index[h] = i;
+   }
+}
+
+static int
+compaction_map_lookup(const struct compaction_map *map, uint32_t key)
+{
+   for (unsigned h = compaction_hash(key); map->index[h] >= 0;
+        h = (h + 1) % COMPACTION_MAP_SIZE) {
+      if (map->key[h] == key)
+         return map->index[h];
+   }
+
+   return -1;
+}
 
 static bool
 set_control_index(struct intel_context *intel,
@@ -335,6 +388,7 @@ set_control_index(struct intel_context *intel,
 {
    uint32_t *src_u32 = (uint32_t *)src;
    uint32_t uncompacted = 0;
+   int i;
 
    uncompacted |= ((src_u32[0] >> 8) & 0xffff) << 0;
    uncompacted |= ((src_u32[0] >> 31) & 0x1) << 16;
@@ -344,14 +398,12 @@ set_control_index(struct intel_context *intel,
    if (intel->gen >= 7)
       uncompacted |= ((src_u32[2] >> 25) & 0x3) << 17;
 
-   for (int i = 0; i < 32; i++) {
-      if (control_index_table[i] == uncompacted) {
-	 dst->dw0.control_index = i;
-	 return true;
-      }
-   }
+   i = compaction_map_lookup(&control_index_map, uncompacted);
+   if (i < 0)
+      return false;
 
-   return false;
+   dst->dw0.control_index = i;
+   return true;
 }
 
 static bool
@@ -359,52 +411,51 @@ set_datatype_index(struct brw_compact_instruction *dst,
                    struct brw_instruction *src)
 {
    uint32_t uncompacted = 0;
+   int i;
 
    uncompacted |= src->bits1.ud & 0x7fff;
    uncompacted |= (src->bits1.ud >> 29) << 15;
 
-   for (int i = 0; i < 32; i++) {
-      if (datatype_table[i] == uncompacted) {
-	 dst->dw0.data_type_index = i;
-	 return true;
-      }
-   }
+   i = compaction_map_lookup(&datatype_map, uncompacted);
+   if (i < 0)
+      return false;
 
-   return false;
+   dst->dw0.data_type_index = i;
+   return true;
 }
 
 static bool
 set_subreg_index(struct brw_compact_instruction *dst,
-                 struct brw_instruction *src)
+                 struct brw_instruction *src,
+                 bool is_immediate)
 {
    uint32_t uncompacted = 0;
+   int i;
 
    uncompacted |= src->bits1.da1.dest_subreg_nr << 0;
    uncompacted |= src->bits2.da1.src0_subreg_nr << 5;
-   uncompacted |= src->bits3.da1.src1_subreg_nr << 10;
+   if (!is_immediate)
+      uncompacted |= src->bits3.da1.src1_subreg_nr << 10;
 
-   for (int i = 0; i < 32; i++) {
-      if (subreg_table[i] == uncompacted) {
-	 dst->dw0.sub_reg_index = i;
-	 return true;
-      }
-   }
+   i = compaction_map_lookup(&subreg_map, uncompacted);
+   if (i < 0)
+      return false;
 
-   return false;
+   dst->dw0.sub_reg_index = i;
+   return true;
 }
 
 static bool
 get_src_index(uint32_t uncompacted,
               uint32_t *compacted)
 {
-   for (int i = 0; i < 32; i++) {
-      if (src_index_table[i] == uncompacted) {
-	 *compacted = i;
-	 return true;
-      }
-   }
+   int i = compaction_map_lookup(&src_index_map, uncompacted);
 
-   return false;
+   if (i < 0)
+      return false;
+
+   *compacted = i;
+   return true;
 }
 
 static bool
@@ -424,12 +475,19 @@ set_src0_index(struct brw_compact_instruction *dst,
    return true;
 }
 
+/* An immediate keeps its low 8 bits in src1_reg_nr and the next 5 here */
 static bool
 set_src1_index(struct brw_compact_instruction *dst,
-               struct brw_instruction *src)
+               struct brw_instruction *src,
+               bool is_immediate)
 {
    uint32_t compacted, uncompacted = 0;
 
+   if (is_immediate) {
+      dst->dw1.src1_index = (src->bits3.ud >> 8) & 0x1f;
+      return true;
+   }
+
    uncompacted |= (src->bits3.ud >> 13) & 0xfff;
 
    if (!get_src_index(uncompacted, &compacted))
@@ -440,6 +498,51 @@ set_src1_index(struct brw_compact_instruction *dst,
    return true;
 }
 
+static bool
+has_immediate(struct brw_instruction *insn)
+{
+   return insn->bits1.da1.src0_reg_file == BRW_IMMEDIATE_VALUE ||
+          insn->bits1.da1.src1_reg_file == BRW_IMMEDIATE_VALUE;
+}
+
+/* The top 20 bits of a compacted immediate replicate its 13th */
+static bool
+is_compactable_immediate(uint32_t imm)
+{
+   imm &= ~0xfff;
+   return imm == 0 || imm == 0xfffff000;
+}
+
+/*
+ * It appears that the end of thread SEND instruction needs to be aligned,
+ * or the GPU hangs. It is kept full size too.
+ */
+static bool
+is_end_of_thread(struct brw_instruction *insn)
+{
+   return (insn->header.opcode == BRW_OPCODE_SEND ||
+           insn->header.opcode == BRW_OPCODE_SENDC) &&
+          insn->bits3.generic.end_of_thread;
+}
+
+static bool
+is_flow_control(unsigned opcode)
+{
+   switch (opcode) {
+   case BRW_OPCODE_IF:
+   case BRW_OPCODE_IFF:
+   case BRW_OPCODE_ELSE:
+   case BRW_OPCODE_ENDIF:
+   case BRW_OPCODE_WHILE:
+   case BRW_OPCODE_BREAK:
+   case BRW_OPCODE_CONTINUE:
+   case BRW_OPCODE_HALT:
+      return true;
+   default:
+      return false;
+   }
+}
+
 /**
  * Tries to compact instruction src into dst.
  *
@@ -454,22 +557,40 @@ brw_try_compact_instruction(struct brw_compile *p,
    struct brw_context *brw = p->brw;
    struct intel_context *intel = &brw->intel;
    struct brw_compact_instruction temp;
+   struct brw_instruction uncompacted;
+   bool is_immediate = has_immediate(src);
+
+   if (intel->gen < 6 || intel->gen > 7 || compaction_gen != intel->gen)
+      return false;
 
-   if (src->header.opcode == BRW_OPCODE_IF ||
-       src->header.opcode == BRW_OPCODE_ELSE ||
-       src->header.opcode == BRW_OPCODE_ENDIF ||
-       src->header.opcode == BRW_OPCODE_HALT ||
-       src->header.opcode == BRW_OPCODE_DO ||
-       src->header.opcode == BRW_OPCODE_WHILE) {
-      /* FINISHME: The fixup code below, and brw_set_uip_jip and friends, needs
-       * to be able to handle compacted flow control instructions..
+   switch (src->header.opcode) {
+   case BRW_OPCODE_MAD:
+   case BRW_OPCODE_LRP:
+   case BRW_OPCODE_BFE:
+   case BRW_OPCODE_BFI2:
+      /* There is no compacted form of 3-source instructions. */
+      return false;
+   case BRW_OPCODE_JMPI:
+   case BRW_OPCODE_CALL:
+      /* Their jumps are relative to the next instruction or live outside of
+       * JIP, which brw_compact_instructions() only updates in full size
+       * instructions.
        */
       return false;
    }
 
-   /* FINISHME: immediates */
-   if (src->bits1.da1.src0_reg_file == BRW_IMMEDIATE_VALUE ||
-       src->bits1.da1.src1_reg_file == BRW_IMMEDIATE_VALUE)
+   if (is_end_of_thread(src))
+      return false;
+
+   if (is_flow_control(src->header.opcode)) {
+      /* Gen6 keeps the jump count in the destination fields. Gen7 JIP and
+       * UIP only stay compactable as they shrink when they are an immediate.
+       */
+      if (intel->gen == 6 || !is_immediate)
+         return false;
+   }
+
+   if (is_immediate && !is_compactable_immediate(src->bits3.ud))
       return false;
 
    memset(&temp, 0, sizeof(temp));
@@ -480,7 +601,7 @@ brw_try_compact_instruction(struct brw_compile *p,
       return false;
    if (!set_datatype_index(&temp, src))
       return false;
-   if (!set_subreg_index(&temp, src))
+   if (!set_subreg_index(&temp, src, is_immediate))
       return false;
    temp.dw0.acc_wr_control = src->header.acc_wr_control;
    temp.dw0.conditionalmod = src->header.destreg__conditionalmod;
@@ -489,11 +610,21 @@ brw_try_compact_instruction(struct brw_compile *p,
    temp.dw0.cmpt_ctrl = 1;
    if (!set_src0_index(&temp, src))
       return false;
-   if (!set_src1_index(&temp, src))
+   if (!set_src1_index(&temp, src, is_immediate))
       return false;
    temp.dw1.dst_reg_nr = src->bits1.da1.dest_reg_nr;
    temp.dw1.src0_reg_nr = src->bits2.da1.src0_reg_nr;
-   temp.dw1.src1_reg_nr = src->bits3.da1.src1_reg_nr;
+   if (is_immediate)
+      temp.dw1.src1_reg_nr = src->bits3.ud & 0xff;
+   else
+      temp.dw1.src1_reg_nr = src->bits3.da1.src1_reg_nr;
+
+   /* Fields without room in the compacted form must have the value
+    * uncompaction gives them.
+    */
+   brw_uncompact_instruction(intel, &uncompacted, &temp);
+   if (memcmp(&uncompacted, src, sizeof(uncompacted)))
+      return false;
 
    *dst = temp;
 
@@ -529,13 +660,15 @@ set_uncompacted_datatype(struct brw_instruction *dst,
 
 static void
 set_uncompacted_subreg(struct brw_instruction *dst,
-                       struct brw_compact_instruction *src)
+                       struct brw_compact_instruction *src,
+                       bool is_immediate)
 {
    uint32_t uncompacted = subreg_table[src->dw0.sub_reg_index];
 
    dst->bits1.da1.dest_subreg_nr = (uncompacted >> 0)  & 0x1f;
    dst->bits2.da1.src0_subreg_nr = (uncompacted >> 5)  & 0x1f;
-   dst->bits3.da1.src1_subreg_nr = (uncompacted >> 10) & 0x1f;
+   if (!is_immediate)
+      dst->bits3.da1.src1_subreg_nr = (uncompacted >> 10) & 0x1f;
 }
 
 static void
@@ -550,11 +683,22 @@ set_uncompacted_src0(struct brw_instruction *dst,
 
 static void
 set_uncompacted_src1(struct brw_instruction *dst,
-                     struct brw_compact_instruction *src)
+                     struct brw_compact_instruction *src,
+                     bool is_immediate)
 {
-   uint32_t uncompacted = src_index_table[src->dw1.src1_index];
-
-   dst->bits3.ud |= uncompacted << 13;
+   if (is_immediate) {
+      uint32_t imm = src->dw1.src1_index << 8 | src->dw1.src1_reg_nr;
+
+      /* The top bit of src1_index is replicated through the top 20 bits */
+      if (imm & 0x1000)
+         imm |= 0xfffff000;
+      dst->bits3.ud = imm;
+   } else {
+      uint32_t uncompacted = src_index_table[src->dw1.src1_index];
+
+      dst->bits3.ud |= uncompacted << 13;
+      dst->bits3.da1.src1_reg_nr = src->dw1.src1_reg_nr;
+   }
 }
 
 void
@@ -562,6 +706,8 @@ brw_uncompact_instruction(struct intel_context *intel,
                           struct brw_instruction *dst,
                           struct brw_compact_instruction *src)
 {
+   bool is_immediate;
+
    memset(dst, 0, sizeof(*dst));
 
    dst->header.opcode = src->dw0.opcode;
@@ -569,16 +715,16 @@ brw_uncompact_instruction(struct intel_context *intel,
 
    set_uncompacted_control(intel, dst, src);
    set_uncompacted_datatype(dst, src);
-   set_uncompacted_subreg(dst, src);
+   is_immediate = has_immediate(dst);
+   set_uncompacted_subreg(dst, src, is_immediate);
    dst->header.acc_wr_control = src->dw0.acc_wr_control;
    dst->header.destreg__conditionalmod = src->dw0.conditionalmod;
    if (intel->gen <= 6)
       dst->bits2.da1.flag_subreg_nr = src->dw0.flag_subreg_nr;
    set_uncompacted_src0(dst, src);
-   set_uncompacted_src1(dst, src);
+   set_uncompacted_src1(dst, src, is_immediate);
    dst->bits1.da1.dest_reg_nr = src->dw1.dst_reg_nr;
    dst->bits2.da1.src0_reg_nr = src->dw1.src0_reg_nr;
-   dst->bits3.da1.src1_reg_nr = src->dw1.src1_reg_nr;
 }
 
 void brw_debug_compact_uncompact(struct intel_context *intel,
@@ -609,9 +755,14 @@ void brw_debug_compact_uncompact(struct intel_context *intel,
    }
 }
 
+/* Jumps out of the program are left alone */
 static int
-compacted_between(int old_ip, int old_target_ip, int *compacted_counts)
+compacted_between(int old_ip, int old_target_ip, int *compacted_counts,
+                  int old_end_ip)
 {
+   if (old_target_ip < 0 || old_target_ip > old_end_ip)
+      return 0;
+
    int this_compacted_count = compacted_counts[old_ip];
    int target_compacted_count = compacted_counts[old_target_ip];
    return target_compacted_count - this_compacted_count;
@@ -619,19 +770,34 @@ compacted_between(int old_ip, int old_target_ip, int *compacted_counts)
 
 static void
 update_uip_jip(struct brw_instruction *insn, int this_old_ip,
-               int *compacted_counts)
+               int *compacted_counts, int old_end_ip)
 {
    int target_old_ip;
 
    target_old_ip = this_old_ip + insn->bits3.break_cont.jip;
    insn->bits3.break_cont.jip -= compacted_between(this_old_ip,
                                                    target_old_ip,
-                                                   compacted_counts);
+                                                   compacted_counts,
+                                                   old_end_ip);
 
    target_old_ip = this_old_ip + insn->bits3.break_cont.uip;
    insn->bits3.break_cont.uip -= compacted_between(this_old_ip,
                                                    target_old_ip,
-                                                   compacted_counts);
+                                                   compacted_counts,
+                                                   old_end_ip);
+}
+
+/* In bytes on Haswell and 8 byte units before, from the next instruction */
+static void
+update_jmpi(struct intel_context *intel, struct brw_instruction *insn,
+            int this_old_ip, int *compacted_counts, int old_end_ip)
+{
+   int scale = intel->is_haswell ? 8 : 1;
+   int target_old_ip = this_old_ip + 2 + insn->bits3.JIP / scale;
+
+   insn->bits3.JIP -= scale * compacted_between(this_old_ip, target_old_ip,
+                                                compacted_counts,
+                                                old_end_ip);
 }
 
 void
@@ -646,6 +812,9 @@ brw_init_compaction_tables(struct intel_context *intel)
    assert(gen7_subreg_table[ARRAY_SIZE(gen6_subreg_table) - 1] != 0);
    assert(gen7_src_index_table[ARRAY_SIZE(gen6_src_index_table) - 1] != 0);
 
+   if (compaction_gen == intel->gen)
+      return;
+
    switch (intel->gen) {
    case 7:
       control_index_table = gen7_control_index_table;
@@ -662,39 +831,155 @@ brw_init_compaction_tables(struct intel_context *intel)
    default:
       return;
    }
+
+   init_compaction_map(&control_index_map, control_index_table);
+   init_compaction_map(&datatype_map, datatype_table);
+   init_compaction_map(&subreg_map, subreg_table);
+   init_compaction_map(&src_index_map, src_index_table);
+   compaction_gen = intel->gen;
 }
 
-void
-brw_compact_instructions(struct brw_compile *p)
+static void
+insert_compacted_nop(void *store, int offset)
+{
+   struct brw_compact_instruction *nop = store + offset;
+
+   memset(nop, 0, sizeof(*nop));
+   nop->dw0.opcode = BRW_OPCODE_NOP;
+   nop->dw0.cmpt_ctrl = 1;
+}
+
+/**
+ * For an instruction at byte offset 8*i before compaction, this is the most
+ * compacted NOPs that alignment can put before it, counted from the start.
+ */
+static int *
+max_padding(struct brw_compile *p, const unsigned *align)
+{
+   void *store = p->store;
+   int old_end_ip = p->next_insn_offset / 8;
+   int *padded = rzalloc_array(p->mem_ctx, int, old_end_ip + 1);
+   int src_offset, size, nops = 0;
+
+   if (!padded)
+      return NULL;
+
+   for (src_offset = 0; src_offset < p->nr_insn * 16; src_offset += size) {
+      struct brw_instruction *src = store + src_offset;
+      unsigned alignment = align ? align[src_offset / 16] : 0;
+
+      if (is_end_of_thread(src) && alignment < 16)
+         alignment = 16;
+      if (alignment > 8)
+         nops += alignment / 8 - 1;
+
+      size = src->header.cmpt_control ? 8 : 16;
+      padded[src_offset / 8] = nops;
+      if (size == 16)
+         padded[src_offset / 8 + 1] = nops;
+   }
+   padded[old_end_ip] = nops;
+
+   return padded;
+}
+
+/* A jump of @jump from @ip, with every NOP that can come in its way */
+static int
+padded_jump(int jump, int ip, const int *padded, int old_end_ip)
+{
+   int target = ip + jump;
+   int nops;
+
+   if (target < 0 || target > old_end_ip)
+      return jump;
+
+   nops = abs(padded[target] - padded[ip]);
+   return jump < 0 ? jump - nops : jump + nops;
+}
+
+/**
+ * Whether flow control at @ip stays compactable whatever the alignment
+ * padding turns out to be.
+ *
+ * Only Gen7 JIP and UIP get here. Compacting the instructions in between
+ * shrinks them and NOPs grow them, and the compacted immediate holds a
+ * range, so it's enough that they fit both as they are and grown by every
+ * NOP that can come in their way.
+ */
+static bool
+jumps_fit_padding(struct brw_compile *p, struct brw_instruction *insn,
+                  int ip, const int *padded, int old_end_ip)
+{
+   struct brw_instruction worst = *insn;
+   struct brw_compact_instruction scratch;
+   int jip = padded_jump(insn->bits3.break_cont.jip, ip, padded, old_end_ip);
+   int uip = padded_jump(insn->bits3.break_cont.uip, ip, padded, old_end_ip);
+
+   if (jip < INT16_MIN || jip > INT16_MAX ||
+       uip < INT16_MIN || uip > INT16_MAX)
+      return false;
+
+   worst.bits3.break_cont.jip = jip;
+   worst.bits3.break_cont.uip = uip;
+   return brw_try_compact_instruction(p, &scratch, &worst);
+}
+
+/**
+ * One compaction pass, leaving the instructions at the 8-byte offsets set in
+ * @keep full size.
+ *
+ * Returns false if compacted flow control couldn't hold its updated jumps,
+ * setting its offset in @keep. The program is then left half fixed up.
+ */
+static bool
+compact_pass(struct brw_compile *p, const unsigned *align, unsigned *offsets,
+             const int *padded, bool *keep)
 {
    struct brw_context *brw = p->brw;
    struct intel_context *intel = &brw->intel;
    void *store = p->store;
    /* For an instruction at byte offset 8*i before compaction, this is the number
-    * of compacted instructions that preceded it.
+    * of compacted instructions that preceded it, less the NOPs added.
     */
-   int compacted_counts[p->next_insn_offset / 8];
+   int *compacted_counts;
    /* For an instruction at byte offset 8*i after compaction, this is the
     * 8-byte offset it was at before compaction.
     */
-   int old_ip[p->next_insn_offset / 8];
+   int *old_ip;
+   int old_end_ip = p->next_insn_offset / 8;
+   bool fits = true;
 
-   if (intel->gen < 6)
-      return;
+   compacted_counts = rzalloc_array(p->mem_ctx, int, old_end_ip + 1);
+   old_ip = rzalloc_array(p->mem_ctx, int, old_end_ip + 1);
 
    int src_offset;
    int offset = 0;
    int compacted_count = 0;
    for (src_offset = 0; src_offset < p->nr_insn * 16;) {
       struct brw_instruction *src = store + src_offset;
-      void *dst = store + offset;
+      void *dst;
+      unsigned alignment = align ? align[src_offset / 16] : 0;
+
+      if (is_end_of_thread(src) && alignment < 16)
+         alignment = 16;
+
+      while (alignment && offset % alignment) {
+         assert(offset < src_offset);
+         insert_compacted_nop(store, offset);
+         old_ip[offset / 8] = src_offset / 8;
+         compacted_count--;
+         offset += 8;
+      }
 
       old_ip[offset / 8] = src_offset / 8;
       compacted_counts[src_offset / 8] = compacted_count;
+      dst = store + offset;
 
       struct brw_instruction saved = *src;
 
-      if (!src->header.cmpt_control &&
+      if (!src->header.cmpt_control && !keep[src_offset / 8] &&
+          (!is_flow_control(src->header.opcode) ||
+           jumps_fit_padding(p, src, src_offset / 8, padded, old_end_ip)) &&
           brw_try_compact_instruction(p, dst, src)) {
          compacted_count++;
 
@@ -711,22 +996,6 @@ brw_compact_instructions(struct brw_compile *p)
       } else {
          int size = src->header.cmpt_control ? 8 : 16;
 
-         /* It appears that the end of thread SEND instruction needs to be
-          * aligned, or the GPU hangs.
-          */
-         if ((src->header.opcode == BRW_OPCODE_SEND ||
-              src->header.opcode == BRW_OPCODE_SENDC) &&
-             src->bits3.generic.end_of_thread &&
-             (offset & 8) != 0) {
-            struct brw_compact_instruction *align = store + offset;
-            memset(align, 0, sizeof(*align));
-            align->dw0.opcode = BRW_OPCODE_NOP;
-            align->dw0.cmpt_ctrl = 1;
-            offset += 8;
-            old_ip[offset / 8] = src_offset / 8;
-            dst = store + offset;
-         }
-
          /* If we didn't compact this intruction, we need to move it down into
           * place.
           */
@@ -737,58 +1006,106 @@ brw_compact_instructions(struct brw_compile *p)
          src_offset += size;
       }
    }
+   compacted_counts[old_end_ip] = compacted_count;
+
+   if (offsets) {
+      for (int i = 0; i <= p->nr_insn; i++)
+         offsets[i] = 16 * i - 8 * compacted_counts[2 * i];
+   }
 
    /* Fix up control flow offsets. */
    p->next_insn_offset = offset;
    for (offset = 0; offset < p->next_insn_offset;) {
       struct brw_instruction *insn = store + offset;
+      struct brw_instruction uncompacted;
       int this_old_ip = old_ip[offset / 8];
-      int this_compacted_count = compacted_counts[this_old_ip];
-      int target_old_ip, target_compacted_count;
+      int target_old_ip;
+      bool compacted = insn->header.cmpt_control;
+
+      /* Compacted flow control has its JIP and UIP in an immediate, which
+       * stays compactable as they shrink.
+       */
+      if (compacted) {
+         if (!is_flow_control(insn->header.opcode)) {
+            offset += 8;
+            continue;
+         }
+         brw_uncompact_instruction(intel, &uncompacted, (void *)insn);
+         insn = &uncompacted;
+      }
 
       switch (insn->header.opcode) {
       case BRW_OPCODE_BREAK:
       case BRW_OPCODE_CONTINUE:
       case BRW_OPCODE_HALT:
-         update_uip_jip(insn, this_old_ip, compacted_counts);
+         update_uip_jip(insn, this_old_ip, compacted_counts, old_end_ip);
          break;
 
       case BRW_OPCODE_IF:
+      case BRW_OPCODE_IFF:
       case BRW_OPCODE_ELSE:
       case BRW_OPCODE_ENDIF:
       case BRW_OPCODE_WHILE:
          if (intel->gen == 6) {
             target_old_ip = this_old_ip + insn->bits1.branch_gen6.jump_count;
-            target_compacted_count = compacted_counts[target_old_ip];
-            insn->bits1.branch_gen6.jump_count -= (target_compacted_count -
-                                                   this_compacted_count);
+            insn->bits1.branch_gen6.jump_count -=
+               compacted_between(this_old_ip, target_old_ip,
+                                 compacted_counts, old_end_ip);
          } else {
-            update_uip_jip(insn, this_old_ip, compacted_counts);
+            update_uip_jip(insn, this_old_ip, compacted_counts, old_end_ip);
          }
          break;
+
+      case BRW_OPCODE_JMPI:
+         update_jmpi(intel, insn, this_old_ip, compacted_counts, old_end_ip);
+         break;
+
+      case BRW_OPCODE_CALL:
+         if (intel->gen == 6)
+            insn->bits3.JIP -= compacted_between(this_old_ip,
+                                                 this_old_ip + insn->bits3.JIP,
+                                                 compacted_counts,
+                                                 old_end_ip);
+         else
+            update_uip_jip(insn, this_old_ip, compacted_counts, old_end_ip);
+         break;
       }
 
-      if (insn->header.cmpt_control) {
+      if (compacted) {
+         /* Checked against the worst padding before compacting it, so this
+          * is only a safety net. There's no room left to uncompact it here.
+          */
+         if (!brw_try_compact_instruction(p, (void *)(store + offset),
+                                          &uncompacted)) {
+            keep[this_old_ip] = true;
+            fits = false;
+         }
          offset += 8;
       } else {
          offset += 16;
       }
    }
 
+   ralloc_free(compacted_counts);
+   ralloc_free(old_ip);
+
+   if (!fits)
+      return false;
+
    /* p->nr_insn is counting the number of uncompacted instructions still, so
     * divide.  We do want to be sure there's a valid instruction in any
     * alignment padding, so that the next compression pass (for the FS 8/16
     * compile passes) parses correctly.
     */
    if (p->next_insn_offset & 8) {
-      struct brw_compact_instruction *align = store + offset;
-      memset(align, 0, sizeof(*align));
-      align->dw0.opcode = BRW_OPCODE_NOP;
-      align->dw0.cmpt_ctrl = 1;
+      insert_compacted_nop(store, offset);
       p->next_insn_offset += 8;
    }
    p->nr_insn = p->next_insn_offset / 16;
 
+   if (offsets)
+      offsets[old_end_ip / 2] = p->next_insn_offset;
+
    if (0) {
       fprintf(stdout, "dumping compacted program\n");
       brw_dump_compile(p, stdout, 0, p->next_insn_offset);
@@ -807,4 +1124,58 @@ brw_compact_instructions(struct brw_compile *p)
       fprintf(stderr, "%db/%db saved (%d%%)\n", cmp * 8, offset + cmp * 8,
               cmp * 8 * 100 / (offset + cmp * 8));
    }
+
+   return true;
+}
+
+/**
+ * Compacts the program in place, updating the jumps.
+ *
+ * If @align isn't NULL, the instruction i must start at a multiple of
+ * align[i] bytes after compaction, 0 meaning any. It must have been aligned
+ * as much before. If @offsets isn't NULL, offsets[i] is set to the byte
+ * offset of the instruction i after compaction. Both have an entry for each
+ * instruction and one for the end of the program.
+ *
+ * Flow control is only compacted if its jumps fit with the worst padding.
+ * Should one still not fit, the pass is redone with it left full size.
+ * Returns false, with the program as it was, if that fails too or memory
+ * runs out.
+ */
+bool
+brw_compact_instructions(struct brw_compile *p, const unsigned *align,
+                         unsigned *offsets)
+{
+   struct brw_context *brw = p->brw;
+   struct intel_context *intel = &brw->intel;
+   int nr_insn = p->nr_insn;
+   int next_insn_offset = p->next_insn_offset;
+   void *saved;
+   int *padded;
+   bool *keep;
+   bool ok = false;
+
+   if (intel->gen < 6 || intel->gen > 7)
+      return true;
+
+   saved = ralloc_size(p->mem_ctx, next_insn_offset);
+   padded = max_padding(p, align);
+   keep = rzalloc_array(p->mem_ctx, bool, next_insn_offset / 8 + 1);
+   if (saved && padded && keep) {
+      memcpy(saved, p->store, next_insn_offset);
+
+      for (int pass = 0; pass < 2 && !ok; pass++) {
+         ok = compact_pass(p, align, offsets, padded, keep);
+         if (!ok) {
+            memcpy(p->store, saved, next_insn_offset);
+            p->nr_insn = nr_insn;
+            p->next_insn_offset = next_insn_offset;
+         }
+      }
+   }
+
+   ralloc_free(saved);
+   ralloc_free(padded);
+   ralloc_free(keep);
+   return ok;
 }
@@ -25,97 +25,326 @@
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "gen4asm.h"
 #include "brw_eu.h"
 #include "gen8_instruction.h"
 
+/* Instructions a thread formats at once */
+#define CHUNK_INSN	4096
+
 static const struct option longopts[] = {
+	{"binary", no_argument, 0, 'b'},
+	{"raw", no_argument, 0, 'r'},
+	{"output", required_argument, 0, 'o'},
+	{"gen", required_argument, 0, 'g'},
+	{"threads", required_argument, 0, 'j'},
 	{ NULL, 0, NULL, 0 }
 };
 
+/* The whole input, mapped when it is a regular file */
+struct input {
+    char	*data;
+    size_t	size;
+};
+
+static int
+read_input (FILE *file, struct input *in)
+{
+    struct stat	st;
+    size_t	len = 0, size = 0, n;
+    char	*data = NULL, *tmp;
+
+    if (fstat (fileno (file), &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0) {
+	data = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		     fileno (file), 0);
+	if (data != MAP_FAILED) {
+	    in->data = data;
+	    in->size = st.st_size;
+	    return 0;
+	}
+	data = NULL;
+    }
+
+    do {
+	if (len == size) {
+	    size = size ? 2 * size : 64 * 1024;
+	    tmp = realloc (data, size);
+	    if (tmp == NULL) {
+		free (data);
+		return -1;
+	    }
+	    data = tmp;
+	}
+	n = fread (data + len, 1, size - len, file);
+	len += n;
+    } while (n);
+
+    if (ferror (file)) {
+	free (data);
+	return -1;
+    }
+
+    in->data = data;
+    in->size = len;
+    return 0;
+}
+
+static inline int
+hex_digit (int c)
+{
+    if (c >= '0' && c <= '9')
+	return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+	return c - 'a' + 10;
+    return -1;
+}
+
+/*
+ * Finds the next 0x prefixed number of at most @max_digits digits from *@pos,
+ * skipping anything else, and leaves *@pos just after it.
+ */
+static int
+next_hex (const char **pos, const char *end, int max_digits, uint32_t *value)
+{
+    const char	*p = *pos;
+    int		n, d;
+
+    while ((p = memchr (p, '0', end - p)) != NULL) {
+	p++;
+	if (p == end || *p != 'x')
+	    continue;
+
+	*value = 0;
+	for (n = 0, p++; n < max_digits && p < end && (d = hex_digit (*p)) >= 0; n++, p++)
+	    *value = *value << 4 | d;
+	if (n) {
+	    *pos = p;
+	    return 1;
+	}
+    }
+
+    *pos = end;
+    return 0;
+}
+
 static struct brw_program *
-read_program (FILE *input)
+read_program (const struct input *in)
 {
     uint32_t			    inst[4];
     struct brw_program		    *program;
-    struct brw_program_instruction  *entry, **prev;
-    int			c;
+    const char			    *pos = in->data, *end = in->data + in->size;
     int			n = 0;
 
     program = malloc (sizeof (struct brw_program));
-    program->first = NULL;
-    prev = &program->first;
-    while ((c = getc (input)) != EOF) {
-	if (c == '0') {
-	    if (fscanf (input, "x%x", &inst[n]) == 1) {
-		++n;
-		if (n == 4) {
-		    entry = malloc (sizeof (struct brw_program_instruction));
-		    memcpy (&entry->insn, inst, 4 * sizeof (uint32_t));
-		    entry->next = NULL;
-		    *prev = entry;
-		    prev = &entry->next;
-		    n = 0;
-		}
-	    }
+    brw_program_init (program, ralloc_context (NULL));
+    while (next_hex (&pos, end, 8, &inst[n])) {
+	++n;
+	if (n == 4) {
+	    memcpy (brw_program_next_insn (program), inst, 4 * sizeof (uint32_t));
+	    n = 0;
 	}
     }
     return program;
 }
 
 static struct brw_program *
-read_program_binary (FILE *input)
+read_program_binary (const struct input *in)
 {
     uint32_t			    temp;
     uint8_t			    inst[16];
     struct brw_program		    *program;
-    struct brw_program_instruction  *entry, **prev;
-    int			c;
+    const char			    *pos = in->data, *end = in->data + in->size;
     int			n = 0;
 
     program = malloc (sizeof (struct brw_program));
-    program->first = NULL;
-    prev = &program->first;
-    while ((c = getc (input)) != EOF) {
-	if (c == '0') {
-	    if (fscanf (input, "x%2x", &temp) == 1) {
-		inst[n++] = (uint8_t)temp;
-		if (n == 16) {
-		    entry = malloc (sizeof (struct brw_program_instruction));
-		    memcpy (&entry->insn, inst, 16 * sizeof (uint8_t));
-		    entry->next = NULL;
-		    *prev = entry;
-		    prev = &entry->next;
-		    n = 0;
-		}
-	    }
+    brw_program_init (program, ralloc_context (NULL));
+    while (next_hex (&pos, end, 2, &temp)) {
+	inst[n++] = (uint8_t)temp;
+	if (n == 16) {
+	    memcpy (brw_program_next_insn (program), inst, 16 * sizeof (uint8_t));
+	    n = 0;
 	}
     }
     return program;
 }
 
+/* The instructions are the input itself, 16 bytes each */
+static struct brw_program *
+read_program_raw (const struct input *in)
+{
+    struct brw_program		    *program;
+
+    if (in->size % sizeof (union brw_program_insn))
+	fprintf (stderr, "Ignoring the last %zu bytes, not a whole instruction\n",
+		 in->size % sizeof (union brw_program_insn));
+
+    program = malloc (sizeof (struct brw_program));
+    brw_program_init (program, NULL);
+    program->insn = (union brw_program_insn *)in->data;
+    program->nr_insn = in->size / sizeof (union brw_program_insn);
+    program->insn_size = program->nr_insn;
+    return program;
+}
+
+static void
+disassemble (FILE *output, union brw_program_insn *insn, unsigned count, int gen)
+{
+    unsigned	i;
+
+    for (i = 0; i < count; i++)
+	if (gen >= 8)
+	    gen8_disassemble(output, &insn[i].gen8, gen);
+	else
+	    brw_disasm (output, &insn[i].gen, gen);
+}
+
+struct disasm_chunk {
+    char	*text;
+    size_t	size;
+    int		done;
+};
+
+/*
+ * The threads format chunks in any order, at most @window ahead of the
+ * chunk being written, which the main thread writes in program order.
+ */
+struct disasm_job {
+    struct brw_program	*program;
+    int			gen;
+
+    struct disasm_chunk	*chunks;
+    unsigned		nr_chunks;
+    unsigned		next;
+    unsigned		written;
+    unsigned		window;
+
+    pthread_mutex_t	mutex;
+    pthread_cond_t	cond;
+};
+
+static void *
+disasm_thread (void *arg)
+{
+    struct disasm_job	*job = arg;
+    struct disasm_chunk	*chunk;
+    unsigned		n, count;
+    FILE		*f;
+
+    for (;;) {
+	pthread_mutex_lock (&job->mutex);
+	while (job->next < job->nr_chunks && job->next >= job->written + job->window)
+	    pthread_cond_wait (&job->cond, &job->mutex);
+	n = job->next++;
+	pthread_mutex_unlock (&job->mutex);
+	if (n >= job->nr_chunks)
+	    return NULL;
+
+	chunk = &job->chunks[n];
+	count = job->program->nr_insn - n * CHUNK_INSN;
+	if (count > CHUNK_INSN)
+	    count = CHUNK_INSN;
+
+	f = open_memstream (&chunk->text, &chunk->size);
+	if (f) {
+	    disassemble (f, &job->program->insn[n * CHUNK_INSN], count, job->gen);
+	    fclose (f);
+	}
+
+	pthread_mutex_lock (&job->mutex);
+	chunk->done = 1;
+	pthread_cond_broadcast (&job->cond);
+	pthread_mutex_unlock (&job->mutex);
+    }
+}
+
+static int
+disassemble_threaded (FILE *output, struct brw_program *program, int gen,
+		      int nr_threads)
+{
+    struct disasm_job	job = {
+	.program = program,
+	.gen = gen,
+	.nr_chunks = (program->nr_insn + CHUNK_INSN - 1) / CHUNK_INSN,
+	.window = 4 * nr_threads,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+    };
+    pthread_t		*threads;
+    int			i, err = 0;
+
+    job.chunks = calloc (job.nr_chunks, sizeof (*job.chunks));
+    threads = calloc (nr_threads, sizeof (*threads));
+    if (job.chunks == NULL || threads == NULL)
+	return -1;
+
+    for (i = 0; i < nr_threads; i++)
+	if (pthread_create (&threads[i], NULL, disasm_thread, &job))
+	    break;
+    nr_threads = i;
+    if (nr_threads == 0) {
+	free (threads);
+	free (job.chunks);
+	return -1;
+    }
+
+    while (job.written < job.nr_chunks) {
+	struct disasm_chunk *chunk = &job.chunks[job.written];
+
+	pthread_mutex_lock (&job.mutex);
+	while (!chunk->done)
+	    pthread_cond_wait (&job.cond, &job.mutex);
+	pthread_mutex_unlock (&job.mutex);
+
+	if (chunk->text == NULL)
+	    err = -1;
+	else
+	    fwrite (chunk->text, 1, chunk->size, output);
+	free (chunk->text);
+
+	pthread_mutex_lock (&job.mutex);
+	job.written++;
+	pthread_cond_broadcast (&job.cond);
+	pthread_mutex_unlock (&job.mutex);
+    }
+
+    for (i = 0; i < nr_threads; i++)
+	pthread_join (threads[i], NULL);
+
+    free (threads);
+    free (job.chunks);
+    return err;
+}
+
 static void usage(void)
 {
     fprintf(stderr, "usage: intel-gen4disasm [options] inputfile\n");
-    fprintf(stderr, "\t-b, --binary                         C style binary output\n");
+    fprintf(stderr, "\t-b, --binary                         C style binary input\n");
+    fprintf(stderr, "\t-r, --raw                            Raw binary input\n");
     fprintf(stderr, "\t-o, --output {outputfile}            Specify output file\n");
     fprintf(stderr, "\t-g, --gen <4|5|6|7|8>                Specify GPU generation\n");
+    fprintf(stderr, "\t-j, --threads <n>                    Disassemble on n threads, 0 for one per CPU\n");
 }
 
 int main(int argc, char **argv)
 {
     struct brw_program	*program;
+    struct input	in;
     FILE		*input = stdin;
     FILE		*output = stdout;
     char		*input_filename = NULL;
     char		*output_file = NULL;
     int			byte_array_input = 0;
+    int			raw_input = 0;
+    int			nr_threads = 1;
     int			o;
     int			gen = 4;
-    struct brw_program_instruction  *inst;
 
-    while ((o = getopt_long(argc, argv, "o:bg:", longopts, NULL)) != -1) {
+    while ((o = getopt_long(argc, argv, "o:bg:j:r", longopts, NULL)) != -1) {
 	switch (o) {
 	case 'o':
 	    if (strcmp(optarg, "-") != 0)
@@ -124,6 +353,9 @@ int main(int argc, char **argv)
 	case 'b':
 	    byte_array_input = 1;
 	    break;
+	case 'r':
+	    raw_input = 1;
+	    break;
 	case 'g':
 	    gen = strtol(optarg, NULL, 10);
 
@@ -132,6 +364,17 @@ int main(int argc, char **argv)
 		    exit(1);
 	    }
 
+	    break;
+	case 'j':
+	    nr_threads = strtol(optarg, NULL, 10);
+	    if (nr_threads == 0)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	    if (nr_threads < 1) {
+		    usage();
+		    exit(1);
+	    }
+
 	    break;
 	default:
 	    usage();
@@ -153,10 +396,16 @@ int main(int argc, char **argv)
 	    exit(1);
 	}
     }
-    if (byte_array_input)
-	program = read_program_binary (input);
+    if (read_input (input, &in)) {
+	perror("Couldn't read input file");
+	exit(1);
+    }
+    if (raw_input)
+	program = read_program_raw (&in);
+    else if (byte_array_input)
+	program = read_program_binary (&in);
     else
-	program = read_program (input);
+	program = read_program (&in);
     if (!program)
 	exit (1);
     if (output_file) {
@@ -167,11 +416,13 @@ int main(int argc, char **argv)
 	}
     }
 
-    for (inst = program->first; inst; inst = inst->next)
-	if (gen >= 8)
-	    gen8_disassemble(output, &inst->insn.gen8, gen);
-	else
-	    brw_disasm (output, &inst->insn.gen, gen);
+    if (nr_threads > 1 && program->nr_insn > CHUNK_INSN) {
+	if (disassemble_threaded (output, program, gen, nr_threads)) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+    } else
+	disassemble (output, program->insn, program->nr_insn, gen);
 
     exit (0);
 }
@@ -31,36 +31,32 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
 #include <assert.h>
 
+#include "ralloc.h"
 #include "brw_reg.h"
 #include "brw_defines.h"
 #include "brw_structs.h"
+#include "brw_eu.h"
 #include "gen8_instruction.h"
 
-extern long int gen_level;
-extern int advanced_flag;
-extern int errors;
-
 #define WARN_ALWAYS	(1 << 0)
 #define WARN_ALL	(1 << 31)
-extern unsigned int warning_flags;
-
-extern char *input_filename;
 
-extern struct brw_context genasm_context;
-extern struct brw_compile genasm_compile;
+/* The assembly in progress on this thread, see struct gen4asm_context */
+extern __thread struct gen4asm_context *gen4asm_ctx;
 
 /* Predicate for Gen X and above */
-#define IS_GENp(x) (gen_level >= (x)*10)
+#define IS_GENp(x) (gen4asm_ctx->gen_level >= (x)*10)
 
 /* Predicate for Gen X exactly */
-#define IS_GENx(x) (gen_level >= (x)*10 && gen_level < ((x)+1)*10)
+#define IS_GENx(x) (gen4asm_ctx->gen_level >= (x)*10 && gen4asm_ctx->gen_level < ((x)+1)*10)
 
 /* Predicate to match Haswell processors */
-#define IS_HASWELL(x) (gen_level == 75)
-
-void yyerror (char *msg);
+#define IS_HASWELL(x) (gen4asm_ctx->gen_level == 75)
 
 #define STRUCT_SIZE_ASSERT(TYPE, SIZE) \
 typedef struct { \
@@ -116,7 +112,7 @@ struct src_operand {
 	int default_region;
 	uint32_t imm32; /* set if src_operand is expressing a branch offset */
 	char *reloc_target; /* bspec: branching instructions JIP and UIP are source operands */
-} src_operand;
+};
 
 typedef struct {
     enum {
@@ -129,65 +125,84 @@ typedef struct {
     } u;
 } imm32_t;
 
-enum assembler_instruction_type {
-    GEN4ASM_INSTRUCTION_GEN,
-    GEN4ASM_INSTRUCTION_GEN_RELOCATABLE,
-    GEN4ASM_INSTRUCTION_GEN8,
-    GEN4ASM_INSTRUCTION_GEN8_RELOCATABLE,
-    GEN4ASM_INSTRUCTION_LABEL,
-};
-
-struct label_instruction {
-    char   *name;
-};
-
 struct relocation {
     char *first_reloc_target, *second_reloc_target; // JIP and UIP respectively
     int first_reloc_offset, second_reloc_offset; // in number of instructions
 };
 
 /**
- * This structure is just the list container for instructions accumulated by
- * the parser and labels.
+ * An instruction in its native encoding, 128 bits on every generation.
+ */
+union brw_program_insn {
+    struct brw_instruction gen;
+    struct gen8_instruction gen8;
+};
+
+/**
+ * This structure is the internal representation of instructions in the
+ * parser, along with the labels they branch to.
  */
 struct brw_program_instruction {
-    enum assembler_instruction_type type;
-    unsigned inst_offset;
-    union {
-	struct brw_instruction gen;
-	struct gen8_instruction gen8;
-	struct label_instruction label;
-    } insn;
+    union brw_program_insn insn;
     struct relocation reloc;
-    struct brw_program_instruction *next;
 };
 
-static inline bool is_label(struct brw_program_instruction *instruction)
-{
-    return instruction->type == GEN4ASM_INSTRUCTION_LABEL;
-}
-
-static inline char *label_name(struct brw_program_instruction *i)
-{
-    assert(is_label(i));
-    return i->insn.label.name;
-}
+/**
+ * A label, defined just before the instruction at @index.
+ */
+struct brw_program_label {
+    char *name;
+    unsigned index;
+};
 
-static inline bool is_relocatable(struct brw_program_instruction *intruction)
-{
-    return intruction->type == GEN4ASM_INSTRUCTION_GEN_RELOCATABLE;
-}
+/**
+ * The branch targets of the instruction at @index, to resolve once all the
+ * labels are known.
+ */
+struct brw_program_reloc {
+    unsigned index;
+    struct relocation reloc;
+};
 
 /**
- * This structure is a list of instructions.  It is the final output of the
- * parser.
+ * This structure is the final output of the parser: the instructions, stored
+ * contiguously, and the labels and relocations in program order, all
+ * allocated from @mem_ctx.
  */
 struct brw_program {
-	struct brw_program_instruction *first;
-	struct brw_program_instruction *last;
+	void *mem_ctx;
+
+	union brw_program_insn *insn;
+	unsigned nr_insn;
+	unsigned insn_size;
+
+	struct brw_program_label *labels;
+	unsigned nr_labels;
+	unsigned labels_size;
+
+	struct brw_program_reloc *relocs;
+	unsigned nr_relocs;
+	unsigned relocs_size;
 };
 
-extern struct brw_program compiled_program;
+static inline void brw_program_init(struct brw_program *p, void *mem_ctx)
+{
+	memset(p, 0, sizeof(*p));
+	p->mem_ctx = mem_ctx;
+}
+
+/* Returns room for one more instruction at the end of the program */
+static inline union brw_program_insn *
+brw_program_next_insn(struct brw_program *p)
+{
+	if (p->nr_insn == p->insn_size) {
+		p->insn_size = p->insn_size ? p->insn_size << 1 : 1024;
+		p->insn = reralloc(p->mem_ctx, p->insn,
+				   union brw_program_insn, p->insn_size);
+	}
+
+	return &p->insn[p->nr_insn++];
+}
 
 #define TYPE_B_INDEX            0
 #define TYPE_UB_INDEX           1
@@ -209,7 +224,6 @@ struct program_defaults {
     struct region dest_region;
     struct region dest_region_type[TOTAL_TYPES];
 };
-extern struct program_defaults program_defaults;
 
 struct declared_register {
     char *name;
@@ -219,13 +233,59 @@ struct declared_register {
     int dst_region;
 };
 struct declared_register *find_register(char *name);
-void insert_register(struct declared_register *reg);
+int insert_register(struct declared_register *reg);
+
+struct hash_item {
+	char *key;
+	unsigned hash;
+	void *value;
+	struct hash_item *next;
+};
+
+/* Chained, doubling whenever there are more items than buckets */
+struct hash_table {
+	struct hash_item **buckets;
+	unsigned size;
+	unsigned count;
+	int nocase;
+};
+
+/**
+ * Everything the lexer, the parser and the passes after them share while
+ * assembling one kernel. gen4asm_assemble() points gen4asm_ctx at its own
+ * context for the duration of the call, so that any number of kernels can
+ * be assembled at once on different threads.
+ */
+struct gen4asm_context {
+	void *mem_ctx;
+
+	long int gen_level;
+	int advanced_flag; /* 0: in unit of byte, 1: in unit of data element size */
+	unsigned int warning_flags;
+	const char *input_filename;
+	int errors;
+	char *messages;
+	int out_of_memory; /* gen4asm_assemble() then returns NULL */
+
+	struct brw_context brw_context;
+	struct brw_compile compile;
+	struct brw_program program;
+	struct program_defaults program_defaults;
+
+	struct hash_table declared_register_table;
+	struct hash_table label_table;
+	struct hash_table entry_point_table;
+
+	int saved_state; /* of the lexer, around comments */
+};
+
+void gen4asm_printf(const char *fmt, ...) PRINTFLIKE(1, 2);
+void gen4asm_vprintf(const char *fmt, va_list args);
 
-int yyparse(void);
-int yylex(void);
-int yylex_destroy(void);
+int gen4asm_parse(struct gen4asm_context *ctx,
+		  const char *source, size_t length);
 
 char *
-lex_text(void);
+lex_text(void *scanner);
 
 #endif /* __GEN4ASM_H__ */
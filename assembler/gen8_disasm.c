@@ -266,7 +266,8 @@ static const char *const m_urb_opcode[16] = {
 
 static const char *const m_urb_interleave[2] = { "", "interleaved" };
 
-static int column;
+/* Of the line being formatted, on this thread */
+static __thread int column;
 
 static int
 string(FILE *file, const char *string)
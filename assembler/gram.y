@@ -36,7 +36,7 @@
 #include "brw_eu.h"
 #include "gen8_instruction.h"
 
-#define DEFAULT_EXECSIZE (ffs(program_defaults.execute_size) - 1)
+#define DEFAULT_EXECSIZE (ffs(gen4asm_ctx->program_defaults.execute_size) - 1)
 #define DEFAULT_DSTREGION -1
 
 #define SWIZZLE(reg) (reg.dw1.bits.swizzle)
@@ -53,19 +53,19 @@ typedef struct YYLTYPE
  int last_column;
 } YYLTYPE;
 
-extern int need_export;
-static struct src_operand src_null_reg =
+/* Templates, whose width some instructions change before use */
+static __thread struct src_operand src_null_reg =
 {
     .reg.file = BRW_ARCHITECTURE_REGISTER_FILE,
     .reg.nr = BRW_ARF_NULL,
     .reg.type = BRW_REGISTER_TYPE_UD,
 };
-static struct brw_reg dst_null_reg =
+static __thread struct brw_reg dst_null_reg =
 {
     .file = BRW_ARCHITECTURE_REGISTER_FILE,
     .nr = BRW_ARF_NULL,
 };
-static struct brw_reg ip_dst =
+static __thread struct brw_reg ip_dst =
 {
     .file = BRW_ARCHITECTURE_REGISTER_FILE,
     .nr = BRW_ARF_IP,
@@ -74,7 +74,7 @@ static struct brw_reg ip_dst =
     .hstride = 1,
     .dw1.bits.writemask = BRW_WRITEMASK_XYZW,
 };
-static struct src_operand ip_src =
+static __thread struct src_operand ip_src =
 {
     .reg.file = BRW_ARCHITECTURE_REGISTER_FILE,
     .reg.nr = BRW_ARF_IP,
@@ -132,19 +132,19 @@ static void message(enum message_level level, YYLTYPE *location,
     va_list args;
 
     if (location)
-	fprintf(stderr, "%s:%d:%d: %s: ", input_filename, location->first_line,
-		location->first_column, level_str[level]);
+	gen4asm_printf("%s:%d:%d: %s: ", gen4asm_ctx->input_filename, location->first_line,
+		       location->first_column, level_str[level]);
     else
-	fprintf(stderr, "%s:%s: ", input_filename, level_str[level]);
+	gen4asm_printf("%s:%s: ", gen4asm_ctx->input_filename, level_str[level]);
 
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    gen4asm_vprintf(fmt, args);
     va_end(args);
 }
 
 #define warn(flag, l, fmt, ...)					\
     do {							\
-	if (warning_flags & WARN_ ## flag)			\
+	if (gen4asm_ctx->warning_flags & WARN_ ## flag)		\
 	    message(WARN, l, fmt, ## __VA_ARGS__);	\
     } while(0)
 
@@ -192,55 +192,42 @@ static bool declared_register_equal(struct declared_register *r1,
     return true;
 }
 
-static void brw_program_init(struct brw_program *p)
-{
-   memset(p, 0, sizeof(struct brw_program));
-}
-
-static void brw_program_append_entry(struct brw_program *p,
-				     struct brw_program_instruction *entry)
-{
-    entry->next = NULL;
-    if (p->last)
-	p->last->next = entry;
-    else
-	p->first = entry;
-    p->last = entry;
-}
-
 static void
 brw_program_add_instruction(struct brw_program *p,
 			    struct brw_program_instruction *instruction)
 {
-    struct brw_program_instruction *list_entry;
-
-    list_entry = calloc(sizeof(struct brw_program_instruction), 1);
-    list_entry->type = GEN4ASM_INSTRUCTION_GEN;
-    list_entry->insn.gen = instruction->insn.gen;
-    brw_program_append_entry(p, list_entry);
+    *brw_program_next_insn(p) = instruction->insn;
 }
 
 static void
 brw_program_add_relocatable(struct brw_program *p,
 			    struct brw_program_instruction *instruction)
 {
-    struct brw_program_instruction *list_entry;
+    if (p->nr_relocs == p->relocs_size) {
+	p->relocs_size = p->relocs_size ? p->relocs_size << 1 : 64;
+	p->relocs = reralloc(p->mem_ctx, p->relocs,
+			     struct brw_program_reloc, p->relocs_size);
+    }
 
-    list_entry = calloc(sizeof(struct brw_program_instruction), 1);
-    list_entry->type = GEN4ASM_INSTRUCTION_GEN_RELOCATABLE;
-    list_entry->insn.gen = instruction->insn.gen;
-    list_entry->reloc = instruction->reloc;
-    brw_program_append_entry(p, list_entry);
+    p->relocs[p->nr_relocs].index = p->nr_insn;
+    p->relocs[p->nr_relocs].reloc = instruction->reloc;
+    p->nr_relocs++;
+
+    brw_program_add_instruction(p, instruction);
 }
 
-static void brw_program_add_label(struct brw_program *p, const char *label)
+/* @label is allocated from the context of the whole assembly, as is @p */
+static void brw_program_add_label(struct brw_program *p, char *label)
 {
-    struct brw_program_instruction *list_entry;
+    if (p->nr_labels == p->labels_size) {
+	p->labels_size = p->labels_size ? p->labels_size << 1 : 64;
+	p->labels = reralloc(p->mem_ctx, p->labels,
+			     struct brw_program_label, p->labels_size);
+    }
 
-    list_entry = calloc(sizeof(struct brw_program_instruction), 1);
-    list_entry->type = GEN4ASM_INSTRUCTION_LABEL;
-    list_entry->insn.label.name = strdup(label);
-    brw_program_append_entry(p, list_entry);
+    p->labels[p->nr_labels].name = label;
+    p->labels[p->nr_labels].index = p->nr_insn;
+    p->nr_labels++;
 }
 
 static int resolve_dst_region(struct declared_register *reference, int region)
@@ -290,13 +277,13 @@ static bool validate_dst_reg(struct brw_program_instruction *insn, struct brw_re
 	reg->dw1.bits.writemask != 0 &&
 	reg->dw1.bits.writemask != BRW_WRITEMASK_XYZW)
     {
-	fprintf(stderr, "error: write mask set in align1 instruction\n");
+	error(NULL, "write mask set in align1 instruction\n");
 	return false;
     }
 
     if (reg->address_mode == BRW_ADDRESS_REGISTER_INDIRECT_REGISTER &&
 	access_mode(insn) == BRW_ALIGN_16) {
-	fprintf(stderr, "error: indirect Dst addr mode in align16 instruction\n");
+	error(NULL, "indirect Dst addr mode in align16 instruction\n");
 	return false;
     }
 
@@ -325,7 +312,7 @@ static bool validate_src_reg(struct brw_program_instruction *insn,
 
     if (reg.address_mode == BRW_ADDRESS_REGISTER_INDIRECT_REGISTER &&
 	access_mode(insn) == BRW_ALIGN_16) {
-	fprintf(stderr, "error: indirect Source addr mode in align16 instruction\n");
+	error(location, "indirect Source addr mode in align16 instruction\n");
 	return false;
     }
 
@@ -387,7 +374,7 @@ static int get_subreg_address(unsigned regfile, unsigned type, unsigned subreg,
     assert(address_mode == BRW_ADDRESS_DIRECT);
     assert(regfile != BRW_IMMEDIATE_VALUE);
 
-    if (advanced_flag)
+    if (gen4asm_ctx->advanced_flag)
 	unit_size = get_type_size(type);
 
     return subreg * unit_size;
@@ -413,7 +400,7 @@ static int get_subreg_address(unsigned regfile, unsigned type, unsigned subreg,
  */
 static int get_indirect_subreg_address(unsigned subreg)
 {
-    return advanced_flag == 0 ? subreg / 2 : subreg;
+    return gen4asm_ctx->advanced_flag == 0 ? subreg / 2 : subreg;
 }
 
 static void resolve_subnr(struct brw_reg *reg)
@@ -431,6 +418,9 @@ static void resolve_subnr(struct brw_reg *reg)
 
 %}
 %locations
+%define api.pure
+%lex-param {void *scanner}
+%parse-param {void *scanner}
 
 %start ROOT
 
@@ -452,6 +442,11 @@ static void resolve_subnr(struct brw_reg *reg)
 	struct src_operand src_operand;
 }
 
+%code {
+int yylex(YYSTYPE *lval, YYLTYPE *lloc, void *scanner);
+void yyerror(YYLTYPE *location, void *scanner, char *msg);
+}
+
 %token COLON
 %token SEMICOLON
 %token LPAREN RPAREN
@@ -637,7 +632,7 @@ exp:		INTEGER { $$ = $1; }
 
 ROOT:		instrseq
 		{
-		  compiled_program = $1;
+		  gen4asm_ctx->program = $1;
 		}
 ;
 
@@ -698,11 +693,15 @@ declare_pragma:	DECLARE_PRAGMA STRING declare_base declare_elementsize declare_s
 		        if (!declared_register_equal(&reg, found))
 			    error(&@1, "%s already defined and definitions "
 				  "don't agree\n", $2);
-			free($2); // $2 has been malloc'ed by strdup
 		    } else {
 			new_reg = malloc(sizeof(struct declared_register));
-			*new_reg = reg;
-			insert_register(new_reg);
+			if (new_reg)
+			    *new_reg = reg;
+			if (new_reg == NULL || insert_register(new_reg)) {
+			    free(new_reg);
+			    gen4asm_ctx->out_of_memory = 1;
+			    YYABORT;
+			}
 		    }
 		}
 ;
@@ -714,12 +713,12 @@ reg_count_payload_pragma: 	REG_COUNT_PAYLOAD_PRAGMA exp
 
 default_exec_size_pragma:	DEFAULT_EXEC_SIZE_PRAGMA exp
 				{
-				    program_defaults.execute_size = $2;
+				    gen4asm_ctx->program_defaults.execute_size = $2;
 				}
 ;
 default_reg_type_pragma:	DEFAULT_REG_TYPE_PRAGMA regtype
 				{
-				    program_defaults.register_type = $2.type;
+				    gen4asm_ctx->program_defaults.register_type = $2.type;
 				}
 ;
 pragma:		reg_count_total_pragma
@@ -740,7 +739,7 @@ instrseq:	instrseq pragma
 		}
 		| instruction SEMICOLON
 		{
-		  brw_program_init(&$$);
+		  brw_program_init(&$$, ralloc_context(gen4asm_ctx->mem_ctx));
 		  brw_program_add_instruction(&$$, &$1);
 		}
 		| instrseq relocatableinstruction SEMICOLON
@@ -750,7 +749,7 @@ instrseq:	instrseq pragma
 		}
 		| relocatableinstruction SEMICOLON
 		{
-		  brw_program_init(&$$);
+		  brw_program_init(&$$, ralloc_context(gen4asm_ctx->mem_ctx));
 		  brw_program_add_relocatable(&$$, &$1);
 		}
 		| instrseq SEMICOLON
@@ -764,13 +763,12 @@ instrseq:	instrseq pragma
                 }
 		| label
 		{
-		  brw_program_init(&$$);
+		  brw_program_init(&$$, ralloc_context(gen4asm_ctx->mem_ctx));
 		  brw_program_add_label(&$$, $1);
 		}
 		| pragma
 		{
-		  $$.first = NULL;
-		  $$.last = NULL;
+		  brw_program_init(&$$, ralloc_context(gen4asm_ctx->mem_ctx));
 		}
 		| instrseq error SEMICOLON {
 		  $$ = $1;
@@ -1433,7 +1431,7 @@ jumpinstruction: predicate JMPI execsize relativelocation2
 		   */
 		  memset(&$$, 0, sizeof($$));
 		  set_instruction_opcode(&$$, $2);
-		  if(advanced_flag) {
+		  if(gen4asm_ctx->advanced_flag) {
                       if (IS_GENp(8))
                           gen8_set_mask_control(GEN8(&$$), BRW_MASK_DISABLE);
                       else
@@ -1845,7 +1843,7 @@ msgtarget:	NULL_TOKEN
                       gen8_set_cre_binding_table_index(GEN8(&$$), $3);
                       gen8_set_cre_message_type(GEN8(&$$), $5);
 		  } else {
-                      if (gen_level < 75)
+                      if (gen4asm_ctx->gen_level < 75)
                           error (&@1, "Below Gen7.5 doesn't have CRE function\n");
 
                       GEN(&$$)->bits3.generic.msg_target = HSW_SFID_CRE;
@@ -2012,7 +2010,6 @@ symbol_reg:	STRING %prec STR_SYMBOL_REG
 			error(&@1, "can't find register %s\n", $1);
 
 		    memcpy(&$$, dcl_reg, sizeof(*dcl_reg));
-		    free($1); // $1 has been malloc'ed by strdup
 		}
 		| symbol_reg_p 
 		{
@@ -2029,7 +2026,6 @@ symbol_reg_p: STRING LPAREN exp RPAREN
 
 		    memcpy(&$$, dcl_reg, sizeof(*dcl_reg));
 		    $$.reg.nr += $3;
-		    free($1);
 		}
 		| STRING LPAREN exp COMMA exp RPAREN
 		{
@@ -2040,7 +2036,7 @@ symbol_reg_p: STRING LPAREN exp RPAREN
 
 		    memcpy(&$$, dcl_reg, sizeof(*dcl_reg));
 		    $$.reg.nr += $3;
-		    if(advanced_flag) {
+		    if(gen4asm_ctx->advanced_flag) {
 			int size = get_type_size(dcl_reg->reg.type);
 		        $$.reg.nr += ($$.reg.subnr + $5) / (32 / size);
 		        $$.reg.subnr = ($$.reg.subnr + $5) % (32 / size);
@@ -2048,7 +2044,6 @@ symbol_reg_p: STRING LPAREN exp RPAREN
 		        $$.reg.nr += ($$.reg.subnr + $5) / 32;
 		        $$.reg.subnr = ($$.reg.subnr + $5) % 32;
 		    }
-		    free($1);
 		}
 ;
 /* Returns a partially complete destination register consisting of the
@@ -2134,8 +2129,7 @@ imm32reg:	imm32 srcimmtype
 		    break;
 #if 0
 		  case BRW_REGISTER_TYPE_VF:
-		    fprintf (stderr, "Immediate type VF not supported yet\n");
-		    YYERROR;
+		    error(&@2, "Immediate type VF not supported yet\n");
 #endif
 		  default:
 		    error(&@2, "unknown immediate type %d\n", $2);
@@ -2504,10 +2498,8 @@ notifyreg:	NOTIFYREG regtype
 		| NOTIFYREG regtype
 		{
 		  if ($1 > 1) {
-		    fprintf(stderr,
-			    "notification register number %d out of range",
-			    $1);
-		    YYERROR;
+		    error(&@1, "notification register number %d out of range\n",
+			  $1);
 		  }
 		  memset (&$$, '\0', sizeof ($$));
 		  $$.reg_file = BRW_ARCHITECTURE_REGISTER_FILE;
@@ -2706,7 +2698,7 @@ indirectregion:	region | region_wh
  * instruction.
  */
 regtype:	/* empty */
-		{ $$.type = program_defaults.register_type;$$.is_default = 1;}
+		{ $$.type = gen4asm_ctx->program_defaults.register_type;$$.is_default = 1;}
 		| TYPE_F { $$.type = BRW_REGISTER_TYPE_F;$$.is_default = 0; }
 		| TYPE_UD { $$.type = BRW_REGISTER_TYPE_UD;$$.is_default = 0; }
 		| TYPE_D { $$.type = BRW_REGISTER_TYPE_D;$$.is_default = 0; }
@@ -2835,7 +2827,7 @@ abs:		/* empty */ { $$ = 0; }
 
 execsize:	/* empty */ %prec EMPTEXECSIZE
 		{
-		  $$ = ffs(program_defaults.execute_size) - 1;
+		  $$ = ffs(gen4asm_ctx->program_defaults.execute_size) - 1;
 		}
 		|LPAREN exp RPAREN
 		{
@@ -2918,13 +2910,12 @@ instoption:	ALIGN1 { $$ = ALIGN1; }
 ;
 
 %%
-extern int yylineno;
-
-void yyerror (char *msg)
+void yyerror (YYLTYPE *location, void *scanner, char *msg)
 {
-	fprintf(stderr, "%s: %d: %s at \"%s\"\n",
-		input_filename, yylineno, msg, lex_text());
-	++errors;
+	gen4asm_printf("%s: %d: %s at \"%s\"\n",
+		       gen4asm_ctx->input_filename, location->first_line, msg,
+		       lex_text(scanner));
+	++gen4asm_ctx->errors;
 }
 
 static int get_type_size(unsigned type)
@@ -3055,7 +3046,7 @@ static int set_instruction_dest(struct brw_program_instruction *instr,
 		gen8_set_exec_size(GEN8(instr), dest->width);
 		gen8_set_dst(GEN8(instr), *dest);
 	} else {
-		brw_set_dest(&genasm_compile, GEN(instr), *dest);
+		brw_set_dest(&gen4asm_ctx->compile, GEN(instr), *dest);
 	}
 
 	return 0;
@@ -3067,7 +3058,7 @@ static int set_instruction_src0(struct brw_program_instruction *instr,
 				YYLTYPE *location)
 {
 
-	if (advanced_flag)
+	if (gen4asm_ctx->advanced_flag)
 		reset_instruction_src_region(GEN(instr), src);
 
 	if (!validate_src_reg(instr, src->reg, location))
@@ -3080,7 +3071,7 @@ static int set_instruction_src0(struct brw_program_instruction *instr,
 	if (IS_GENp(8))
 		gen8_set_src0(GEN8(instr), src->reg);
 	else
-		brw_set_src0(&genasm_compile, GEN(instr), src->reg);
+		brw_set_src0(&gen4asm_ctx->compile, GEN(instr), src->reg);
 
 	return 0;
 }
@@ -3091,7 +3082,7 @@ static int set_instruction_src1(struct brw_program_instruction *instr,
 				struct src_operand *src,
 				YYLTYPE *location)
 {
-	if (advanced_flag)
+	if (gen4asm_ctx->advanced_flag)
 		reset_instruction_src_region(GEN(instr), src);
 
 	if (!validate_src_reg(instr, src->reg, location))
@@ -3104,7 +3095,7 @@ static int set_instruction_src1(struct brw_program_instruction *instr,
 	if (IS_GENp(8))
 		gen8_set_src1(GEN8(instr), src->reg);
 	else
-		brw_set_src1(&genasm_compile, GEN(instr), src->reg);
+		brw_set_src1(&gen4asm_ctx->compile, GEN(instr), src->reg);
 
 	return 0;
 }
@@ -3113,46 +3104,46 @@ static int set_instruction_dest_three_src(struct brw_program_instruction *instr,
 					  struct brw_reg *dest)
 {
     resolve_subnr(dest);
-    brw_set_3src_dest(&genasm_compile, GEN(instr), *dest);
+    brw_set_3src_dest(&gen4asm_ctx->compile, GEN(instr), *dest);
     return 0;
 }
 
 static int set_instruction_src0_three_src(struct brw_program_instruction *instr,
 					  struct src_operand *src)
 {
-    if (advanced_flag)
+    if (gen4asm_ctx->advanced_flag)
 	reset_instruction_src_region(GEN(instr), src);
 
     resolve_subnr(&src->reg);
 
     // TODO: src0 modifier, src0 rep_ctrl
-    brw_set_3src_src0(&genasm_compile, GEN(instr), src->reg);
+    brw_set_3src_src0(&gen4asm_ctx->compile, GEN(instr), src->reg);
     return 0;
 }
 
 static int set_instruction_src1_three_src(struct brw_program_instruction *instr,
 					  struct src_operand *src)
 {
-    if (advanced_flag)
+    if (gen4asm_ctx->advanced_flag)
 	reset_instruction_src_region(GEN(instr), src);
 
     resolve_subnr(&src->reg);
 
     // TODO: src1 modifier, src1 rep_ctrl
-    brw_set_3src_src1(&genasm_compile, GEN(instr), src->reg);
+    brw_set_3src_src1(&gen4asm_ctx->compile, GEN(instr), src->reg);
     return 0;
 }
 
 static int set_instruction_src2_three_src(struct brw_program_instruction *instr,
 					  struct src_operand *src)
 {
-    if (advanced_flag)
+    if (gen4asm_ctx->advanced_flag)
 	reset_instruction_src_region(GEN(instr), src);
 
     resolve_subnr(&src->reg);
 
     // TODO: src2 modifier, src2 rep_ctrl
-    brw_set_3src_src2(&genasm_compile, GEN(instr), src->reg);
+    brw_set_3src_src2(&gen4asm_ctx->compile, GEN(instr), src->reg);
     return 0;
 }
 
@@ -3290,10 +3281,10 @@ static inline int branch_offset(struct brw_program_instruction *insn, int offset
      * Gen7.5+: the offset is in unit of 8bits for JMPI, 64bits for other flow
      * control instructions
      */
-    if (gen_level >= 75 &&
+    if (gen4asm_ctx->gen_level >= 75 &&
         (instruction_opcode(insn) == BRW_OPCODE_JMPI))
         offset *= 16;
-    else if (gen_level >= 50)
+    else if (gen4asm_ctx->gen_level >= 50)
         offset *= 2;
 
     return offset;
@@ -0,0 +1,529 @@
+/* -*- c-basic-offset: 8 -*- */
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "ralloc.h"
+#include "gen4asm.h"
+#include "intel-gen4asm.h"
+
+extern void set_branch_two_offsets(struct brw_program_instruction *insn, int jip_offset, int uip_offset);
+extern void set_branch_one_offset(struct brw_program_instruction *insn, int jip_offset);
+
+__thread struct gen4asm_context *gen4asm_ctx;
+
+/* Every address a label is defined at, in increasing order */
+struct label_item {
+	int *addr;
+	int count;
+	int size;
+};
+
+void gen4asm_vprintf(const char *fmt, va_list args)
+{
+	ralloc_vasprintf_append(&gen4asm_ctx->messages, fmt, args);
+}
+
+void gen4asm_printf(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	gen4asm_vprintf(fmt, args);
+	va_end(args);
+}
+
+static unsigned hash(const char *key, int nocase)
+{
+    unsigned ret = 2166136261u;
+    while (*key) {
+	unsigned char c = *key++;
+	ret = (ret ^ (nocase ? tolower(c) : c)) * 16777619u;
+    }
+    return ret;
+}
+
+static struct hash_item *find_hash_item(struct hash_table *t, const char *key)
+{
+    struct hash_item *p;
+    unsigned h;
+
+    if (t->size == 0)
+	return NULL;
+
+    h = hash(key, t->nocase);
+    for (p = t->buckets[h & (t->size - 1)]; p; p = p->next) {
+	if (p->hash != h)
+	    continue;
+	if ((t->nocase ? strcasecmp(p->key, key) : strcmp(p->key, key)) == 0)
+	    return p;
+    }
+    return NULL;
+}
+
+/*
+ * Splits every chain in two, keeping the order of items with equal keys.
+ * Returns -1, leaving @t as it was, when out of memory.
+ */
+static int grow_hash_table(struct hash_table *t)
+{
+    unsigned size = t->size ? 2 * t->size : 64;
+    struct hash_item **buckets = calloc(size, sizeof(*buckets));
+    unsigned i;
+
+    if (buckets == NULL)
+	return -1;
+
+    for (i = 0; i < t->size; i++) {
+	struct hash_item **tail[2] = { &buckets[i], &buckets[i + t->size] };
+	struct hash_item *p, *next;
+
+	for (p = t->buckets[i]; p; p = next) {
+	    int half = (p->hash & t->size) != 0;
+
+	    next = p->next;
+	    p->next = NULL;
+	    *tail[half] = p;
+	    tail[half] = &p->next;
+	}
+    }
+
+    free(t->buckets);
+    t->buckets = buckets;
+    t->size = size;
+    return 0;
+}
+
+/* Returns -1 when out of memory */
+static int insert_hash_item(struct hash_table *t, char *key, void *v)
+{
+    struct hash_item *p = malloc(sizeof(*p));
+    unsigned index;
+
+    if (p == NULL)
+	return -1;
+
+    if (t->count >= t->size && grow_hash_table(t)) {
+	free(p);
+	return -1;
+    }
+
+    p->key = key;
+    p->hash = hash(key, t->nocase);
+    p->value = v;
+
+    index = p->hash & (t->size - 1);
+    p->next = t->buckets[index];
+    t->buckets[index] = p;
+    t->count++;
+    return 0;
+}
+
+static void free_hash_table(struct hash_table *t,
+			    void (*free_item)(struct hash_item *))
+{
+    struct hash_item *p, *next;
+    unsigned i;
+    for (i = 0; i < t->size; i++) {
+	p = t->buckets[i];
+	while(p) {
+	    next = p->next;
+	    free_item(p);
+	    free(p);
+	    p = next;
+	}
+    }
+    free(t->buckets);
+    t->buckets = NULL;
+    t->size = t->count = 0;
+}
+
+/* The names belong to ctx->mem_ctx */
+static void free_register(struct hash_item *p)
+{
+    free(p->value);
+}
+
+struct declared_register *find_register(char *name)
+{
+    struct hash_item *p = find_hash_item(&gen4asm_ctx->declared_register_table, name);
+    return p ? p->value : NULL;
+}
+
+int insert_register(struct declared_register *reg)
+{
+    return insert_hash_item(&gen4asm_ctx->declared_register_table, reg->name, reg);
+}
+
+/*
+ * Labels are added in program order, so their addresses stay sorted.
+ * Returns -1 when out of memory.
+ */
+static int add_label(struct brw_program_label *l)
+{
+    struct hash_item *p;
+    struct label_item *label;
+
+    p = find_hash_item(&gen4asm_ctx->label_table, l->name);
+    if (p == NULL) {
+	label = calloc(1, sizeof(*label));
+	if (label == NULL)
+	    return -1;
+	if (insert_hash_item(&gen4asm_ctx->label_table, l->name, label)) {
+	    free(label);
+	    return -1;
+	}
+    } else
+	label = p->value;
+
+    if (label->count == label->size) {
+	unsigned size = label->size ? 2 * label->size : 1;
+	int *addr = realloc(label->addr, size * sizeof(*addr));
+
+	if (addr == NULL)
+	    return -1;
+	label->addr = addr;
+	label->size = size;
+    }
+    label->addr[label->count++] = l->index;
+    return 0;
+}
+
+/* Some assembly code have duplicated labels.
+   Start from start_addr. Search as a loop. Return the first label found. */
+static int label_to_addr(char *name, int start_addr)
+{
+    /* return the first label just after start_addr, or the first label from the head */
+    struct hash_item *p = find_hash_item(&gen4asm_ctx->label_table, name);
+    struct label_item *label;
+    int lo, hi;
+
+    if (p == NULL) {
+        gen4asm_printf("%s: Can't find label %s\n",
+                       gen4asm_ctx->input_filename, name);
+        gen4asm_ctx->errors++;
+        return start_addr;
+    }
+    label = p->value;
+
+    lo = 0;
+    hi = label->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (label->addr[mid] < start_addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return label->addr[lo < label->count ? lo : 0];
+}
+
+/* The names belong to the label instructions */
+static void free_label(struct hash_item *p)
+{
+    struct label_item *label = p->value;
+
+    free(label->addr);
+    free(label);
+}
+
+static int is_entry_point(struct brw_program_label *l)
+{
+	return find_hash_item(&gen4asm_ctx->entry_point_table, l->name) != NULL;
+}
+
+/*
+ * Entry points must start at a multiple of 4 instructions: pads the program
+ * with NOPs before them, moving the labels and relocations that follow.
+ */
+static void pad_entry_points(struct brw_program *p)
+{
+	union brw_program_insn *insn;
+	unsigned i, r, src, dst, count, pad = 0;
+	unsigned *padding;
+
+	if (gen4asm_ctx->entry_point_table.count == 0)
+		return;
+
+	padding = ralloc_array(p->mem_ctx, unsigned, p->nr_labels);
+	for (i = 0; i < p->nr_labels; i++) {
+		padding[i] = 0;
+		if (is_entry_point(&p->labels[i]))
+			padding[i] = (4 - (p->labels[i].index + pad) % 4) % 4;
+		pad += padding[i];
+	}
+
+	if (pad == 0) {
+		ralloc_free(padding);
+		return;
+	}
+
+	insn = ralloc_array(p->mem_ctx, union brw_program_insn, p->nr_insn + pad);
+	src = dst = r = 0;
+	for (i = 0; i <= p->nr_labels; i++) {
+		struct brw_program_label *label = i < p->nr_labels ? &p->labels[i] : NULL;
+
+		count = (label ? label->index : p->nr_insn) - src;
+		memcpy(insn + dst, p->insn + src, count * sizeof(*insn));
+		src += count;
+		dst += count;
+
+		for (; r < p->nr_relocs && p->relocs[r].index < src; r++)
+			p->relocs[r].index += dst - src;
+
+		if (label == NULL)
+			break;
+
+		for (count = 0; count < padding[i]; count++) {
+			memset(&insn[dst], 0, sizeof(*insn));
+			insn[dst++].gen.header.opcode = BRW_OPCODE_NOP;
+		}
+		label->index = dst;
+	}
+
+	ralloc_free(padding);
+	ralloc_free(p->insn);
+	p->insn = insn;
+	p->nr_insn += pad;
+	p->insn_size = p->nr_insn;
+}
+
+/* The names belong to the caller */
+static void free_entry_point(struct hash_item *p)
+{
+}
+
+static void relocate(struct brw_program *p)
+{
+	unsigned i;
+
+	for (i = 0; i < p->nr_relocs; i++) {
+	    struct relocation *reloc = &p->relocs[i].reloc;
+	    int inst_offset = p->relocs[i].index;
+	    struct brw_program_instruction entry;
+
+	    if (reloc->first_reloc_target)
+		reloc->first_reloc_offset = label_to_addr(reloc->first_reloc_target, inst_offset) - inst_offset;
+
+	    if (reloc->second_reloc_target)
+		reloc->second_reloc_offset = label_to_addr(reloc->second_reloc_target, inst_offset) - inst_offset;
+
+	    entry.insn = p->insn[inst_offset];
+	    if (reloc->second_reloc_offset) { // this is a branch instruction with two offset arguments
+		set_branch_two_offsets(&entry, reloc->first_reloc_offset, reloc->second_reloc_offset);
+	    } else if (reloc->first_reloc_offset) {
+		set_branch_one_offset(&entry, reloc->first_reloc_offset);
+	    }
+	    p->insn[inst_offset] = entry.insn;
+	}
+}
+
+/*
+ * Gen7 JIP and UIP are an immediate, which the parser leaves typed as the
+ * null register. Typing them as such lets the instructions be compacted.
+ */
+static void flow_control_to_immediate(struct brw_instruction *insn)
+{
+	switch (insn->header.opcode) {
+	case BRW_OPCODE_IF:
+	case BRW_OPCODE_ELSE:
+	case BRW_OPCODE_ENDIF:
+	case BRW_OPCODE_WHILE:
+	case BRW_OPCODE_BREAK:
+	case BRW_OPCODE_CONTINUE:
+	case BRW_OPCODE_HALT:
+		if (insn->bits1.da1.src1_reg_file == BRW_ARCHITECTURE_REGISTER_FILE) {
+			insn->bits1.da1.src1_reg_file = BRW_IMMEDIATE_VALUE;
+			insn->bits1.da1.src1_reg_type = BRW_REGISTER_TYPE_D;
+		}
+		break;
+	}
+}
+
+/*
+ * Compacts the instructions that can be, keeping labels 16 bytes aligned so
+ * that they stay addressable in instructions, and entry points 64. Returns
+ * the size of the instructions before, or 0 if they were left alone.
+ */
+static unsigned compact(struct gen4asm_context *ctx)
+{
+	struct brw_program *p = &ctx->program;
+	struct brw_compile *c = &ctx->compile;
+	unsigned size = p->nr_insn * sizeof(*p->insn);
+	unsigned *align, *offsets;
+	unsigned i;
+
+	if (!IS_GENx(6) && !IS_GENx(7)) {
+		gen4asm_printf("%s: warning: compaction is only supported on Gen6 and Gen7\n",
+			       ctx->input_filename);
+		return 0;
+	}
+
+	align = rzalloc_array(ctx->mem_ctx, unsigned, p->nr_insn + 1);
+	offsets = ralloc_array(ctx->mem_ctx, unsigned, p->nr_insn + 1);
+	for (i = 0; i < p->nr_labels; i++) {
+		unsigned *a = &align[p->labels[i].index];
+
+		if (is_entry_point(&p->labels[i]))
+			*a = 64;
+		else if (*a < 16)
+			*a = 16;
+	}
+
+	if (IS_GENx(7)) {
+		for (i = 0; i < p->nr_insn; i++)
+			flow_control_to_immediate(&p->insn[i].gen);
+	}
+
+	c->store = &p->insn[0].gen;
+	c->nr_insn = p->nr_insn;
+	c->next_insn_offset = p->nr_insn * sizeof(*p->insn);
+	if (!brw_compact_instructions(c, align, offsets)) {
+		gen4asm_printf("%s: error: compacted flow control can't hold its jumps\n",
+			       ctx->input_filename);
+		ctx->errors++;
+		size = 0;
+	} else {
+		for (i = 0; i < p->nr_labels; i++)
+			p->labels[i].index = offsets[p->labels[i].index] / sizeof(*p->insn);
+		p->nr_insn = c->nr_insn;
+	}
+
+	ralloc_free(align);
+	ralloc_free(offsets);
+	return size;
+}
+
+/* Copies what the caller gets back out of @ctx, which is freed after */
+static void
+fill_kernel(struct gen4asm_kernel *kernel, struct gen4asm_context *ctx)
+{
+	struct brw_program *p = &ctx->program;
+	struct gen4asm_label *labels;
+	uint32_t *insn;
+	unsigned i;
+
+	kernel->errors = ctx->errors;
+	ralloc_steal(kernel, ctx->messages);
+	kernel->messages = ctx->messages;
+	if (ctx->errors)
+		return;
+
+	insn = ralloc_array(kernel, uint32_t, 4 * p->nr_insn);
+	memcpy(insn, p->insn, p->nr_insn * sizeof(*p->insn));
+	kernel->insn = insn;
+	kernel->nr_insn = p->nr_insn;
+
+	labels = ralloc_array(kernel, struct gen4asm_label, p->nr_labels);
+	for (i = 0; i < p->nr_labels; i++) {
+		labels[i].name = ralloc_strdup(kernel, p->labels[i].name);
+		labels[i].offset = p->labels[i].index;
+	}
+	kernel->labels = labels;
+	kernel->nr_labels = p->nr_labels;
+}
+
+struct gen4asm_kernel *
+gen4asm_assemble(const char *source, size_t length,
+		 const struct gen4asm_options *options)
+{
+	struct gen4asm_context ctx, *saved = gen4asm_ctx;
+	struct gen4asm_kernel *kernel;
+	unsigned i;
+	int ret;
+
+	kernel = rzalloc(NULL, struct gen4asm_kernel);
+	if (kernel == NULL)
+		return NULL;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.mem_ctx = ralloc_context(NULL);
+	if (ctx.mem_ctx == NULL) {
+		ralloc_free(kernel);
+		return NULL;
+	}
+	ctx.gen_level = options->gen ? options->gen : 40;
+	ctx.advanced_flag = options->advanced;
+	ctx.warning_flags = WARN_ALWAYS | (options->warnings ? WARN_ALL : 0);
+	ctx.input_filename = options->filename ? options->filename : "<memory>";
+	ctx.messages = ralloc_strdup(ctx.mem_ctx, "");
+	ctx.program_defaults.register_type = BRW_REGISTER_TYPE_F;
+	ctx.declared_register_table.nocase = 1;
+	brw_init_context(&ctx.brw_context, ctx.gen_level);
+	brw_init_compile(&ctx.brw_context, &ctx.compile, ctx.mem_ctx);
+	brw_program_init(&ctx.program, ctx.mem_ctx);
+
+	gen4asm_ctx = &ctx;
+
+	/* -1 when the scanner can't be created, 2 when the parser stack can't grow */
+	ret = gen4asm_parse(&ctx, source, length);
+	if (ret == -1 || ret == 2)
+		ctx.out_of_memory = 1;
+	else if (ret && ctx.errors == 0)
+		ctx.errors = 1;
+
+	if (ctx.errors == 0 && !ctx.out_of_memory) {
+		for (i = 0; options->entry_points && options->entry_points[i]; i++) {
+			if (insert_hash_item(&ctx.entry_point_table,
+					     (char *)options->entry_points[i], NULL))
+				ctx.out_of_memory = 1;
+		}
+		pad_entry_points(&ctx.program);
+
+		for (i = 0; i < ctx.program.nr_labels; i++) {
+			if (add_label(&ctx.program.labels[i]))
+				ctx.out_of_memory = 1;
+		}
+	}
+
+	if (ctx.errors == 0 && !ctx.out_of_memory) {
+		relocate(&ctx.program);
+
+		if (options->compact)
+			kernel->uncompacted_size = compact(&ctx);
+	}
+
+	if (ctx.out_of_memory) {
+		ralloc_free(kernel);
+		kernel = NULL;
+	} else
+		fill_kernel(kernel, &ctx);
+
+	free_hash_table(&ctx.entry_point_table, free_entry_point);
+	free_hash_table(&ctx.declared_register_table, free_register);
+	free_hash_table(&ctx.label_table, free_label);
+	ralloc_free(ctx.mem_ctx);
+
+	gen4asm_ctx = saved;
+	return kernel;
+}
+
+void gen4asm_kernel_free(struct gen4asm_kernel *kernel)
+{
+	ralloc_free(kernel);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INTEL_GEN4ASM_H
+#define INTEL_GEN4ASM_H
+
+/**
+ * Assembles kernels from memory into memory, the library behind
+ * intel-gen4asm. It does no file I/O and prints nothing: errors and warnings
+ * are returned along with the kernel. Any number of kernels can be assembled
+ * at once on different threads.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct gen4asm_options {
+	/** Generation times 10, from 40 to 80, e.g. 75 for Haswell */
+	int gen;
+	/** Register offsets are in units of data element size, not bytes */
+	int advanced;
+	/** Report all warnings */
+	int warnings;
+	/** Name of the source in messages, "<memory>" if NULL */
+	const char *filename;
+	/** NULL terminated labels to align to 4 instructions, or NULL */
+	const char *const *entry_points;
+	/** Compact the instructions that can be to 8 bytes, Gen6 and Gen7 */
+	int compact;
+};
+
+struct gen4asm_label {
+	const char *name;
+	/** In instructions from the start of the kernel */
+	unsigned offset;
+};
+
+struct gen4asm_kernel {
+	/**
+	 * 4 dwords per instruction, NULL if there were errors. Once compacted,
+	 * each 4 dwords hold an instruction or two compacted ones.
+	 */
+	const uint32_t *insn;
+	unsigned nr_insn;
+	/** In bytes, before compaction, 0 if the instructions weren't compacted */
+	unsigned uncompacted_size;
+
+	/** Every label defined, in program order */
+	const struct gen4asm_label *labels;
+	unsigned nr_labels;
+
+	/** The errors and warnings, one per line, empty if none */
+	const char *messages;
+	int errors;
+};
+
+/**
+ * Assembles @length bytes of @source. Returns NULL when out of memory, the
+ * kernel otherwise, whose errors tells whether it assembled.
+ */
+struct gen4asm_kernel *
+gen4asm_assemble(const char *source, size_t length,
+		 const struct gen4asm_options *options);
+
+void gen4asm_kernel_free(struct gen4asm_kernel *kernel);
+
+#endif /* INTEL_GEN4ASM_H */
@@ -28,59 +28,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
-#include <assert.h>
 
-#include "ralloc.h"
-#include "gen4asm.h"
-#include "brw_eu.h"
-
-extern FILE *yyin;
-extern void set_branch_two_offsets(struct brw_program_instruction *insn, int jip_offset, int uip_offset);
-extern void set_branch_one_offset(struct brw_program_instruction *insn, int jip_offset);
-
-long int gen_level = 40;
-int advanced_flag = 0; /* 0: in unit of byte, 1: in unit of data element size */
-unsigned int warning_flags = WARN_ALWAYS;
-int need_export = 0;
-char *input_filename = "<stdin>";
-int errors;
-
-struct brw_context genasm_brw_context;
-struct brw_compile genasm_compile;
-
-struct brw_program compiled_program;
-struct program_defaults program_defaults = {.register_type = BRW_REGISTER_TYPE_F};
+#include "intel-gen4asm.h"
 
 /* 0: default output style, 1: nice C-style output */
 static int binary_like_output = 0;
 static char *export_filename = NULL;
 static const char binary_prepend[] = "static const char gen_eu_bytes[] = {\n";
 
-#define HASH_SIZE 37
-
-struct hash_item {
-	char *key;
-	void *value;
-	struct hash_item *next;
-};
-
-typedef struct hash_item *hash_table[HASH_SIZE];
-
-static hash_table declared_register_table;
-
-struct label_item {
-	char *name;
-	int addr;
-	struct label_item *next;
-};
-static struct label_item *label_table;
-
 static const struct option longopts[] = {
 	{"advanced", no_argument, 0, 'a'},
 	{"binary", no_argument, 0, 'b'},
+	{"compact", no_argument, 0, 'c'},
 	{"export", required_argument, 0, 'e'},
 	{"input_list", required_argument, 0, 'l'},
 	{"output", required_argument, 0, 'o'},
@@ -94,199 +57,138 @@ static void usage(void)
 	fprintf(stderr, "OPTIONS:\n");
 	fprintf(stderr, "\t-a, --advanced                       Set advanced flag\n");
 	fprintf(stderr, "\t-b, --binary                         C style binary output\n");
+	fprintf(stderr, "\t-c, --compact                        Compact instructions (Gen6, Gen7)\n");
 	fprintf(stderr, "\t-e, --export {exportfile}            Export label file\n");
 	fprintf(stderr, "\t-l, --input_list {entrytablefile}    Input entry_table_list file\n");
 	fprintf(stderr, "\t-o, --output {outputfile}            Specify output file\n");
 	fprintf(stderr, "\t-g, --gen <4|5|6|7|8>                Specify GPU generation\n");
 }
 
-static int hash(char *key)
-{
-    unsigned ret = 0;
-    while(*key)
-        ret = (ret << 1) + (*key++);
-    return ret % HASH_SIZE;
-}
-
-static void *find_hash_item(hash_table t, char *key)
-{
-    struct hash_item *p;
-    for(p = t[hash(key)]; p; p = p->next)
-	if(strcasecmp(p->key, key) == 0)
-	    return p->value;
-    return NULL;
-}
-
-static void insert_hash_item(hash_table t, char *key, void *v)
+/* Reads all of @file, returning NULL on error */
+static char *read_file(FILE *file, size_t *length)
 {
-    int index = hash(key);
-    struct hash_item *p = malloc(sizeof(*p));
-    p->key = key;
-    p->value = v;
-    p->next = t[index];
-    t[index] = p;
-}
+	size_t size = 0, len = 0, n;
+	char *buf = NULL, *tmp;
+
+	do {
+		if (len == size) {
+			size = size ? 2 * size : 64 * 1024;
+			tmp = realloc(buf, size);
+			if (tmp == NULL) {
+				free(buf);
+				return NULL;
+			}
+			buf = tmp;
+		}
+		n = fread(buf + len, 1, size - len, file);
+		len += n;
+	} while (n);
 
-static void free_hash_table(hash_table t)
-{
-    struct hash_item *p, *next;
-    int i;
-    for (i = 0; i < HASH_SIZE; i++) {
-	p = t[i];
-	while(p) {
-	    next = p->next;
-	    free(p->key);
-	    free(p->value);
-	    free(p);
-	    p = next;
+	if (ferror(file)) {
+		free(buf);
+		return NULL;
 	}
-    }
-}
-
-struct declared_register *find_register(char *name)
-{
-    return find_hash_item(declared_register_table, name);
-}
 
-void insert_register(struct declared_register *reg)
-{
-    insert_hash_item(declared_register_table, reg->name, reg);
+	*length = len;
+	return buf;
 }
 
-static void add_label(struct brw_program_instruction *i)
-{
-    struct label_item **p = &label_table;
-
-    assert(is_label(i));
-
-    while(*p)
-        p = &((*p)->next);
-    *p = calloc(1, sizeof(**p));
-    (*p)->name = label_name(i);
-    (*p)->addr = i->inst_offset;
-}
-
-/* Some assembly code have duplicated labels.
-   Start from start_addr. Search as a loop. Return the first label found. */
-static int label_to_addr(char *name, int start_addr)
-{
-    /* return the first label just after start_addr, or the first label from the head */
-    struct label_item *p;
-    int r = -1;
-    for(p = label_table; p; p = p->next) {
-        if(strcmp(p->name, name) == 0) {
-            if(p->addr >= start_addr) // the first label just after start_addr
-                return p->addr;
-            else if(r == -1) // the first label from the head
-                r = p->addr;
-        }
-    }
-    if(r == -1) {
-        fprintf(stderr, "Can't find label %s\n", name);
-        exit(1);
-    }
-    return r;
-}
-
-static void free_label_table(struct label_item *p)
-{
-    if(p) {
-        free_label_table(p->next);
-        free(p);
-    }
-}
-
-struct entry_point_item {
-	char *str;
-	struct entry_point_item *next;
-} *entry_point_table;
-
-static int read_entry_file(char *fn)
+/* Returns the NULL terminated list of entry points in @fn, or NULL on error */
+static char **read_entry_file(char *fn)
 {
 	FILE *entry_table_file;
 	char buf[2048];
-	struct entry_point_item **p = &entry_point_table;
+	char **entry_points, **tmp;
+	int count = 0;
+
+	entry_points = calloc(1, sizeof(*entry_points));
+	if (entry_points == NULL)
+		return NULL;
 	if (!fn)
-		return 0;
+		return entry_points;
 	if ((entry_table_file = fopen(fn, "r")) == NULL)
-		return -1;
+		return NULL;
 	while (fgets(buf, sizeof(buf)-1, entry_table_file) != NULL) {
 		// drop the final char '\n'
 		if(buf[strlen(buf)-1] == '\n')
 			buf[strlen(buf)-1] = 0;
-		*p = calloc(1, sizeof(struct entry_point_item));
-		(*p)->str = strdup(buf);
-		p = &((*p)->next);
+		tmp = realloc(entry_points, (count + 2) * sizeof(*entry_points));
+		if (tmp == NULL)
+			break;
+		entry_points = tmp;
+		entry_points[count++] = strdup(buf);
+		entry_points[count] = NULL;
 	}
 	fclose(entry_table_file);
-	return 0;
+	return entry_points;
 }
 
-static int is_entry_point(struct brw_program_instruction *i)
+static char *put_hex(char *s, uint32_t value, int digits)
 {
-	struct entry_point_item *p;
-
-	assert(i->type == GEN4ASM_INSTRUCTION_LABEL);
-
-	for (p = entry_point_table; p; p = p->next) {
-	    if (strcmp(p->str, i->insn.label.name) == 0)
-		return 1;
-	}
-	return 0;
-}
-
-static void free_entry_point_table(struct entry_point_item *p) {
-	if (p) {
-		free_entry_point_table(p->next);
-		free(p->str);
-		free(p);
+	static const char hex[] = "0123456789abcdef";
+	int i;
+
+	s[0] = '0';
+	s[1] = 'x';
+	for (i = digits + 1; i >= 2; i--) {
+		s[i] = hex[value & 0xf];
+		value >>= 4;
 	}
+	return s + digits + 2;
 }
 
+/* Formats by hand, the output being most of the time spent on big kernels */
 static void
-print_instruction(FILE *output, struct brw_instruction *instruction)
+print_instruction(FILE *output, const uint32_t *instruction)
 {
+	char buf[256], *s = buf;
+	int i;
+
 	if (binary_like_output) {
-		fprintf(output, "\t0x%02x, 0x%02x, 0x%02x, 0x%02x, "
-				"0x%02x, 0x%02x, 0x%02x, 0x%02x,\n"
-				"\t0x%02x, 0x%02x, 0x%02x, 0x%02x, "
-				"0x%02x, 0x%02x, 0x%02x, 0x%02x,\n",
-			((unsigned char *)instruction)[0],
-			((unsigned char *)instruction)[1],
-			((unsigned char *)instruction)[2],
-			((unsigned char *)instruction)[3],
-			((unsigned char *)instruction)[4],
-			((unsigned char *)instruction)[5],
-			((unsigned char *)instruction)[6],
-			((unsigned char *)instruction)[7],
-			((unsigned char *)instruction)[8],
-			((unsigned char *)instruction)[9],
-			((unsigned char *)instruction)[10],
-			((unsigned char *)instruction)[11],
-			((unsigned char *)instruction)[12],
-			((unsigned char *)instruction)[13],
-			((unsigned char *)instruction)[14],
-			((unsigned char *)instruction)[15]);
+		const uint8_t *bytes = (const uint8_t *)instruction;
+
+		for (i = 0; i < 16; i++) {
+			if (i % 8 == 0)
+				*s++ = '\t';
+			s = put_hex(s, bytes[i], 2);
+			*s++ = ',';
+			*s++ = i % 8 == 7 ? '\n' : ' ';
+		}
 	} else {
-		fprintf(output, "   { 0x%08x, 0x%08x, 0x%08x, 0x%08x },\n",
-			((int *)instruction)[0],
-			((int *)instruction)[1],
-			((int *)instruction)[2],
-			((int *)instruction)[3]);
+		memcpy(s, "   { ", 5);
+		s += 5;
+		for (i = 0; i < 4; i++) {
+			s = put_hex(s, instruction[i], 8);
+			if (i < 3) {
+				memcpy(s, ", ", 2);
+				s += 2;
+			}
+		}
+		memcpy(s, " },\n", 4);
+		s += 4;
 	}
+
+	fwrite(buf, s - buf, 1, output);
 }
+
 int main(int argc, char **argv)
 {
+	struct gen4asm_options options = { .gen = 40, .filename = "<stdin>" };
+	struct gen4asm_kernel *kernel;
 	char *output_file = NULL;
 	char *entry_table_file = NULL;
+	char **entry_points;
+	char *source;
+	size_t length;
+	FILE *input = stdin;
 	FILE *output = stdout;
 	FILE *export_file;
-	struct brw_program_instruction *entry, *entry1, *tmp_entry;
-	int err, inst_offset;
+	int need_export = 0;
+	unsigned i;
+	int err = 0;
 	char o;
-	void *mem_ctx;
 
-	while ((o = getopt_long(argc, argv, "e:l:o:g:abW", longopts, NULL)) != -1) {
+	while ((o = getopt_long(argc, argv, "e:l:o:g:abcW", longopts, NULL)) != -1) {
 		switch (o) {
 		case 'o':
 			if (strcmp(optarg, "-") != 0)
@@ -298,7 +200,7 @@ int main(int argc, char **argv)
 			char *dec_ptr, *end_ptr;
 			unsigned long decimal;
 
-			gen_level = strtol(optarg, &dec_ptr, 10) * 10;
+			options.gen = strtol(optarg, &dec_ptr, 10) * 10;
 
 			if (*dec_ptr == '.') {
 				decimal = strtoul(++dec_ptr, &end_ptr, 10);
@@ -307,11 +209,11 @@ int main(int argc, char **argv)
 						fprintf(stderr, "Invalid Gen X decimal version\n");
 						exit(1);
 					}
-					gen_level += decimal;
+					options.gen += decimal;
 				}
 			}
 
-			if (gen_level < 40 || gen_level > 80) {
+			if (options.gen < 40 || options.gen > 80) {
 				usage();
 				exit(1);
 			}
@@ -320,11 +222,14 @@ int main(int argc, char **argv)
 		}
 
 		case 'a':
-			advanced_flag = 1;
+			options.advanced = 1;
 			break;
 		case 'b':
 			binary_like_output = 1;
 			break;
+		case 'c':
+			options.compact = 1;
+			break;
 
 		case 'e':
 			need_export = 1;
@@ -338,7 +243,7 @@ int main(int argc, char **argv)
 			break;
 
 		case 'W':
-			warning_flags |= WARN_ALL;
+			options.warnings = 1;
 			break;
 
 		default:
@@ -354,26 +259,37 @@ int main(int argc, char **argv)
 	}
 
 	if (strcmp(argv[0], "-") != 0) {
-		input_filename = argv[0];
-		yyin = fopen(input_filename, "r");
-		if (yyin == NULL) {
+		options.filename = argv[0];
+		input = fopen(options.filename, "r");
+		if (input == NULL) {
 			perror("Couldn't open input file");
 			exit(1);
 		}
 	}
 
-	brw_init_context(&genasm_brw_context, gen_level);
-	mem_ctx = ralloc_context(NULL);
-	brw_init_compile(&genasm_brw_context, &genasm_compile, mem_ctx);
-
-	err = yyparse();
+	source = read_file(input, &length);
+	if (source == NULL) {
+		perror("Couldn't read input file");
+		exit(1);
+	}
+	if (input != stdin)
+		fclose(input);
 
-	if (strcmp(argv[0], "-"))
-		fclose(yyin);
+	entry_points = read_entry_file(entry_table_file);
+	if (entry_points == NULL) {
+		fprintf(stderr, "Read entry file error\n");
+		exit(1);
+	}
+	options.entry_points = (const char *const *)entry_points;
 
-	yylex_destroy();
+	kernel = gen4asm_assemble(source, length, &options);
+	if (kernel == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
 
-	if (err || errors)
+	fputs(kernel->messages, stderr);
+	if (kernel->errors)
 		exit (1);
 
 	if (output_file) {
@@ -385,87 +301,44 @@ int main(int argc, char **argv)
 
 	}
 
-	if (read_entry_file(entry_table_file)) {
-		fprintf(stderr, "Read entry file error\n");
-		exit(1);
-	}
-	inst_offset = 0 ;
-	for (entry = compiled_program.first;
-		entry != NULL; entry = entry->next) {
-	    entry->inst_offset = inst_offset;
-	    entry1 = entry->next;
-	    if (entry1 && is_label(entry1) && is_entry_point(entry1)) {
-		// insert NOP instructions until (inst_offset+1) % 4 == 0
-		while (((inst_offset+1) % 4) != 0) {
-		    tmp_entry = calloc(sizeof(*tmp_entry), 1);
-		    tmp_entry->insn.gen.header.opcode = BRW_OPCODE_NOP;
-		    entry->next = tmp_entry;
-		    tmp_entry->next = entry1;
-		    entry = tmp_entry;
-		    tmp_entry->inst_offset = ++inst_offset;
-		}
-	    }
-	    if (!is_label(entry))
-              inst_offset++;
-	}
-
-	for (entry = compiled_program.first; entry; entry = entry->next)
-	    if (is_label(entry))
-		add_label(entry);
-
 	if (need_export) {
+		/* Gen5 counts in 64 bits units */
+		int factor = options.gen >= 50 && options.gen < 60 ? 2 : 1;
+
 		if (export_filename) {
 			export_file = fopen(export_filename, "w");
 		} else {
 			export_file = fopen("export.inc", "w");
 		}
-		for (entry = compiled_program.first;
-			entry != NULL; entry = entry->next) {
-		    if (is_label(entry))
+		for (i = 0; i < kernel->nr_labels; i++) {
 			fprintf(export_file, "#define %s_IP %d\n",
-				label_name(entry), (IS_GENx(5) ? 2 : 1)*(entry->inst_offset));
+				kernel->labels[i].name,
+				factor * kernel->labels[i].offset);
 		}
 		fclose(export_file);
 	}
 
-	for (entry = compiled_program.first; entry; entry = entry->next) {
-	    struct relocation *reloc = &entry->reloc;
-
-	    if (!is_relocatable(entry))
-		continue;
-
-	    if (reloc->first_reloc_target)
-		reloc->first_reloc_offset = label_to_addr(reloc->first_reloc_target, entry->inst_offset) - entry->inst_offset;
-
-	    if (reloc->second_reloc_target)
-		reloc->second_reloc_offset = label_to_addr(reloc->second_reloc_target, entry->inst_offset) - entry->inst_offset;
-
-	    if (reloc->second_reloc_offset) { // this is a branch instruction with two offset arguments
-                set_branch_two_offsets(entry, reloc->first_reloc_offset, reloc->second_reloc_offset);
-	    } else if (reloc->first_reloc_offset) {
-                set_branch_one_offset(entry, reloc->first_reloc_offset);
-	    }
-	}
-
 	if (binary_like_output)
 		fprintf(output, "%s", binary_prepend);
 
-	for (entry = compiled_program.first;
-		entry != NULL;
-		entry = entry1) {
-	    entry1 = entry->next;
-	    if (!is_label(entry))
-		print_instruction(output, &entry->insn.gen);
-	    else
-		free(entry->insn.label.name);
-	    free(entry);
-	}
+	for (i = 0; i < kernel->nr_insn; i++)
+	    print_instruction(output, &kernel->insn[4 * i]);
 	if (binary_like_output)
 		fprintf(output, "};");
 
-	free_entry_point_table(entry_point_table);
-	free_hash_table(declared_register_table);
-	free_label_table(label_table);
+	if (kernel->uncompacted_size) {
+		unsigned size = 16 * kernel->nr_insn;
+
+		fprintf(stderr, "%s: compacted from %u to %u bytes (%u%% smaller)\n",
+			options.filename, kernel->uncompacted_size, size,
+			100 - 100 * size / kernel->uncompacted_size);
+	}
+
+	for (i = 0; entry_points[i]; i++)
+		free(entry_points[i]);
+	free(entry_points);
+	gen4asm_kernel_free(kernel);
+	free(source);
 
 	fflush (output);
 	if (ferror (output)) {
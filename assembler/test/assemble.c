@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Assembles the tests run through run-test.sh again with gen4asm_assemble(),
+ * twice each, as a library user would, and checks what comes back against
+ * the same .expected files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intel-gen4asm.h"
+
+static const char *tests[] = {
+	"mov", "frc", "rndd", "rndu", "rnde", "rnde-intsrc", "rndz", "lzd",
+	"not", "immediate",
+};
+
+static const char bad_source[] =
+	"mov (1) g1<1>F g2<0,1,0>F { align1 };\n"
+	"mov (1) g1<1>F g2<0,1,0>F bogus;\n";
+
+/* Reads all of @path, NUL terminated, returning NULL on error */
+static char *read_file(const char *path, size_t *length)
+{
+	FILE *file = fopen(path, "r");
+	char *buf;
+	long size;
+
+	if (file == NULL)
+		return NULL;
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	buf = malloc(size + 1);
+	if (buf && fread(buf, 1, size, file) != (size_t)size) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(file);
+
+	if (buf) {
+		buf[size] = '\0';
+		*length = size;
+	}
+	return buf;
+}
+
+/* Formats @kernel the way intel-gen4asm does by default */
+static char *format_kernel(const struct gen4asm_kernel *kernel)
+{
+	char *buf = malloc(64 * kernel->nr_insn + 1), *s = buf;
+	unsigned i;
+
+	*s = '\0';
+	for (i = 0; i < kernel->nr_insn; i++) {
+		const uint32_t *insn = &kernel->insn[4 * i];
+
+		s += sprintf(s, "   { 0x%08x, 0x%08x, 0x%08x, 0x%08x },\n",
+			     insn[0], insn[1], insn[2], insn[3]);
+	}
+	return buf;
+}
+
+static int check_test(const char *srcdir, const char *name)
+{
+	struct gen4asm_options options = { .gen = 40 };
+	struct gen4asm_kernel *kernel;
+	char path[4096], *source, *expected, *output;
+	size_t length, expected_length;
+	int pass, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s.g4a", srcdir, name);
+	source = read_file(path, &length);
+	snprintf(path, sizeof(path), "%s/%s.expected", srcdir, name);
+	expected = read_file(path, &expected_length);
+	if (source == NULL || expected == NULL) {
+		fprintf(stderr, "%s: couldn't read the test files\n", name);
+		free(source);
+		free(expected);
+		return 1;
+	}
+
+	options.filename = name;
+	for (pass = 0; pass < 2 && ret == 0; pass++) {
+		kernel = gen4asm_assemble(source, length, &options);
+		if (kernel == NULL) {
+			fprintf(stderr, "%s: out of memory\n", name);
+			ret = 1;
+			break;
+		}
+
+		if (kernel->errors) {
+			fprintf(stderr, "%s: failed to assemble:\n%s",
+				name, kernel->messages);
+			ret = 1;
+		} else {
+			output = format_kernel(kernel);
+			if (strcmp(output, expected) != 0) {
+				fprintf(stderr, "%s: output differs, got:\n%s",
+					name, output);
+				ret = 1;
+			}
+			free(output);
+		}
+
+		gen4asm_kernel_free(kernel);
+	}
+
+	free(source);
+	free(expected);
+	return ret;
+}
+
+/* Errors come back in the kernel, with lines counted from each source */
+static int check_errors(void)
+{
+	struct gen4asm_options options = { .gen = 40 };
+	struct gen4asm_kernel *kernel;
+	int pass, ret = 0;
+
+	for (pass = 0; pass < 2 && ret == 0; pass++) {
+		kernel = gen4asm_assemble(bad_source, strlen(bad_source),
+					  &options);
+		if (kernel == NULL) {
+			fprintf(stderr, "errors: out of memory\n");
+			return 1;
+		}
+
+		if (kernel->errors == 0 || kernel->insn != NULL ||
+		    strstr(kernel->messages, "<memory>: 2: ") == NULL) {
+			fprintf(stderr, "errors: unexpected result, got:\n%s",
+				kernel->messages);
+			ret = 1;
+		}
+
+		gen4asm_kernel_free(kernel);
+	}
+
+	return ret;
+}
+
+int main(void)
+{
+	const char *srcdir = getenv("srcdir");
+	unsigned i;
+	int ret = 0;
+
+	if (srcdir == NULL)
+		srcdir = ".";
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+		ret |= check_test(srcdir, tests[i]);
+	ret |= check_errors();
+
+	return ret;
+}
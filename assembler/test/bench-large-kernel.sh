@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Assembles a synthetic kernel of many blocks, each with its own label, a
+# declared register and a jump to some other block, to measure how the
+# assembler scales with the size of generated media kernels. The time is end
+# to end, scanning included, which dominates until the kernel is large.
+#
+# usage: bench-large-kernel.sh [blocks] [gen]
+
+BUILDDIR=${top_builddir-`pwd`/../..}
+BLOCKS=${1-20000}
+GEN=${2-7}
+
+TMPDIR=`mktemp -d` || exit 1
+trap 'rm -rf $TMPDIR' EXIT
+
+awk -v n=$BLOCKS -v entries=$TMPDIR/entries 'BEGIN {
+	for (i = 0; i < n; i++)
+		printf(".declare sym%d Base=g%d.0 ElementSize=4 SrcRegion=<8,8,1> DstRegion=<1> Type=F\n",
+		       i, 2 + i % 100);
+	for (i = 0; i < n; i++) {
+		printf("block%d:\n", i);
+		printf("add (8) g%d<1>F g1<8,8,1>F g2<8,8,1>F { align1 };\n", 2 + i % 100);
+		printf("jmpi (1) block%d;\n", (i * 7919 + 1) % n);
+		if (i % 16 == 0)
+			printf("block%d\n", i) > entries;
+	}
+}' > $TMPDIR/kernel.g4a
+
+START=`date +%s%N`
+${BUILDDIR}/assembler/intel-gen4asm -g $GEN -l $TMPDIR/entries \
+	-o $TMPDIR/kernel.out $TMPDIR/kernel.g4a || exit 1
+END=`date +%s%N`
+
+echo "$BLOCKS blocks, gen $GEN: $(( (END - START) / 1000000 )) ms"
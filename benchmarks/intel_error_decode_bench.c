@@ -0,0 +1,216 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/** @file intel_error_decode_bench.c
+ *
+ * Measures the throughput of intel_error_decode on a synthetic error state.
+ *
+ * The error state mimics what the kernel writes out for a hang on a
+ * multi-ring machine: a register dump per ring followed by a long list of
+ * batchbuffers and the ringbuffers, padded out to the requested size. The
+ * batches are filled with MI_NOOPs so that the time spent in the decoder
+ * proper stays small and the parser dominates.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+static const char *rings[] = { "render", "bsd", "blt", "vebox" };
+
+static double
+get_time_in_secs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double)tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+write_error_state(FILE *file, unsigned long size)
+{
+	unsigned long batch = 0;
+	int i;
+
+	fprintf(file,
+		"Time: 1400000000 s 0 us\n"
+		"Kernel: 3.15.0\n"
+		"PCI ID: 0x0166\n"
+		"EIR: 0x00000000\n"
+		"IER: 0xfc002ca9\n"
+		"PGTBL_ER: 0x00000000\n");
+	for (i = 0; i < 16; i++)
+		fprintf(file, "  fence[%d] = %x\n", i, 0);
+
+	for (i = 0; i < 4; i++)
+		fprintf(file,
+			"%s command stream:\n"
+			"  START: 0x00010000\n"
+			"  HEAD: 0x00000040\n"
+			"  TAIL: 0x00000100\n"
+			"  CTL: 0x0001f001\n"
+			"  ACTHD: 0x00100040\n"
+			"  INSTDONE: 0xffffffff\n"
+			"  INSTDONE1: 0xffffffff\n",
+			rings[i]);
+
+	while (ftell(file) < size) {
+		fprintf(file, "%s ring --- gtt_offset = 0x%08lx\n",
+			rings[batch % 4], 0x100000 + (batch % 4096) * 0x10000);
+		for (i = 0; i < 4096; i++)
+			fprintf(file, "%08x :  %08x\n", i * 4, 0);
+		batch++;
+	}
+
+	for (i = 0; i < 4; i++) {
+		int j;
+
+		fprintf(file, "%s ring --- ringbuffer = 0x00010000\n",
+			rings[i]);
+		for (j = 0; j < 1024; j++)
+			fprintf(file, "%08x :  %08x\n", j * 4, 0);
+	}
+}
+
+static double
+run_decoder(const char *decoder, const char *path)
+{
+	double start;
+	pid_t pid;
+	int status;
+
+	start = get_time_in_secs();
+
+	pid = fork();
+	if (pid == 0) {
+		int fd = open("/dev/null", O_WRONLY);
+
+		dup2(fd, STDOUT_FILENO);
+		execlp(decoder, decoder, path, NULL);
+		fprintf(stderr, "Failed to run %s: %s\n",
+			decoder, strerror(errno));
+		_exit(127);
+	}
+
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "%s failed\n", decoder);
+		exit(1);
+	}
+
+	return get_time_in_secs() - start;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-s size_in_MiB] [-r repeats] [-d decoder] [-k file]\n"
+		"\n"
+		"  -s\tsize of the synthetic error state (default 256 MiB)\n"
+		"  -r\tnumber of timed runs (default 3)\n"
+		"  -d\tdecoder to run (default intel_error_decode)\n"
+		"  -k\tkeep the error state in file instead of a temporary\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *decoder = "intel_error_decode";
+	char path[] = "/tmp/intel_error_state.XXXXXX";
+	const char *keep = NULL, *filename;
+	unsigned long size = 256;
+	double elapsed, best = 0;
+	struct stat st;
+	FILE *file;
+	int repeats = 3;
+	int fd, c, i;
+
+	while ((c = getopt(argc, argv, "s:r:d:k:")) != -1) {
+		switch (c) {
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 'd':
+			decoder = optarg;
+			break;
+		case 'k':
+			keep = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (keep)
+		fd = open(keep, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	else
+		fd = mkstemp(path);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create error state: %s\n",
+			strerror(errno));
+		return 1;
+	}
+
+	file = fdopen(fd, "w");
+	write_error_state(file, size << 20);
+	fclose(file);
+
+	filename = keep ? keep : path;
+	stat(filename, &st);
+
+	/* Warm the page cache so that we time the parser, not the disk */
+	run_decoder(decoder, filename);
+
+	for (i = 0; i < repeats; i++) {
+		elapsed = run_decoder(decoder, filename);
+		printf("run %d: %.3fs, %.1f MiB/s\n", i, elapsed,
+		       st.st_size / elapsed / (1 << 20));
+		if (i == 0 || elapsed < best)
+			best = elapsed;
+	}
+
+	printf("best: %.1f MiB/s over %.1f MiB\n",
+	       st.st_size / best / (1 << 20), st.st_size / (double)(1 << 20));
+
+	if (!keep)
+		unlink(path);
+
+	return 0;
+}
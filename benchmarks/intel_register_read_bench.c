@@ -0,0 +1,231 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/** @file intel_register_read_bench.c
+ *
+ * Measures the cost of the register access checks in intel_register_read().
+ *
+ * The mmio BAR is backed by a register dump (either the one given on the
+ * command line or a zero filled temporary) so that no hardware is needed and
+ * the numbers reflect the library overhead rather than bus latency. Every
+ * readable register of the selected device is read in turn with INREG(), with
+ * intel_register_read() in unsafe mode and with intel_register_read() in safe
+ * mode. The raw range lookup is then timed with and without the precomputed
+ * access table.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include <pciaccess.h>
+
+#include "intel_io.h"
+
+#define DUMP_SIZE (2 * 1024 * 1024)
+
+static double
+get_time_in_secs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double)tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+report(const char *name, unsigned long reads, double elapsed, double base)
+{
+	printf("%-28s %8.1f Mreads/s, %6.2f ns/read",
+	       name, reads / elapsed / 1e6, elapsed * 1e9 / reads);
+	if (base > 0)
+		printf(" (%.2fx)", elapsed / base);
+	printf("\n");
+}
+
+static double
+time_inreg(const uint32_t *regs, int count, int loops)
+{
+	volatile uint32_t sink = 0;
+	double start = get_time_in_secs();
+	int i, j;
+
+	for (i = 0; i < loops; i++)
+		for (j = 0; j < count; j++)
+			sink += INREG(regs[j]);
+
+	return get_time_in_secs() - start;
+}
+
+static double
+time_register_read(struct pci_device *dev, int safe,
+		   const uint32_t *regs, int count, int loops)
+{
+	volatile uint32_t sink = 0;
+	double start;
+	int i, j;
+
+	intel_register_access_init(dev, safe);
+
+	start = get_time_in_secs();
+	for (i = 0; i < loops; i++)
+		for (j = 0; j < count; j++)
+			sink += intel_register_read(regs[j]);
+	start = get_time_in_secs() - start;
+
+	intel_register_access_fini();
+
+	return start;
+}
+
+static double
+time_lookup(struct intel_register_map map,
+	    const uint32_t *regs, int count, int loops)
+{
+	unsigned long found = 0;
+	double start = get_time_in_secs();
+	int i, j;
+
+	for (i = 0; i < loops; i++)
+		for (j = 0; j < count; j++)
+			found += intel_get_register_range(map, regs[j],
+							  INTEL_RANGE_READ) != NULL;
+
+	if (found != (unsigned long)count * loops) {
+		fprintf(stderr, "Register lookup mismatch\n");
+		exit(1);
+	}
+
+	return get_time_in_secs() - start;
+}
+
+static char *
+create_dump(void)
+{
+	static char path[] = "/tmp/intel_register_dump.XXXXXX";
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0 || ftruncate(fd, DUMP_SIZE)) {
+		fprintf(stderr, "Failed to create register dump: %s\n",
+			strerror(errno));
+		exit(1);
+	}
+	close(fd);
+
+	return path;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-d devid] [-f dump] [-l loops]\n"
+		"\n"
+		"  -d\tdevice id whose register map to use (default 0x0166)\n"
+		"  -f\tregister dump or snapshot to read from (default zeroes)\n"
+		"  -l\tpasses over the register map (default 200)\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct pci_device dev;
+	struct intel_register_map map;
+	char *dump = NULL, *tmp = NULL;
+	uint32_t devid = 0, snapshot_devid, *regs, reg;
+	unsigned long reads;
+	double inreg, elapsed;
+	int loops = 200, count = 0, c;
+
+	while ((c = getopt(argc, argv, "d:f:l:")) != -1) {
+		switch (c) {
+		case 'd':
+			devid = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			dump = optarg;
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (dump == NULL)
+		dump = tmp = create_dump();
+
+	snapshot_devid = intel_mmio_use_dump_file(dump);
+	if (devid == 0)
+		devid = snapshot_devid ? snapshot_devid : 0x0166;
+
+	/* only the device id is looked at once mmio is set up */
+	memset(&dev, 0, sizeof(dev));
+	dev.device_id = devid;
+
+	map = intel_get_register_map(devid);
+	regs = malloc(map.top / 4 * sizeof(*regs));
+	if (regs == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+
+	for (reg = 0; reg < map.top; reg += 4)
+		if (intel_get_register_range(map, reg, INTEL_RANGE_READ))
+			regs[count++] = reg;
+
+	printf("devid 0x%04x, %d readable registers, %d passes\n",
+	       devid, count, loops);
+	reads = (unsigned long)count * loops;
+
+	inreg = time_inreg(regs, count, loops);
+	report("INREG", reads, inreg, 0);
+
+	elapsed = time_register_read(&dev, 0, regs, count, loops);
+	report("intel_register_read unsafe", reads, elapsed, inreg);
+
+	elapsed = time_register_read(&dev, 1, regs, count, loops);
+	report("intel_register_read safe", reads, elapsed, inreg);
+
+	elapsed = time_lookup(map, regs, count, loops);
+	report("range lookup, table", reads, elapsed, 0);
+
+	map.access = NULL;
+	elapsed = time_lookup(map, regs, count, loops);
+	report("range lookup, list walk", reads, elapsed, 0);
+
+	free(regs);
+	if (tmp)
+		unlink(tmp);
+
+	return 0;
+}
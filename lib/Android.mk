@@ -9,12 +9,15 @@ $(GPU_TOOLS_PATH)/config.h:
 	@echo '#define PACKAGE_VERSION "1.5"' >> $@ ; \
 	echo '#define TARGET_CPU_PLATFORM "android-ia"' >> $@ ;
 
+PYTHON := python3
+
 include $(LOCAL_PATH)/Makefile.sources
 
 include $(CLEAR_VARS)
 
 LOCAL_GENERATED_SOURCES :=       \
 	$(IGT_LIB_PATH)/version.h  \
+	$(GPU_TOOLS_PATH)/lib/intel_reg_db_tables.c \
 	$(GPU_TOOLS_PATH)/config.h
 
 LOCAL_C_INCLUDES +=              \
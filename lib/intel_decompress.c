@@ -0,0 +1,389 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Transparent decompression of tool input files.
+ *
+ * The input is sniffed for the gzip, xz and zstd magic numbers and, if
+ * compressed, wrapped in a stdio stream that inflates it on the fly through
+ * a fixed size window. Memory use is therefore bounded by the window and the
+ * decompressor state, not by the size of the file.
+ */
+
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "intel_io.h"
+
+#if defined(HAVE_ZLIB) || defined(HAVE_LZMA) || defined(HAVE_ZSTD)
+
+#define WINDOW_SIZE (64 * 1024)
+
+enum compression {
+	COMPRESSION_NONE,
+	COMPRESSION_GZIP,
+	COMPRESSION_XZ,
+	COMPRESSION_ZSTD,
+};
+
+static const struct {
+	enum compression type;
+	const char *name;
+	const unsigned char *magic;
+	size_t len;
+} formats[] = {
+	{ COMPRESSION_GZIP, "gzip", (const unsigned char *)"\x1f\x8b", 2 },
+	{ COMPRESSION_XZ, "xz", (const unsigned char *)"\xfd" "7zXZ\x00", 6 },
+	{ COMPRESSION_ZSTD, "zstd", (const unsigned char *)"\x28\xb5\x2f\xfd", 4 },
+};
+
+#define MAX_MAGIC 6
+
+struct decompress {
+	FILE *file;
+	enum compression type;
+	unsigned char *in;
+	size_t in_pos, in_len;
+	bool in_eof;
+	bool done;
+#ifdef HAVE_ZLIB
+	z_stream zlib;
+#endif
+#ifdef HAVE_LZMA
+	lzma_stream lzma;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zstd;
+#endif
+};
+
+static bool
+refill(struct decompress *d)
+{
+	if (d->in_pos < d->in_len)
+		return true;
+
+	if (d->in_eof)
+		return false;
+
+	d->in_pos = 0;
+	d->in_len = fread(d->in, 1, WINDOW_SIZE, d->file);
+	if (d->in_len < WINDOW_SIZE)
+		d->in_eof = true;
+
+	return d->in_len > 0;
+}
+
+static ssize_t
+read_none(struct decompress *d, char *buf, size_t size)
+{
+	size_t len;
+
+	/* Hand out the bytes we consumed sniffing the magic first */
+	if (d->in_pos < d->in_len) {
+		len = d->in_len - d->in_pos;
+		if (len > size)
+			len = size;
+		memcpy(buf, d->in + d->in_pos, len);
+		d->in_pos += len;
+		return len;
+	}
+
+	return fread(buf, 1, size, d->file);
+}
+
+#ifdef HAVE_ZLIB
+static ssize_t
+read_gzip(struct decompress *d, char *buf, size_t size)
+{
+	z_stream *zs = &d->zlib;
+	int ret;
+
+	zs->next_out = (Bytef *)buf;
+	zs->avail_out = size;
+
+	while (zs->avail_out == size && !d->done) {
+		bool more = refill(d);
+
+		zs->next_in = d->in + d->in_pos;
+		zs->avail_in = d->in_len - d->in_pos;
+
+		ret = inflate(zs, Z_NO_FLUSH);
+		d->in_pos = d->in_len - zs->avail_in;
+
+		if (ret == Z_STREAM_END) {
+			/* gzip allows several members to be concatenated */
+			if (refill(d))
+				inflateReset(zs);
+			else
+				d->done = true;
+		} else if (ret == Z_BUF_ERROR && !more) {
+			/* truncated input, return what we have */
+			d->done = true;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	return size - zs->avail_out;
+}
+#endif
+
+#ifdef HAVE_LZMA
+static ssize_t
+read_xz(struct decompress *d, char *buf, size_t size)
+{
+	lzma_stream *xz = &d->lzma;
+	lzma_ret ret;
+
+	xz->next_out = (uint8_t *)buf;
+	xz->avail_out = size;
+
+	while (xz->avail_out == size && !d->done) {
+		bool more = refill(d);
+
+		xz->next_in = d->in + d->in_pos;
+		xz->avail_in = d->in_len - d->in_pos;
+
+		ret = lzma_code(xz, more ? LZMA_RUN : LZMA_FINISH);
+		d->in_pos = d->in_len - xz->avail_in;
+
+		if (ret == LZMA_STREAM_END)
+			d->done = true;
+		else if (ret != LZMA_OK) {
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	return size - xz->avail_out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static ssize_t
+read_zstd(struct decompress *d, char *buf, size_t size)
+{
+	ZSTD_outBuffer output = { buf, size, 0 };
+
+	while (output.pos == 0) {
+		bool more = refill(d);
+		ZSTD_inBuffer input;
+		size_t ret;
+
+		input.src = d->in;
+		input.size = d->in_len;
+		input.pos = d->in_pos;
+
+		ret = ZSTD_decompressStream(d->zstd, &output, &input);
+		d->in_pos = input.pos;
+
+		if (ZSTD_isError(ret)) {
+			errno = EIO;
+			return -1;
+		}
+
+		if (!more && output.pos == 0)
+			break;
+	}
+
+	return output.pos;
+}
+#endif
+
+static ssize_t
+decompress_read(void *cookie, char *buf, size_t size)
+{
+	struct decompress *d = cookie;
+
+	switch (d->type) {
+#ifdef HAVE_ZLIB
+	case COMPRESSION_GZIP:
+		return read_gzip(d, buf, size);
+#endif
+#ifdef HAVE_LZMA
+	case COMPRESSION_XZ:
+		return read_xz(d, buf, size);
+#endif
+#ifdef HAVE_ZSTD
+	case COMPRESSION_ZSTD:
+		return read_zstd(d, buf, size);
+#endif
+	default:
+		return read_none(d, buf, size);
+	}
+}
+
+static int
+decompress_close(void *cookie)
+{
+	struct decompress *d = cookie;
+	int ret;
+
+#ifdef HAVE_ZLIB
+	if (d->type == COMPRESSION_GZIP)
+		inflateEnd(&d->zlib);
+#endif
+#ifdef HAVE_LZMA
+	if (d->type == COMPRESSION_XZ)
+		lzma_end(&d->lzma);
+#endif
+#ifdef HAVE_ZSTD
+	if (d->type == COMPRESSION_ZSTD)
+		ZSTD_freeDStream(d->zstd);
+#endif
+
+	ret = fclose(d->file);
+	free(d->in);
+	free(d);
+
+	return ret;
+}
+
+static bool
+decompress_init(struct decompress *d)
+{
+	switch (d->type) {
+#ifdef HAVE_ZLIB
+	case COMPRESSION_GZIP:
+		/* 15 + 32: maximum window, automatic gzip/zlib header */
+		return inflateInit2(&d->zlib, 15 + 32) == Z_OK;
+#endif
+#ifdef HAVE_LZMA
+	case COMPRESSION_XZ:
+		return lzma_stream_decoder(&d->lzma, UINT64_MAX,
+					   LZMA_CONCATENATED) == LZMA_OK;
+#endif
+#ifdef HAVE_ZSTD
+	case COMPRESSION_ZSTD:
+		d->zstd = ZSTD_createDStream();
+		return d->zstd && !ZSTD_isError(ZSTD_initDStream(d->zstd));
+#endif
+	case COMPRESSION_NONE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * intel_decompress_file:
+ * @file: stream to read the (possibly compressed) input from
+ *
+ * Sniffs the start of @file for gzip, xz or zstd compressed data. If the
+ * data is compressed, returns a new read-only stream that decompresses it
+ * on the fly; closing that stream also closes @file. Uncompressed regular
+ * files are rewound and @file itself is returned, so callers can still
+ * mmap() or seek them. Exits on compressed input that this build cannot
+ * decompress.
+ *
+ * Returns: a stream yielding the decompressed contents of @file.
+ */
+FILE *intel_decompress_file(FILE *file)
+{
+	cookie_io_functions_t io = {
+		.read = decompress_read,
+		.close = decompress_close,
+	};
+	struct decompress *d;
+	FILE *stream;
+	int i;
+
+	d = calloc(1, sizeof(*d));
+	if (d)
+		d->in = malloc(WINDOW_SIZE);
+	if (d == NULL || d->in == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	d->file = file;
+
+	while (d->in_len < MAX_MAGIC && !d->in_eof) {
+		size_t len = fread(d->in + d->in_len, 1,
+				   MAX_MAGIC - d->in_len, file);
+		if (len == 0)
+			d->in_eof = true;
+		d->in_len += len;
+	}
+
+	d->type = COMPRESSION_NONE;
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		if (d->in_len >= formats[i].len &&
+		    memcmp(d->in, formats[i].magic, formats[i].len) == 0) {
+			d->type = formats[i].type;
+			break;
+		}
+	}
+
+	if (d->type == COMPRESSION_NONE && fseek(file, 0, SEEK_SET) == 0) {
+		free(d->in);
+		free(d);
+		return file;
+	}
+
+	if (!decompress_init(d)) {
+		fprintf(stderr, "Unable to decompress %s input, "
+			"support not built in\n", formats[i].name);
+		exit(1);
+	}
+
+	stream = fopencookie(d, "r", io);
+	if (stream == NULL) {
+		fprintf(stderr, "Failed to open decompression stream: %s\n",
+			strerror(errno));
+		exit(1);
+	}
+
+	return stream;
+}
+
+#else
+
+FILE *intel_decompress_file(FILE *file)
+{
+	/* built without any decompressor, hand the input over untouched */
+	return file;
+}
+
+#endif
@@ -29,12 +29,13 @@
 #define INTEL_GPU_TOOLS_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include <pciaccess.h>
 
 /* register access helpers from intel_mmio.c */
 extern void *mmio;
 void intel_mmio_use_pci_bar(struct pci_device *pci_dev);
-void intel_mmio_use_dump_file(char *file);
+uint32_t intel_mmio_use_dump_file(char *file);
 
 int intel_register_access_init(struct pci_device *pci_dev, int safe);
 void intel_register_access_fini(void);
@@ -42,6 +43,12 @@ uint32_t intel_register_read(uint32_t reg);
 void intel_register_write(uint32_t reg, uint32_t val);
 int intel_register_access_needs_fakewake(void);
 
+struct intel_register_set;
+struct intel_register_set *intel_register_set_create(const uint32_t *regs, unsigned int n);
+void intel_register_set_read(const struct intel_register_set *set, uint32_t *vals);
+void intel_register_set_destroy(struct intel_register_set *set);
+void intel_register_read_batch(const uint32_t *regs, uint32_t *vals, unsigned int n);
+
 uint32_t INREG(uint32_t reg);
 void OUTREG(uint32_t reg, uint32_t val);
 
@@ -58,6 +65,40 @@ int intel_punit_write(uint8_t addr, uint32_t val);
 int intel_nc_read(uint8_t addr, uint32_t *val);
 int intel_nc_write(uint8_t addr, uint32_t val);
 
+/* register snapshot file format, written by intel_reg_snapshot */
+#ifndef __GTK_DOC_IGNORE__
+
+#define INTEL_SNAPSHOT_MAGIC		"IGTREGS1"
+
+#define INTEL_SNAPSHOT_FORCEWAKE	(1<<0) /* forcewake was held */
+#define INTEL_SNAPSHOT_REGISTER_MAP	(1<<1) /* ranges from the register map */
+
+#define INTEL_SNAPSHOT_RANGE_ZLIB	(1<<0)
+
+struct intel_snapshot_header {
+	char magic[8];
+	uint32_t devid;
+	uint32_t gen;
+	uint64_t timestamp;	/* seconds since the epoch */
+	uint32_t flags;
+	uint32_t mmio_size;	/* size of the virtual BAR */
+	uint32_t num_ranges;
+	uint32_t pad;
+};
+
+/* followed by num_ranges of these, then the range data */
+struct intel_snapshot_range {
+	uint32_t base;
+	uint32_t size;		/* bytes of register space */
+	uint32_t flags;
+	uint32_t length;	/* bytes stored in the file */
+	uint64_t offset;	/* file offset of the data */
+};
+#endif /* __GTK_DOC_IGNORE__ */
+
+/* compressed input helpers from intel_decompress.c */
+FILE *intel_decompress_file(FILE *file);
+
 /* register maps from intel_reg_map.c */
 #ifndef __GTK_DOC_IGNORE__
 
@@ -77,6 +118,7 @@ struct intel_register_map {
 	struct intel_register_range *map;
 	uint32_t top;
 	uint32_t alignment_mask;
+	const uint16_t *access;	/* per 64 bytes, see intel_reg_map.c */
 };
 struct intel_register_map intel_get_register_map(uint32_t devid);
 struct intel_register_range *intel_get_register_range(struct intel_register_map map, uint32_t offset, uint32_t mode);
@@ -41,6 +41,11 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 
+#include "config.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "intel_io.h"
 #include "igt_core.h"
 #include "igt_debugfs.h"
@@ -75,10 +80,69 @@ static struct _mmio_data {
 	int inited;
 	bool safe;
 	uint32_t i915_devid;
+	int gen;
 	struct intel_register_map map;
 	int key;
 } mmio_data;
 
+static uint32_t
+use_snapshot(int fd, const struct intel_snapshot_header *hdr)
+{
+	struct intel_snapshot_range *ranges;
+	size_t size;
+	uint32_t i;
+
+	size = hdr->num_ranges * sizeof(*ranges);
+	ranges = malloc(size);
+	igt_fail_on_f(ranges == NULL ||
+		      pread(fd, ranges, size, sizeof(*hdr)) != size,
+		      "Truncated register snapshot\n");
+
+	/* Holes in the snapshot read back as zero */
+	mmio = mmap(NULL, hdr->mmio_size, PROT_READ|PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	igt_fail_on_f(mmio == MAP_FAILED,
+		      "Couldn't allocate %u bytes of register space\n",
+		      hdr->mmio_size);
+
+	for (i = 0; i < hdr->num_ranges; i++) {
+		struct intel_snapshot_range *r = &ranges[i];
+		char *dst = (char *)mmio + r->base;
+
+		igt_fail_on_f(r->base > hdr->mmio_size ||
+			      r->size > hdr->mmio_size - r->base,
+			      "Corrupt register snapshot range 0x%08x\n",
+			      r->base);
+
+		if (r->flags & INTEL_SNAPSHOT_RANGE_ZLIB) {
+#ifdef HAVE_ZLIB
+			void *buf = malloc(r->length);
+			uLongf len = r->size;
+
+			igt_fail_on_f(buf == NULL ||
+				      pread(fd, buf, r->length, r->offset) != r->length ||
+				      uncompress((Bytef *)dst, &len, buf, r->length) != Z_OK ||
+				      len != r->size,
+				      "Corrupt register snapshot range 0x%08x\n",
+				      r->base);
+			free(buf);
+#else
+			igt_fail_on_f(true,
+				      "Compressed register snapshots are not supported by this build\n");
+#endif
+		} else {
+			igt_fail_on_f(r->length != r->size ||
+				      pread(fd, dst, r->size, r->offset) != r->size,
+				      "Corrupt register snapshot range 0x%08x\n",
+				      r->base);
+		}
+	}
+
+	free(ranges);
+
+	return hdr->devid;
+}
+
 /**
  * intel_mmio_use_dump_file:
  * @file: name of the register dump file to open
@@ -86,10 +150,19 @@ static struct _mmio_data {
  * Sets up #mmio to point at the data contained in @file. This allows the same
  * code to get reused for dumping and decoding from running hardwared as from
  * register dumps.
+ *
+ * @file can either be a raw dump of the MMIO BAR or a snapshot as written by
+ * intel_reg_snapshot, in which case the stored ranges are loaded into a
+ * virtual BAR and any register outside of them reads back as zero.
+ *
+ * Returns:
+ * The device id recorded in the snapshot, or 0 for raw dumps.
  */
-void
+uint32_t
 intel_mmio_use_dump_file(char *file)
 {
+	struct intel_snapshot_header hdr;
+	uint32_t devid = 0;
 	int fd;
 	struct stat st;
 
@@ -97,11 +170,20 @@ intel_mmio_use_dump_file(char *file)
 	igt_fail_on_f(fd == -1,
 		      "Couldn't open %s\n", file);
 
+	if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+	    memcmp(hdr.magic, INTEL_SNAPSHOT_MAGIC, sizeof(hdr.magic)) == 0) {
+		devid = use_snapshot(fd, &hdr);
+		close(fd);
+		return devid;
+	}
+
 	fstat(fd, &st);
 	mmio = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
 	igt_fail_on_f(mmio == MAP_FAILED,
 		      "Couldn't mmap %s\n", file);
 	close(fd);
+
+	return devid;
 }
 
 /**
@@ -181,6 +263,7 @@ intel_register_access_init(struct pci_device *pci_dev, int safe)
 	mmio_data.safe = (safe != 0 &&
 			intel_gen(pci_dev->device_id) >= 4) ? true : false;
 	mmio_data.i915_devid = pci_dev->device_id;
+	mmio_data.gen = intel_gen(mmio_data.i915_devid);
 	if (mmio_data.safe)
 		mmio_data.map = intel_get_register_map(mmio_data.i915_devid);
 
@@ -249,7 +332,7 @@ intel_register_read(uint32_t reg)
 
 	igt_assert(mmio_data.inited);
 
-	if (intel_gen(mmio_data.i915_devid) >= 6)
+	if (mmio_data.gen >= 6)
 		igt_assert(mmio_data.key != -1);
 
 	if (!mmio_data.safe)
@@ -289,7 +372,7 @@ intel_register_write(uint32_t reg, uint32_t val)
 
 	igt_assert(mmio_data.inited);
 
-	if (intel_gen(mmio_data.i915_devid) >= 6)
+	if (mmio_data.gen >= 6)
 		igt_assert(mmio_data.key != -1);
 
 	if (!mmio_data.safe)
@@ -306,6 +389,135 @@ write_out:
 	*(volatile uint32_t *)((volatile char *)mmio + reg) = val;
 }
 
+/*
+ * On gen6+ everything below this offset lives in the GT power well and needs
+ * forcewake to be accessed, the display and PCH registers above it do not.
+ */
+#define FORCEWAKE_GT_END 0x40000
+
+struct intel_register_set {
+	unsigned int num_regs;
+	unsigned int count;		/* readable registers, in read order */
+	struct {
+		uint32_t offset;
+		uint32_t index;		/* slot in the caller's array */
+	} entries[];			/* blocked registers fill up the end */
+};
+
+/**
+ * intel_register_set_create:
+ * @regs: register offsets
+ * @n: number of entries in @regs
+ *
+ * Precompiles a set of registers which are always read together, e.g. once
+ * per sample, for intel_register_set_read(). When the register access helper
+ * is initialized in safe mode the offsets are checked against the white list
+ * here, once, instead of on every read. Blocked registers are reported and
+ * read back as 0xffffffff, like with intel_register_read(). Without
+ * intel_register_access_init() reads are unchecked like INREG(), so sets can
+ * also be used on dump files.
+ *
+ * The registers are grouped by forcewake domain, keeping their relative order
+ * within each domain.
+ *
+ * Returns:
+ * The new register set, to be freed with intel_register_set_destroy().
+ */
+struct intel_register_set *
+intel_register_set_create(const uint32_t *regs, unsigned int n)
+{
+	struct intel_register_set *set;
+	bool check = mmio_data.inited && mmio_data.safe;
+	int domains = mmio_data.inited && mmio_data.gen >= 6 ? 2 : 1;
+	unsigned int i, blocked = n;
+	int domain;
+
+	set = malloc(sizeof(*set) + n * sizeof(set->entries[0]));
+	igt_fail_on_f(set == NULL,
+		      "Couldn't allocate a set of %u registers\n", n);
+	set->num_regs = n;
+	set->count = 0;
+
+	for (domain = 0; domain < domains; domain++) {
+		for (i = 0; i < n; i++) {
+			if (domains > 1 &&
+			    (regs[i] < FORCEWAKE_GT_END) != (domain == 0))
+				continue;
+
+			if (check &&
+			    !intel_get_register_range(mmio_data.map, regs[i],
+						      INTEL_RANGE_READ)) {
+				igt_warn("Register read blocked for safety ""(*0x%08x)\n", regs[i]);
+				set->entries[--blocked].index = i;
+				continue;
+			}
+
+			set->entries[set->count].offset = regs[i];
+			set->entries[set->count].index = i;
+			set->count++;
+		}
+	}
+
+	return set;
+}
+
+/**
+ * intel_register_set_read:
+ * @set: register set from intel_register_set_create()
+ * @vals: array receiving the values, in the order the registers were given
+ *
+ * Reads all registers of @set in one pass.
+ */
+void
+intel_register_set_read(const struct intel_register_set *set, uint32_t *vals)
+{
+	volatile char *base = mmio;
+	unsigned int i;
+
+	if (mmio_data.inited && mmio_data.gen >= 6)
+		igt_assert(mmio_data.key != -1);
+
+	for (i = 0; i < set->count; i++)
+		vals[set->entries[i].index] =
+			*(volatile uint32_t *)(base + set->entries[i].offset);
+
+	for (; i < set->num_regs; i++)
+		vals[set->entries[i].index] = 0xffffffff;
+}
+
+/**
+ * intel_register_set_destroy:
+ * @set: register set from intel_register_set_create()
+ *
+ * Frees @set.
+ */
+void
+intel_register_set_destroy(struct intel_register_set *set)
+{
+	free(set);
+}
+
+/**
+ * intel_register_read_batch:
+ * @regs: register offsets
+ * @vals: array receiving the values
+ * @n: number of registers
+ *
+ * Reads @n registers in one go, with the same checking as
+ * intel_register_set_read(). Registers that are read repeatedly should use a
+ * set from intel_register_set_create() instead, which validates them only
+ * once.
+ */
+void
+intel_register_read_batch(const uint32_t *regs, uint32_t *vals, unsigned int n)
+{
+	struct intel_register_set *set;
+
+	set = intel_register_set_create(regs, n);
+	intel_register_set_read(set, vals);
+	intel_register_set_destroy(set);
+}
+
 
 /**
  * INREG:
@@ -0,0 +1,408 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intel_reg_db.h"
+
+/**
+ * SECTION:intel_reg_db
+ * @short_description: Register name and offset database
+ * @title: intel reg db
+ * @include: intel_reg_db.h
+ *
+ * Lookup of register descriptions by name or offset. The builtin database,
+ * #intel_reg_db_builtin, is compiled from the quick_dump register lists at
+ * build time by intel_reg_db_gen.py. Tools with their own tables of
+ * registers, e.g. with decoder functions attached, can index those with
+ * intel_reg_db_create().
+ *
+ * Names are found through a perfect hash of the distinct names, offsets by a
+ * binary search, so both lookups take close to constant time regardless of
+ * the size of the database.
+ */
+
+#define MAX_SEED (1 << 24)
+
+/* Must match reg_hash() in intel_reg_db_gen.py */
+static uint32_t reg_hash(uint32_t seed, const char *name)
+{
+	uint32_t h = 2166136261u ^ seed;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static int port_offset_cmp(enum intel_reg_port port, uint32_t offset,
+			   const struct intel_reg_desc *reg)
+{
+	if (port != reg->port)
+		return port < reg->port ? -1 : 1;
+	if (offset != reg->offset)
+		return offset < reg->offset ? -1 : 1;
+	return 0;
+}
+
+/* ties are broken by position so equal keys keep the caller's order */
+static int by_name_cmp(const void *a, const void *b)
+{
+	const struct intel_reg_desc *ra = *(const struct intel_reg_desc **)a;
+	const struct intel_reg_desc *rb = *(const struct intel_reg_desc **)b;
+	int ret = strcmp(ra->name, rb->name);
+
+	if (ret == 0)
+		ret = ra < rb ? -1 : ra > rb;
+
+	return ret;
+}
+
+static int by_offset_cmp(const void *a, const void *b)
+{
+	const struct intel_reg_desc *ra = *(const struct intel_reg_desc **)a;
+	const struct intel_reg_desc *rb = *(const struct intel_reg_desc **)b;
+	int ret = port_offset_cmp(ra->port, ra->offset, rb);
+
+	if (ret == 0)
+		ret = ra < rb ? -1 : ra > rb;
+
+	return ret;
+}
+
+/*
+ * Hash and displace: the names are first distributed into buckets, then,
+ * biggest bucket first, each bucket gets the smallest seed which maps all of
+ * its names onto free slots.
+ */
+static bool build_hash(const char **names, unsigned int num_names,
+		       uint32_t *seeds, unsigned int num_buckets,
+		       uint32_t *slots, unsigned int num_slots)
+{
+	unsigned int *start, *members, *order, *placed;
+	bool *used;
+	unsigned int i, j, b;
+	bool ret = false;
+
+	start = calloc(num_buckets + 1, sizeof(*start));
+	members = malloc(num_names * sizeof(*members));
+	order = malloc(num_buckets * sizeof(*order));
+	placed = malloc(num_names * sizeof(*placed));
+	used = calloc(num_slots, sizeof(*used));
+	if (!start || !members || !order || !placed || !used)
+		goto out;
+
+	for (i = 0; i < num_names; i++)
+		start[reg_hash(0, names[i]) % num_buckets + 1]++;
+	for (b = 0; b < num_buckets; b++)
+		start[b + 1] += start[b];
+	for (i = 0; i < num_names; i++) {
+		b = reg_hash(0, names[i]) % num_buckets;
+		members[start[b]++] = i;
+	}
+	for (b = num_buckets; b > 0; b--)
+		start[b] = start[b - 1];
+	start[0] = 0;
+
+	/* order the buckets by size, largest first */
+	for (b = 0; b < num_buckets; b++) {
+		unsigned int size = start[b + 1] - start[b];
+
+		for (j = b; j > 0; j--) {
+			unsigned int other = order[j - 1];
+
+			if (start[other + 1] - start[other] >= size)
+				break;
+			order[j] = other;
+		}
+		order[j] = b;
+	}
+
+	for (i = 0; i < num_buckets; i++) {
+		unsigned int size, seed;
+
+		b = order[i];
+		size = start[b + 1] - start[b];
+		if (size == 0)
+			break;
+
+		for (seed = 1; seed < MAX_SEED; seed++) {
+			for (j = 0; j < size; j++) {
+				unsigned int k;
+
+				placed[j] = reg_hash(seed, names[members[start[b] + j]]) % num_slots;
+				if (used[placed[j]])
+					break;
+				for (k = 0; k < j; k++)
+					if (placed[k] == placed[j])
+						break;
+				if (k < j)
+					break;
+			}
+			if (j == size)
+				break;
+		}
+		if (seed == MAX_SEED)
+			goto out;
+
+		seeds[b] = seed;
+		for (j = 0; j < size; j++) {
+			used[placed[j]] = true;
+			slots[placed[j]] = members[start[b] + j];
+		}
+	}
+
+	ret = true;
+out:
+	free(start);
+	free(members);
+	free(order);
+	free(placed);
+	free(used);
+	return ret;
+}
+
+/**
+ * intel_reg_db_create:
+ * @regs: register descriptions
+ * @count: number of entries in @regs
+ *
+ * Builds a database indexing @regs by name and offset. @regs is referenced,
+ * not copied, and needs to outlive the database. Registers may appear more
+ * than once, e.g. with different decoders for different platforms.
+ *
+ * Returns:
+ * The new database, or NULL when out of memory.
+ */
+struct intel_reg_db *intel_reg_db_create(const struct intel_reg_desc *regs,
+					 unsigned int count)
+{
+	struct intel_reg_db *db;
+	const struct intel_reg_desc **by_name, **by_offset;
+	const char **names = NULL;
+	uint32_t *seeds = NULL, *slots = NULL, *first = NULL;
+	unsigned int i, num_names = 0;
+
+	db = calloc(1, sizeof(*db));
+	by_name = malloc((count + 1) * sizeof(*by_name));
+	by_offset = malloc((count + 1) * sizeof(*by_offset));
+	if (!db || !by_name || !by_offset)
+		goto err;
+
+	for (i = 0; i < count; i++)
+		by_name[i] = by_offset[i] = &regs[i];
+	qsort(by_name, count, sizeof(*by_name), by_name_cmp);
+	qsort(by_offset, count, sizeof(*by_offset), by_offset_cmp);
+
+	names = malloc((count + 1) * sizeof(*names));
+	first = malloc((count + 1) * sizeof(*first));
+	if (!names || !first)
+		goto err;
+
+	for (i = 0; i < count; i++) {
+		if (num_names && strcmp(names[num_names - 1], by_name[i]->name) == 0)
+			continue;
+		names[num_names] = by_name[i]->name;
+		first[num_names] = i;
+		num_names++;
+	}
+
+	/*
+	 * Unlike the builtin table, this is built on every run. A quarter of
+	 * spare slots makes finding the seeds about four times quicker than a
+	 * minimal table. Spare slots point at by_name[0], which only matches
+	 * its own name, and that hashes elsewhere.
+	 */
+	db->num_buckets = num_names / 4 + 1;
+	db->num_slots = num_names + num_names / 4;
+	seeds = calloc(db->num_buckets, sizeof(*seeds));
+	slots = calloc(db->num_slots + 1, sizeof(*slots));
+	if (!seeds || !slots ||
+	    !build_hash(names, num_names, seeds, db->num_buckets, slots,
+			db->num_slots))
+		goto err;
+
+	/* slots were filled with name indices, point them into by_name */
+	for (i = 0; i < db->num_slots; i++)
+		slots[i] = first[slots[i]];
+
+	free(names);
+	free(first);
+
+	db->by_name = by_name;
+	db->by_offset = by_offset;
+	db->count = count;
+	db->seeds = seeds;
+	db->slots = slots;
+
+	return db;
+
+err:
+	free(names);
+	free(first);
+	free(seeds);
+	free(slots);
+	free(by_name);
+	free(by_offset);
+	free(db);
+	return NULL;
+}
+
+/**
+ * intel_reg_db_destroy:
+ * @db: database from intel_reg_db_create()
+ *
+ * Frees @db. The register descriptions it indexes are left alone.
+ */
+void intel_reg_db_destroy(struct intel_reg_db *db)
+{
+	if (db == NULL)
+		return;
+
+	free((void *)db->by_name);
+	free((void *)db->by_offset);
+	free((void *)db->seeds);
+	free((void *)db->slots);
+	free(db);
+}
+
+/**
+ * intel_reg_db_find_name:
+ * @db: register database
+ * @name: register name, matched exactly
+ * @matches: set to the registers called @name
+ *
+ * Looks up all registers called @name, in the order they were given to the
+ * database.
+ *
+ * Returns:
+ * The number of entries in @matches.
+ */
+unsigned int intel_reg_db_find_name(const struct intel_reg_db *db,
+				    const char *name,
+				    const struct intel_reg_desc *const **matches)
+{
+	uint32_t seed, pos;
+	unsigned int n;
+
+	if (db->num_slots == 0)
+		return 0;
+
+	seed = db->seeds[reg_hash(0, name) % db->num_buckets];
+	pos = db->slots[reg_hash(seed, name) % db->num_slots];
+
+	for (n = 0; pos + n < db->count; n++)
+		if (strcmp(db->by_name[pos + n]->name, name))
+			break;
+
+	*matches = &db->by_name[pos];
+	return n;
+}
+
+/**
+ * intel_reg_db_find_offset:
+ * @db: register database
+ * @port: register port, #INTEL_REG_PORT_MMIO for plain mmio registers
+ * @offset: register offset
+ * @matches: set to the registers at @offset
+ *
+ * Looks up all registers at @offset in @port, in the order they were given to
+ * the database.
+ *
+ * Returns:
+ * The number of entries in @matches.
+ */
+unsigned int intel_reg_db_find_offset(const struct intel_reg_db *db,
+				      enum intel_reg_port port, uint32_t offset,
+				      const struct intel_reg_desc *const **matches)
+{
+	unsigned int lo = 0, hi = db->count, n;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (port_offset_cmp(port, offset, db->by_offset[mid]) > 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (n = 0; lo + n < db->count; n++)
+		if (port_offset_cmp(port, offset, db->by_offset[lo + n]))
+			break;
+
+	*matches = &db->by_offset[lo];
+	return n;
+}
+
+/**
+ * intel_reg_db_find_group:
+ * @db: register database
+ * @name: group name, e.g. "base_display"
+ *
+ * Returns:
+ * The group called @name, or NULL.
+ */
+const struct intel_reg_group *
+intel_reg_db_find_group(const struct intel_reg_db *db, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < db->num_groups; i++)
+		if (strcmp(db->groups[i].name, name) == 0)
+			return &db->groups[i];
+
+	return NULL;
+}
+
+/**
+ * intel_reg_db_find_profile:
+ * @db: register database
+ * @name: profile name, e.g. "haswell"
+ *
+ * Returns:
+ * The profile called @name, listing the groups to dump on that platform, or
+ * NULL.
+ */
+const struct intel_reg_profile *
+intel_reg_db_find_profile(const struct intel_reg_db *db, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < db->num_profiles; i++)
+		if (strcmp(db->profiles[i].name, name) == 0)
+			return &db->profiles[i];
+
+	return NULL;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef INTEL_REG_DB_H
+#define INTEL_REG_DB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum intel_reg_port {
+	INTEL_REG_PORT_MMIO,
+	INTEL_REG_PORT_DPIO,
+	INTEL_REG_PORT_DPIO2,
+	INTEL_REG_PORT_FLISDSI,
+};
+
+typedef void (*intel_reg_decode_func)(char *result, int len, int reg,
+				      uint32_t val);
+
+#ifndef __GTK_DOC_IGNORE__
+struct intel_reg_desc {
+	const char *name;
+	uint32_t offset;
+	enum intel_reg_port port;
+	const char *group;
+	intel_reg_decode_func decode;	/* may be NULL */
+};
+
+struct intel_reg_group {
+	const char *name;
+	const struct intel_reg_desc *regs;
+	unsigned int count;
+};
+
+struct intel_reg_profile {
+	const char *name;
+	const struct intel_reg_group *const *groups;
+	unsigned int num_groups;
+};
+
+struct intel_reg_db {
+	const struct intel_reg_desc *const *by_name;	/* sorted by name */
+	const struct intel_reg_desc *const *by_offset;	/* by port, offset */
+	unsigned int count;
+
+	/* perfect hash of the distinct names into by_name */
+	const uint32_t *seeds;
+	unsigned int num_buckets;
+	const uint32_t *slots;
+	unsigned int num_slots;
+
+	const struct intel_reg_group *groups;
+	unsigned int num_groups;
+	const struct intel_reg_profile *profiles;
+	unsigned int num_profiles;
+};
+#endif
+
+extern const struct intel_reg_db intel_reg_db_builtin;
+
+struct intel_reg_db *intel_reg_db_create(const struct intel_reg_desc *regs,
+					 unsigned int count);
+void intel_reg_db_destroy(struct intel_reg_db *db);
+
+unsigned int intel_reg_db_find_name(const struct intel_reg_db *db,
+				    const char *name,
+				    const struct intel_reg_desc *const **matches);
+unsigned int intel_reg_db_find_offset(const struct intel_reg_db *db,
+				      enum intel_reg_port port, uint32_t offset,
+				      const struct intel_reg_desc *const **matches);
+const struct intel_reg_group *
+intel_reg_db_find_group(const struct intel_reg_db *db, const char *name);
+const struct intel_reg_profile *
+intel_reg_db_find_profile(const struct intel_reg_db *db, const char *name);
+
+#endif /* INTEL_REG_DB_H */
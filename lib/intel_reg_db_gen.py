@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+#
+# Copyright © 2014 Intel Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+# Compiles the quick_dump register lists into the builtin register database
+# of intel_reg_db.c.
+#
+# usage: intel_reg_db_gen.py <quick_dump directory> <output.c>
+#
+# Every *.txt file becomes a register group named after the file, every
+# extensionless file listing groups (haswell, valleyview, ...) a profile. The
+# name index is a perfect hash built with the same hash-and-displace scheme
+# and hash function as intel_reg_db_create(), so both are looked up by the
+# same code.
+#
+# vim: tabstop=8 expandtab shiftwidth=4 softtabstop=4
+
+import ast
+import os
+import sys
+
+PORTS = {
+    '': 'INTEL_REG_PORT_MMIO',
+    'DPIO': 'INTEL_REG_PORT_DPIO',
+    'DPIO2': 'INTEL_REG_PORT_DPIO2',
+    'FLISDSI': 'INTEL_REG_PORT_FLISDSI',
+}
+PORT_ORDER = list(PORTS.values())
+
+MAX_SEED = 1 << 24
+
+def ignore_line(line):
+    line = line.strip()
+    return not line or line.startswith(('#', ';', '//'))
+
+def parse_group(path):
+    regs = []
+    with open(path) as f:
+        for line in f:
+            if ignore_line(line):
+                continue
+            name, offset, kind = ast.literal_eval(line.strip())
+            if isinstance(offset, str):
+                offset = int(offset, 16)
+            if kind in PORTS:
+                port = PORTS[kind]
+            else:
+                # anything else is a base added to the offset
+                offset += int(kind, 16)
+                port = PORTS['']
+            regs.append((name, offset, port))
+    return regs
+
+def parse_profile(path):
+    with open(path) as f:
+        return [os.path.splitext(l.strip())[0] for l in f if l.strip()]
+
+def reg_hash(seed, name):
+    # FNV-1a seeded through the offset basis, finished with the murmur3
+    # mixer. Must match reg_hash() in intel_reg_db.c.
+    h = (2166136261 ^ seed) & 0xffffffff
+    for c in name.encode():
+        h ^= c
+        h = (h * 16777619) & 0xffffffff
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & 0xffffffff
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & 0xffffffff
+    h ^= h >> 16
+    return h
+
+def build_hash(names):
+    num_slots = len(names)
+    num_buckets = num_slots // 4 + 1
+    buckets = [[] for i in range(num_buckets)]
+    for i, name in enumerate(names):
+        buckets[reg_hash(0, name) % num_buckets].append(i)
+
+    seeds = [0] * num_buckets
+    slots = [None] * num_slots
+    for b in sorted(range(num_buckets), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            break
+        for seed in range(1, MAX_SEED):
+            placed = [reg_hash(seed, names[i]) % num_slots for i in buckets[b]]
+            if len(set(placed)) == len(placed) and \
+               all(slots[s] is None for s in placed):
+                break
+        else:
+            sys.exit('failed to build a perfect hash of register names')
+        seeds[b] = seed
+        for i, s in zip(buckets[b], placed):
+            slots[s] = i
+
+    return seeds, slots
+
+def c_array(f, decl, values, per_line=8):
+    f.write('%s = {\n' % decl)
+    for i in range(0, len(values), per_line):
+        f.write('\t' + ' '.join('%s,' % v for v in values[i:i + per_line]) + '\n')
+    f.write('};\n\n')
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: %s <quick_dump directory> <output.c>' % sys.argv[0])
+    srcdir, output = sys.argv[1:]
+
+    files = sorted(os.listdir(srcdir))
+    groups = [os.path.splitext(f)[0] for f in files if f.endswith('.txt')]
+    profiles = [f for f in files
+                if '.' not in f and os.path.isfile(os.path.join(srcdir, f))]
+
+    regs = []
+    group_ranges = []
+    for g in groups:
+        group_regs = parse_group(os.path.join(srcdir, g + '.txt'))
+        group_ranges.append((len(regs), len(group_regs)))
+        regs += [(name, offset, port, g) for name, offset, port in group_regs]
+
+    profile_groups = {}
+    for p in profiles:
+        profile_groups[p] = parse_profile(os.path.join(srcdir, p))
+        for g in profile_groups[p]:
+            if g not in groups:
+                sys.exit('profile %s lists unknown group %s' % (p, g))
+
+    by_name = sorted(range(len(regs)), key=lambda i: (regs[i][0].encode(), i))
+    by_offset = sorted(range(len(regs)),
+                       key=lambda i: (PORT_ORDER.index(regs[i][2]), regs[i][1], i))
+
+    # hash the distinct names, each slot points at the first of the run of
+    # identically named registers in by_name
+    names = []
+    first = []
+    for pos, i in enumerate(by_name):
+        if not names or names[-1] != regs[i][0]:
+            names.append(regs[i][0])
+            first.append(pos)
+    seeds, slots = build_hash(names)
+
+    with open(output, 'w') as f:
+        f.write('/* Generated by intel_reg_db_gen.py from tools/quick_dump, '
+                'do not edit. */\n\n')
+        f.write('#include "intel_reg_db.h"\n\n')
+
+        f.write('static const struct intel_reg_desc regs[] = {\n')
+        for name, offset, port, g in regs:
+            f.write('\t{ "%s", 0x%08x, %s, "%s", NULL },\n' %
+                    (name, offset, port, g))
+        f.write('};\n\n')
+
+        c_array(f, 'static const struct intel_reg_desc *const by_name[]',
+                ['&regs[%d]' % i for i in by_name], 6)
+        c_array(f, 'static const struct intel_reg_desc *const by_offset[]',
+                ['&regs[%d]' % i for i in by_offset], 6)
+        c_array(f, 'static const uint32_t seeds[]', ['%d' % s for s in seeds])
+        c_array(f, 'static const uint32_t slots[]',
+                ['%d' % first[s] for s in slots])
+
+        f.write('static const struct intel_reg_group groups[] = {\n')
+        for g, (start, count) in zip(groups, group_ranges):
+            f.write('\t{ "%s", &regs[%d], %d },\n' % (g, start, count))
+        f.write('};\n\n')
+
+        for p in profiles:
+            c_array(f, 'static const struct intel_reg_group *const %s_groups[]' % p,
+                    ['&groups[%d]' % groups.index(g) for g in profile_groups[p]], 4)
+
+        f.write('static const struct intel_reg_profile profiles[] = {\n')
+        for p in profiles:
+            f.write('\t{ "%s", %s_groups, %d },\n' %
+                    (p, p, len(profile_groups[p])))
+        f.write('};\n\n')
+
+        f.write('const struct intel_reg_db intel_reg_db_builtin = {\n'
+                '\t.by_name = by_name,\n'
+                '\t.by_offset = by_offset,\n'
+                '\t.count = %d,\n'
+                '\t.seeds = seeds,\n'
+                '\t.num_buckets = %d,\n'
+                '\t.slots = slots,\n'
+                '\t.num_slots = %d,\n'
+                '\t.groups = groups,\n'
+                '\t.num_groups = %d,\n'
+                '\t.profiles = profiles,\n'
+                '\t.num_profiles = %d,\n'
+                '};\n' % (len(regs), len(seeds), len(slots),
+                          len(groups), len(profiles)))
+
+if __name__ == '__main__':
+    main()
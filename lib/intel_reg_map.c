@@ -127,6 +127,74 @@ static struct intel_register_range gen6_gt_register_map[] = {
 	{0x00000000, 0x00000000, INTEL_RANGE_END}
 };
 
+/*
+ * intel_register_read()/write() check every access in safe mode, so rather
+ * than walking the range list each time we precompute a table with one entry
+ * per 64 bytes of register space (all ranges are at least 128 byte aligned).
+ * Each entry holds the index of the range covering that chunk and the access
+ * it permits. Chunks which are only partially covered, or covered by more
+ * than one range, are flagged to fall back to the list walk.
+ */
+#define ACCESS_CHUNK_SHIFT	6
+#define ACCESS_INDEX_MASK	0xff
+#define ACCESS_MODE_SHIFT	8
+#define ACCESS_VALID		(1 << 10)
+#define ACCESS_SLOW		(1 << 11)
+
+static const uint16_t *
+build_access_table(struct intel_register_range *map, uint32_t top)
+{
+	static struct {
+		struct intel_register_range *map;
+		uint16_t *table;
+	} cache[3];
+	struct intel_register_range *range;
+	uint32_t chunk_size = 1 << ACCESS_CHUNK_SHIFT;
+	uint16_t *table;
+	unsigned int i, num_cache = sizeof(cache) / sizeof(cache[0]);
+
+	for (i = 0; i < num_cache && cache[i].map; i++)
+		if (cache[i].map == map)
+			return cache[i].table;
+
+	if (i == num_cache)
+		return NULL;
+
+	table = calloc(top >> ACCESS_CHUNK_SHIFT, sizeof(*table));
+	if (table == NULL)
+		return NULL;
+
+	for (range = map; !(range->flags & INTEL_RANGE_END); range++) {
+		uint32_t start, end, chunk;
+
+		if (range - map > ACCESS_INDEX_MASK) {
+			free(table);
+			return NULL;
+		}
+
+		start = range->base >> ACCESS_CHUNK_SHIFT;
+		end = (range->base + range->size) >> ACCESS_CHUNK_SHIFT;
+		for (chunk = start; chunk <= end && chunk < top >> ACCESS_CHUNK_SHIFT; chunk++) {
+			uint32_t base = chunk << ACCESS_CHUNK_SHIFT;
+
+			if (table[chunk] & ACCESS_VALID ||
+			    base < range->base ||
+			    base + chunk_size - 1 > range->base + range->size) {
+				table[chunk] |= ACCESS_SLOW;
+				continue;
+			}
+
+			table[chunk] = (range - map) | ACCESS_VALID |
+				(range->flags & INTEL_RANGE_RW) << ACCESS_MODE_SHIFT;
+		}
+	}
+
+	cache[i].map = map;
+	cache[i].table = table;
+
+	return table;
+}
+
 struct intel_register_map
 intel_get_register_map(uint32_t devid)
 {
@@ -147,6 +215,7 @@ intel_get_register_map(uint32_t devid)
 	}
 
 	map.alignment_mask = 0x3;
+	map.access = build_access_table(map.map, map.top);
 
 	return map;
 }
@@ -163,6 +232,18 @@ intel_get_register_range(struct intel_register_map map, uint32_t offset, uint32_
 	if (offset >= map.top)
 		return NULL;
 
+	if (map.access) {
+		uint16_t entry = map.access[offset >> ACCESS_CHUNK_SHIFT];
+
+		if (!(entry & ACCESS_SLOW)) {
+			if (!(entry & ACCESS_VALID) ||
+			    ((entry >> ACCESS_MODE_SHIFT) & mode) != mode)
+				return NULL;
+
+			return &map.map[entry & ACCESS_INDEX_MASK];
+		}
+	}
+
 	while (!(range->flags & INTEL_RANGE_END)) {
 		/*  list is assumed to be in order */
 		if (offset < range->base)
@@ -25,10 +25,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
 #include <cairo.h>
 
-#include <stdio.h>
-
 #include "chart.h"
 
 int chart_init(struct chart *chart, const char *name, int num_samples)
@@ -36,8 +35,14 @@ int chart_init(struct chart *chart, const char *name, int num_samples)
 	memset(chart, 0, sizeof(*chart));
 	chart->name = name;
 	chart->samples = malloc(sizeof(*chart->samples)*num_samples);
-	if (chart->samples == NULL)
+	chart->min.sample = malloc(sizeof(int)*num_samples);
+	chart->max.sample = malloc(sizeof(int)*num_samples);
+	if (chart->samples == NULL ||
+	    chart->min.sample == NULL ||
+	    chart->max.sample == NULL) {
+		chart_fini(chart);
 		return ENOMEM;
+	}
 
 	chart->num_samples = num_samples;
 	chart->range_automatic = 1;
@@ -49,16 +54,19 @@ int chart_init(struct chart *chart, const char *name, int num_samples)
 void chart_set_mode(struct chart *chart, enum chart_mode mode)
 {
 	chart->mode = mode;
+	chart->cache_valid = 0;
 }
 
 void chart_set_smooth(struct chart *chart, enum chart_smooth smooth)
 {
 	chart->smooth = smooth;
+	chart->cache_valid = 0;
 }
 
 void chart_set_stroke_width(struct chart *chart, float width)
 {
 	chart->stroke_width = width;
+	chart->cache_valid = 0;
 }
 
 void chart_set_stroke_rgba(struct chart *chart, float red, float green, float blue, float alpha)
@@ -67,6 +75,7 @@ void chart_set_stroke_rgba(struct chart *chart, float red, float green, float bl
 	chart->stroke_rgb[1] = green;
 	chart->stroke_rgb[2] = blue;
 	chart->stroke_rgb[3] = alpha;
+	chart->cache_valid = 0;
 }
 
 void chart_set_fill_rgba(struct chart *chart, float red, float green, float blue, float alpha)
@@ -75,6 +84,7 @@ void chart_set_fill_rgba(struct chart *chart, float red, float green, float blue
 	chart->fill_rgb[1] = green;
 	chart->fill_rgb[2] = blue;
 	chart->fill_rgb[3] = alpha;
+	chart->cache_valid = 0;
 }
 
 void chart_set_position(struct chart *chart, int x, int y)
@@ -87,6 +97,7 @@ void chart_set_size(struct chart *chart, int w, int h)
 {
 	chart->w = w;
 	chart->h = h;
+	chart->cache_valid = 0;
 }
 
 void chart_set_range(struct chart *chart, double min, double max)
@@ -96,17 +107,48 @@ void chart_set_range(struct chart *chart, double min, double max)
 	chart->range_automatic = 0;
 }
 
+static double window_value(struct chart *chart, struct chart_window *w)
+{
+	return chart->samples[w->sample[w->head] % chart->num_samples];
+}
+
 void chart_get_range(struct chart *chart, double *range)
 {
-	int n, max = chart->current_sample;
-	if (max > chart->num_samples)
-		max = chart->num_samples;
-	for (n = 0; n < max; n++) {
-		if (chart->samples[n] < range[0])
-			range[0] = chart->samples[n];
-		else if (chart->samples[n] > range[1])
-			range[1] = chart->samples[n];
+	if (chart->current_sample == 0)
+		return;
+
+	if (window_value(chart, &chart->min) < range[0])
+		range[0] = window_value(chart, &chart->min);
+	if (window_value(chart, &chart->max) > range[1])
+		range[1] = window_value(chart, &chart->max);
+}
+
+/*
+ * Keeps the window's deque ordered by value, dropping the samples that can
+ * no longer be the extreme (older and not beyond the new one) from the back
+ * and those that have scrolled out of the chart from the front. Each sample
+ * enters and leaves once, so this is O(1) amortized.
+ */
+static void window_add(struct chart *chart, struct chart_window *w,
+		       int sample, int sign)
+{
+	const int num_samples = chart->num_samples;
+	double value = chart->samples[sample % num_samples];
+
+	if (w->count && w->sample[w->head] <= sample - num_samples) {
+		w->head = (w->head + 1) % num_samples;
+		w->count--;
+	}
+
+	while (w->count) {
+		int tail = (w->head + w->count - 1) % num_samples;
+		double v = chart->samples[w->sample[tail] % num_samples];
+		if (sign * (value - v) > 0)
+			break;
+		w->count--;
 	}
+
+	w->sample[(w->head + w->count++) % num_samples] = sample;
 }
 
 void chart_add_sample(struct chart *chart, double value)
@@ -116,28 +158,17 @@ void chart_add_sample(struct chart *chart, double value)
 	if (chart->num_samples == 0)
 		return;
 
-	pos = chart->current_sample++ % chart->num_samples;
+	pos = chart->current_sample % chart->num_samples;
 	chart->samples[pos] = value;
-}
-
-static void chart_update_range(struct chart *chart)
-{
-	int n, max = chart->current_sample;
-	if (max > chart->num_samples)
-		max = chart->num_samples;
-	chart->range[0] = chart->range[1] = chart->samples[0];
-	for (n = 1; n < max; n++) {
-		if (chart->samples[n] < chart->range[0])
-			chart->range[0] = chart->samples[n];
-		else if (chart->samples[n] > chart->range[1])
-			chart->range[1] = chart->samples[n];
-	}
-	if (strcmp(chart->name, "power") == 0)
-	printf ("chart_update_range [%f, %f]\n", chart->range[0], chart->range[1]);
+	window_add(chart, &chart->min, chart->current_sample, 1);
+	window_add(chart, &chart->max, chart->current_sample, -1);
+	chart->current_sample++;
 }
 
 static double value_at(struct chart *chart, int n)
 {
+	if (n < 0)
+		n = 0;
 	if (n < chart->current_sample - chart->num_samples)
 		n = chart->current_sample;
 	else if (n >= chart->current_sample)
@@ -156,81 +187,221 @@ static double gradient_at(struct chart *chart, int n)
 	return (y1 - y0) / 2.;
 }
 
+/*
+ * Samples are placed on whole pixels relative to cache_base, so that the
+ * cache can be scrolled by whole pixels and the edges of neighbouring
+ * segments meet exactly, leaving no antialiasing seams between them.
+ */
+static double sample_x(struct chart *chart, int n)
+{
+	return floor((n - chart->cache_base) * chart->w / (double)(chart->num_samples-1) + .5);
+}
+
+static double value_y(struct chart *chart, double value)
+{
+	return chart->h - (value - chart->range[0]) * chart->h / (chart->range[1] - chart->range[0]);
+}
+
+/* Adds the segment between samples n-1 and n, closed down to 0 for fills */
+static void segment_path(struct chart *chart, cairo_t *cr, int n,
+			 double x, double y, int fill)
+{
+	double x0 = x + sample_x(chart, n-1);
+	double x1 = x + sample_x(chart, n);
+
+	cairo_move_to(cr, x0, y + value_y(chart, value_at(chart, n-1)));
+	switch (chart->smooth) {
+	case CHART_LINE:
+		break;
+	case CHART_CURVE:
+		cairo_curve_to(cr,
+			       x0 + (x1-x0)/3., y + value_y(chart, value_at(chart, n-1) + gradient_at(chart, n-1)/3.),
+			       x0 + 2*(x1-x0)/3., y + value_y(chart, value_at(chart, n) - gradient_at(chart, n)/3.),
+			       x1, y + value_y(chart, value_at(chart, n)));
+		break;
+	}
+	cairo_line_to(cr, x1, y + value_y(chart, value_at(chart, n)));
+	if (fill) {
+		cairo_line_to(cr, x1, y + value_y(chart, 0));
+		cairo_line_to(cr, x0, y + value_y(chart, 0));
+		cairo_close_path(cr);
+	}
+}
+
+/*
+ * Renders segments [start, end), layer 0 being the fill and layer 1 the
+ * stroke. Each stroke is capped separately, which is only invisible for
+ * opaque lines, as all of ours are.
+ */
+static void draw_segments(struct chart *chart, cairo_t *cr, int layer,
+			  int start, int end, double x, double y)
+{
+	int n;
+
+	cairo_new_path(cr);
+	for (n = start; n < end; n++)
+		segment_path(chart, cr, n, x, y, layer == 0);
+
+	if (layer == 0) {
+		if (chart->mode == CHART_FILL_STROKE)
+			cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+		cairo_set_source_rgba(cr, chart->fill_rgb[0], chart->fill_rgb[1], chart->fill_rgb[2], chart->fill_rgb[3]);
+		cairo_fill(cr);
+		cairo_set_antialias(cr, CAIRO_ANTIALIAS_DEFAULT);
+	} else {
+		cairo_set_line_width(cr, chart->stroke_width);
+		cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+		cairo_set_source_rgba(cr, chart->stroke_rgb[0], chart->stroke_rgb[1], chart->stroke_rgb[2], chart->stroke_rgb[3]);
+		cairo_stroke(cr);
+	}
+}
+
+static int has_layer(struct chart *chart, int layer)
+{
+	return layer == 0 ? chart->mode != CHART_STROKE : chart->mode != CHART_FILL;
+}
+
+static void cache_fini(struct chart *chart)
+{
+	int layer;
+
+	for (layer = 0; layer < 2; layer++) {
+		if (chart->cache[layer])
+			cairo_surface_destroy(chart->cache[layer]);
+		chart->cache[layer] = NULL;
+	}
+	chart->cache_valid = 0;
+}
+
+/* Starts the cache over with the chart's oldest sample at its left edge */
+static int cache_reset(struct chart *chart, cairo_t *cr)
+{
+	int layer, height;
+
+	chart->cache_pad = ceil(chart->stroke_width) + 1;
+	height = chart->h + 2*chart->cache_pad;
+
+	if (!chart->cache_valid) {
+		cache_fini(chart);
+		chart->cache_width = 2*chart->w + 2*chart->cache_pad;
+		for (layer = 0; layer < 2; layer++) {
+			if (!has_layer(chart, layer))
+				continue;
+
+			chart->cache[layer] =
+				cairo_surface_create_similar(cairo_get_target(cr),
+							     CAIRO_CONTENT_COLOR_ALPHA,
+							     chart->cache_width,
+							     height);
+			if (cairo_surface_status(chart->cache[layer])) {
+				cache_fini(chart);
+				return 0;
+			}
+		}
+	}
+
+	for (layer = 0; layer < 2; layer++) {
+		cairo_t *c;
+
+		if (chart->cache[layer] == NULL)
+			continue;
+
+		c = cairo_create(chart->cache[layer]);
+		cairo_set_operator(c, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(c);
+		cairo_destroy(c);
+	}
+
+	chart->cache_base = chart->current_sample - chart->num_samples;
+	if (chart->cache_base < 0)
+		chart->cache_base = 0;
+	chart->cache_end = chart->cache_base + 1;
+	chart->cache_range[0] = chart->range[0];
+	chart->cache_range[1] = chart->range[1];
+	chart->cache_valid = 1;
+	return 1;
+}
+
+/*
+ * The chart is kept rendered in a cache twice its width; every frame only
+ * the segments for the new samples are added to it, and it is painted at an
+ * offset that scrolls the old ones out to the left. With curves, the newest
+ * segment still depends on the next sample and so is drawn directly until
+ * that arrives. Only a change of range, or running off the end of the
+ * cache, requires everything to be redrawn.
+ */
 void chart_draw(struct chart *chart, cairo_t *cr)
 {
-	int i, n, max, x;
+	int layer, end, last, x;
 
 	if (chart->current_sample == 0)
 		return;
 
-	if (chart->range_automatic)
-		chart_update_range(chart);
+	if (chart->range_automatic) {
+		chart->range[0] = window_value(chart, &chart->min);
+		chart->range[1] = window_value(chart, &chart->max);
+	}
 
 	if (chart->range[1] <= chart->range[0])
 		return;
 
-	cairo_save(cr);
+	if (chart->cache_valid &&
+	    (chart->range[0] != chart->cache_range[0] ||
+	     chart->range[1] != chart->cache_range[1]))
+		chart->cache_valid = 0;
 
-	cairo_translate(cr, chart->x, chart->y + chart->h);
-	cairo_scale(cr,
-		    chart->w / (double)(chart->num_samples-1),
-		    -chart->h / (chart->range[1] - chart->range[0]));
+	last = chart->current_sample;
+	end = chart->smooth == CHART_CURVE ? last - 1 : last;
 
-	x = 0;
-	max = chart->current_sample;
-	if (max >= chart->num_samples) {
-		max = chart->num_samples;
-		i = chart->current_sample - max;
-	} else {
-		i = 0;
-		x = chart->num_samples - max;
-	}
-	cairo_translate(cr, x, -chart->range[0]);
+	if (chart->cache_valid &&
+	    sample_x(chart, last - 1) > chart->cache_width - 2*chart->cache_pad)
+		cache_reset(chart, cr);
 
-	cairo_new_path(cr);
-	if (chart->mode != CHART_STROKE)
-		cairo_move_to(cr, 0, 0);
-	for (n = 0; n < max; n++) {
-		switch (chart->smooth) {
-		case CHART_LINE:
-			cairo_line_to(cr,
-				      n, value_at(chart, i + n));
-			break;
-		case CHART_CURVE:
-			cairo_curve_to(cr,
-				       n-2/3., value_at(chart, i + n -1) + gradient_at(chart, i + n - 1)/3.,
-				       n-1/3., value_at(chart, i + n) - gradient_at(chart, i + n)/3.,
-				       n, value_at(chart, i + n));
-			break;
+	if (!chart->cache_valid && !cache_reset(chart, cr))
+		return;
+
+	if (chart->cache_end < end) {
+		for (layer = 0; layer < 2; layer++) {
+			cairo_t *c;
+
+			if (chart->cache[layer] == NULL)
+				continue;
+
+			c = cairo_create(chart->cache[layer]);
+			draw_segments(chart, c, layer, chart->cache_end, end,
+				      chart->cache_pad, chart->cache_pad);
+			cairo_destroy(c);
 		}
+		chart->cache_end = end;
 	}
-	if (chart->mode != CHART_STROKE)
-		cairo_line_to(cr, n-1, 0);
 
-	cairo_identity_matrix(cr);
-	cairo_set_line_width(cr, chart->stroke_width);
-	switch (chart->mode) {
-	case CHART_STROKE:
-		cairo_set_source_rgba(cr, chart->stroke_rgb[0], chart->stroke_rgb[1], chart->stroke_rgb[2], chart->stroke_rgb[3]);
-		cairo_stroke(cr);
-		break;
-	case CHART_FILL:
-		cairo_set_source_rgba(cr, chart->fill_rgb[0], chart->fill_rgb[1], chart->fill_rgb[2], chart->fill_rgb[3]);
-		cairo_fill(cr);
-		break;
-	case CHART_FILL_STROKE:
-		cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
-		cairo_set_source_rgba(cr, chart->fill_rgb[0], chart->fill_rgb[1], chart->fill_rgb[2], chart->fill_rgb[3]);
-		cairo_fill_preserve(cr);
-		cairo_set_antialias(cr, CAIRO_ANTIALIAS_DEFAULT);
-		cairo_set_source_rgba(cr, chart->stroke_rgb[0], chart->stroke_rgb[1], chart->stroke_rgb[2], chart->stroke_rgb[3]);
-		cairo_stroke(cr);
-		break;
+	/* align the newest sample with the right edge of the chart */
+	x = chart->x + chart->w - sample_x(chart, last - 1);
+
+	cairo_save(cr);
+	cairo_rectangle(cr,
+			chart->x, chart->y - chart->cache_pad,
+			chart->w + chart->cache_pad, chart->h + 2*chart->cache_pad);
+	cairo_clip(cr);
+	for (layer = 0; layer < 2; layer++) {
+		if (chart->cache[layer] == NULL)
+			continue;
+
+		cairo_set_source_surface(cr, chart->cache[layer],
+					 x - chart->cache_pad,
+					 chart->y - chart->cache_pad);
+		cairo_paint(cr);
+
+		if (end < last && end > chart->cache_base)
+			draw_segments(chart, cr, layer, end, last, x, chart->y);
 	}
 	cairo_restore(cr);
 }
 
 void chart_fini(struct chart *chart)
 {
+	cache_fini(chart);
 	free(chart->samples);
+	free(chart->min.sample);
+	free(chart->max.sample);
 }
@@ -45,6 +45,20 @@ struct chart {
 	double stroke_width;
 	double range[2];
 	double *samples;
+
+	/* sliding window minimum and maximum of the samples, as monotonic
+	 * deques of sample numbers */
+	struct chart_window {
+		int *sample;
+		int head, count;
+	} min, max;
+
+	/* segments already rendered, [fill, stroke], scrolled across */
+	cairo_surface_t *cache[2];
+	int cache_valid;
+	int cache_base, cache_end;
+	int cache_pad, cache_width;
+	double cache_range[2];
 };
 
 int chart_init(struct chart *chart, const char *name, int num_samples);
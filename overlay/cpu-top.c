@@ -37,7 +37,7 @@ int cpu_top_init(struct cpu_top *cpu)
 
 	cpu->nr_cpu = sysconf(_SC_NPROCESSORS_ONLN);
 
-	return 0;
+	return sampled_file_open(&cpu->stat_file, "/proc/stat");
 }
 
 int cpu_top_update(struct cpu_top *cpu)
@@ -46,18 +46,11 @@ int cpu_top_update(struct cpu_top *cpu)
 	struct cpu_stat *d = &cpu->stat[cpu->count&1];
 	uint64_t d_total, d_idle;
 	char buf[4096], *b;
-	int fd, len = -1;
-
-	fd = open("/proc/stat", 0);
-	if (fd < 0)
-		return errno;
-
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
+	int len;
 
+	len = sampled_file_read(&cpu->stat_file, buf, sizeof(buf));
 	if (len < 0)
-		return EIO;
-	buf[len] = '\0';
+		return -len;
 
 #ifdef __x86_64__
 	sscanf(buf, "cpu %lu %lu %lu %lu",
@@ -27,12 +27,15 @@
 
 #include <stdint.h>
 
+#include "sampled-file.h"
+
 struct cpu_top {
 	uint8_t busy;
 	int nr_cpu;
 	int nr_running;
 
 	int count;
+	struct sampled_file stat_file;
 	struct cpu_stat {
 		uint64_t user, nice, sys, idle;
 		uint64_t total;
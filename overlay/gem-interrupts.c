@@ -49,24 +49,13 @@ static int perf_open(void)
 	return perf_event_open(&attr, -1, 0, -1, 0);
 }
 
-static long long debugfs_read(void)
+static long long debugfs_read(struct gem_interrupts *irqs)
 {
 	char buf[8192], *b;
-	int fd, len;
 
-	sprintf(buf, "%s/i915_gem_interrupt", debugfs_dri_path);
-	fd = open(buf, 0);
-	if (fd < 0)
+	if (sampled_file_read(&irqs->debugfs, buf, sizeof(buf)) < 0)
 		return -1;
 
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-
-	if (len < 0)
-		return -1;
-
-	buf[len] = '\0';
-
 	b = strstr(buf, "Interrupts received:");
 	if (b == NULL)
 		return -1;
@@ -74,25 +63,15 @@ static long long debugfs_read(void)
 	return strtoull(b + sizeof("Interrupts received:"), 0, 0);
 }
 
-static long long procfs_read(void)
+static long long procfs_read(struct gem_interrupts *irqs)
 {
 	char buf[8192], *b;
-	int fd, len;
 	unsigned long long val;
 
 /* 44:         51      42446          0          0   PCI-MSI-edge      i915*/
-	fd = open("/proc/interrupts", 0);
-	if (fd < 0)
-		return -1;
-
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-
-	if (len < 0)
+	if (sampled_file_read(&irqs->procfs, buf, sizeof(buf)) < 0)
 		return -1;
 
-	buf[len] = '\0';
-
 	b = strstr(buf, "i915");
 	if (b == NULL)
 		return -1;
@@ -112,13 +91,13 @@ static long long procfs_read(void)
 	return val;
 }
 
-static long long interrupts_read(void)
+static long long interrupts_read(struct gem_interrupts *irqs)
 {
 	long long val;
 
-	val = debugfs_read();
+	val = debugfs_read(irqs);
 	if (val < 0)
-		val = procfs_read();
+		val = procfs_read(irqs);
 	return val;
 }
 
@@ -127,8 +106,13 @@ int gem_interrupts_init(struct gem_interrupts *irqs)
 	memset(irqs, 0, sizeof(*irqs));
 
 	irqs->fd = perf_open();
-	if (irqs->fd < 0 && interrupts_read() < 0)
-		irqs->error = ENODEV;
+	if (irqs->fd < 0) {
+		sampled_file_open(&irqs->debugfs, "%s/i915_gem_interrupt",
+				  debugfs_dri_path);
+		sampled_file_open(&irqs->procfs, "/proc/interrupts");
+		if (interrupts_read(irqs) < 0)
+			irqs->error = ENODEV;
+	}
 
 	return irqs->error;
 }
@@ -142,7 +126,7 @@ int gem_interrupts_update(struct gem_interrupts *irqs)
 		return irqs->error;
 
 	if (irqs->fd < 0) {
-		val = interrupts_read();
+		val = interrupts_read(irqs);
 		if (val < 0)
 			return irqs->error = ENODEV;
 	} else {
@@ -27,10 +27,13 @@
 
 #include <stdint.h>
 
+#include "sampled-file.h"
+
 struct gem_interrupts {
 	long unsigned last_count, count, delta;
 	int error;
 	int fd;
+	struct sampled_file debugfs, procfs;
 };
 
 int gem_interrupts_init(struct gem_interrupts *irqs);
@@ -49,18 +49,16 @@
 int gem_objects_init(struct gem_objects *obj)
 {
 	char buf[8192], *b;
-	int fd, len;
+	int ret;
 
 	memset(obj, 0, sizeof(*obj));
 
-	sprintf(buf, "%s/i915_gem_objects", debugfs_dri_path);
-	fd = open(buf, 0);
-	if (fd < 0)
-		return errno;
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
+	ret = sampled_file_open(&obj->file, "%s/i915_gem_objects",
+				debugfs_dri_path);
+	if (ret)
+		return ret;
 
-	if (len < 0)
+	if (sampled_file_read(&obj->file, buf, sizeof(buf)) < 0)
 		return EIO;
 
 	b = strstr(buf, "gtt total");
@@ -94,27 +92,18 @@ int gem_objects_update(struct gem_objects *obj)
 	char buf[8192], *b;
 	struct gem_objects_comm *comm;
 	struct gem_objects_comm *freed;
-	int fd, len, ret;
+	int len, ret;
 
 	freed = obj->comm;
 	obj->comm = NULL;
 
-	sprintf(buf, "%s/i915_gem_objects", debugfs_dri_path);
-	fd = open(buf, 0);
-	if (fd < 0) {
-		ret = errno;
-		goto done;
-	}
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-
+	len = sampled_file_read(&obj->file, buf, sizeof(buf));
 	if (len < 0) {
-		ret = EIO;
+		ret = -len;
 		goto done;
 	}
 
-	buf[len] = '\0';
-	while (buf[--len] == '\n')
+	while (len && buf[--len] == '\n')
 		buf[len] = '\0';
 
 	b = buf;
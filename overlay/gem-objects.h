@@ -27,10 +27,13 @@
 
 #include <stdint.h>
 
+#include "sampled-file.h"
+
 struct gem_objects {
 	long unsigned total_bytes, total_count;
 	long unsigned total_gtt, total_aperture;
 	long unsigned max_gtt, max_aperture;
+	struct sampled_file file;
 	struct gem_objects_comm {
 		struct gem_objects_comm *next;
 		char name[256];
@@ -66,28 +66,23 @@ static int perf_open(void)
 int gpu_freq_init(struct gpu_freq *gf)
 {
 	char buf[4096], *s;
-	int fd, len = -1;
+	int ret;
 
 	memset(gf, 0, sizeof(*gf));
 
 	gf->fd = perf_open();
 
-	sprintf(buf, "%s/i915_frequency_info", debugfs_dri_path);
-	fd = open(buf, 0);
-	if (fd < 0) {
-		sprintf(buf, "%s/i915_cur_delayinfo", debugfs_dri_path);
-		fd = open(buf, 0);
-	}
-	if (fd < 0)
-		return gf->error = errno;
+	ret = sampled_file_open(&gf->info, "%s/i915_frequency_info",
+				debugfs_dri_path);
+	if (ret)
+		ret = sampled_file_open(&gf->info, "%s/i915_cur_delayinfo",
+					debugfs_dri_path);
+	if (ret)
+		return gf->error = ret;
 
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-	if (len < 0)
+	if (sampled_file_read(&gf->info, buf, sizeof(buf)) < 0)
 		goto err;
 
-	buf[len] = '\0';
-
 	if (strstr(buf, "PUNIT_REG_GPU_FREQ_STS")) {
 		/* Baytrail is special, ofc. */
 		gf->is_byt = 1;
@@ -135,24 +130,10 @@ int gpu_freq_update(struct gpu_freq *gf)
 
 	if (gf->fd < 0) {
 		char buf[4096], *s;
-		int fd, len = -1;
-
-		sprintf(buf, "%s/i915_frequency_info", debugfs_dri_path);
-		fd = open(buf, 0);
-		if (fd < 0) {
-			sprintf(buf, "%s/i915_cur_delayinfo", debugfs_dri_path);
-			fd = open(buf, 0);
-		}
-		if (fd < 0)
-			return gf->error = errno;
 
-		len = read(fd, buf, sizeof(buf)-1);
-		close(fd);
-		if (len < 0)
+		if (sampled_file_read(&gf->info, buf, sizeof(buf)) < 0)
 			return gf->error = EIO;
 
-		buf[len] = '\0';
-
 		if (gf->is_byt) {
 			s = strstr(buf, "current");
 			if (s)
@@ -27,12 +27,15 @@
 
 #include <stdint.h>
 
+#include "sampled-file.h"
+
 struct gpu_freq {
 	struct gpu_freq_stat {
 		uint64_t act, req;
 		uint64_t timestamp;
 	} stat[2];
 	int fd;
+	struct sampled_file info;
 	int count;
 	int is_byt;
 	int min, max;
@@ -0,0 +1,263 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Replays a synthetic stream of i915 tracepoint samples through gpu-perf to
+ * measure how many events per second it can digest. The clients are
+ * short-lived: every generation replaces the whole set of pids, so the pid
+ * hash is continually filling up and evicting, as on a busy build server.
+ *
+ * By default the samples are handed straight to the tracepoint handlers;
+ * with -r they are first written into a file-backed imitation of the perf
+ * ring and read back through gpu_perf_update(), with -t by the reader
+ * thread.
+ */
+
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gpu-perf.h"
+
+static uint64_t gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct ring {
+	struct perf_event_mmap_page *page;
+	uint8_t *data;
+	int size;
+	int wakeup;
+};
+
+static void ring_wait(struct gpu_perf *gp, struct ring *ring)
+{
+	uint64_t one = 1;
+
+	if (gp->thread) {
+		if (write(ring->wakeup, &one, sizeof(one)) < 0)
+			abort();
+		sched_yield();
+	}
+}
+
+/* Plays the kernel's part, waiting for the reader when the ring is full */
+static int ring_write(struct gpu_perf *gp, struct ring *ring,
+		      const struct perf_event_header *header)
+{
+	uint64_t head = ring->page->data_head;
+	int offset, before, update = 0;
+
+	while (ring->size - (head - __atomic_load_n(&ring->page->data_tail, __ATOMIC_ACQUIRE)) < header->size) {
+		update += gpu_perf_update(gp);
+		ring_wait(gp, ring);
+	}
+
+	offset = head & (ring->size - 1);
+	before = ring->size - offset;
+	if (before >= header->size) {
+		memcpy(ring->data + offset, header, header->size);
+	} else {
+		memcpy(ring->data + offset, header, before);
+		memcpy(ring->data, (const uint8_t *)header + before, header->size - before);
+	}
+
+	__atomic_store_n(&ring->page->data_head, head + header->size, __ATOMIC_RELEASE);
+	return update;
+}
+
+static int ring_flush(struct gpu_perf *gp, struct ring *ring)
+{
+	int update = 0;
+
+	while (__atomic_load_n(&ring->page->data_tail, __ATOMIC_ACQUIRE) != ring->page->data_head) {
+		update += gpu_perf_update(gp);
+		ring_wait(gp, ring);
+	}
+
+	/* and collect whatever the reader thread staged last */
+	return update + gpu_perf_update(gp);
+}
+
+static int ring_init(struct gpu_perf *gp, struct ring *ring)
+{
+	FILE *file;
+	int ret;
+
+	file = tmpfile();
+	if (file == NULL)
+		return errno;
+
+	if (ftruncate(fileno(file), gp->page_size + gp->ring_size))
+		return errno;
+
+	ring->wakeup = eventfd(0, 0);
+	if (ring->wakeup == -1)
+		return errno;
+
+	ret = gpu_perf_attach_ring(gp, fileno(file), ring->wakeup);
+	if (ret)
+		return ret;
+
+	ring->page = mmap(NULL, gp->page_size + gp->ring_size,
+			  PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+	if (ring->page == MAP_FAILED)
+		return errno;
+
+	ring->data = (uint8_t *)ring->page + gp->page_size;
+	ring->size = gp->ring_size;
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [-e events] [-c clients] [-g generation] [-r] [-t]\n"
+	       "\t-e events: number of samples to replay (default 10000000)\n"
+	       "\t-c clients: concurrent client processes (default 512)\n"
+	       "\t-g generation: samples before all clients are replaced (default 100000)\n"
+	       "\t-r: pass the samples through a file-backed perf ring\n"
+	       "\t-t: drain the ring from the reader thread (implies -r)\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	union {
+		struct gpu_perf_event sample;
+		uint64_t pad[8];
+	} event;
+	struct gpu_perf gp;
+	struct ring ring = { NULL };
+	unsigned long nr_events = 10000000, generation = 100000, n;
+	unsigned long updates = 0;
+	unsigned clients = 512, seqno = 0;
+	uint64_t start, elapsed;
+	int use_ring = 0, use_thread = 0;
+	int c, ret;
+
+	while ((c = getopt(argc, argv, "e:c:g:rth")) != -1) {
+		switch (c) {
+		case 'e':
+			nr_events = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			clients = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			generation = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			use_thread = 1;
+			/* fall through */
+		case 'r':
+			use_ring = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return c != 'h';
+		}
+	}
+	if (clients == 0 || generation == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	gpu_perf_init_replay(&gp);
+	if (gp.error) {
+		fprintf(stderr, "%s\n", gp.error);
+		return 1;
+	}
+
+	if (use_ring) {
+		ret = ring_init(&gp, &ring);
+		if (ret) {
+			fprintf(stderr, "failed to create ring: %s\n", strerror(ret));
+			return 1;
+		}
+	}
+
+	if (use_thread) {
+		ret = gpu_perf_start_thread(&gp);
+		if (ret) {
+			fprintf(stderr, "failed to start reader: %s\n", strerror(ret));
+			return 1;
+		}
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.sample.header.type = PERF_RECORD_SAMPLE;
+	event.sample.header.size = offsetof(struct gpu_perf_event, raw[3]);
+	event.sample.raw_size = 3 * sizeof(uint32_t);
+
+	start = gettime();
+	for (n = 0; n < nr_events; n++) {
+		unsigned long op = n / 3, client = op % clients;
+
+		/* each client submits a request and then waits for it */
+		event.sample.pid = 1 + client + (n / generation) * clients;
+		event.sample.time = n * 1000;
+		event.sample.raw[1] = op % 3;
+		switch (n % 3) {
+		case 0:
+			event.sample.id = GPU_PERF_REQUEST_ADD;
+			event.sample.raw[2] = ++seqno;
+			break;
+		case 1:
+			event.sample.id = GPU_PERF_WAIT_BEGIN;
+			break;
+		case 2:
+			event.sample.id = GPU_PERF_WAIT_END;
+			break;
+		}
+
+		if (use_ring)
+			updates += ring_write(&gp, &ring, &event.sample.header);
+		else
+			updates += gpu_perf_replay(&gp, &event.sample);
+	}
+	if (use_ring)
+		updates += ring_flush(&gp, &ring);
+	elapsed = gettime() - start;
+
+	printf("%lu events in %.3fs: %.2f Mevents/s, %.1f ns/event, %lu updates, %d clients tracked\n",
+	       nr_events, elapsed / 1e9,
+	       nr_events * 1e3 / elapsed, (double)elapsed / nr_events,
+	       updates, gp.nr_comms);
+
+	gpu_perf_stop_thread(&gp);
+	return 0;
+}
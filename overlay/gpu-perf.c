@@ -27,12 +27,14 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "perf.h"
 #include "gpu-perf.h"
@@ -50,15 +52,27 @@
 
 #define N_PAGES 32
 
-struct sample_event {
-	struct perf_event_header header;
-	uint32_t pid, tid;
-	uint64_t time;
-	uint64_t id;
-	uint32_t raw_size;
-	uint32_t raw_hdr0;
-	uint32_t raw_hdr1;
-	uint32_t raw[0];
+#define COMM_HASH_BITS 6
+#define MAX_COMMS 1024
+#define COMM_MAX_AGE (60ull*1000*1000*1000) /* ns */
+#define TIME_SLAB 64
+#define MAX_IDS 4096
+#define MAX_STAGE (16 << 20)
+
+/*
+ * With GPU_PERF_THREAD, a reader thread sleeps on the rings and copies out
+ * the samples as soon as they arrive into stage[]. gpu_perf_update() then
+ * just swaps buffers, so neither side waits on the other for more than a
+ * memcpy and bursts are drained before the kernel has to drop any.
+ */
+struct gpu_perf_thread {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	uint8_t *stage;
+	int stage_len, stage_size;
+	uint8_t *batch;
+	int batch_size;
+	int stop;
 };
 
 static uint64_t tracepoint_id(const char *sys, const char *name)
@@ -100,6 +114,10 @@ static int perf_tracepoint_open(struct gpu_perf *gp,
 
 	attr.exclude_guest = 1;
 
+	/* only wake up the reader for bursts, trickles are picked up on a timer */
+	attr.watermark = 1;
+	attr.wakeup_watermark = N_PAGES * gp->page_size / 4;
+
 	n = gp->nr_cpus * (gp->nr_events+1);
 	fd = realloc(gp->fd, n*sizeof(int));
 	sample = realloc(gp->sample, n*sizeof(*gp->sample));
@@ -149,6 +167,20 @@ static int perf_mmap(struct gpu_perf *gp)
 			ioctl(*fd++, PERF_EVENT_IOC_SET_OUTPUT, gp->fd[j]);
 	}
 
+	gp->nr_rings = gp->nr_cpus;
+	gp->ring_size = N_PAGES * gp->page_size;
+
+	/* the first event on each cpu owns its ring and so its wakeups */
+	gp->epoll_fd = epoll_create(gp->nr_cpus);
+	for (j = 0; gp->epoll_fd != -1 && j < gp->nr_cpus; j++) {
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = j;
+		epoll_ctl(gp->epoll_fd, EPOLL_CTL_ADD, gp->fd[j], &ev);
+	}
+
 	return 0;
 
 err:
@@ -179,39 +211,219 @@ static int get_comm(pid_t pid, char *comm, int len)
 	return len;
 }
 
+static unsigned comm_hash(pid_t pid, int bits)
+{
+	return ((uint32_t)pid * 0x9e3779b1) >> (32 - bits);
+}
+
+static unsigned comm_slot(struct gpu_perf *gp, pid_t pid)
+{
+	const unsigned mask = (1 << gp->comm_hash_bits) - 1;
+	unsigned i = comm_hash(pid, gp->comm_hash_bits);
+
+	while (gp->comm_hash[i] && gp->comm_hash[i]->pid != pid)
+		i = (i + 1) & mask;
+
+	return i;
+}
+
+static int comm_hash_resize(struct gpu_perf *gp, int bits)
+{
+	struct gpu_perf_comm **old = gp->comm_hash;
+	int n, old_bits = gp->comm_hash_bits;
+
+	gp->comm_hash = calloc(1 << bits, sizeof(*gp->comm_hash));
+	if (gp->comm_hash == NULL) {
+		gp->comm_hash = old;
+		return ENOMEM;
+	}
+	gp->comm_hash_bits = bits;
+
+	if (old) {
+		for (n = 0; n < 1 << old_bits; n++)
+			if (old[n])
+				gp->comm_hash[comm_slot(gp, old[n]->pid)] = old[n];
+		free(old);
+	}
+
+	return 0;
+}
+
+/* Backward shift deletion, so lookups never have to skip tombstones */
+static void comm_unhash(struct gpu_perf *gp, struct gpu_perf_comm *comm)
+{
+	const unsigned mask = (1 << gp->comm_hash_bits) - 1;
+	unsigned i, j, k;
+
+	i = comm_slot(gp, comm->pid);
+	gp->comm_hash[i] = NULL;
+
+	for (j = (i + 1) & mask; gp->comm_hash[j]; j = (j + 1) & mask) {
+		k = comm_hash(gp->comm_hash[j]->pid, gp->comm_hash_bits);
+		/* leave j alone if its home slot lies cyclically within (i, j] */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		gp->comm_hash[i] = gp->comm_hash[j];
+		gp->comm_hash[j] = NULL;
+		i = j;
+	}
+}
+
+void gpu_perf_comm_free(struct gpu_perf *gp, struct gpu_perf_comm *comm)
+{
+	int n;
+
+	comm_unhash(gp, comm);
+	gp->nr_comms--;
+
+	*comm->pprev = comm->next;
+	if (comm->next)
+		comm->next->pprev = comm->pprev;
+
+	/* drop any waits still outstanding, they would be left dangling */
+	for (n = 0; n < MAX_RINGS; n++) {
+		struct gpu_perf_time *wait, **prev;
+
+		for (prev = &gp->wait[n]; (wait = *prev) != NULL; ) {
+			if (wait->comm == comm) {
+				*prev = wait->next;
+				wait->next = gp->free_time;
+				gp->free_time = wait;
+			} else
+				prev = &wait->next;
+		}
+	}
+
+	if (gp->comm_fini)
+		gp->comm_fini(comm);
+	free(comm);
+}
+
+/*
+ * Approximate LRU: rather than scanning for the single oldest client on
+ * every insertion, evict the oldest quarter of the age range in one pass.
+ */
+static void evict_oldest_comms(struct gpu_perf *gp)
+{
+	struct gpu_perf_comm *comm, *next;
+	uint64_t oldest = -1, newest = 0, threshold;
+
+	for (comm = gp->comm; comm != NULL; comm = comm->next) {
+		if (comm->last_seen < oldest)
+			oldest = comm->last_seen;
+		if (comm->last_seen > newest)
+			newest = comm->last_seen;
+	}
+
+	threshold = oldest + (newest - oldest) / 4;
+	for (comm = gp->comm; comm != NULL; comm = next) {
+		next = comm->next;
+		if (comm->last_seen <= threshold)
+			gpu_perf_comm_free(gp, comm);
+	}
+}
+
+/* Forget about the clients we have not heard from in a while */
+static void sweep_comms(struct gpu_perf *gp)
+{
+	struct gpu_perf_comm *comm, *next;
+
+	if (gp->time - gp->last_sweep < COMM_MAX_AGE)
+		return;
+
+	for (comm = gp->comm; comm != NULL; comm = next) {
+		next = comm->next;
+		if (gp->time - comm->last_seen > COMM_MAX_AGE)
+			gpu_perf_comm_free(gp, comm);
+	}
+
+	gp->last_sweep = gp->time;
+}
+
 static struct gpu_perf_comm *
 lookup_comm(struct gpu_perf *gp, pid_t pid)
 {
 	struct gpu_perf_comm *comm;
+	unsigned slot;
 
 	if (pid == 0)
 		return NULL;
 
-	for (comm = gp->comm; comm != NULL; comm = comm->next) {
-		if (comm->pid == pid)
-			break;
-	}
+	if (gp->comm_hash == NULL &&
+	    comm_hash_resize(gp, COMM_HASH_BITS))
+		return NULL;
+
+	slot = comm_slot(gp, pid);
+	comm = gp->comm_hash[slot];
 	if (comm == NULL) {
 		comm = calloc(1, sizeof(*comm));
 		if (comm == NULL)
 			return NULL;
 
-		if (get_comm(pid, comm->name, sizeof(comm->name)) < 0) {
+		if (gp->replay) {
+			/* the recorded processes are likely long gone */
+			snprintf(comm->name, sizeof(comm->name), "%d", pid);
+		} else if (get_comm(pid, comm->name, sizeof(comm->name)) < 0) {
+			free(comm);
+			return NULL;
+		}
+
+		if (gp->nr_comms >= MAX_COMMS)
+			evict_oldest_comms(gp);
+
+		/* keep the table at most half full */
+		if (2*(gp->nr_comms + 1) > 1 << gp->comm_hash_bits &&
+		    comm_hash_resize(gp, gp->comm_hash_bits + 1)) {
 			free(comm);
 			return NULL;
 		}
 
 		comm->pid = pid;
 		comm->next = gp->comm;
+		if (comm->next)
+			comm->next->pprev = &comm->next;
+		comm->pprev = &gp->comm;
 		gp->comm = comm;
+
+		gp->comm_hash[comm_slot(gp, pid)] = comm;
+		gp->nr_comms++;
 	}
 
+	comm->last_seen = gp->time;
 	return comm;
 }
 
+static struct gpu_perf_time *alloc_time(struct gpu_perf *gp)
+{
+	struct gpu_perf_time *time;
+	int n;
+
+	if (gp->free_time == NULL) {
+		time = malloc(TIME_SLAB * sizeof(*time));
+		if (time == NULL)
+			return NULL;
+
+		for (n = 0; n < TIME_SLAB; n++) {
+			time[n].next = gp->free_time;
+			gp->free_time = &time[n];
+		}
+	}
+
+	time = gp->free_time;
+	gp->free_time = time->next;
+	return time;
+}
+
+static void free_time(struct gpu_perf *gp, struct gpu_perf_time *time)
+{
+	time->next = gp->free_time;
+	gp->free_time = time;
+}
+
 static int request_add(struct gpu_perf *gp, const void *event)
 {
-	const struct sample_event *sample = event;
+	const struct gpu_perf_event *sample = event;
 	struct gpu_perf_comm *comm;
 
 	comm = lookup_comm(gp, sample->pid);
@@ -219,12 +431,13 @@ static int request_add(struct gpu_perf *gp, const void *event)
 		return 0;
 
 	comm->nr_requests[sample->raw[1]]++;
+	comm->total_requests[sample->raw[1]]++;
 	return 1;
 }
 
 static int flip_complete(struct gpu_perf *gp, const void *event)
 {
-	const struct sample_event *sample = event;
+	const struct gpu_perf_event *sample = event;
 
 	gp->flip_complete[sample->raw[0]]++;
 	return 1;
@@ -232,7 +445,7 @@ static int flip_complete(struct gpu_perf *gp, const void *event)
 
 static int ctx_switch(struct gpu_perf *gp, const void *event)
 {
-	const struct sample_event *sample = event;
+	const struct gpu_perf_event *sample = event;
 
 	gp->ctx_switch[sample->raw[1]]++;
 	return 1;
@@ -240,7 +453,7 @@ static int ctx_switch(struct gpu_perf *gp, const void *event)
 
 static int ring_sync(struct gpu_perf *gp, const void *event)
 {
-	const struct sample_event *sample = event;
+	const struct gpu_perf_event *sample = event;
 	struct gpu_perf_comm *comm;
 
 	comm = lookup_comm(gp, sample->pid);
@@ -248,12 +461,13 @@ static int ring_sync(struct gpu_perf *gp, const void *event)
 		return 0;
 
 	comm->nr_sema++;
+	comm->total_sema++;
 	return 1;
 }
 
 static int wait_begin(struct gpu_perf *gp, const void *event)
 {
-	const struct sample_event *sample = event;
+	const struct gpu_perf_event *sample = event;
 	struct gpu_perf_comm *comm;
 	struct gpu_perf_time *wait;
 
@@ -261,7 +475,7 @@ static int wait_begin(struct gpu_perf *gp, const void *event)
 	if (comm == NULL)
 		return 0;
 
-	wait = malloc(sizeof(*wait));
+	wait = alloc_time(gp);
 	if (wait == NULL)
 		return 0;
 
@@ -276,7 +490,7 @@ static int wait_begin(struct gpu_perf *gp, const void *event)
 
 static int wait_end(struct gpu_perf *gp, const void *event)
 {
-	const struct sample_event *sample = event;
+	const struct gpu_perf_event *sample = event;
 	struct gpu_perf_time *wait, **prev;
 
 	for (prev = &gp->wait[sample->raw[1]]; (wait = *prev) != NULL; prev = &wait->next) {
@@ -284,17 +498,49 @@ static int wait_end(struct gpu_perf *gp, const void *event)
 			continue;
 
 		wait->comm->wait_time += sample->time - wait->time;
+		wait->comm->total_wait_time += sample->time - wait->time;
 		*prev = wait->next;
-		free(wait);
+		free_time(gp, wait);
 		return 1;
 	}
 
 	return 0;
 }
 
+static void build_id_table(struct gpu_perf *gp)
+{
+	int n, count = gp->nr_events * gp->nr_cpus;
+	uint64_t min, max;
+
+	if (count == 0)
+		return;
+
+	min = max = gp->sample[0].id;
+	for (n = 1; n < count; n++) {
+		if (gp->sample[n].id < min)
+			min = gp->sample[n].id;
+		if (gp->sample[n].id > max)
+			max = gp->sample[n].id;
+	}
+
+	/* ids are handed out sequentially, so expect them to be dense */
+	if (max - min >= MAX_IDS)
+		return;
+
+	gp->id_func = calloc(max - min + 1, sizeof(*gp->id_func));
+	if (gp->id_func == NULL)
+		return;
+
+	for (n = 0; n < count; n++)
+		gp->id_func[gp->sample[n].id - min] = gp->sample[n].func;
+	gp->id_base = min;
+	gp->nr_ids = max - min + 1;
+}
+
 void gpu_perf_init(struct gpu_perf *gp, unsigned flags)
 {
 	memset(gp, 0, sizeof(*gp));
+	gp->epoll_fd = -1;
 	gp->nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
 	gp->page_size = getpagesize();
 
@@ -310,24 +556,220 @@ void gpu_perf_init(struct gpu_perf *gp, unsigned flags)
 		return;
 	}
 
+	build_id_table(gp);
+
 	if (perf_mmap(gp))
 		return;
+
+	if (flags & GPU_PERF_THREAD)
+		gpu_perf_start_thread(gp);
 }
 
-static int process_sample(struct gpu_perf *gp, int cpu,
+static int process_sample(struct gpu_perf *gp,
 			  const struct perf_event_header *header)
 {
-	const struct sample_event *sample = (const struct sample_event *)header;
-	int n, update = 0;
+	const struct gpu_perf_event *sample = (const struct gpu_perf_event *)header;
+	int n;
+
+	gp->time = sample->time;
+
+	if (gp->id_func) {
+		uint64_t id = sample->id - gp->id_base;
+
+		if (id < gp->nr_ids && gp->id_func[id])
+			return gp->id_func[id](gp, sample);
 
-	/* hash me! */
-	for (n = 0; n < gp->nr_events; n++) {
-		int m = n * gp->nr_cpus + cpu;
-		if (gp->sample[m].id != sample->id)
+		return 0;
+	}
+
+	for (n = 0; n < gp->nr_events * gp->nr_cpus; n++) {
+		if (gp->sample[n].id == sample->id)
+			return gp->sample[n].func(gp, sample);
+	}
+
+	return 0;
+}
+
+static int stage_sample(struct gpu_perf *gp,
+			const struct perf_event_header *header)
+{
+	struct gpu_perf_thread *t = gp->thread;
+
+	if (t->stage_len + header->size > t->stage_size) {
+		int size = t->stage_size ? 2*t->stage_size : 64*1024;
+		uint8_t *stage;
+
+		while (size < t->stage_len + header->size)
+			size *= 2;
+
+		/* the consumer has stalled, drop rather than grow forever */
+		if (size > MAX_STAGE)
+			return 0;
+
+		stage = realloc(t->stage, size);
+		if (stage == NULL)
+			return 0;
+
+		t->stage = stage;
+		t->stage_size = size;
+	}
+
+	memcpy(t->stage + t->stage_len, header, header->size);
+	t->stage_len += header->size;
+	return 1;
+}
+
+/* Consumes every complete record in the ring in a single pass */
+static int drain_ring(struct gpu_perf *gp, struct perf_event_mmap_page *mmap,
+		      int (*func)(struct gpu_perf *, const struct perf_event_header *))
+{
+	const int size = gp->ring_size;
+	const int mask = size - 1;
+	const uint8_t *data = (uint8_t *)mmap + gp->page_size;
+	uint64_t head, tail;
+	int update = 0;
+
+	head = mmap->data_head;
+	rmb();
+	tail = mmap->data_tail;
+	if (head == tail)
+		return 0;
+
+	while (head - tail >= sizeof(struct perf_event_header)) {
+		const struct perf_event_header *header;
+
+		header = (const struct perf_event_header *)(data + (tail & mask));
+		if (header->size < sizeof(*header) || header->size > head - tail)
+			break;
+
+		if ((tail & mask) + header->size > size) {
+			int before = size - (tail & mask);
+
+			if (header->size > gp->buffer_size) {
+				uint8_t *b = realloc(gp->buffer, header->size);
+				if (b == NULL)
+					break;
+
+				gp->buffer = b;
+				gp->buffer_size = header->size;
+			}
+
+			memcpy(gp->buffer, header, before);
+			memcpy(gp->buffer + before, data, header->size - before);
+
+			header = (struct perf_event_header *)gp->buffer;
+		}
+
+		if (header->type == PERF_RECORD_SAMPLE)
+			update += func(gp, header);
+		tail += header->size;
+	}
+
+	wmb();
+	mmap->data_tail = tail;
+	return update;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct gpu_perf *gp = arg;
+	struct gpu_perf_thread *t = gp->thread;
+	struct epoll_event ev[16];
+	int n, staged;
+
+	for (;;) {
+		staged = 0;
+		pthread_mutex_lock(&t->lock);
+		if (t->stop) {
+			pthread_mutex_unlock(&t->lock);
+			break;
+		}
+		for (n = 0; n < gp->nr_rings; n++)
+			staged += drain_ring(gp, gp->map[n], stage_sample);
+		pthread_mutex_unlock(&t->lock);
+		if (staged)
 			continue;
 
-		update = gp->sample[m].func(gp, sample);
-		break;
+		/* sleep until a ring passes its watermark, or time out to
+		 * collect the trickle below it
+		 */
+		if (gp->epoll_fd != -1)
+			epoll_wait(gp->epoll_fd, ev, 16, 100);
+		else
+			usleep(100*1000);
+	}
+
+	return NULL;
+}
+
+int gpu_perf_start_thread(struct gpu_perf *gp)
+{
+	struct gpu_perf_thread *t;
+
+	if (gp->thread)
+		return 0;
+
+	t = calloc(1, sizeof(*t));
+	if (t == NULL)
+		return ENOMEM;
+
+	pthread_mutex_init(&t->lock, NULL);
+	gp->thread = t;
+
+	if (pthread_create(&t->thread, NULL, reader_thread, gp)) {
+		gp->thread = NULL;
+		pthread_mutex_destroy(&t->lock);
+		free(t);
+		return EAGAIN;
+	}
+
+	return 0;
+}
+
+/*
+ * Waits for the reader thread to notice, within its 100ms timeout, and frees
+ * what it staged. Must be called before @gp goes away.
+ */
+void gpu_perf_stop_thread(struct gpu_perf *gp)
+{
+	struct gpu_perf_thread *t = gp->thread;
+
+	if (t == NULL)
+		return;
+
+	pthread_mutex_lock(&t->lock);
+	t->stop = 1;
+	pthread_mutex_unlock(&t->lock);
+	pthread_join(t->thread, NULL);
+
+	gp->thread = NULL;
+	pthread_mutex_destroy(&t->lock);
+	free(t->stage);
+	free(t->batch);
+	free(t);
+}
+
+static int update_from_thread(struct gpu_perf *gp)
+{
+	struct gpu_perf_thread *t = gp->thread;
+	const struct perf_event_header *header;
+	uint8_t *batch;
+	int len, size, offset, update = 0;
+
+	pthread_mutex_lock(&t->lock);
+	batch = t->stage;
+	len = t->stage_len;
+	size = t->stage_size;
+	t->stage = t->batch;
+	t->stage_size = t->batch_size;
+	t->stage_len = 0;
+	t->batch = batch;
+	t->batch_size = size;
+	pthread_mutex_unlock(&t->lock);
+
+	for (offset = 0; offset < len; offset += header->size) {
+		header = (const struct perf_event_header *)(batch + offset);
+		update += process_sample(gp, header);
 	}
 
 	return update;
@@ -335,71 +777,100 @@ static int process_sample(struct gpu_perf *gp, int cpu,
 
 int gpu_perf_update(struct gpu_perf *gp)
 {
-	const int size = N_PAGES * gp->page_size;
-	const int mask = size - 1;
-	uint8_t *buffer = NULL;
-	int buffer_size = 0;
 	int n, update = 0;
 
 	if (gp->map == NULL)
 		return 0;
 
-	for (n = 0; n < gp->nr_cpus; n++) {
-		struct perf_event_mmap_page *mmap = gp->map[n];
-		const uint8_t *data;
-		uint64_t head, tail;
-		int wrap = 0;
-
-		tail = mmap->data_tail;
-		head = mmap->data_head;
-		rmb();
-
-		if (head < tail) {
-			wrap = 1;
-			tail &= mask;
-			head &= mask;
-			head += size;
-		}
-
-		data = (uint8_t *)mmap + gp->page_size;
-		while (head - tail >= sizeof (struct perf_event_header)) {
-			const struct perf_event_header *header;
+	if (gp->thread) {
+		update = update_from_thread(gp);
+	} else {
+		/* no reader thread, so poll every ring on each tick */
+		for (n = 0; n < gp->nr_rings; n++)
+			update += drain_ring(gp, gp->map[n], process_sample);
+	}
 
-			header = (const struct perf_event_header *)(data + (tail & mask));
-			if (header->size > head - tail)
-				break;
+	sweep_comms(gp);
+	return update;
+}
 
-			if ((const uint8_t *)header + header->size > data + size) {
-				int before;
+/*
+ * Replay mode takes samples from the caller rather than from perf, with the
+ * sample ids being the GPU_PERF_* tracepoints. Used for benchmarking and to
+ * play back recorded traces.
+ */
+void gpu_perf_init_replay(struct gpu_perf *gp)
+{
+	static int (*const func[])(struct gpu_perf *, const void *) = {
+		[GPU_PERF_REQUEST_ADD] = request_add,
+		[GPU_PERF_WAIT_BEGIN] = wait_begin,
+		[GPU_PERF_WAIT_END] = wait_end,
+		[GPU_PERF_FLIP_COMPLETE] = flip_complete,
+		[GPU_PERF_RING_SYNC] = ring_sync,
+		[GPU_PERF_CTX_SWITCH] = ctx_switch,
+	};
 
-				if (header->size > buffer_size) {
-					uint8_t *b = realloc(buffer, header->size);
-					if (b == NULL)
-						break;
+	memset(gp, 0, sizeof(*gp));
+	gp->replay = 1;
+	gp->epoll_fd = -1;
+	gp->page_size = getpagesize();
+	gp->ring_size = N_PAGES * gp->page_size;
 
-					buffer = b;
-					buffer_size = header->size;
-				}
+	gp->id_func = malloc(sizeof(func));
+	if (gp->id_func == NULL) {
+		gp->error = "out of memory";
+		return;
+	}
 
-				before = data + size - (const uint8_t *)header;
+	memcpy(gp->id_func, func, sizeof(func));
+	gp->nr_ids = sizeof(func)/sizeof(func[0]);
+}
 
-				memcpy(buffer, header, before);
-				memcpy(buffer + before, data, header->size - before);
+/*
+ * Adds a ring laid out as the perf mmap, a struct perf_event_mmap_page in
+ * the first page followed by ring_size bytes of records, mapped from fd.
+ * Lets a file stand in for the kernel when testing the reader, with
+ * wakeup_fd (if not -1) becoming readable in place of the watermark.
+ */
+int gpu_perf_attach_ring(struct gpu_perf *gp, int fd, int wakeup_fd)
+{
+	void **map;
 
-				header = (struct perf_event_header *)buffer;
-			}
+	if (wakeup_fd != -1) {
+		struct epoll_event ev;
 
-			if (header->type == PERF_RECORD_SAMPLE)
-				update += process_sample(gp, n, header);
-			tail += header->size;
-		}
+		if (gp->epoll_fd == -1)
+			gp->epoll_fd = epoll_create(1);
+		if (gp->epoll_fd == -1)
+			return errno;
 
-		if (wrap)
-			tail &= mask;
-		mmap->data_tail = tail;
-		wmb();
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.u32 = gp->nr_rings;
+		if (epoll_ctl(gp->epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev))
+			return errno;
 	}
 
-	free(buffer);
+	map = realloc(gp->map, (gp->nr_rings + 1)*sizeof(void *));
+	if (map == NULL)
+		return ENOMEM;
+	gp->map = map;
+
+	map[gp->nr_rings] = mmap(NULL, gp->page_size + gp->ring_size,
+				 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map[gp->nr_rings] == MAP_FAILED)
+		return errno;
+
+	gp->nr_rings++;
+	return 0;
+}
+
+int gpu_perf_replay(struct gpu_perf *gp, const struct gpu_perf_event *event)
+{
+	int update;
+
+	update = process_sample(gp, &event->header);
+	sweep_comms(gp);
+
 	return update;
 }
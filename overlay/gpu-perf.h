@@ -26,26 +26,43 @@
 #define GPU_PERF_H
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "perf.h"
 
 #define MAX_RINGS 4
 
+#define GPU_PERF_THREAD 0x1
+
 struct gpu_perf {
 	const char *error;
+	int replay;
 	int page_size;
 	int nr_cpus;
 	int nr_events;
 	int *fd;
 	void **map;
+	int nr_rings;
+	int ring_size;
+	int epoll_fd;
+	uint8_t *buffer;
+	int buffer_size;
 	struct gpu_perf_sample {
 		uint64_t id;
 		int (*func)(struct gpu_perf *, const void *);
 	} *sample;
+	/* sample id - id_base -> handler */
+	int (**id_func)(struct gpu_perf *, const void *);
+	uint64_t id_base;
+	int nr_ids;
+	struct gpu_perf_thread *thread;
 
 	unsigned flip_complete[MAX_RINGS];
 	unsigned ctx_switch[MAX_RINGS];
 
 	struct gpu_perf_comm {
-		struct gpu_perf_comm *next;
+		struct gpu_perf_comm *next, **pprev;
 		char name[256];
 		pid_t pid;
 		int nr_requests[4];
@@ -54,17 +71,59 @@ struct gpu_perf {
 		uint64_t wait_time;
 		uint32_t nr_sema;
 
+		/* running totals, never reset */
+		uint64_t total_requests[4];
+		uint64_t total_wait_time;
+		uint64_t total_sema;
+
 		time_t show;
+		uint64_t last_seen;
 	} *comm;
+	/* open addressed by pid, 1 << comm_hash_bits slots */
+	struct gpu_perf_comm **comm_hash;
+	int comm_hash_bits;
+	int nr_comms;
+	void (*comm_fini)(struct gpu_perf_comm *comm);
+
 	struct gpu_perf_time {
 		struct gpu_perf_time *next;
 		struct gpu_perf_comm *comm;
 		uint32_t seqno;
 		uint64_t time;
-	} *wait[MAX_RINGS];
+	} *wait[MAX_RINGS], *free_time;
+
+	uint64_t time, last_sweep;
+};
+
+/* Layout of the i915 tracepoint samples, raw[] holds the tracepoint fields */
+struct gpu_perf_event {
+	struct perf_event_header header;
+	uint32_t pid, tid;
+	uint64_t time;
+	uint64_t id;
+	uint32_t raw_size;
+	uint32_t raw_hdr0;
+	uint32_t raw_hdr1;
+	uint32_t raw[0];
+};
+
+enum gpu_perf_event_id {
+	GPU_PERF_REQUEST_ADD,
+	GPU_PERF_WAIT_BEGIN,
+	GPU_PERF_WAIT_END,
+	GPU_PERF_FLIP_COMPLETE,
+	GPU_PERF_RING_SYNC,
+	GPU_PERF_CTX_SWITCH,
 };
 
 void gpu_perf_init(struct gpu_perf *gp, unsigned flags);
+int gpu_perf_start_thread(struct gpu_perf *gp);
+void gpu_perf_stop_thread(struct gpu_perf *gp);
 int gpu_perf_update(struct gpu_perf *gp);
+void gpu_perf_comm_free(struct gpu_perf *gp, struct gpu_perf_comm *comm);
+
+void gpu_perf_init_replay(struct gpu_perf *gp);
+int gpu_perf_attach_ring(struct gpu_perf *gp, int fd, int wakeup_fd);
+int gpu_perf_replay(struct gpu_perf *gp, const struct gpu_perf_event *event);
 
 #endif /* GPU_PERF_H */
@@ -0,0 +1,477 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+#define METRICS_FRESH 4
+#define CLIENT_TIMEOUT 5 /* seconds */
+
+static const char response_header[] =
+	"HTTP/1.0 %s\r\n"
+	"Content-Type: text/plain; version=0.0.4\r\n"
+	"Content-Length: %zu\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+static void text_append(struct metrics_text *t, const char *str, size_t len)
+{
+	if (t->len + len + 1 > t->size) {
+		size_t size = t->size ? t->size : 4096;
+		char *data;
+
+		while (size < t->len + len + 1)
+			size *= 2;
+
+		data = realloc(t->data, size);
+		if (data == NULL)
+			return;
+
+		t->data = data;
+		t->size = size;
+	}
+
+	memcpy(t->data + t->len, str, len);
+	t->len += len;
+	t->data[t->len] = '\0';
+}
+
+static void __attribute__((format(printf, 2, 3)))
+text_printf(struct metrics_text *t, const char *fmt, ...)
+{
+	char buf[512];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len > 0)
+		text_append(t, buf, len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1);
+}
+
+/* label values are quoted strings, escape \, " and newlines */
+static void text_append_label(struct metrics_text *t, const char *str)
+{
+	while (*str) {
+		size_t len = strcspn(str, "\\\"\n");
+
+		text_append(t, str, len);
+		str += len;
+
+		switch (*str) {
+		case '\\': text_append(t, "\\\\", 2); break;
+		case '"': text_append(t, "\\\"", 2); break;
+		case '\n': text_append(t, "\\n", 2); break;
+		default: continue;
+		}
+		str++;
+	}
+}
+
+/**
+ * Start a new snapshot. Only the thread sampling may call metrics_begin(),
+ * metrics_describe(), metrics_sample() and metrics_publish().
+ */
+void metrics_begin(struct metrics *m)
+{
+	m->text[m->back].len = 0;
+}
+
+void metrics_describe(struct metrics *m, const char *name,
+		      const char *type, const char *help)
+{
+	struct metrics_text *t = &m->text[m->back];
+
+	text_printf(t, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * Add a sample of @name, followed by any number of label name and value
+ * pairs, terminated by NULL.
+ */
+void metrics_sample(struct metrics *m, const char *name, double value, ...)
+{
+	struct metrics_text *t = &m->text[m->back];
+	const char *label;
+	char sep = '{';
+	va_list ap;
+
+	text_append(t, name, strlen(name));
+
+	va_start(ap, value);
+	while ((label = va_arg(ap, const char *)) != NULL) {
+		text_printf(t, "%c%s=\"", sep, label);
+		text_append_label(t, va_arg(ap, const char *));
+		text_append(t, "\"", 1);
+		sep = ',';
+	}
+	va_end(ap);
+
+	text_printf(t, "%s %.15g\n", sep == ',' ? "}" : "", value);
+}
+
+/* Hand the finished snapshot over, and take the stale one to write next. */
+void metrics_publish(struct metrics *m)
+{
+	m->back = __atomic_exchange_n(&m->middle, m->back | METRICS_FRESH,
+				      __ATOMIC_ACQ_REL) & ~METRICS_FRESH;
+}
+
+static struct metrics_text *latest_text(struct metrics *m)
+{
+	if (__atomic_load_n(&m->middle, __ATOMIC_RELAXED) & METRICS_FRESH)
+		m->front = __atomic_exchange_n(&m->middle, m->front,
+					       __ATOMIC_ACQ_REL) & ~METRICS_FRESH;
+
+	return &m->text[m->front];
+}
+
+static int now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static void client_respond(struct metrics *m, struct metrics_client *c)
+{
+	static const char not_found[] = "Not found, try /metrics\n";
+	static const char bad_method[] = "Only GET is supported\n";
+	const char *status, *body;
+	const char *path = c->request + 4;
+	size_t len, body_len, header_len;
+
+	if (strncmp(c->request, "GET ", 4)) {
+		status = "405 Method Not Allowed";
+		body = bad_method;
+		body_len = sizeof(bad_method) - 1;
+	} else {
+		len = strcspn(path, " ?\r\n");
+		if ((len == 1 && path[0] == '/') ||
+		    (len == 8 && strncmp(path, "/metrics", 8) == 0)) {
+			struct metrics_text *t = latest_text(m);
+
+			status = "200 OK";
+			body = t->data ? t->data : "";
+			body_len = t->len;
+		} else {
+			status = "404 Not Found";
+			body = not_found;
+			body_len = sizeof(not_found) - 1;
+		}
+	}
+
+	header_len = snprintf(NULL, 0, response_header, status, body_len);
+	c->response = malloc(header_len + body_len + 1);
+	if (c->response == NULL)
+		return;
+
+	sprintf(c->response, response_header, status, body_len);
+	memcpy(c->response + header_len, body, body_len);
+	c->response_len = header_len + body_len;
+	c->sent = 0;
+}
+
+/* Returns 0 while the connection is still in use. */
+static int client_update(struct metrics *m, struct metrics_client *c, int revents)
+{
+	ssize_t len;
+
+	if (revents & POLLNVAL)
+		return -1;
+
+	if (c->response == NULL) {
+		len = read(c->fd, c->request + c->request_len,
+			   sizeof(c->request) - 1 - c->request_len);
+		if (len < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		if (len == 0)
+			return -1;
+
+		c->request_len += len;
+		c->request[c->request_len] = '\0';
+
+		/* the rest of the request does not matter, answer once the
+		 * headers are complete or no longer fit */
+		if (strstr(c->request, "\r\n\r\n") == NULL &&
+		    strstr(c->request, "\n\n") == NULL &&
+		    c->request_len < sizeof(c->request) - 1)
+			return 0;
+
+		client_respond(m, c);
+		if (c->response == NULL)
+			return -1;
+	}
+
+	len = send(c->fd, c->response + c->sent, c->response_len - c->sent,
+		   MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+	c->sent += len;
+	return c->sent == c->response_len ? -1 : 0;
+}
+
+static void client_close(struct metrics *m, int n)
+{
+	struct metrics_client *c = &m->client[n];
+
+	close(c->fd);
+	free(c->response);
+
+	*c = m->client[--m->nr_clients];
+	m->client[m->nr_clients].response = NULL;
+}
+
+static void accept_clients(struct metrics *m)
+{
+	while (m->nr_clients < METRICS_MAX_CLIENTS) {
+		struct metrics_client *c = &m->client[m->nr_clients];
+		int fd;
+
+		fd = accept4(m->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			break;
+
+		c->fd = fd;
+		c->request_len = 0;
+		c->response = NULL;
+		c->idle = now() + CLIENT_TIMEOUT;
+		m->nr_clients++;
+	}
+}
+
+static void *server_thread(void *arg)
+{
+	struct metrics *m = arg;
+	struct pollfd pfd[METRICS_MAX_CLIENTS + 2];
+
+	for (;;) {
+		int n, t;
+
+		pfd[0].fd = m->wakeup[0];
+		pfd[0].events = POLLIN;
+		/* leave connections queued on the socket while full */
+		pfd[1].fd = m->nr_clients < METRICS_MAX_CLIENTS ? m->fd : -1;
+		pfd[1].events = POLLIN;
+		for (n = 0; n < m->nr_clients; n++) {
+			pfd[n + 2].fd = m->client[n].fd;
+			pfd[n + 2].events = m->client[n].response ? POLLOUT : POLLIN;
+		}
+
+		if (poll(pfd, m->nr_clients + 2, 1000) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfd[0].revents)
+			break;
+
+		/* backwards, so that closing a client only moves an
+		 * already visited one into its place */
+		t = now();
+		for (n = m->nr_clients; n--; ) {
+			struct metrics_client *c = &m->client[n];
+
+			if (pfd[n + 2].revents) {
+				if (client_update(m, c, pfd[n + 2].revents)) {
+					client_close(m, n);
+					continue;
+				}
+				c->idle = t + CLIENT_TIMEOUT;
+			} else if (t > c->idle)
+				client_close(m, n);
+		}
+
+		if (pfd[1].revents & POLLIN)
+			accept_clients(m);
+	}
+
+	return NULL;
+}
+
+static int listen_unix(struct metrics *m, const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return ENAMETOOLONG;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* replace a socket left behind by a previous run, but nothing else */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return errno;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int err = errno;
+		close(fd);
+		return err;
+	}
+
+	m->fd = fd;
+	m->path = strdup(path);
+	return 0;
+}
+
+static int listen_tcp(struct metrics *m, const char *port)
+{
+	struct sockaddr_in addr;
+	char *end;
+	long value;
+	int fd, on = 1;
+
+	value = strtol(port, &end, 10);
+	if (*port == '\0' || *end != '\0' || value <= 0 || value > 65535)
+		return EINVAL;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(value);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return errno;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int err = errno;
+		close(fd);
+		return err;
+	}
+
+	m->fd = fd;
+	return 0;
+}
+
+/**
+ * Listen on @address, either "unix:<path>" (or just an absolute path) for a
+ * unix socket, or "<port>" for that TCP port on 127.0.0.1.
+ *
+ * The socket is created here so that errors are reported before the caller
+ * detaches, but nothing is served until metrics_start().
+ */
+int metrics_init(struct metrics *m, const char *address)
+{
+	int ret;
+
+	memset(m, 0, sizeof(*m));
+	m->fd = -1;
+	m->wakeup[0] = m->wakeup[1] = -1;
+	m->back = 0;
+	m->middle = 1;
+	m->front = 2;
+
+	if (strncmp(address, "unix:", 5) == 0)
+		ret = listen_unix(m, address + 5);
+	else if (address[0] == '/')
+		ret = listen_unix(m, address);
+	else
+		ret = listen_tcp(m, address);
+	if (ret)
+		return ret;
+
+	if (listen(m->fd, METRICS_MAX_CLIENTS) < 0 ||
+	    pipe2(m->wakeup, O_NONBLOCK | O_CLOEXEC) < 0) {
+		ret = errno;
+		metrics_fini(m);
+		return ret;
+	}
+
+	return 0;
+}
+
+int metrics_start(struct metrics *m)
+{
+	if (m->fd < 0)
+		return EINVAL;
+
+	if (pthread_create(&m->thread, NULL, server_thread, m))
+		return EAGAIN;
+
+	m->running = 1;
+	return 0;
+}
+
+void metrics_fini(struct metrics *m)
+{
+	int n;
+
+	if (m->running) {
+		if (write(m->wakeup[1], "", 1) == 1)
+			pthread_join(m->thread, NULL);
+		m->running = 0;
+	}
+
+	while (m->nr_clients)
+		client_close(m, 0);
+
+	if (m->wakeup[0] >= 0) {
+		close(m->wakeup[0]);
+		close(m->wakeup[1]);
+	}
+
+	if (m->fd >= 0)
+		close(m->fd);
+	m->fd = -1;
+
+	if (m->path) {
+		unlink(m->path);
+		free(m->path);
+		m->path = NULL;
+	}
+
+	for (n = 0; n < 3; n++)
+		free(m->text[n].data);
+	memset(m->text, 0, sizeof(m->text));
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define METRICS_MAX_CLIENTS 16
+
+/*
+ * Serves the latest sample in the Prometheus text exposition format over a
+ * local socket, either a unix socket or a TCP port on the loopback address.
+ *
+ * The sampler writes each snapshot into its own buffer and publishes it by
+ * exchanging that buffer with the shared middle one; the server thread does
+ * the same to pick up the newest snapshot when a request arrives. Neither
+ * side ever waits for the other, so a slow or stuck client cannot delay
+ * sampling.
+ */
+struct metrics {
+	int fd;
+	int wakeup[2];
+	char *path;
+	pthread_t thread;
+	int running;
+
+	struct metrics_text {
+		char *data;
+		size_t len, size;
+	} text[3];
+	int back;	/* written by the sampler */
+	int front;	/* served by the thread */
+	int middle;	/* exchanged atomically, with METRICS_FRESH */
+
+	struct metrics_client {
+		int fd;
+		char request[1024];
+		size_t request_len;
+		char *response;
+		size_t response_len, sent;
+		int idle;
+	} client[METRICS_MAX_CLIENTS];
+	int nr_clients;
+};
+
+int metrics_init(struct metrics *m, const char *address);
+int metrics_start(struct metrics *m);
+void metrics_fini(struct metrics *m);
+
+void metrics_begin(struct metrics *m);
+void metrics_describe(struct metrics *m, const char *name,
+		      const char *type, const char *help);
+void metrics_sample(struct metrics *m, const char *name, double value, ...);
+void metrics_publish(struct metrics *m);
+
+#endif /* METRICS_H */
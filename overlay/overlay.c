@@ -46,8 +46,10 @@
 #include "gpu-freq.h"
 #include "gpu-top.h"
 #include "gpu-perf.h"
+#include "metrics.h"
 #include "power.h"
 #include "rc6.h"
+#include "recorder.h"
 
 #define is_power_of_two(x)  (((x) & ((x)-1)) == 0)
 
@@ -137,6 +139,9 @@ struct overlay_context {
 	struct overlay_gpu_perf gpu_perf;
 	struct overlay_gpu_freq gpu_freq;
 	struct overlay_gem_objects gem_objects;
+
+	struct metrics *metrics;
+	struct overlay_replay *replay;
 };
 
 static void init_gpu_top(struct overlay_context *ctx,
@@ -150,8 +155,11 @@ static void init_gpu_top(struct overlay_context *ctx,
 	};
 	int n;
 
-	cpu_top_init(&gt->cpu_top);
-	gpu_top_init(&gt->gpu_top);
+	/* when replaying, the rings are those found in the recording */
+	if (ctx->replay == NULL) {
+		cpu_top_init(&gt->cpu_top);
+		gpu_top_init(&gt->gpu_top);
+	}
 
 	chart_init(&gt->cpu, "CPU", 120);
 	chart_set_position(&gt->cpu, PAD, PAD);
@@ -193,14 +201,14 @@ static void show_gpu_top(struct overlay_context *ctx, struct overlay_gpu_top *gt
 	int rewind;
 	int do_rewind;
 
-	update = gpu_top_update(&gt->gpu_top);
+	update = ctx->replay ? 1 : gpu_top_update(&gt->gpu_top);
 
 	cairo_rectangle(ctx->cr, PAD-.5, PAD-.5, ctx->width/2-SIZE_PAD+1, ctx->height/2-SIZE_PAD+1);
 	cairo_set_source_rgb(ctx->cr, .15, .15, .15);
 	cairo_set_line_width(ctx->cr, 1);
 	cairo_stroke(ctx->cr);
 
-	if (update && cpu_top_update(&gt->cpu_top) == 0)
+	if (update && (ctx->replay || cpu_top_update(&gt->cpu_top) == 0))
 		chart_add_sample(&gt->cpu, gt->cpu_top.busy);
 
 	for (n = 0; n < gt->gpu_top.num_rings; n++) {
@@ -272,10 +280,21 @@ static void show_gpu_top(struct overlay_context *ctx, struct overlay_gpu_top *gt
 	}
 }
 
+static void gpu_perf_comm_fini(struct gpu_perf_comm *comm)
+{
+	if (comm->user_data) {
+		chart_fini(comm->user_data);
+		free(comm->user_data);
+	}
+}
+
 static void init_gpu_perf(struct overlay_context *ctx,
-			  struct overlay_gpu_perf *gp)
+			  struct overlay_gpu_perf *gp,
+			  unsigned flags)
 {
-	gpu_perf_init(&gp->gpu_perf, 0);
+	if (ctx->replay == NULL)
+		gpu_perf_init(&gp->gpu_perf, flags);
+	gp->gpu_perf.comm_fini = gpu_perf_comm_fini;
 
 	gp->show_ctx = 0;
 	gp->show_flips = 0;
@@ -309,7 +328,7 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 		{ 0.25, 0.25, 1, 1 },
 		{ 1, 1, 1, 1 },
 	};
-	struct gpu_perf_comm *comm, **prev;
+	struct gpu_perf_comm *comm, *next;
 	const char *ring_name[] = {
 		"R",
 		"V",
@@ -411,7 +430,7 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 	cairo_pattern_destroy(linear);
 	cairo_fill(ctx->cr);
 
-	for (prev = &gp->gpu_perf.comm; (comm = *prev) != NULL; ) {
+	for (comm = gp->gpu_perf.comm; comm != NULL; comm = next) {
 		int need_comma = 0, len;
 
 		if (comm->name[0] == '\0')
@@ -466,17 +485,12 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 		y += 14;
 
 skip_comm:
+		next = comm->next;
 		memset(comm->nr_requests, 0, sizeof(comm->nr_requests));
 		if (comm->show < ctx->time - IDLE_TIME ||
-		    strcmp(comm->name, get_comm(comm->pid, buf, sizeof(buf)))) {
-			*prev = comm->next;
-			if (comm->user_data) {
-				chart_fini(comm->user_data);
-				free(comm->user_data);
-			}
-			free(comm);
-		} else
-			prev = &comm->next;
+		    (ctx->replay == NULL &&
+		     strcmp(comm->name, get_comm(comm->pid, buf, sizeof(buf)))))
+			gpu_perf_comm_free(&gp->gpu_perf, comm);
 	}
 
 	cairo_set_source_rgba(ctx->cr, 1, 1, 1, 1);
@@ -524,7 +538,14 @@ skip_comm:
 static void init_gpu_freq(struct overlay_context *ctx,
 			  struct overlay_gpu_freq *gf)
 {
-	if (gpu_freq_init(&gf->gpu_freq) == 0) {
+	if (ctx->replay == NULL) {
+		gpu_freq_init(&gf->gpu_freq);
+		power_init(&gf->power);
+		rc6_init(&gf->rc6);
+		gem_interrupts_init(&gf->irqs);
+	}
+
+	if (gf->gpu_freq.error == 0) {
 		chart_init(&gf->current, "current", 120);
 		chart_set_position(&gf->current, PAD, ctx->height/2 + HALF_PAD);
 		chart_set_size(&gf->current, ctx->width/2 - SIZE_PAD, ctx->height/2 - SIZE_PAD);
@@ -542,16 +563,13 @@ static void init_gpu_freq(struct overlay_context *ctx,
 		chart_set_range(&gf->request, 0, gf->gpu_freq.max);
 	}
 
-	if (power_init(&gf->power) == 0) {
+	if (gf->power.error == 0) {
 		chart_init(&gf->power_chart, "power", 120);
 		chart_set_position(&gf->power_chart, PAD, ctx->height/2 + HALF_PAD);
 		chart_set_size(&gf->power_chart, ctx->width/2 - SIZE_PAD, ctx->height/2 - SIZE_PAD);
 		chart_set_stroke_rgba(&gf->power_chart, 0.45, 0.55, 0.45, 1.);
 		gf->power_max = 0;
 	}
-
-	rc6_init(&gf->rc6);
-	gem_interrupts_init(&gf->irqs);
 }
 
 static void show_gpu_freq(struct overlay_context *ctx, struct overlay_gpu_freq *gf)
@@ -559,12 +577,21 @@ static void show_gpu_freq(struct overlay_context *ctx, struct overlay_gpu_freq *
 	char buf[160];
 	int y1, y2, y, len;
 
-	int has_freq = gpu_freq_update(&gf->gpu_freq) == 0;
-	int has_rc6 = rc6_update(&gf->rc6) == 0;
-	int has_power = power_update(&gf->power) == 0;
-	int has_irqs = gem_interrupts_update(&gf->irqs) == 0;
+	int has_freq, has_rc6, has_power, has_irqs;
 	cairo_pattern_t *linear;
 
+	if (ctx->replay) {
+		has_freq = gf->gpu_freq.error == 0;
+		has_rc6 = gf->rc6.error == 0;
+		has_power = gf->power.error == 0;
+		has_irqs = gf->irqs.error == 0;
+	} else {
+		has_freq = gpu_freq_update(&gf->gpu_freq) == 0;
+		has_rc6 = rc6_update(&gf->rc6) == 0;
+		has_power = power_update(&gf->power) == 0;
+		has_irqs = gem_interrupts_update(&gf->irqs) == 0;
+	}
+
 	cairo_rectangle(ctx->cr, PAD-.5, ctx->height/2+HALF_PAD-.5, ctx->width/2-SIZE_PAD+1, ctx->height/2-SIZE_PAD+1);
 	cairo_set_source_rgb(ctx->cr, .15, .15, .15);
 	cairo_set_line_width(ctx->cr, 1);
@@ -702,7 +729,8 @@ static void show_gpu_freq(struct overlay_context *ctx, struct overlay_gpu_freq *
 static void init_gem_objects(struct overlay_context *ctx,
 			     struct overlay_gem_objects *go)
 {
-	go->error = gem_objects_init(&go->gem_objects);
+	if (ctx->replay == NULL)
+		go->error = gem_objects_init(&go->gem_objects);
 	if (go->error)
 		return;
 
@@ -728,7 +756,7 @@ static void show_gem_objects(struct overlay_context *ctx, struct overlay_gem_obj
 	cairo_pattern_t *linear;
 	int x, y, y1, y2;
 
-	if (go->error == 0)
+	if (go->error == 0 && ctx->replay == NULL)
 		go->error = gem_objects_update(&go->gem_objects);
 	if (go->error)
 		return;
@@ -787,6 +815,191 @@ static void show_gem_objects(struct overlay_context *ctx, struct overlay_gem_obj
 	}
 }
 
+/* the gpu-perf tracepoints number the rings in this order */
+static const char *perf_ring[MAX_RINGS] = { "rcs", "vcs", "bcs", "vecs" };
+
+/*
+ * A process may own several clients. Sum them all into the first one listed
+ * and return 0 for the others, so that each process is exported once.
+ */
+static int sum_gem_objects(struct gem_objects *obj,
+			   struct gem_objects_comm *comm,
+			   unsigned long *bytes, unsigned long *count)
+{
+	struct gem_objects_comm *other;
+
+	for (other = obj->comm; other != comm; other = other->next)
+		if (strcmp(other->name, comm->name) == 0)
+			return 0;
+
+	*bytes = *count = 0;
+	for (; other; other = other->next) {
+		if (strcmp(other->name, comm->name))
+			continue;
+		*bytes += other->bytes;
+		*count += other->count;
+	}
+
+	return 1;
+}
+
+/*
+ * Export the values last sampled by the show functions. The per-client
+ * gpu-perf counters are cleared for every frame, so their running totals
+ * are exported instead.
+ */
+static void update_metrics(struct overlay_context *ctx)
+{
+	struct metrics *m = ctx->metrics;
+	struct gpu_top *gpu_top = &ctx->gpu_top.gpu_top;
+	struct gpu_perf *gpu_perf = &ctx->gpu_perf.gpu_perf;
+	struct overlay_gpu_freq *gf = &ctx->gpu_freq;
+	struct gem_objects *gem_objects = &ctx->gem_objects.gem_objects;
+	char pid[16];
+	int n;
+
+	metrics_begin(m);
+
+	metrics_describe(m, "intel_gpu_cpu_busy_percent", "gauge",
+			 "CPU utilisation");
+	metrics_sample(m, "intel_gpu_cpu_busy_percent",
+		       ctx->gpu_top.cpu_top.busy, NULL);
+
+	if (gpu_top->num_rings) {
+		metrics_describe(m, "intel_gpu_ring_busy_percent", "gauge",
+				 "Time the ring was busy");
+		for (n = 0; n < gpu_top->num_rings; n++)
+			metrics_sample(m, "intel_gpu_ring_busy_percent",
+				       gpu_top->ring[n].u.u.busy,
+				       "ring", gpu_top->ring[n].name, NULL);
+	}
+	if (gpu_top->num_rings && gpu_top->have_wait) {
+		metrics_describe(m, "intel_gpu_ring_wait_percent", "gauge",
+				 "Time the ring waited on an event");
+		for (n = 0; n < gpu_top->num_rings; n++)
+			metrics_sample(m, "intel_gpu_ring_wait_percent",
+				       gpu_top->ring[n].u.u.wait,
+				       "ring", gpu_top->ring[n].name, NULL);
+	}
+	if (gpu_top->num_rings && gpu_top->have_sema) {
+		metrics_describe(m, "intel_gpu_ring_sema_percent", "gauge",
+				 "Time the ring waited on a semaphore");
+		for (n = 0; n < gpu_top->num_rings; n++)
+			metrics_sample(m, "intel_gpu_ring_sema_percent",
+				       gpu_top->ring[n].u.u.sema,
+				       "ring", gpu_top->ring[n].name, NULL);
+	}
+
+	if (gpu_perf->error == NULL) {
+		struct gpu_perf_comm *comm;
+
+		metrics_describe(m, "intel_gpu_client_requests_total", "counter",
+				 "Requests submitted by a process");
+		for (comm = gpu_perf->comm; comm; comm = comm->next) {
+			sprintf(pid, "%d", comm->pid);
+			for (n = 0; n < MAX_RINGS; n++)
+				if (comm->total_requests[n])
+					metrics_sample(m, "intel_gpu_client_requests_total",
+						       comm->total_requests[n],
+						       "comm", comm->name, "pid", pid,
+						       "ring", perf_ring[n], NULL);
+		}
+
+		metrics_describe(m, "intel_gpu_client_wait_seconds_total", "counter",
+				 "Time a process spent waiting for the GPU");
+		for (comm = gpu_perf->comm; comm; comm = comm->next) {
+			sprintf(pid, "%d", comm->pid);
+			metrics_sample(m, "intel_gpu_client_wait_seconds_total",
+				       comm->total_wait_time / 1e9,
+				       "comm", comm->name, "pid", pid, NULL);
+		}
+
+		metrics_describe(m, "intel_gpu_client_semaphores_total", "counter",
+				 "Semaphore waits between rings by a process");
+		for (comm = gpu_perf->comm; comm; comm = comm->next) {
+			sprintf(pid, "%d", comm->pid);
+			metrics_sample(m, "intel_gpu_client_semaphores_total",
+				       comm->total_sema,
+				       "comm", comm->name, "pid", pid, NULL);
+		}
+	}
+
+	if (gf->gpu_freq.error == 0) {
+		metrics_describe(m, "intel_gpu_frequency_mhz", "gauge",
+				 "GPU frequency");
+		metrics_sample(m, "intel_gpu_frequency_mhz", gf->gpu_freq.current,
+			       "type", "current", NULL);
+		metrics_sample(m, "intel_gpu_frequency_mhz", gf->gpu_freq.request,
+			       "type", "request", NULL);
+		metrics_sample(m, "intel_gpu_frequency_mhz", gf->gpu_freq.min,
+			       "type", "min", NULL);
+		metrics_sample(m, "intel_gpu_frequency_mhz", gf->gpu_freq.max,
+			       "type", "max", NULL);
+	}
+
+	if (gf->rc6.error == 0) {
+		metrics_describe(m, "intel_gpu_rc6_residency_percent", "gauge",
+				 "Time spent in each RC6 state");
+		metrics_sample(m, "intel_gpu_rc6_residency_percent", gf->rc6.rc6,
+			       "state", "rc6", NULL);
+		metrics_sample(m, "intel_gpu_rc6_residency_percent", gf->rc6.rc6p,
+			       "state", "rc6p", NULL);
+		metrics_sample(m, "intel_gpu_rc6_residency_percent", gf->rc6.rc6pp,
+			       "state", "rc6pp", NULL);
+	}
+
+	if (gf->power.error == 0) {
+		metrics_describe(m, "intel_gpu_power_watts", "gauge",
+				 "GPU power consumption");
+		metrics_sample(m, "intel_gpu_power_watts",
+			       gf->power.power_mW / 1000., NULL);
+	}
+
+	if (gf->irqs.error == 0) {
+		metrics_describe(m, "intel_gpu_interrupts_total", "counter",
+				 "GPU interrupts");
+		metrics_sample(m, "intel_gpu_interrupts_total",
+			       gf->irqs.count, NULL);
+	}
+
+	if (ctx->gem_objects.error == 0) {
+		struct gem_objects_comm *comm;
+		unsigned long bytes, count;
+
+		metrics_describe(m, "intel_gpu_gem_bytes", "gauge",
+				 "Memory allocated to GEM objects");
+		metrics_sample(m, "intel_gpu_gem_bytes",
+			       gem_objects->total_bytes, NULL);
+		metrics_describe(m, "intel_gpu_gem_objects", "gauge",
+				 "Number of GEM objects");
+		metrics_sample(m, "intel_gpu_gem_objects",
+			       gem_objects->total_count, NULL);
+		metrics_describe(m, "intel_gpu_gem_gtt_bytes", "gauge",
+				 "GEM objects bound into the GTT");
+		metrics_sample(m, "intel_gpu_gem_gtt_bytes",
+			       gem_objects->total_gtt, NULL);
+		metrics_describe(m, "intel_gpu_gem_aperture_bytes", "gauge",
+				 "GEM objects bound into the mappable aperture");
+		metrics_sample(m, "intel_gpu_gem_aperture_bytes",
+			       gem_objects->total_aperture, NULL);
+
+		metrics_describe(m, "intel_gpu_client_gem_bytes", "gauge",
+				 "Memory allocated to GEM objects by a process");
+		for (comm = gem_objects->comm; comm; comm = comm->next)
+			if (sum_gem_objects(gem_objects, comm, &bytes, &count))
+				metrics_sample(m, "intel_gpu_client_gem_bytes", bytes,
+					       "comm", comm->name, NULL);
+		metrics_describe(m, "intel_gpu_client_gem_objects", "gauge",
+				 "Number of GEM objects allocated by a process");
+		for (comm = gem_objects->comm; comm; comm = comm->next)
+			if (sum_gem_objects(gem_objects, comm, &bytes, &count))
+				metrics_sample(m, "intel_gpu_client_gem_objects", count,
+					       "comm", comm->name, NULL);
+	}
+
+	metrics_publish(m);
+}
+
 static int take_snapshot;
 
 static void signal_snapshot(int sig)
@@ -809,6 +1022,645 @@ static int get_sample_period(struct config *config)
 	return 500000;
 }
 
+/* Read the tracepoints from their own thread unless told otherwise */
+static unsigned get_gpu_perf_flags(struct config *config)
+{
+	const char *value;
+
+	value = config_get_value(config, "sampling", "perf-thread");
+	if (value && atoi(value) == 0)
+		return 0;
+
+	return GPU_PERF_THREAD;
+}
+
+/*
+ * Headless recording: the same sources as the overlay, sampled at the same
+ * period, but written out as a time series rather than drawn, so cairo is
+ * never touched.
+ */
+struct overlay_recorder {
+	struct recorder rec;
+
+	struct cpu_top cpu_top;
+	struct gpu_top gpu_top;
+	struct gpu_perf gpu_perf;
+	struct gpu_freq gpu_freq;
+	struct rc6 rc6;
+	struct power power;
+	struct gem_interrupts irqs;
+	struct gem_objects gem_objects;
+
+	/* the channel of each statistic, -1 if not available */
+	struct overlay_recorder_channels {
+		int cpu, cpu_cores, cpu_running;
+		int busy[MAX_RINGS], wait[MAX_RINGS], sema[MAX_RINGS];
+		int requests[MAX_RINGS], wait_time, syncs, flips, ctx_switch;
+		int current, request, min, max;
+		int rc6, rc6p, rc6pp;
+		int power;
+		int interrupts;
+		int gem_bytes, gem_count, gem_gtt, gem_aperture;
+		int gem_max_gtt, gem_max_aperture;
+	} ch;
+};
+
+static volatile int recording = 1;
+
+static void signal_stop(int sig)
+{
+	recording = 0;
+}
+
+static void init_recorder(struct overlay_recorder *r, unsigned perf_flags)
+{
+	struct recorder *rec = &r->rec;
+	char name[32];
+	int n;
+
+	memset(&r->ch, -1, sizeof(r->ch));
+
+	if (cpu_top_init(&r->cpu_top) == 0) {
+		r->ch.cpu = recorder_add_channel(rec, "cpu.busy");
+		r->ch.cpu_cores = recorder_add_channel(rec, "cpu.cores");
+		r->ch.cpu_running = recorder_add_channel(rec, "cpu.running");
+	}
+
+	gpu_top_init(&r->gpu_top);
+	for (n = 0; n < r->gpu_top.num_rings; n++) {
+		sprintf(name, "%s.busy", r->gpu_top.ring[n].name);
+		r->ch.busy[n] = recorder_add_channel(rec, name);
+		if (r->gpu_top.have_wait) {
+			sprintf(name, "%s.wait", r->gpu_top.ring[n].name);
+			r->ch.wait[n] = recorder_add_channel(rec, name);
+		}
+		if (r->gpu_top.have_sema) {
+			sprintf(name, "%s.sema", r->gpu_top.ring[n].name);
+			r->ch.sema[n] = recorder_add_channel(rec, name);
+		}
+	}
+
+	gpu_perf_init(&r->gpu_perf, perf_flags);
+	if (r->gpu_perf.error == NULL) {
+		for (n = 0; n < MAX_RINGS; n++) {
+			sprintf(name, "requests.%s", perf_ring[n]);
+			r->ch.requests[n] = recorder_add_channel(rec, name);
+		}
+		r->ch.wait_time = recorder_add_channel(rec, "waits.us");
+		r->ch.syncs = recorder_add_channel(rec, "syncs");
+		r->ch.flips = recorder_add_channel(rec, "flips");
+		r->ch.ctx_switch = recorder_add_channel(rec, "contexts");
+	}
+
+	if (gpu_freq_init(&r->gpu_freq) == 0) {
+		r->ch.current = recorder_add_channel(rec, "freq.current");
+		r->ch.request = recorder_add_channel(rec, "freq.request");
+		r->ch.min = recorder_add_channel(rec, "freq.min");
+		r->ch.max = recorder_add_channel(rec, "freq.max");
+	}
+
+	if (rc6_init(&r->rc6) == 0) {
+		r->ch.rc6 = recorder_add_channel(rec, "rc6");
+		r->ch.rc6p = recorder_add_channel(rec, "rc6p");
+		r->ch.rc6pp = recorder_add_channel(rec, "rc6pp");
+	}
+
+	if (power_init(&r->power) == 0)
+		r->ch.power = recorder_add_channel(rec, "power.mW");
+
+	if (gem_interrupts_init(&r->irqs) == 0)
+		r->ch.interrupts = recorder_add_channel(rec, "interrupts");
+
+	if (gem_objects_init(&r->gem_objects) == 0) {
+		r->ch.gem_bytes = recorder_add_channel(rec, "gem.bytes");
+		r->ch.gem_count = recorder_add_channel(rec, "gem.objects");
+		r->ch.gem_gtt = recorder_add_channel(rec, "gem.gtt");
+		r->ch.gem_aperture = recorder_add_channel(rec, "gem.aperture");
+		r->ch.gem_max_gtt = recorder_add_channel(rec, "gem.max_gtt");
+		r->ch.gem_max_aperture = recorder_add_channel(rec, "gem.max_aperture");
+	}
+}
+
+static void update_recorder(struct overlay_recorder *r)
+{
+	struct recorder *rec = &r->rec;
+	int n;
+
+	if (r->ch.cpu >= 0 && cpu_top_update(&r->cpu_top) == 0) {
+		recorder_set(rec, r->ch.cpu, r->cpu_top.busy);
+		recorder_set(rec, r->ch.cpu_cores, r->cpu_top.nr_cpu);
+		recorder_set(rec, r->ch.cpu_running, r->cpu_top.nr_running);
+	}
+
+	if (r->gpu_top.num_rings && gpu_top_update(&r->gpu_top)) {
+		for (n = 0; n < r->gpu_top.num_rings; n++) {
+			recorder_set(rec, r->ch.busy[n], r->gpu_top.ring[n].u.u.busy);
+			recorder_set(rec, r->ch.wait[n], r->gpu_top.ring[n].u.u.wait);
+			recorder_set(rec, r->ch.sema[n], r->gpu_top.ring[n].u.u.sema);
+		}
+	}
+
+	if (r->gpu_perf.error == NULL) {
+		struct gpu_perf_comm *comm;
+		uint64_t requests[MAX_RINGS] = {}, wait_time = 0, syncs = 0;
+		uint64_t flips = 0, ctx_switch = 0;
+
+		gpu_perf_update(&r->gpu_perf);
+		for (comm = r->gpu_perf.comm; comm; comm = comm->next) {
+			for (n = 0; n < MAX_RINGS; n++)
+				requests[n] += comm->nr_requests[n];
+			wait_time += comm->wait_time;
+			syncs += comm->nr_sema;
+
+			memset(comm->nr_requests, 0, sizeof(comm->nr_requests));
+			comm->wait_time = 0;
+			comm->nr_sema = 0;
+		}
+		for (n = 0; n < MAX_RINGS; n++) {
+			flips += r->gpu_perf.flip_complete[n];
+			ctx_switch += r->gpu_perf.ctx_switch[n];
+		}
+		memset(r->gpu_perf.flip_complete, 0, sizeof(r->gpu_perf.flip_complete));
+		memset(r->gpu_perf.ctx_switch, 0, sizeof(r->gpu_perf.ctx_switch));
+
+		for (n = 0; n < MAX_RINGS; n++)
+			recorder_set(rec, r->ch.requests[n], requests[n]);
+		recorder_set(rec, r->ch.wait_time, wait_time / 1000);
+		recorder_set(rec, r->ch.syncs, syncs);
+		recorder_set(rec, r->ch.flips, flips);
+		recorder_set(rec, r->ch.ctx_switch, ctx_switch);
+	}
+
+	if (r->ch.current >= 0 && gpu_freq_update(&r->gpu_freq) == 0) {
+		recorder_set(rec, r->ch.current, r->gpu_freq.current);
+		recorder_set(rec, r->ch.request, r->gpu_freq.request);
+		recorder_set(rec, r->ch.min, r->gpu_freq.min);
+		recorder_set(rec, r->ch.max, r->gpu_freq.max);
+	}
+
+	if (r->ch.rc6 >= 0 && rc6_update(&r->rc6) == 0) {
+		recorder_set(rec, r->ch.rc6, r->rc6.rc6);
+		recorder_set(rec, r->ch.rc6p, r->rc6.rc6p);
+		recorder_set(rec, r->ch.rc6pp, r->rc6.rc6pp);
+	}
+
+	if (r->ch.power >= 0 && power_update(&r->power) == 0)
+		recorder_set(rec, r->ch.power, r->power.power_mW);
+
+	if (r->ch.interrupts >= 0 && gem_interrupts_update(&r->irqs) == 0)
+		recorder_set(rec, r->ch.interrupts, r->irqs.delta);
+
+	if (r->ch.gem_bytes >= 0 && gem_objects_update(&r->gem_objects) == 0) {
+		recorder_set(rec, r->ch.gem_bytes, r->gem_objects.total_bytes);
+		recorder_set(rec, r->ch.gem_count, r->gem_objects.total_count);
+		recorder_set(rec, r->ch.gem_gtt, r->gem_objects.total_gtt);
+		recorder_set(rec, r->ch.gem_aperture, r->gem_objects.total_aperture);
+		recorder_set(rec, r->ch.gem_max_gtt, r->gem_objects.max_gtt);
+		recorder_set(rec, r->ch.gem_max_aperture, r->gem_objects.max_aperture);
+	}
+}
+
+static int overlay_record(struct config *config, const char *path, int daemonize)
+{
+	struct overlay_recorder r;
+	struct timespec next, now;
+	int sample_period, ret;
+
+	memset(&r, 0, sizeof(r));
+	ret = recorder_open(&r.rec, path);
+	if (ret) {
+		fprintf(stderr, "Unable to open %s for recording: %s\n",
+			path, strerror(ret));
+		return ret;
+	}
+
+	if (daemonize && daemon(0, 0))
+		return EINVAL;
+
+	signal(SIGINT, signal_stop);
+	signal(SIGTERM, signal_stop);
+
+	debugfs_init();
+	init_recorder(&r, get_gpu_perf_flags(config));
+
+	sample_period = get_sample_period(config);
+
+	/* keep to the period however long sampling takes */
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (recording) {
+		update_recorder(&r);
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		ret = recorder_write(&r.rec, now.tv_sec * 1000LL + now.tv_nsec / 1000000);
+		if (ret)
+			break;
+
+		next.tv_nsec += sample_period * 1000LL;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	gpu_perf_stop_thread(&r.gpu_perf);
+	recorder_close(&r.rec);
+	return ret;
+}
+
+static void overlay_render(struct overlay_context *ctx)
+{
+	char buf[80];
+	cairo_text_extents_t extents;
+
+	ctx->cr = cairo_create(ctx->surface);
+	cairo_set_operator(ctx->cr, CAIRO_OPERATOR_CLEAR);
+	cairo_paint(ctx->cr);
+	cairo_set_operator(ctx->cr, CAIRO_OPERATOR_OVER);
+
+	show_gpu_top(ctx, &ctx->gpu_top);
+	show_gpu_perf(ctx, &ctx->gpu_perf);
+	show_gpu_freq(ctx, &ctx->gpu_freq);
+	show_gem_objects(ctx, &ctx->gem_objects);
+
+	gethostname(buf, sizeof(buf));
+	cairo_set_source_rgb(ctx->cr, .5, .5, .5);
+	cairo_set_font_size(ctx->cr, PAD-2);
+	cairo_text_extents(ctx->cr, buf, &extents);
+	cairo_move_to(ctx->cr,
+		      (ctx->width-extents.width)/2.,
+		      1+extents.height);
+	cairo_show_text(ctx->cr, buf);
+
+	cairo_destroy(ctx->cr);
+}
+
+/*
+ * Offline replay of a recording through the show functions into an image
+ * surface, as fast as possible, so that rendering can be timed and checked
+ * on any machine. The sources are filled in from the recording instead of
+ * being sampled; gpu-perf only has its counters summed over all processes
+ * recorded, so those are replayed as the tracepoints of a single client.
+ */
+#define REPLAY_PID 1
+
+struct overlay_replay {
+	struct recorder rec;
+	struct overlay_recorder_channels ch;
+	char ring_name[MAX_RINGS][32];
+	int64_t time; /* of the next record, -1 at the end */
+	uint32_t seqno;
+};
+
+static int replay_open(struct overlay_context *ctx,
+		       struct overlay_replay *r,
+		       const char *path)
+{
+	struct recorder *rec = &r->rec;
+	struct gpu_top *gpu_top = &ctx->gpu_top.gpu_top;
+	struct gpu_perf *gpu_perf = &ctx->gpu_perf.gpu_perf;
+	struct overlay_gpu_freq *gf = &ctx->gpu_freq;
+	char name[48];
+	int n, ret;
+
+	ret = recorder_open_read(rec, path);
+	if (ret)
+		return ret;
+
+	memset(&r->ch, -1, sizeof(r->ch));
+	r->seqno = 0;
+
+	r->ch.cpu = recorder_find_channel(rec, "cpu.busy");
+	r->ch.cpu_cores = recorder_find_channel(rec, "cpu.cores");
+	r->ch.cpu_running = recorder_find_channel(rec, "cpu.running");
+
+	/* the rings are the ones recorded, named as they were */
+	for (n = 0; n < rec->nr_channels && gpu_top->num_rings < MAX_RINGS; n++) {
+		const char *suffix = strrchr(rec->name[n], '.');
+		int ring = gpu_top->num_rings;
+
+		if (strncmp(rec->name[n], "cpu.", 4) == 0 ||
+		    suffix == NULL || strcmp(suffix, ".busy"))
+			continue;
+
+		snprintf(r->ring_name[ring], sizeof(r->ring_name[ring]), "%.*s",
+			 (int)(suffix - rec->name[n]), rec->name[n]);
+		gpu_top->ring[ring].name = r->ring_name[ring];
+		r->ch.busy[ring] = n;
+
+		sprintf(name, "%s.wait", r->ring_name[ring]);
+		r->ch.wait[ring] = recorder_find_channel(rec, name);
+		if (r->ch.wait[ring] >= 0)
+			gpu_top->have_wait = 1;
+
+		sprintf(name, "%s.sema", r->ring_name[ring]);
+		r->ch.sema[ring] = recorder_find_channel(rec, name);
+		if (r->ch.sema[ring] >= 0)
+			gpu_top->have_sema = 1;
+
+		gpu_top->num_rings++;
+	}
+
+	gpu_perf_init_replay(gpu_perf);
+	for (n = 0; n < MAX_RINGS; n++) {
+		sprintf(name, "requests.%s", perf_ring[n]);
+		r->ch.requests[n] = recorder_find_channel(rec, name);
+	}
+	r->ch.wait_time = recorder_find_channel(rec, "waits.us");
+	r->ch.syncs = recorder_find_channel(rec, "syncs");
+	r->ch.flips = recorder_find_channel(rec, "flips");
+	r->ch.ctx_switch = recorder_find_channel(rec, "contexts");
+	if (gpu_perf->error == NULL && r->ch.requests[0] < 0)
+		gpu_perf->error = "No perf data recorded";
+
+	r->ch.current = recorder_find_channel(rec, "freq.current");
+	r->ch.request = recorder_find_channel(rec, "freq.request");
+	r->ch.min = recorder_find_channel(rec, "freq.min");
+	r->ch.max = recorder_find_channel(rec, "freq.max");
+	gf->gpu_freq.error = r->ch.current < 0 ? ENOENT : 0;
+
+	r->ch.rc6 = recorder_find_channel(rec, "rc6");
+	r->ch.rc6p = recorder_find_channel(rec, "rc6p");
+	r->ch.rc6pp = recorder_find_channel(rec, "rc6pp");
+	gf->rc6.error = r->ch.rc6 < 0 ? ENOENT : 0;
+
+	r->ch.power = recorder_find_channel(rec, "power.mW");
+	gf->power.error = r->ch.power < 0 ? ENOENT : 0;
+
+	r->ch.interrupts = recorder_find_channel(rec, "interrupts");
+	gf->irqs.error = r->ch.interrupts < 0 ? ENOENT : 0;
+
+	r->ch.gem_bytes = recorder_find_channel(rec, "gem.bytes");
+	r->ch.gem_count = recorder_find_channel(rec, "gem.objects");
+	r->ch.gem_gtt = recorder_find_channel(rec, "gem.gtt");
+	r->ch.gem_aperture = recorder_find_channel(rec, "gem.aperture");
+	r->ch.gem_max_gtt = recorder_find_channel(rec, "gem.max_gtt");
+	r->ch.gem_max_aperture = recorder_find_channel(rec, "gem.max_aperture");
+	ctx->gem_objects.error = r->ch.gem_bytes < 0 ? ENOENT : 0;
+
+	/* the charts are scaled by the limits, so have them before init */
+	r->time = recorder_read(rec);
+	gf->gpu_freq.min = recorder_get(rec, r->ch.min);
+	gf->gpu_freq.max = recorder_get(rec, r->ch.max);
+	ctx->gem_objects.gem_objects.max_gtt = recorder_get(rec, r->ch.gem_max_gtt);
+	ctx->gem_objects.gem_objects.max_aperture = recorder_get(rec, r->ch.gem_max_aperture);
+
+	return 0;
+}
+
+static void replay_event(struct gpu_perf *gp, enum gpu_perf_event_id id,
+			 uint64_t time, uint32_t ring, uint32_t seqno, int count)
+{
+	union {
+		struct gpu_perf_event sample;
+		uint64_t pad[8];
+	} event;
+
+	memset(&event, 0, sizeof(event));
+	event.sample.header.type = PERF_RECORD_SAMPLE;
+	event.sample.header.size = offsetof(struct gpu_perf_event, raw[3]);
+	event.sample.raw_size = 3 * sizeof(uint32_t);
+	event.sample.pid = REPLAY_PID;
+	event.sample.time = time;
+	event.sample.id = id;
+	event.sample.raw[0] = ring;
+	event.sample.raw[1] = ring;
+	event.sample.raw[2] = seqno;
+
+	while (count-- > 0)
+		gpu_perf_replay(gp, &event.sample);
+}
+
+static void replay_gpu_perf(struct overlay_context *ctx,
+			    struct overlay_replay *r, int64_t time_ms)
+{
+	struct gpu_perf *gp = &ctx->gpu_perf.gpu_perf;
+	struct recorder *rec = &r->rec;
+	uint64_t time = time_ms * 1000000;
+	uint64_t wait = recorder_get(rec, r->ch.wait_time) * 1000;
+	struct gpu_perf_comm *comm;
+	int n;
+
+	for (n = 0; n < MAX_RINGS; n++)
+		replay_event(gp, GPU_PERF_REQUEST_ADD, time, n, ++r->seqno,
+			     recorder_get(rec, r->ch.requests[n]));
+
+	if (wait) {
+		replay_event(gp, GPU_PERF_WAIT_BEGIN,
+			     time > wait ? time - wait : 0, 0, r->seqno, 1);
+		replay_event(gp, GPU_PERF_WAIT_END, time, 0, r->seqno, 1);
+	}
+
+	replay_event(gp, GPU_PERF_RING_SYNC, time, 0, 0,
+		     recorder_get(rec, r->ch.syncs));
+	replay_event(gp, GPU_PERF_FLIP_COMPLETE, time, 0, 0,
+		     recorder_get(rec, r->ch.flips));
+	replay_event(gp, GPU_PERF_CTX_SWITCH, time, 0, 0,
+		     recorder_get(rec, r->ch.ctx_switch));
+
+	for (comm = gp->comm; comm; comm = comm->next)
+		if (comm->pid == REPLAY_PID)
+			strcpy(comm->name, "all clients");
+}
+
+/* Fills in the sources from the next record, returns 0 at the end */
+static int replay_frame(struct overlay_context *ctx, struct overlay_replay *r)
+{
+	struct recorder *rec = &r->rec;
+	struct gpu_top *gpu_top = &ctx->gpu_top.gpu_top;
+	struct overlay_gpu_freq *gf = &ctx->gpu_freq;
+	struct gem_objects *gem_objects = &ctx->gem_objects.gem_objects;
+	int n;
+
+	if (r->time < 0)
+		return 0;
+
+	ctx->time = r->time / 1000;
+
+	ctx->gpu_top.cpu_top.busy = recorder_get(rec, r->ch.cpu);
+	ctx->gpu_top.cpu_top.nr_cpu = recorder_get(rec, r->ch.cpu_cores);
+	ctx->gpu_top.cpu_top.nr_running = recorder_get(rec, r->ch.cpu_running);
+	for (n = 0; n < gpu_top->num_rings; n++) {
+		gpu_top->ring[n].u.u.busy = recorder_get(rec, r->ch.busy[n]);
+		gpu_top->ring[n].u.u.wait = recorder_get(rec, r->ch.wait[n]);
+		gpu_top->ring[n].u.u.sema = recorder_get(rec, r->ch.sema[n]);
+	}
+
+	if (ctx->gpu_perf.gpu_perf.error == NULL)
+		replay_gpu_perf(ctx, r, r->time);
+
+	gf->gpu_freq.current = recorder_get(rec, r->ch.current);
+	gf->gpu_freq.request = recorder_get(rec, r->ch.request);
+	gf->gpu_freq.min = recorder_get(rec, r->ch.min);
+	gf->gpu_freq.max = recorder_get(rec, r->ch.max);
+
+	gf->rc6.rc6 = recorder_get(rec, r->ch.rc6);
+	gf->rc6.rc6p = recorder_get(rec, r->ch.rc6p);
+	gf->rc6.rc6pp = recorder_get(rec, r->ch.rc6pp);
+	n = gf->rc6.rc6 + gf->rc6.rc6p + gf->rc6.rc6pp;
+	gf->rc6.rc6_combined = n < 100 ? n : 100;
+
+	gf->power.power_mW = recorder_get(rec, r->ch.power);
+	gf->power.new_sample = 1;
+
+	gf->irqs.delta = recorder_get(rec, r->ch.interrupts);
+
+	gem_objects->total_bytes = recorder_get(rec, r->ch.gem_bytes);
+	gem_objects->total_count = recorder_get(rec, r->ch.gem_count);
+	gem_objects->total_gtt = recorder_get(rec, r->ch.gem_gtt);
+	gem_objects->total_aperture = recorder_get(rec, r->ch.gem_aperture);
+	gem_objects->max_gtt = recorder_get(rec, r->ch.gem_max_gtt);
+	gem_objects->max_aperture = recorder_get(rec, r->ch.gem_max_aperture);
+
+	r->time = recorder_read(rec);
+	return 1;
+}
+
+/* The frames are named by a printf pattern, with no more than one %d */
+static int valid_frame_pattern(const char *pattern)
+{
+	int count = 0;
+
+	while ((pattern = strchr(pattern, '%')) != NULL) {
+		pattern++;
+		if (*pattern == '%') {
+			pattern++;
+			continue;
+		}
+
+		pattern += strspn(pattern, "0123456789");
+		if (*pattern != 'd' || count++)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Expands the %d of a pattern accepted by valid_frame_pattern() */
+static void frame_path(char *path, size_t size, const char *pattern, int frame)
+{
+	size_t len = 0;
+	int width, zero, n;
+
+	while (*pattern && len + 1 < size) {
+		if (*pattern != '%' || *++pattern == '%') {
+			path[len++] = *pattern++;
+			continue;
+		}
+
+		zero = *pattern == '0';
+		width = atoi(pattern);
+		pattern += strspn(pattern, "0123456789") + 1;
+
+		n = snprintf(path + len, size - len,
+			     zero ? "%0*d" : "%*d", width, frame);
+		len = n < (int)(size - len) ? len + n : size - 1;
+	}
+	path[len] = '\0';
+}
+
+static int write_frame(cairo_surface_t *surface, const char *output, int frame)
+{
+	char path[1024];
+
+	if (strcmp(output, "-") == 0) {
+		/* raw frames, e.g. for ffmpeg -f rawvideo -pix_fmt bgra */
+		size_t size = cairo_image_surface_get_stride(surface) *
+			cairo_image_surface_get_height(surface);
+
+		if (fwrite(cairo_image_surface_get_data(surface), size, 1, stdout) != 1)
+			return EIO;
+
+		return 0;
+	}
+
+	frame_path(path, sizeof(path), output, frame);
+	if (cairo_surface_write_to_png(surface, path) != CAIRO_STATUS_SUCCESS)
+		return EIO;
+
+	return 0;
+}
+
+static int overlay_replay(struct config *config, const char *path,
+			  const char *output)
+{
+	struct overlay_context ctx;
+	struct overlay_replay r;
+	struct timespec start, end;
+	double elapsed, total = 0, min = 0, max = 0;
+	const char *size;
+	int frame, ret;
+
+	if (output && strcmp(output, "-") && !valid_frame_pattern(output)) {
+		fprintf(stderr, "Invalid output %s, expected a filename with at most one %%d\n",
+			output);
+		return EINVAL;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.width = 640;
+	ctx.height = 236;
+
+	size = config_get_value(config, "window", "size");
+	if (size && sscanf(size, "%dx%d", &ctx.width, &ctx.height) != 2) {
+		fprintf(stderr, "Invalid size %s, expected <width>x<height>\n", size);
+		return EINVAL;
+	}
+
+	ret = replay_open(&ctx, &r, path);
+	if (ret) {
+		fprintf(stderr, "Unable to replay %s: %s\n", path, strerror(ret));
+		return ret;
+	}
+	ctx.replay = &r;
+
+	ctx.surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						 ctx.width, ctx.height);
+	if (cairo_surface_status(ctx.surface)) {
+		recorder_close(&r.rec);
+		return ENOMEM;
+	}
+
+	init_gpu_top(&ctx, &ctx.gpu_top);
+	init_gpu_perf(&ctx, &ctx.gpu_perf, 0);
+	init_gpu_freq(&ctx, &ctx.gpu_freq);
+	init_gem_objects(&ctx, &ctx.gem_objects);
+
+	for (frame = 0; replay_frame(&ctx, &r); frame++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		overlay_render(&ctx);
+		cairo_surface_flush(ctx.surface);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		elapsed = (end.tv_sec - start.tv_sec) * 1e3 +
+			(end.tv_nsec - start.tv_nsec) * 1e-6;
+		if (frame == 0 || elapsed < min)
+			min = elapsed;
+		if (elapsed > max)
+			max = elapsed;
+		total += elapsed;
+
+		fprintf(stderr, "frame %d: %.3fms\n", frame, elapsed);
+
+		if (output) {
+			ret = write_frame(ctx.surface, output, frame);
+			if (ret) {
+				fprintf(stderr, "Unable to write frame %d: %s\n",
+					frame, strerror(ret));
+				break;
+			}
+		}
+	}
+
+	if (frame)
+		fprintf(stderr, "%d frames, render time avg %.3fms, min %.3fms, max %.3fms\n",
+			frame, total / frame, min, max);
+
+	cairo_surface_destroy(ctx.surface);
+	recorder_close(&r.rec);
+	return ret;
+}
+
 static void overlay_snapshot(struct overlay_context *ctx)
 {
 	char buf[1024];
@@ -824,6 +1676,11 @@ static void usage(const char *progname)
 	printf("\t--geometry|-G <width>x<height>+<x-offset>+<y-offset>\tExact window placement and size\n");
 	printf("\t--position|-P (top|middle|bottom)-(left|centre|right)\tPlace the window in a particular corner\n");
 	printf("\t--size|-S <width>x<height> | <scale>%%\t\t\tWindow size\n");
+	printf("\t--record|-r <filename>\t\t\t\t\tRecord the statistics to a file instead of displaying them\n");
+	printf("\t--csv <filename>\t\t\t\t\tConvert a recording to CSV on stdout\n");
+	printf("\t--metrics <port> | unix:<path>\t\t\t\tServe Prometheus metrics on a loopback port or unix socket\n");
+	printf("\t--replay <filename>\t\t\t\t\tRender a recording offline, timing each frame\n");
+	printf("\t--output|-o <pattern.png> | -\t\t\t\tWrite the replayed frames as PNGs, or raw BGRA to stdout\n");
 	printf("\t--help|-h\t\t\t\t\t\tThis help message\n");
 }
 
@@ -834,19 +1691,28 @@ int main(int argc, char **argv)
 		{"geometry", 1, 0, 'G'},
 		{"position", 1, 0, 'P'},
 		{"size", 1, 0, 'S'},
+		{"record", 1, 0, 'r'},
+		{"csv", 1, 0, 'C'},
+		{"metrics", 1, 0, 'M'},
+		{"replay", 1, 0, 'R'},
+		{"output", 1, 0, 'o'},
 		{"help", 0, 0, 'h'},
 		{NULL, 0, 0, 0,}
 	};
 	struct overlay_context ctx;
 	struct config config;
+	struct metrics metrics;
+	const char *metrics_address;
 	int index, sample_period;
 	int daemonize = 1, renice = 0;
+	const char *record = NULL;
+	const char *replay = NULL, *output = NULL;
 	int i;
 
 	config_init(&config);
 
 	opterr = 0;
-	while ((i = getopt_long(argc, argv, "c:fhn?", long_options, &index)) != -1) {
+	while ((i = getopt_long(argc, argv, "c:fhno:r:?", long_options, &index)) != -1) {
 		switch (i) {
 		case 'c':
 			config_parse_string(&config, optarg);
@@ -863,6 +1729,24 @@ int main(int argc, char **argv)
 		case 'f':
 			daemonize = 0;
 			break;
+		case 'r':
+			record = optarg;
+			break;
+		case 'M':
+			config_set_value(&config, "metrics", "listen", optarg);
+			break;
+		case 'R':
+			replay = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'C':
+			i = recorder_to_csv(optarg, stdout);
+			if (i)
+				fprintf(stderr, "Unable to convert %s: %s\n",
+					optarg, strerror(i));
+			return i;
 		case 'n':
 			renice = -20;
 			if (optarg)
@@ -879,6 +1763,15 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	if (replay)
+		return overlay_replay(&config, replay, output);
+
+	if (record) {
+		if (renice)
+			nice(renice);
+		return overlay_record(&config, record, daemonize);
+	}
+
 	ctx.width = 640;
 	ctx.height = 236;
 	ctx.surface = NULL;
@@ -891,9 +1784,25 @@ int main(int argc, char **argv)
 	if (ctx.surface == NULL)
 		return ENOMEM;
 
+	ctx.metrics = NULL;
+	metrics_address = config_get_value(&config, "metrics", "listen");
+	if (metrics_address) {
+		i = metrics_init(&metrics, metrics_address);
+		if (i) {
+			fprintf(stderr, "Unable to serve metrics on %s: %s\n",
+				metrics_address, strerror(i));
+			return i;
+		}
+		ctx.metrics = &metrics;
+	}
+
 	if (daemonize && daemon(0, 0))
 		return EINVAL;
 
+	/* only now, the server thread would not survive daemon() */
+	if (ctx.metrics && metrics_start(ctx.metrics))
+		ctx.metrics = NULL;
+
 	if (renice)
 		nice(renice);
 
@@ -902,7 +1811,7 @@ int main(int argc, char **argv)
 	debugfs_init();
 
 	init_gpu_top(&ctx, &ctx.gpu_top);
-	init_gpu_perf(&ctx, &ctx.gpu_perf);
+	init_gpu_perf(&ctx, &ctx.gpu_perf, get_gpu_perf_flags(&config));
 	init_gpu_freq(&ctx, &ctx.gpu_freq);
 	init_gem_objects(&ctx, &ctx.gem_objects);
 
@@ -912,30 +1821,10 @@ int main(int argc, char **argv)
 	while (1) {
 		ctx.time = time(NULL);
 
-		ctx.cr = cairo_create(ctx.surface);
-		cairo_set_operator(ctx.cr, CAIRO_OPERATOR_CLEAR);
-		cairo_paint(ctx.cr);
-		cairo_set_operator(ctx.cr, CAIRO_OPERATOR_OVER);
-
-		show_gpu_top(&ctx, &ctx.gpu_top);
-		show_gpu_perf(&ctx, &ctx.gpu_perf);
-		show_gpu_freq(&ctx, &ctx.gpu_freq);
-		show_gem_objects(&ctx, &ctx.gem_objects);
-
-		{
-			char buf[80];
-			cairo_text_extents_t extents;
-			gethostname(buf, sizeof(buf));
-			cairo_set_source_rgb(ctx.cr, .5, .5, .5);
-			cairo_set_font_size(ctx.cr, PAD-2);
-			cairo_text_extents(ctx.cr, buf, &extents);
-			cairo_move_to(ctx.cr,
-				      (ctx.width-extents.width)/2.,
-				      1+extents.height);
-			cairo_show_text(ctx.cr, buf);
-		}
+		overlay_render(&ctx);
 
-		cairo_destroy(ctx.cr);
+		if (ctx.metrics)
+			update_metrics(&ctx);
 
 		overlay_show(ctx.surface);
 
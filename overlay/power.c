@@ -54,54 +54,23 @@ static int perf_open(void)
 
 int power_init(struct power *power)
 {
-	char buf[4096];
-	int fd, len;
-
 	memset(power, 0, sizeof(*power));
 
 	power->fd = perf_open();
 	if (power->fd != -1)
 		return 0;
 
-	sprintf(buf, "%s/i915_energy_uJ", debugfs_dri_path);
-	fd = open(buf, 0);
-	if (fd < 0)
-		return power->error = errno;
-
-	len = read(fd, buf, sizeof(buf));
-	close(fd);
-
-	if (len < 0)
-		return power->error = errno;
+	power->error = sampled_file_open(&power->energy, "%s/i915_energy_uJ",
+					 debugfs_dri_path);
+	if (power->error)
+		return power->error;
 
-	buf[len] = '\0';
-	if (strtoull(buf, 0, 0) == 0)
+	if (sampled_file_read_u64(&power->energy) == 0)
 		return power->error = EINVAL;
 
 	return 0;
 }
 
-static uint64_t file_to_u64(const char *name)
-{
-	char buf[4096];
-	int fd, len;
-
-	sprintf(buf, "%s/%s", debugfs_dri_path, name);
-	fd = open(buf, 0);
-	if (fd < 0)
-		return 0;
-
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-
-	if (len < 0)
-		return 0;
-
-	buf[len] = '\0';
-
-	return strtoull(buf, 0, 0);
-}
-
 static uint64_t clock_ms_to_u64(void)
 {
 	struct timespec tv;
@@ -132,7 +101,7 @@ int power_update(struct power *power)
 		s->energy = data[0];
 		s->timestamp = data[1] / (1000*1000);
 	} else {
-		s->energy = file_to_u64("i915_energy_uJ");
+		s->energy = sampled_file_read_u64(&power->energy);
 		s->timestamp = clock_ms_to_u64();
 	}
 
@@ -27,6 +27,8 @@
 
 #include <stdint.h>
 
+#include "sampled-file.h"
+
 struct power {
 	struct power_stat {
 		uint64_t energy;
@@ -34,6 +36,7 @@ struct power {
 	} stat[2];
 
 	int fd;
+	struct sampled_file energy;
 	int error;
 	int count;
 	int new_sample;
@@ -83,31 +83,22 @@ int rc6_init(struct rc6 *rc6)
 		struct stat st;
 		if (stat("/sys/class/drm/card0/power", &st) < 0)
 			return rc6->error = errno;
+
+		/* rc6p and rc6pp only exist on some platforms */
+		if (sampled_file_open(&rc6->rc6_file,
+				      "/sys/class/drm/card0/power/rc6_residency_ms") == 0)
+			rc6->flags |= RC6;
+		if (sampled_file_open(&rc6->rc6p_file,
+				      "/sys/class/drm/card0/power/rc6p_residency_ms") == 0)
+			rc6->flags |= RC6p;
+		if (sampled_file_open(&rc6->rc6pp_file,
+				      "/sys/class/drm/card0/power/rc6pp_residency_ms") == 0)
+			rc6->flags |= RC6pp;
 	}
 
 	return 0;
 }
 
-static uint64_t file_to_u64(const char *path)
-{
-	char buf[4096];
-	int fd, len;
-
-	fd = open(path, 0);
-	if (fd < 0)
-		return -1;
-
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-
-	if (len < 0)
-		return -1;
-
-	buf[len] = '\0';
-
-	return strtoull(buf, 0, 0);
-}
-
 static uint64_t clock_ms_to_u64(void)
 {
 	struct timespec tv;
@@ -128,14 +119,17 @@ int rc6_update(struct rc6 *rc6)
 		return rc6->error;
 
 	if (rc6->fd == -1) {
-		struct stat st;
+		char buf[64];
 
-		if (stat("/sys/class/drm/card0/power/rc6_residency_ms", &st) < 0)
+		if (!(rc6->flags & RC6) ||
+		    sampled_file_read(&rc6->rc6_file, buf, sizeof(buf)) < 0)
 			return rc6->error = ENOENT;
 
-		s->rc6_residency = file_to_u64("/sys/class/drm/card0/power/rc6_residency_ms");
-		s->rc6p_residency = file_to_u64("/sys/class/drm/card0/power/rc6p_residency_ms");
-		s->rc6pp_residency = file_to_u64("/sys/class/drm/card0/power/rc6pp_residency_ms");
+		s->rc6_residency = strtoull(buf, 0, 0);
+		if (rc6->flags & RC6p)
+			s->rc6p_residency = sampled_file_read_u64(&rc6->rc6p_file);
+		if (rc6->flags & RC6pp)
+			s->rc6pp_residency = sampled_file_read_u64(&rc6->rc6pp_file);
 		s->timestamp = clock_ms_to_u64();
 	} else {
 		uint64_t data[5];
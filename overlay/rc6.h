@@ -27,6 +27,8 @@
 
 #include <stdint.h>
 
+#include "sampled-file.h"
+
 struct rc6 {
 	struct rc6_stat {
 		uint64_t rc6_residency;
@@ -36,6 +38,7 @@ struct rc6 {
 	} stat[2];
 
 	int fd;
+	struct sampled_file rc6_file, rc6p_file, rc6pp_file;
 	int count;
 	int error;
 
@@ -0,0 +1,232 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "recorder.h"
+
+#define MAGIC "IGTOVLY1"
+
+static void put_varint(FILE *file, int64_t value)
+{
+	uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+
+	while (v >= 0x80) {
+		putc(v | 0x80, file);
+		v >>= 7;
+	}
+	putc(v, file);
+}
+
+static int get_varint(FILE *file, int64_t *value)
+{
+	uint64_t v = 0;
+	int shift, c;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		c = getc(file);
+		if (c == EOF)
+			return 0;
+
+		v |= (uint64_t)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0) {
+			*value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int recorder_open(struct recorder *rec, const char *path)
+{
+	memset(rec, 0, sizeof(*rec));
+
+	rec->file = fopen(path, "w");
+	if (rec->file == NULL)
+		return errno;
+
+	return 0;
+}
+
+/* Returns the new channel, or -1 when there is no room for it */
+int recorder_add_channel(struct recorder *rec, const char *name)
+{
+	if (rec->started || rec->nr_channels == RECORDER_MAX_CHANNELS)
+		return -1;
+
+	snprintf(rec->name[rec->nr_channels], sizeof(rec->name[0]), "%s", name);
+	return rec->nr_channels++;
+}
+
+void recorder_set(struct recorder *rec, int channel, int64_t value)
+{
+	if (channel >= 0)
+		rec->value[channel] = value;
+}
+
+/* Channels that were not set since the last record keep their value */
+int recorder_write(struct recorder *rec, int64_t time_ms)
+{
+	int n;
+
+	if (!rec->started) {
+		fputs(MAGIC, rec->file);
+		put_varint(rec->file, time_ms);
+		put_varint(rec->file, rec->nr_channels);
+		for (n = 0; n < rec->nr_channels; n++)
+			fwrite(rec->name[n], strlen(rec->name[n]) + 1, 1, rec->file);
+
+		rec->last_time = time_ms;
+		rec->started = 1;
+	}
+
+	put_varint(rec->file, time_ms - rec->last_time);
+	rec->last_time = time_ms;
+
+	for (n = 0; n < rec->nr_channels; n++) {
+		put_varint(rec->file, rec->value[n] - rec->last[n]);
+		rec->last[n] = rec->value[n];
+	}
+
+	/* a record at a time, so that a killed recorder loses at most one */
+	if (fflush(rec->file))
+		return errno;
+
+	return 0;
+}
+
+void recorder_close(struct recorder *rec)
+{
+	if (rec->file)
+		fclose(rec->file);
+	rec->file = NULL;
+}
+
+/* Opens a recording for recorder_read(), leaving its channel names in @rec */
+int recorder_open_read(struct recorder *rec, const char *path)
+{
+	int64_t count;
+	char magic[8];
+	int n, m, c;
+
+	memset(rec, 0, sizeof(*rec));
+
+	rec->file = fopen(path, "r");
+	if (rec->file == NULL)
+		return errno;
+
+	if (fread(magic, sizeof(magic), 1, rec->file) != 1 ||
+	    memcmp(magic, MAGIC, sizeof(magic)) ||
+	    !get_varint(rec->file, &rec->last_time) ||
+	    !get_varint(rec->file, &count) ||
+	    count < 0 || count > RECORDER_MAX_CHANNELS)
+		goto invalid;
+
+	for (n = 0; n < count; n++) {
+		for (m = 0; (c = getc(rec->file)) != '\0'; m++) {
+			if (c == EOF || m == sizeof(rec->name[n]) - 1)
+				goto invalid;
+			rec->name[n][m] = c;
+		}
+		rec->name[n][m] = '\0';
+	}
+
+	rec->nr_channels = count;
+	rec->started = 1;
+	return 0;
+
+invalid:
+	recorder_close(rec);
+	return EINVAL;
+}
+
+int recorder_find_channel(const struct recorder *rec, const char *name)
+{
+	int n;
+
+	for (n = 0; n < rec->nr_channels; n++)
+		if (strcmp(rec->name[n], name) == 0)
+			return n;
+
+	return -1;
+}
+
+/*
+ * Reads the next record into rec->value, returning its time, or -1 at the
+ * end of the recording. A truncated record at the end is from a recorder
+ * being killed and is ignored.
+ */
+int64_t recorder_read(struct recorder *rec)
+{
+	int64_t delta[RECORDER_MAX_CHANNELS], time;
+	int n;
+
+	if (!get_varint(rec->file, &time))
+		return -1;
+
+	for (n = 0; n < rec->nr_channels; n++) {
+		if (!get_varint(rec->file, &delta[n]))
+			return -1;
+	}
+
+	for (n = 0; n < rec->nr_channels; n++)
+		rec->value[n] += delta[n];
+
+	return rec->last_time += time;
+}
+
+int64_t recorder_get(const struct recorder *rec, int channel)
+{
+	return channel >= 0 ? rec->value[channel] : 0;
+}
+
+int recorder_to_csv(const char *path, FILE *out)
+{
+	struct recorder rec;
+	int64_t time;
+	int n, ret;
+
+	ret = recorder_open_read(&rec, path);
+	if (ret)
+		return ret;
+
+	fprintf(out, "time");
+	for (n = 0; n < rec.nr_channels; n++)
+		fprintf(out, ",%s", rec.name[n]);
+	fprintf(out, "\n");
+
+	while ((time = recorder_read(&rec)) >= 0) {
+		fprintf(out, "%lld.%03lld", (long long)(time / 1000), (long long)(time % 1000));
+		for (n = 0; n < rec.nr_channels; n++)
+			fprintf(out, ",%lld", (long long)rec.value[n]);
+		fprintf(out, "\n");
+	}
+
+	recorder_close(&rec);
+	return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define RECORDER_MAX_CHANNELS 64
+
+/*
+ * A time series of integer channels, written as
+ *
+ *	"IGTOVLY1", start time (ms since the epoch), number of channels,
+ *	the channel names, NUL-terminated,
+ *
+ * followed by one record per sample: the time since the previous record
+ * in ms and then every channel's change from its previous value, all as
+ * zigzag LEB128 varints. Most channels change little or not at all from
+ * one sample to the next, so a record typically takes a byte per channel.
+ */
+struct recorder {
+	FILE *file;
+	int nr_channels;
+	char name[RECORDER_MAX_CHANNELS][32];
+	int64_t value[RECORDER_MAX_CHANNELS];
+	int64_t last[RECORDER_MAX_CHANNELS];
+	int64_t last_time;
+	int started;
+};
+
+int recorder_open(struct recorder *rec, const char *path);
+int recorder_add_channel(struct recorder *rec, const char *name);
+void recorder_set(struct recorder *rec, int channel, int64_t value);
+int recorder_write(struct recorder *rec, int64_t time_ms);
+void recorder_close(struct recorder *rec);
+
+int recorder_open_read(struct recorder *rec, const char *path);
+int recorder_find_channel(const struct recorder *rec, const char *name);
+int64_t recorder_read(struct recorder *rec);
+int64_t recorder_get(const struct recorder *rec, int channel);
+
+int recorder_to_csv(const char *path, FILE *out);
+
+#endif /* RECORDER_H */
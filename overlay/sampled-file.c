@@ -0,0 +1,107 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "sampled-file.h"
+
+/*
+ * The sources sample their files on every update. Rather than opening the
+ * file, reading and closing it again each time, the file is kept open and
+ * reread from the start with pread(): procfs, sysfs and debugfs regenerate
+ * the contents on a read from offset 0. Should the file go away underneath
+ * us, e.g. across a driver reload, it is reopened on the next read.
+ */
+
+static int sampled_file_reopen(struct sampled_file *sf)
+{
+	if (sf->fd >= 0)
+		close(sf->fd);
+
+	sf->fd = open(sf->path, O_RDONLY | O_CLOEXEC);
+	if (sf->fd < 0)
+		return errno;
+
+	return 0;
+}
+
+int sampled_file_open(struct sampled_file *sf, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(sf->path, sizeof(sf->path), fmt, ap);
+	va_end(ap);
+
+	sf->fd = -1;
+	return sampled_file_reopen(sf);
+}
+
+/*
+ * Reads the current contents into @buf, up to @size - 1 bytes, and
+ * terminates them. Returns the length read, or a negative errno.
+ */
+int sampled_file_read(struct sampled_file *sf, char *buf, int size)
+{
+	int len, ret, retry;
+
+	for (retry = 0; retry < 2; retry++) {
+		if (sf->fd < 0 && (ret = sampled_file_reopen(sf)))
+			return -ret;
+
+		/* larger files may come back in pieces */
+		len = 0;
+		do {
+			ret = pread(sf->fd, buf + len, size - 1 - len, len);
+			if (ret > 0)
+				len += ret;
+		} while (ret > 0 && len < size - 1);
+
+		if (ret == 0 || len > 0) {
+			buf[len] = '\0';
+			return len;
+		}
+
+		ret = errno;
+		close(sf->fd);
+		sf->fd = -1;
+	}
+
+	return -ret;
+}
+
+uint64_t sampled_file_read_u64(struct sampled_file *sf)
+{
+	char buf[64];
+
+	if (sampled_file_read(sf, buf, sizeof(buf)) < 0)
+		return 0;
+
+	return strtoull(buf, 0, 0);
+}
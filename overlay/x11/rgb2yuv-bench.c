@@ -0,0 +1,247 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Checks that every rgb2yuv implementation supported by this CPU produces
+ * exactly the output of the C reference, over random frames of awkward
+ * sizes and with dirty row tracking, then measures how many frames per
+ * second each converts, in full and when nothing changed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rgb2yuv.h"
+
+static const char *impls[] = { "c", "sse2", "avx2" };
+
+struct frame {
+	cairo_surface_t *surface;
+	XvImage image;
+	int pitches[3];
+	uint8_t *yuv;
+	int size;
+};
+
+static uint64_t gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void frame_init(struct frame *f, int width, int height)
+{
+	f->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB16_565,
+						width, height);
+
+	memset(&f->image, 0, sizeof(f->image));
+	f->image.width = width;
+	f->image.height = height;
+	f->image.pitches = f->pitches;
+	f->pitches[0] = (width + 3) & -4;
+	f->pitches[1] = f->pitches[2] = (width/2 + 3) & -4;
+
+	f->size = f->pitches[0] * height + 2 * f->pitches[1] * (height/2);
+	f->yuv = malloc(f->size);
+	if (f->yuv == NULL)
+		abort();
+}
+
+static void frame_fini(struct frame *f)
+{
+	cairo_surface_destroy(f->surface);
+	free(f->yuv);
+}
+
+static void frame_fill(struct frame *f)
+{
+	uint8_t *data = cairo_image_surface_get_data(f->surface);
+	int stride = cairo_image_surface_get_stride(f->surface);
+	int height = cairo_image_surface_get_height(f->surface);
+	int n;
+
+	cairo_surface_flush(f->surface);
+	for (n = 0; n < stride * height; n++)
+		data[n] = random();
+	cairo_surface_mark_dirty(f->surface);
+}
+
+static void frame_poke(struct frame *f)
+{
+	uint8_t *data = cairo_image_surface_get_data(f->surface);
+	int stride = cairo_image_surface_get_stride(f->surface);
+	int width = cairo_image_surface_get_width(f->surface);
+	int height = cairo_image_surface_get_height(f->surface);
+
+	cairo_surface_flush(f->surface);
+	data[random() % height * stride + random() % (2*width)] ^= 1 << (random() % 8);
+	cairo_surface_mark_dirty(f->surface);
+}
+
+static int check(int width, int height)
+{
+	struct frame f;
+	uint8_t *ref, *last;
+	unsigned n;
+	int errors = 0;
+
+	frame_init(&f, width, height);
+	frame_fill(&f);
+
+	ref = malloc(f.size);
+	if (ref == NULL)
+		abort();
+
+	rgb2yuv_select("c");
+	memset(ref, 0xa5, f.size);
+	rgb2yuv(f.surface, &f.image, ref, NULL);
+
+	for (n = 0; n < sizeof(impls)/sizeof(impls[0]); n++) {
+		if (rgb2yuv_select(impls[n]))
+			continue;
+
+		memset(f.yuv, 0xa5, f.size);
+		rgb2yuv(f.surface, &f.image, f.yuv, NULL);
+		if (memcmp(ref, f.yuv, f.size)) {
+			fprintf(stderr, "%s: %dx%d differs from c\n",
+				impls[n], width, height);
+			errors++;
+		}
+	}
+
+	/* a single changed pixel must be converted, along with its 2x2 block */
+	last = NULL;
+	rgb2yuv(f.surface, &f.image, f.yuv, &last);
+	frame_poke(&f);
+	rgb2yuv(f.surface, &f.image, f.yuv, &last);
+	rgb2yuv(f.surface, &f.image, ref, NULL);
+	if (memcmp(ref, f.yuv, f.size)) {
+		fprintf(stderr, "dirty: %dx%d differs from a full conversion\n",
+			width, height);
+		errors++;
+	}
+	free(last);
+
+	free(ref);
+	frame_fini(&f);
+	return errors;
+}
+
+static void measure(const char *name, int width, int height, int count)
+{
+	struct frame f;
+	uint8_t *last = NULL;
+	uint64_t start, full, dirty;
+	int n;
+
+	frame_init(&f, width, height);
+	frame_fill(&f);
+
+	start = gettime();
+	for (n = 0; n < count; n++)
+		rgb2yuv(f.surface, &f.image, f.yuv, NULL);
+	full = gettime() - start;
+
+	rgb2yuv(f.surface, &f.image, f.yuv, &last);
+	start = gettime();
+	for (n = 0; n < count; n++)
+		rgb2yuv(f.surface, &f.image, f.yuv, &last);
+	dirty = gettime() - start;
+	free(last);
+
+	printf("%-4s: %8.1f frames/s, %8.1f Mpixel/s; unchanged %8.1f frames/s\n",
+	       name,
+	       count * 1e9 / full,
+	       (double)count * width * height * 1e3 / full,
+	       count * 1e9 / dirty);
+
+	frame_fini(&f);
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [-s WxH] [-n frames]\n"
+	       "\t-s WxH: size of the frames measured (default 1920x1080)\n"
+	       "\t-n frames: conversions measured per implementation (default 200)\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[][2] = {
+		{ 1, 1 }, { 2, 2 }, { 3, 5 }, { 15, 2 }, { 16, 4 }, { 17, 3 },
+		{ 31, 7 }, { 32, 2 }, { 33, 9 }, { 47, 6 }, { 63, 11 },
+		{ 64, 64 }, { 100, 33 }, { 1921, 1081 },
+	};
+	int width = 1920, height = 1080, count = 200;
+	unsigned n;
+	int c, errors = 0;
+
+	while ((c = getopt(argc, argv, "s:n:h")) != -1) {
+		switch (c) {
+		case 's':
+			if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return c != 'h';
+		}
+	}
+	if (width < 1 || height < 1 || count < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	rgb2yuv_init();
+
+	for (n = 0; n < sizeof(sizes)/sizeof(sizes[0]); n++)
+		errors += check(sizes[n][0], sizes[n][1]);
+	for (n = 0; n < 100; n++)
+		errors += check(1 + random() % 200, 1 + random() % 50);
+	if (errors) {
+		fprintf(stderr, "%d mismatches\n", errors);
+		return 1;
+	}
+
+	for (n = 0; n < sizeof(impls)/sizeof(impls[0]); n++) {
+		if (rgb2yuv_select(impls[n]) == 0)
+			measure(impls[n], width, height, count);
+		else
+			printf("%-4s: not supported\n", impls[n]);
+	}
+
+	return 0;
+}
@@ -22,45 +22,404 @@
  *
  */
 
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
 
 #include "rgb2yuv.h"
 
+/*
+ * BT.601 coefficients in 8.8 fixed point. Being integers, the vector paths
+ * below compute exactly the same values as the lookup tables.
+ */
+#define C_YR 16763	/* 65.481 */
+#define C_YG 32910	/* 128.553 */
+#define C_YB 6391	/* 24.966 */
+#define C_UR 9676	/* 37.797 */
+#define C_UG 18996	/* 74.203 */
+#define C_UBVR 28672	/* 112 */
+#define C_VG 24009	/* 93.786 */
+#define C_VB 4663	/* 18.214 */
+
+#define Y_BIAS 1048576
+#define UV_BIAS 8388608
+
 static int RGB2YUV_YR[256], RGB2YUV_YG[256], RGB2YUV_YB[256];
 static int RGB2YUV_UR[256], RGB2YUV_UG[256], RGB2YUV_UBVR[256];
 static int RGB2YUV_VG[256], RGB2YUV_VB[256];
 
-void rgb2yuv_init(void)
+/*
+ * Converts a pair of rows into two rows of Y and a row each of U and V,
+ * subsampled 2x2.
+ */
+typedef void (*convert_rows_func)(const uint16_t *rgb0, const uint16_t *rgb1,
+				  uint8_t *y0, uint8_t *y1,
+				  uint8_t *u, uint8_t *v,
+				  int width);
+
+static inline void rgb565(uint16_t p, int *r, int *g, int *b)
 {
-	int i;
+	*r = (p >> 11) & 0x1f;
+	*g = (p >>  5) & 0x3f;
+	*b = (p >>  0) & 0x1f;
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_YR[i] = 65.481 * (i << 8);
+	*r = *r<<3 | *r>>2;
+	*g = *g<<2 | *g>>4;
+	*b = *b<<3 | *b>>2;
+}
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_YG[i] = 128.553 * (i << 8);
+static inline uint8_t to_y(uint16_t p)
+{
+	int r, g, b;
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_YB[i] = 24.966 * (i << 8);
+	rgb565(p, &r, &g, &b);
+	return (RGB2YUV_YR[r] + RGB2YUV_YG[g] + RGB2YUV_YB[b] + Y_BIAS) >> 16;
+}
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_UR[i] = 37.797 * (i << 8);
+static inline int to_u(uint16_t p)
+{
+	int r, g, b;
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_UG[i] = 74.203 * (i << 8);
+	rgb565(p, &r, &g, &b);
+	return (-RGB2YUV_UR[r] - RGB2YUV_UG[g] + RGB2YUV_UBVR[b] + UV_BIAS) >> 16;
+}
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_VG[i] = 93.786 * (i << 8);
+static inline int to_v(uint16_t p)
+{
+	int r, g, b;
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_VB[i] = 18.214 * (i << 8);
+	rgb565(p, &r, &g, &b);
+	return (RGB2YUV_UBVR[r] - RGB2YUV_VG[g] - RGB2YUV_VB[b] + UV_BIAS) >> 16;
+}
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_UBVR[i] = 112 * (i << 8);
+/* The reference, every other path must produce identical output */
+static void convert_rows_c(const uint16_t *rgb0, const uint16_t *rgb1,
+			   uint8_t *y0, uint8_t *y1,
+			   uint8_t *u, uint8_t *v,
+			   int width)
+{
+	int j;
+
+	for (j = 0; j < width; j++) {
+		y0[j] = to_y(rgb0[j]);
+		y1[j] = to_y(rgb1[j]);
+	}
+
+	for (j = 0; j < width/2; j++) {
+		const uint16_t *t = rgb0 + 2*j, *b = rgb1 + 2*j;
+
+		u[j] = (to_u(t[0]) + to_u(t[1]) + to_u(b[0]) + to_u(b[1])) >> 2;
+		v[j] = (to_v(t[0]) + to_v(t[1]) + to_v(b[0]) + to_v(b[1])) >> 2;
+	}
 }
 
-int rgb2yuv(cairo_surface_t *surface, XvImage *image, uint8_t *yuv)
+#ifdef HAVE_X86
+/* a pair of 16 bit coefficients, for the even and odd lanes of pmaddwd */
+#define PAIR(a, b) ((int)((uint32_t)(uint16_t)(b) << 16 | (uint16_t)(a)))
+
+/*
+ * Each of Y, U and V is computed as two pmaddwd, of (r, g) and (g, b), so
+ * that all the coefficients fit into 16 bits: that of g in Y does not, so
+ * it is split between both.
+ */
+#define Y_RG PAIR(C_YR, C_YG/2)
+#define Y_GB PAIR(C_YG - C_YG/2, C_YB)
+#define U_RG PAIR(-C_UR, -C_UG)
+#define U_GB PAIR(0, C_UBVR)
+#define V_RG PAIR(C_UBVR, -C_VG)
+#define V_GB PAIR(0, -C_VB)
+
+__attribute__((target("sse2")))
+static inline void rgb565_sse2(__m128i p, __m128i *r, __m128i *g, __m128i *b)
+{
+	__m128i x;
+
+	x = _mm_srli_epi16(p, 11);
+	*r = _mm_or_si128(_mm_slli_epi16(x, 3), _mm_srli_epi16(x, 2));
+
+	x = _mm_and_si128(_mm_srli_epi16(p, 5), _mm_set1_epi16(0x3f));
+	*g = _mm_or_si128(_mm_slli_epi16(x, 2), _mm_srli_epi16(x, 4));
+
+	x = _mm_and_si128(p, _mm_set1_epi16(0x1f));
+	*b = _mm_or_si128(_mm_slli_epi16(x, 3), _mm_srli_epi16(x, 2));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i dot_sse2(__m128i rg_lo, __m128i rg_hi,
+			       __m128i gb_lo, __m128i gb_hi,
+			       int c_rg, int c_gb, int bias)
+{
+	__m128i lo, hi;
+
+	lo = _mm_add_epi32(_mm_madd_epi16(rg_lo, _mm_set1_epi32(c_rg)),
+			   _mm_madd_epi16(gb_lo, _mm_set1_epi32(c_gb)));
+	hi = _mm_add_epi32(_mm_madd_epi16(rg_hi, _mm_set1_epi32(c_rg)),
+			   _mm_madd_epi16(gb_hi, _mm_set1_epi32(c_gb)));
+
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, _mm_set1_epi32(bias)), 16);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, _mm_set1_epi32(bias)), 16);
+
+	return _mm_packs_epi32(lo, hi);
+}
+
+/* Y, U and V of 8 pixels, as 16 bit */
+__attribute__((target("sse2")))
+static inline void pixels_sse2(const uint16_t *rgb,
+			       __m128i *y, __m128i *u, __m128i *v)
+{
+	__m128i r, g, b, rg_lo, rg_hi, gb_lo, gb_hi;
+
+	rgb565_sse2(_mm_loadu_si128((const __m128i *)rgb), &r, &g, &b);
+
+	rg_lo = _mm_unpacklo_epi16(r, g);
+	rg_hi = _mm_unpackhi_epi16(r, g);
+	gb_lo = _mm_unpacklo_epi16(g, b);
+	gb_hi = _mm_unpackhi_epi16(g, b);
+
+	*y = dot_sse2(rg_lo, rg_hi, gb_lo, gb_hi, Y_RG, Y_GB, Y_BIAS);
+	*u = dot_sse2(rg_lo, rg_hi, gb_lo, gb_hi, U_RG, U_GB, UV_BIAS);
+	*v = dot_sse2(rg_lo, rg_hi, gb_lo, gb_hi, V_RG, V_GB, UV_BIAS);
+}
+
+/* Averages 2x2 blocks given the sums of two rows of 16 pixels */
+__attribute__((target("sse2")))
+static inline __m128i subsample_sse2(__m128i a, __m128i b)
+{
+	const __m128i one = _mm_set1_epi16(1);
+
+	a = _mm_srli_epi32(_mm_madd_epi16(a, one), 2);
+	b = _mm_srli_epi32(_mm_madd_epi16(b, one), 2);
+
+	a = _mm_packs_epi32(a, b);
+	return _mm_packus_epi16(a, a);
+}
+
+__attribute__((target("sse2")))
+static void convert_rows_sse2(const uint16_t *rgb0, const uint16_t *rgb1,
+			      uint8_t *y0, uint8_t *y1,
+			      uint8_t *u, uint8_t *v,
+			      int width)
+{
+	int j;
+
+	for (j = 0; j + 16 <= width; j += 16) {
+		__m128i ya, yb, ua, ub, uc, ud, va, vb, vc, vd;
+
+		pixels_sse2(rgb0 + j, &ya, &ua, &va);
+		pixels_sse2(rgb0 + j + 8, &yb, &ub, &vb);
+		_mm_storeu_si128((__m128i *)(y0 + j), _mm_packus_epi16(ya, yb));
+
+		pixels_sse2(rgb1 + j, &ya, &uc, &vc);
+		pixels_sse2(rgb1 + j + 8, &yb, &ud, &vd);
+		_mm_storeu_si128((__m128i *)(y1 + j), _mm_packus_epi16(ya, yb));
+
+		_mm_storel_epi64((__m128i *)(u + j/2),
+				 subsample_sse2(_mm_add_epi16(ua, uc),
+						_mm_add_epi16(ub, ud)));
+		_mm_storel_epi64((__m128i *)(v + j/2),
+				 subsample_sse2(_mm_add_epi16(va, vc),
+						_mm_add_epi16(vb, vd)));
+	}
+
+	convert_rows_c(rgb0 + j, rgb1 + j, y0 + j, y1 + j,
+		       u + j/2, v + j/2, width - j);
+}
+
+__attribute__((target("avx2")))
+static inline void rgb565_avx2(__m256i p, __m256i *r, __m256i *g, __m256i *b)
+{
+	__m256i x;
+
+	x = _mm256_srli_epi16(p, 11);
+	*r = _mm256_or_si256(_mm256_slli_epi16(x, 3), _mm256_srli_epi16(x, 2));
+
+	x = _mm256_and_si256(_mm256_srli_epi16(p, 5), _mm256_set1_epi16(0x3f));
+	*g = _mm256_or_si256(_mm256_slli_epi16(x, 2), _mm256_srli_epi16(x, 4));
+
+	x = _mm256_and_si256(p, _mm256_set1_epi16(0x1f));
+	*b = _mm256_or_si256(_mm256_slli_epi16(x, 3), _mm256_srli_epi16(x, 2));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i dot_avx2(__m256i rg_lo, __m256i rg_hi,
+			       __m256i gb_lo, __m256i gb_hi,
+			       int c_rg, int c_gb, int bias)
+{
+	__m256i lo, hi;
+
+	lo = _mm256_add_epi32(_mm256_madd_epi16(rg_lo, _mm256_set1_epi32(c_rg)),
+			      _mm256_madd_epi16(gb_lo, _mm256_set1_epi32(c_gb)));
+	hi = _mm256_add_epi32(_mm256_madd_epi16(rg_hi, _mm256_set1_epi32(c_rg)),
+			      _mm256_madd_epi16(gb_hi, _mm256_set1_epi32(c_gb)));
+
+	lo = _mm256_srai_epi32(_mm256_add_epi32(lo, _mm256_set1_epi32(bias)), 16);
+	hi = _mm256_srai_epi32(_mm256_add_epi32(hi, _mm256_set1_epi32(bias)), 16);
+
+	/* unpack and pack both work within 128 bit lanes, so this
+	 * restores the pixel order */
+	return _mm256_packs_epi32(lo, hi);
+}
+
+/* Y, U and V of 16 pixels, as 16 bit */
+__attribute__((target("avx2")))
+static inline void pixels_avx2(const uint16_t *rgb,
+			       __m256i *y, __m256i *u, __m256i *v)
+{
+	__m256i r, g, b, rg_lo, rg_hi, gb_lo, gb_hi;
+
+	rgb565_avx2(_mm256_loadu_si256((const __m256i *)rgb), &r, &g, &b);
+
+	rg_lo = _mm256_unpacklo_epi16(r, g);
+	rg_hi = _mm256_unpackhi_epi16(r, g);
+	gb_lo = _mm256_unpacklo_epi16(g, b);
+	gb_hi = _mm256_unpackhi_epi16(g, b);
+
+	*y = dot_avx2(rg_lo, rg_hi, gb_lo, gb_hi, Y_RG, Y_GB, Y_BIAS);
+	*u = dot_avx2(rg_lo, rg_hi, gb_lo, gb_hi, U_RG, U_GB, UV_BIAS);
+	*v = dot_avx2(rg_lo, rg_hi, gb_lo, gb_hi, V_RG, V_GB, UV_BIAS);
+}
+
+/* Averages 2x2 blocks given the sums of two rows of 32 pixels */
+__attribute__((target("avx2")))
+static inline __m128i subsample_avx2(__m256i a, __m256i b)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+
+	a = _mm256_srli_epi32(_mm256_madd_epi16(a, one), 2);
+	b = _mm256_srli_epi32(_mm256_madd_epi16(b, one), 2);
+
+	a = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+	return _mm_packus_epi16(_mm256_castsi256_si128(a),
+				_mm256_extracti128_si256(a, 1));
+}
+
+__attribute__((target("avx2")))
+static void convert_rows_avx2(const uint16_t *rgb0, const uint16_t *rgb1,
+			      uint8_t *y0, uint8_t *y1,
+			      uint8_t *u, uint8_t *v,
+			      int width)
+{
+	int j;
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		__m256i ya, yb, ua, ub, uc, ud, va, vb, vc, vd;
+
+		pixels_avx2(rgb0 + j, &ya, &ua, &va);
+		pixels_avx2(rgb0 + j + 16, &yb, &ub, &vb);
+		_mm256_storeu_si256((__m256i *)(y0 + j),
+				    _mm256_permute4x64_epi64(_mm256_packus_epi16(ya, yb), 0xd8));
+
+		pixels_avx2(rgb1 + j, &ya, &uc, &vc);
+		pixels_avx2(rgb1 + j + 16, &yb, &ud, &vd);
+		_mm256_storeu_si256((__m256i *)(y1 + j),
+				    _mm256_permute4x64_epi64(_mm256_packus_epi16(ya, yb), 0xd8));
+
+		_mm_storeu_si128((__m128i *)(u + j/2),
+				 subsample_avx2(_mm256_add_epi16(ua, uc),
+						_mm256_add_epi16(ub, ud)));
+		_mm_storeu_si128((__m128i *)(v + j/2),
+				 subsample_avx2(_mm256_add_epi16(va, vc),
+						_mm256_add_epi16(vb, vd)));
+	}
+
+	convert_rows_sse2(rgb0 + j, rgb1 + j, y0 + j, y1 + j,
+			  u + j/2, v + j/2, width - j);
+}
+
+static int has_sse2(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+static int has_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static int has_c(void)
+{
+	return 1;
+}
+
+/* in order of preference */
+static const struct rgb2yuv_impl {
+	const char *name;
+	convert_rows_func convert_rows;
+	int (*supported)(void);
+} impls[] = {
+#ifdef HAVE_X86
+	{ "avx2", convert_rows_avx2, has_avx2 },
+	{ "sse2", convert_rows_sse2, has_sse2 },
+#endif
+	{ "c", convert_rows_c, has_c },
+};
+
+static convert_rows_func convert_rows = convert_rows_c;
+
+void rgb2yuv_init(void)
+{
+	unsigned i;
+
+	for (i = 0; i < 256; i++) {
+		RGB2YUV_YR[i] = C_YR * i;
+		RGB2YUV_YG[i] = C_YG * i;
+		RGB2YUV_YB[i] = C_YB * i;
+		RGB2YUV_UR[i] = C_UR * i;
+		RGB2YUV_UG[i] = C_UG * i;
+		RGB2YUV_VG[i] = C_VG * i;
+		RGB2YUV_VB[i] = C_VB * i;
+		RGB2YUV_UBVR[i] = C_UBVR * i;
+	}
+
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+#endif
+	for (i = 0; i < sizeof(impls)/sizeof(impls[0]); i++) {
+		if (impls[i].supported()) {
+			convert_rows = impls[i].convert_rows;
+			break;
+		}
+	}
+}
+
+/*
+ * Forces the conversion to use one implementation, "c", "sse2" or "avx2".
+ * Returns ENODEV if not supported by the CPU, EINVAL if not built in.
+ */
+int rgb2yuv_select(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(impls)/sizeof(impls[0]); i++) {
+		if (strcmp(impls[i].name, name))
+			continue;
+
+		if (!impls[i].supported())
+			return ENODEV;
+
+		convert_rows = impls[i].convert_rows;
+		return 0;
+	}
+
+	return EINVAL;
+}
+
+/*
+ * Converts @surface, RGB565, into the planar YUV 4:2:0 @image mapped at @yuv.
+ *
+ * If @last is not NULL, it keeps a copy of the frame last converted into
+ * @yuv, allocated on the first call and to be freed by the caller, and only
+ * the rows that changed since are converted again.
+ */
+int rgb2yuv(cairo_surface_t *surface, XvImage *image, uint8_t *yuv,
+	    uint8_t **last)
 {
 	uint8_t *data = cairo_image_surface_get_data(surface);
 	int rgb_stride = cairo_image_surface_get_stride(surface);
@@ -68,62 +427,50 @@ int rgb2yuv(cairo_surface_t *surface, XvImage *image, uint8_t *yuv)
 	int height = cairo_image_surface_get_height(surface);
 	int y_stride = image->pitches[0];
 	int uv_stride = image->pitches[1];
-	uint8_t *tmp, *tl, *tr, *bl, *br;
-	int i, j;
+	uint8_t *u = yuv + height * y_stride;
+	uint8_t *v = u + height/2 * uv_stride;
+	uint8_t *prev = NULL;
+	int i;
 
-	tmp = malloc(2*width*height);
-	if (tmp == NULL)
-		return 0;
+	if (last) {
+		prev = *last;
+		if (prev == NULL)
+			*last = malloc(rgb_stride * height);
+	}
 
-	tl = tmp;
-	bl = tmp + width*height;
+	for (i = 0; i + 1 < height; i += 2) {
+		uint8_t *row = data + i * rgb_stride;
+		uint8_t *old = prev ? prev + i * rgb_stride : NULL;
 
-	for (i = 0; i < height; i++) {
-		uint16_t *rgb = (uint16_t *)(data + i * rgb_stride);
-		for (j = 0; j < width; j++) {
-			uint8_t r = (rgb[j] >> 11) & 0x1f;
-			uint8_t g = (rgb[j] >>  5) & 0x3f;
-			uint8_t b = (rgb[j] >>  0) & 0x1f;
-
-			r = r<<3 | r>>2;
-			g = g<<2 | g>>4;
-			b = b<<3 | b>>2;
-
-			yuv[j] = (RGB2YUV_YR[r] + RGB2YUV_YG[g] + RGB2YUV_YB[b] + 1048576) >> 16;
-			*tl++ = (-RGB2YUV_UR[r] - RGB2YUV_UG[g] + RGB2YUV_UBVR[b] + 8388608) >> 16;
-			*bl++ = (RGB2YUV_UBVR[r] - RGB2YUV_VG[g] - RGB2YUV_VB[b] + 8388608) >> 16;
-		}
-		yuv += y_stride;
-	}
+		if (old &&
+		    memcmp(old, row, 2*width) == 0 &&
+		    memcmp(old + rgb_stride, row + rgb_stride, 2*width) == 0)
+			continue;
 
-	tl = tmp; tr = tl + 1;
-	bl = tl + width; br = bl + 1;
-	for (i = 0; i < height/2; i ++) {
-		for (j = 0; j < width/2; j ++) {
-			yuv[j] = ((int)*tl + *tr + *bl + *br) >> 2;
-			tl += 2; tr += 2;
-			bl += 2; br += 2;
-		}
-		yuv += uv_stride;
+		convert_rows((uint16_t *)row, (uint16_t *)(row + rgb_stride),
+			     yuv + i * y_stride, yuv + (i + 1) * y_stride,
+			     u + i/2 * uv_stride, v + i/2 * uv_stride,
+			     width);
 
-		tl += width; tr += width;
-		bl += width; br += width;
+		if (old)
+			memcpy(old, row, 2 * rgb_stride);
 	}
 
-	tl = tmp + width*height; tr = tl + 1;
-	bl = tl + width; br = bl + 1;
-	for (i = 0; i < height/2; i++) {
-		for (j = 0; j < width/2; j++) {
-			yuv[j] = ((int)*tl + *tr + *bl + *br) >> 2;
-			tl += 2; tr += 2;
-			bl += 2; br += 2;
-		}
-		yuv += uv_stride;
+	/* the last of an odd number of rows only has luma */
+	if (height & 1) {
+		uint16_t *rgb = (uint16_t *)(data + i * rgb_stride);
+		uint8_t *old = prev ? prev + i * rgb_stride : NULL;
 
-		tl += width; tr += width;
-		bl += width; br += width;
+		if (old == NULL || memcmp(old, rgb, 2*width)) {
+			for (i = 0; i < width; i++)
+				yuv[(height - 1) * y_stride + i] = to_y(rgb[i]);
+			if (old)
+				memcpy(old, rgb, 2*width);
+		}
 	}
 
-	free(tmp);
+	if (last && prev == NULL && *last)
+		memcpy(*last, data, rgb_stride * height);
+
 	return 1;
 }
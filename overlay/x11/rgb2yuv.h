@@ -31,6 +31,8 @@
 #include <stdint.h>
 
 void rgb2yuv_init(void);
-int rgb2yuv(cairo_surface_t *rgb, XvImage *image, uint8_t *yuv);
+int rgb2yuv_select(const char *name);
+int rgb2yuv(cairo_surface_t *rgb, XvImage *image, uint8_t *yuv,
+	    uint8_t **last);
 
 #endif /* RGB2YUV_H */
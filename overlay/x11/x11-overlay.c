@@ -56,6 +56,7 @@ struct x11_overlay {
 	XvPortID port;
 	XvImage *image;
 	void *map, *mem;
+	uint8_t *last;
 	int size;
 	unsigned name;
 	int x, y;
@@ -76,7 +77,7 @@ static void x11_overlay_show(struct overlay *overlay)
 	struct x11_overlay *priv = to_x11_overlay(overlay);
 
 	if (priv->image->id == FOURCC_XVMC)
-		rgb2yuv(priv->base.surface, priv->image, priv->map);
+		rgb2yuv(priv->base.surface, priv->image, priv->map, &priv->last);
 	else
 		memcpy(priv->map, priv->mem, priv->size);
 
@@ -107,6 +108,7 @@ static void x11_overlay_destroy(void *data)
 	struct x11_overlay *priv = data;
 	munmap(priv->map, priv->size);
 	free(priv->mem);
+	free(priv->last);
 	XCloseDisplay(priv->dpy);
 	free(priv);
 }
@@ -252,6 +254,7 @@ x11_overlay_create(struct config *config, int *width, int *height)
 	priv->port = port;
 	priv->map = ptr;
 	priv->mem = mem;
+	priv->last = NULL;
 	priv->size = create.size;
 	priv->name = flink.name;
 	priv->visible = false;
@@ -66,23 +66,50 @@ static int disp_reg_base = 0;	/* base address of display registers */
 		set_aud_reg_base((base) + (audio_offset));	\
 	} while (0)
 
-#define dump_reg(reg, desc)					\
-	do {							\
-		dword = INREG(reg);	\
-		printf("%-21s 0x%08x  %s\n", # reg, dword, desc);	\
-	} while (0)
+/*
+ * The register summaries are collected with dump_reg() and friends and then
+ * read in one batch and printed by dump_queued_regs().
+ */
+#define MAX_QUEUED_REGS 128
 
-#define dump_disp_reg(reg, desc)					\
-	do {							\
-		dword = INREG(disp_reg_base + reg);	\
-		printf("%-21s 0x%08x  %s\n", # reg, dword, desc);	\
-	} while (0)
+static struct {
+	uint32_t reg;
+	const char *name;
+	const char *desc;
+} queued_regs[MAX_QUEUED_REGS];
+static int num_queued_regs;
 
-#define dump_aud_reg(reg, desc)					\
-	do {							\
-		dword = INREG(aud_reg_base + reg);	\
-		printf("%-21s 0x%08x  %s\n", # reg, dword, desc);	\
-	} while (0)
+static void queue_reg(uint32_t reg, const char *name, const char *desc)
+{
+	if (num_queued_regs == MAX_QUEUED_REGS)
+		errx(1, "too many registers queued for dumping");
+
+	queued_regs[num_queued_regs].reg = reg;
+	queued_regs[num_queued_regs].name = name;
+	queued_regs[num_queued_regs].desc = desc;
+	num_queued_regs++;
+}
+
+static void dump_queued_regs(void)
+{
+	uint32_t regs[MAX_QUEUED_REGS], vals[MAX_QUEUED_REGS];
+	int i;
+
+	for (i = 0; i < num_queued_regs; i++)
+		regs[i] = queued_regs[i].reg;
+
+	intel_register_read_batch(regs, vals, num_queued_regs);
+
+	for (i = 0; i < num_queued_regs; i++)
+		printf("%-21s 0x%08x  %s\n", queued_regs[i].name, vals[i],
+		       queued_regs[i].desc);
+
+	num_queued_regs = 0;
+}
+
+#define dump_reg(reg, desc)	queue_reg(reg, # reg, desc)
+#define dump_disp_reg(reg, desc)	queue_reg(disp_reg_base + reg, # reg, desc)
+#define dump_aud_reg(reg, desc)	queue_reg(aud_reg_base + reg, # reg, desc)
 
 #define read_aud_reg(reg)	INREG(aud_reg_base + (reg))
 
@@ -516,6 +543,8 @@ static void dump_eaglelake(void)
 	dump_reg(AUD_CONV_CHCNT,	"Audio Converter Channel Count");
 	dump_reg(AUD_CTS_ENABLE,	"Audio CTS Programming Enable");
 
+	dump_queued_regs();
+
 	printf("\nDetails:\n\n");
 
 	dword = INREG(AUD_VID_DID);
@@ -847,6 +876,8 @@ static void dump_cpt(void)
 	dump_reg(AUD_HDMIW_INFOFR_B,	"Audio Widget Data Island Packet - Transcoder B");
 	dump_reg(AUD_HDMIW_INFOFR_C,	"Audio Widget Data Island Packet - Transcoder C");
 
+	dump_queued_regs();
+
 	printf("\nDetails:\n\n");
 
 	dword = INREG(VIDEO_DIP_CTL_A);
@@ -1824,8 +1855,6 @@ static void dump_hdmi_port_ctrl(int port)
 
 static void dump_ironlake(void)
 {
-	uint32_t dword;
-
 	if (!IS_VALLEYVIEW(devid))
 		set_reg_base(0xe0000, 0x2000);   /* ironlake */
 	else
@@ -1871,6 +1900,8 @@ static void dump_ironlake(void)
 	dump_aud_reg(AUD_HDMIW_INFOFR_A,        "Audio Widget Data Island Packet - Transcoder A");
 	dump_aud_reg(AUD_HDMIW_INFOFR_B,        "Audio Widget Data Island Packet - Transcoder B");
 
+	dump_queued_regs();
+
 	printf("\nDetails:\n\n");
 
 	dump_aud_vendor_device_id();
@@ -2186,6 +2217,8 @@ static void dump_hsw_plus(void)
 	dump_aud_reg(AUD_TCB_M_CTS,            "Audio M CTS Read Back Transcoder B");
 	dump_aud_reg(AUD_TCC_M_CTS,            "Audio M CTS Read Back Transcoder C");
 
+	dump_queued_regs();
+
 	printf("\nDetails:\n\n");
 
 	dump_ddi_buf_ctl(PORT_A);
@@ -2271,15 +2304,18 @@ int main(int argc, char **argv)
 {
 	struct pci_device *pci_dev;
 
-	pci_dev = intel_get_pci_device();
-	devid = pci_dev->device_id; /* XXX not true when mapping! */
-
 	do_self_tests();
 
 	if (argc == 2)
-		intel_mmio_use_dump_file(argv[1]);
-	else
-		intel_mmio_use_pci_bar(pci_dev);
+		devid = intel_mmio_use_dump_file(argv[1]);
+
+	/* raw dumps don't record the device, assume it is this machine's */
+	if (!devid) {
+		pci_dev = intel_get_pci_device();
+		devid = pci_dev->device_id;
+		if (argc != 2)
+			intel_mmio_use_pci_bar(pci_dev);
+	}
 
 	if (IS_VALLEYVIEW(devid)) {
 		printf("Valleyview audio registers:\n\n");
@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <err.h>
 #include <string.h>
+#include <sys/time.h>
 #include "intel_chipset.h"
 #include "intel_io.h"
 #include "igt_debugfs.h"
@@ -202,10 +203,232 @@ static uint32_t dsl_reg(int pipe)
 	return 0;
 }
 
-static void poll_pixel_pipestat(int pipe, int bit, uint32_t *min, uint32_t *max, const int count)
+/*
+ * Samples are accumulated into log-linear histograms in the style of
+ * HdrHistogram: values below 2 * HIST_SUB are counted exactly, above that
+ * every power of two is split into HIST_SUB buckets, bounding the error of
+ * any percentile to 1/HIST_SUB of the value. Adding a sample is a couple of
+ * increments, cheap enough for the polling loops.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	uint64_t count;
+	uint32_t min, max;
+	uint32_t buckets[HIST_BUCKETS];
+};
+
+/* scanline or pixel count just before and just after each event, per field */
+struct poll_stats {
+	const char *name;
+	uint64_t target;	/* samples per field, 0 to run until told to quit */
+	struct hist before[2], after[2];
+
+	/* --duration: the interval histograms are printed and folded into
+	 * the totals whenever report_due is raised */
+	struct hist total_before[2], total_after[2];
+	FILE *dump;
+	struct timeval start;
+};
+
+static volatile bool report_due;
+static volatile int intervals_left;
+
+static void alarm_handler(int x)
+{
+	report_due = true;
+	if (intervals_left && --intervals_left == 0)
+		quit = true;
+}
+
+static int hist_index(uint32_t v)
+{
+	int shift;
+
+	if (v < 2 * HIST_SUB)
+		return v;
+
+	shift = 31 - __builtin_clz(v) - HIST_SUB_BITS;
+
+	return shift * HIST_SUB + (v >> shift);
+}
+
+/* largest value counted in bucket @index */
+static uint32_t hist_value(int index)
+{
+	int shift;
+
+	if (index < 2 * HIST_SUB)
+		return index;
+
+	shift = index / HIST_SUB - 1;
+
+	return (((uint64_t)(index - shift * HIST_SUB) + 1) << shift) - 1;
+}
+
+static void hist_reset(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT32_MAX;
+}
+
+static void hist_add(struct hist *h, uint32_t v)
+{
+	h->buckets[hist_index(v)]++;
+	h->count++;
+	h->min = min(h->min, v);
+	h->max = max(h->max, v);
+}
+
+static void hist_merge(struct hist *h, const struct hist *other)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		h->buckets[i] += other->buckets[i];
+	h->count += other->count;
+	h->min = min(h->min, other->min);
+	h->max = max(h->max, other->max);
+}
+
+static uint32_t hist_percentile(const struct hist *h, double percentile)
+{
+	uint64_t rank = (percentile * h->count + 99) / 100, seen = 0;
+	int i;
+
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			return min(hist_value(i), h->max);
+	}
+
+	return h->max;
+}
+
+static void hist_print(const char *name, int field, const char *what,
+		       const struct hist *h)
+{
+	if (!h->count)
+		return;
+
+	printf("%s: [%u] %-6s n %6llu min %4u p50 %4u p90 %4u p99 %4u p99.9 %4u max %4u\n",
+	       name, field, what, (unsigned long long)h->count, h->min,
+	       hist_percentile(h, 50), hist_percentile(h, 90),
+	       hist_percentile(h, 99), hist_percentile(h, 99.9), h->max);
+}
+
+/* one line per non-empty bucket: time, field, series, bucket range, count */
+static void hist_dump(FILE *out, double time, int field, const char *what,
+		      const struct hist *h)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		if (h->buckets[i])
+			fprintf(out, "%.3f\t%d\t%s\t%u\t%u\t%u\n", time, field, what,
+				i ? hist_value(i - 1) + 1 : 0, hist_value(i),
+				h->buckets[i]);
+}
+
+static void poll_stats_init(struct poll_stats *stats, const char *name,
+			    uint64_t target, FILE *dump)
+{
+	int field;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->name = name;
+	stats->target = target;
+	stats->dump = dump;
+	gettimeofday(&stats->start, NULL);
+
+	for (field = 0; field < 2; field++) {
+		hist_reset(&stats->before[field]);
+		hist_reset(&stats->after[field]);
+		hist_reset(&stats->total_before[field]);
+		hist_reset(&stats->total_after[field]);
+	}
+
+	if (dump)
+		fprintf(dump, "# time\tfield\tseries\tlow\thigh\tcount\n");
+}
+
+static void poll_stats_print(const struct poll_stats *stats,
+			     const struct hist *before, const struct hist *after,
+			     bool dump)
+{
+	struct timeval now;
+	double time;
+	int field;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, &stats->start, &now);
+	time = now.tv_sec + 1e-6 * now.tv_usec;
+
+	for (field = 0; field < 2; field++) {
+		hist_print(stats->name, field, "before", &before[field]);
+		hist_print(stats->name, field, "after", &after[field]);
+
+		if (dump && stats->dump) {
+			hist_dump(stats->dump, time, field, "before", &before[field]);
+			hist_dump(stats->dump, time, field, "after", &after[field]);
+		}
+	}
+
+	if (dump && stats->dump)
+		fflush(stats->dump);
+}
+
+static void poll_stats_report(struct poll_stats *stats)
+{
+	struct timeval now;
+	int field;
+
+	report_due = false;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, &stats->start, &now);
+	printf("--- %ld.%03lds\n", (long)now.tv_sec, (long)now.tv_usec / 1000);
+	poll_stats_print(stats, stats->before, stats->after, true);
+	fflush(stdout);
+
+	for (field = 0; field < 2; field++) {
+		hist_merge(&stats->total_before[field], &stats->before[field]);
+		hist_merge(&stats->total_after[field], &stats->after[field]);
+		hist_reset(&stats->before[field]);
+		hist_reset(&stats->after[field]);
+	}
+}
+
+static bool poll_stats_done(const struct poll_stats *stats, bool field)
+{
+	return stats->target && stats->before[field].count >= stats->target;
+}
+
+/*
+ * Records one event seen between scanline/pixel @before and @after.
+ *
+ * Returns: true once enough samples have been taken.
+ */
+static bool poll_stats_add(struct poll_stats *stats, bool field,
+			   uint32_t before, uint32_t after)
+{
+	hist_add(&stats->before[field], before);
+	hist_add(&stats->after[field], after);
+
+	if (report_due)
+		poll_stats_report(stats);
+
+	return poll_stats_done(stats, field);
+}
+
+static void poll_pixel_pipestat(int pipe, int bit, struct poll_stats *stats)
 {
 	uint32_t pix, pix1, pix2, iir, iir1, iir2, iir_bit, iir_mask;
-	int i = 0;
 
 	switch (pipe) {
 	case 0:
@@ -243,17 +466,14 @@ static void poll_pixel_pipestat(int pipe, int bit, uint32_t *min, uint32_t *max,
 		pix1 &= PIPE_PIXEL_MASK;
 		pix2 &= PIPE_PIXEL_MASK;
 
-		min[i] = pix1;
-		max[i] = pix2;
-		if (++i >= count)
+		if (poll_stats_add(stats, false, pix1, pix2))
 			break;
 	}
 }
 
-static void poll_pixel_iir_gen3(int pipe, int bit, uint32_t *min, uint32_t *max, const int count)
+static void poll_pixel_iir_gen3(int pipe, int bit, struct poll_stats *stats)
 {
 	uint32_t pix, pix1, pix2, iir1, iir2, imr_save, ier_save;
-	int i = 0;
 
 	bit = 1 << bit;
 
@@ -293,9 +513,7 @@ static void poll_pixel_iir_gen3(int pipe, int bit, uint32_t *min, uint32_t *max,
 		pix1 &= PIPE_PIXEL_MASK;
 		pix2 &= PIPE_PIXEL_MASK;
 
-		min[i] = pix1;
-		max[i] = pix2;
-		if (++i >= count)
+		if (poll_stats_add(stats, false, pix1, pix2))
 			break;
 	}
 
@@ -303,10 +521,9 @@ static void poll_pixel_iir_gen3(int pipe, int bit, uint32_t *min, uint32_t *max,
 	write_reg(IER, ier_save);
 }
 
-static void poll_pixel_framecount_gen3(int pipe, uint32_t *min, uint32_t *max, const int count)
+static void poll_pixel_framecount_gen3(int pipe, struct poll_stats *stats)
 {
 	uint32_t pix, pix1, pix2, frm1, frm2;
-	int i = 0;
 
 	switch (pipe) {
 	case 0:
@@ -332,19 +549,16 @@ static void poll_pixel_framecount_gen3(int pipe, uint32_t *min, uint32_t *max, c
 		pix1 &= PIPE_PIXEL_MASK;
 		pix2 &= PIPE_PIXEL_MASK;
 
-		min[i] = pix1;
-		max[i] = pix2;
-		if (++i >= count)
+		if (poll_stats_add(stats, false, pix1, pix2))
 			break;
 	}
 }
 
 static void poll_pixel_pan(uint32_t devid, int pipe, int target_pixel, int target_fuzz,
-			   uint32_t *min, uint32_t *max, const int count)
+			   struct poll_stats *stats)
 {
 	uint32_t pix, pix1 = 0, pix2 = 0;
 	uint32_t saved, surf = 0;
-	int i = 0;
 
 	switch (pipe) {
 	case 0:
@@ -378,9 +592,7 @@ static void poll_pixel_pan(uint32_t devid, int pipe, int target_pixel, int targe
 
 		write_reg(surf, saved);
 
-		min[i] = pix1;
-		max[i] = pix2;
-		if (++i >= count)
+		if (poll_stats_add(stats, false, pix1, pix2))
 			break;
 	}
 
@@ -388,11 +600,10 @@ static void poll_pixel_pan(uint32_t devid, int pipe, int target_pixel, int targe
 }
 
 static void poll_pixel_flip(uint32_t devid, int pipe, int target_pixel, int target_fuzz,
-			    uint32_t *min, uint32_t *max, const int count)
+			    struct poll_stats *stats)
 {
 	uint32_t pix, pix1, pix2;
 	uint32_t saved, surf = 0;
-	int i = 0;
 
 	switch (pipe) {
 	case 0:
@@ -424,19 +635,16 @@ static void poll_pixel_flip(uint32_t devid, int pipe, int target_pixel, int targ
 
 		write_reg(surf, saved);
 
-		min[i] = pix1;
-		max[i] = pix2;
-		if (++i >= count)
+		if (poll_stats_add(stats, false, pix1, pix2))
 			break;
 	}
 
 	write_reg(surf, saved);
 }
 
-static void poll_pixel_wrap(int pipe, uint32_t *min, uint32_t *max, const int count)
+static void poll_pixel_wrap(int pipe, struct poll_stats *stats)
 {
 	uint32_t pix, pix1, pix2;
-	int i = 0;
 
 	switch (pipe) {
 	case 0:
@@ -459,19 +667,16 @@ static void poll_pixel_wrap(int pipe, uint32_t *min, uint32_t *max, const int co
 		if (pix2 >= pix1)
 			continue;
 
-		min[i] = pix1;
-		max[i] = pix2;
-		if (++i >= count)
+		if (poll_stats_add(stats, false, pix1, pix2))
 			break;
 	}
 }
 
 static void poll_dsl_pipestat(int pipe, int bit,
-			      uint32_t *min, uint32_t *max, const int count)
+			      struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1, dsl2, iir, iir1, iir2, iir_bit, iir_mask;
 	bool field1, field2;
-	int i[2] = {};
 
 	switch (pipe) {
 	case 0:
@@ -515,19 +720,16 @@ static void poll_dsl_pipestat(int pipe, int bit,
 			printf("fields are different (%u:%u -> %u:%u)\n",
 			       field1, dsl1, field2, dsl2);
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			break;
 	}
 }
 
 static void poll_dsl_iir_gen2(int pipe, int bit,
-			      uint32_t *min, uint32_t *max, const int count)
+			      struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1, dsl2, iir1, iir2, imr_save, ier_save;
 	bool field1, field2;
-	int i[2] = {};
 
 	bit = 1 << bit;
 
@@ -564,9 +766,7 @@ static void poll_dsl_iir_gen2(int pipe, int bit,
 			printf("fields are different (%u:%u -> %u:%u)\n",
 			       field1, dsl1, field2, dsl2);
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			break;
 	}
 
@@ -575,11 +775,10 @@ static void poll_dsl_iir_gen2(int pipe, int bit,
 }
 
 static void poll_dsl_iir_gen3(int pipe, int bit,
-			      uint32_t *min, uint32_t *max, const int count)
+			      struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1, dsl2, iir1, iir2, imr_save, ier_save;
 	bool field1, field2;
-	int i[2] = {};
 
 	bit = 1 << bit;
 
@@ -616,9 +815,7 @@ static void poll_dsl_iir_gen3(int pipe, int bit,
 			printf("fields are different (%u:%u -> %u:%u)\n",
 			       field1, dsl1, field2, dsl2);
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			break;
 	}
 
@@ -627,12 +824,11 @@ static void poll_dsl_iir_gen3(int pipe, int bit,
 }
 
 static void poll_dsl_deiir(uint32_t devid, int pipe, int bit,
-			   uint32_t *min, uint32_t *max, const int count)
+			   struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1, dsl2, iir1, iir2, imr_save, ier_save;
 	bool field1, field2;
 	uint32_t iir, ier, imr;
-	int i[2] = {};
 
 	bit = 1 << bit;
 
@@ -679,9 +875,7 @@ static void poll_dsl_deiir(uint32_t devid, int pipe, int bit,
 			printf("fields are different (%u:%u -> %u:%u)\n",
 			       field1, dsl1, field2, dsl2);
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			break;
 	}
 
@@ -689,11 +883,10 @@ static void poll_dsl_deiir(uint32_t devid, int pipe, int bit,
 	write_reg(ier, ier_save);
 }
 
-static void poll_dsl_framecount_g4x(int pipe, uint32_t *min, uint32_t *max, const int count)
+static void poll_dsl_framecount_g4x(int pipe, struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1, dsl2, frm, frm1, frm2;
 	bool field1, field2;
-	int i[2] = {};
 
 	switch (pipe) {
 	case 0:
@@ -729,19 +922,16 @@ static void poll_dsl_framecount_g4x(int pipe, uint32_t *min, uint32_t *max, cons
 			printf("fields are different (%u:%u -> %u:%u)\n",
 			       field1, dsl1, field2, dsl2);
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			break;
 	}
 }
 
 static void poll_dsl_flipcount_g4x(uint32_t devid, int pipe,
-				   uint32_t *min, uint32_t *max, const int count)
+				   struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1, dsl2, flp, flp1, flp2, surf;
 	bool field1, field2;
-	int i[2] = {};
 
 	switch (pipe) {
 	case 0:
@@ -775,9 +965,7 @@ static void poll_dsl_flipcount_g4x(uint32_t devid, int pipe,
 			printf("fields are different (%u:%u -> %u:%u)\n",
 			       field1, dsl1, field2, dsl2);
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			return;
 
 		write_reg(surf, read_reg(surf));
@@ -799,21 +987,18 @@ static void poll_dsl_flipcount_g4x(uint32_t devid, int pipe,
 				printf("fields are different (%u:%u -> %u:%u)\n",
 				       field1, dsl1, field2, dsl2);
 
-			min[field1*count+i[field1]] = dsl1;
-			max[field1*count+i[field1]] = dsl2;
-			if (++i[field1] >= count)
+			if (poll_stats_add(stats, field1, dsl1, dsl2))
 				break;
 		}
-		if (i[field1] >= count)
+		if (poll_stats_done(stats, field1))
 			break;
 	}
 }
 
-static void poll_dsl_framecount_gen3(int pipe, uint32_t *min, uint32_t *max, const int count)
+static void poll_dsl_framecount_gen3(int pipe, struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1, dsl2, frm, frm1, frm2;
 	bool field1, field2;
-	int i[2] = {};
 
 	switch (pipe) {
 	case 0:
@@ -846,20 +1031,17 @@ static void poll_dsl_framecount_gen3(int pipe, uint32_t *min, uint32_t *max, con
 			printf("fields are different (%u:%u -> %u:%u)\n",
 			       field1, dsl1, field2, dsl2);
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			break;
 	}
 }
 
 static void poll_dsl_pan(uint32_t devid, int pipe, int target_scanline, int target_fuzz,
-			 uint32_t *min, uint32_t *max, const int count)
+			 struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1 = 0, dsl2 = 0;
 	bool field1 = false, field2 = false;
 	uint32_t saved, surf = 0;
-	int i[2] = {};
 
 	dsl = dsl_reg(pipe);
 	surf = dspoffset_reg(devid, pipe);
@@ -891,9 +1073,7 @@ static void poll_dsl_pan(uint32_t devid, int pipe, int target_scanline, int targ
 			printf("fields are different (%u:%u -> %u:%u)\n",
 			       field1, dsl1, field2, dsl2);
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			break;
 	}
 
@@ -901,12 +1081,11 @@ static void poll_dsl_pan(uint32_t devid, int pipe, int target_scanline, int targ
 }
 
 static void poll_dsl_flip(uint32_t devid, int pipe, int target_scanline, int target_fuzz,
-			  uint32_t *min, uint32_t *max, const int count)
+			  struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1 = 0, dsl2 = 0;
 	bool field1 = false, field2 = false;
 	uint32_t saved, surf = 0;
-	int i[2] = {};
 
 	dsl = dsl_reg(pipe);
 	surf = dspsurf_reg(devid, pipe);
@@ -938,9 +1117,7 @@ static void poll_dsl_flip(uint32_t devid, int pipe, int target_scanline, int tar
 			printf("fields are different (%u:%u -> %u:%u)\n",
 			       field1, dsl1, field2, dsl2);
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			break;
 	}
 
@@ -948,11 +1125,10 @@ static void poll_dsl_flip(uint32_t devid, int pipe, int target_scanline, int tar
 }
 
 static void poll_dsl_surflive(uint32_t devid, int pipe,
-			      uint32_t *min, uint32_t *max, const int count)
+			      struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1 = 0, dsl2 = 0, surf, surf1, surf2, surflive, surfl1 = 0, surfl2, saved, tmp;
 	bool field1 = false, field2 = false;
-	int i[2] = {};
 
 	switch (pipe) {
 	case 0:
@@ -999,9 +1175,7 @@ static void poll_dsl_surflive(uint32_t devid, int pipe,
 				printf("fields are different (%u:%u -> %u:%u)\n",
 				       field1, dsl1, field2, dsl2);
 
-			min[field1*count+i[field1]] = dsl1;
-			max[field1*count+i[field1]] = dsl2;
-			if (++i[field1] >= count)
+			if (poll_stats_add(stats, field1, dsl1, dsl2))
 				break;
 		}
 
@@ -1013,11 +1187,10 @@ static void poll_dsl_surflive(uint32_t devid, int pipe,
 	write_reg(surf, saved);
 }
 
-static void poll_dsl_wrap(int pipe, uint32_t *min, uint32_t *max, const int count)
+static void poll_dsl_wrap(int pipe, struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1, dsl2;
 	bool field1, field2;
-	int i[2] = {};
 
 	dsl = dsl_reg(pipe);
 
@@ -1037,18 +1210,15 @@ static void poll_dsl_wrap(int pipe, uint32_t *min, uint32_t *max, const int coun
 			printf("fields are different (%u:%u -> %u:%u)\n",
 			       field1, dsl1, field2, dsl2);
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			break;
 	}
 }
 
-static void poll_dsl_field(int pipe, uint32_t *min, uint32_t *max, const int count)
+static void poll_dsl_field(int pipe, struct poll_stats *stats)
 {
 	uint32_t dsl, dsl1, dsl2;
 	bool field1, field2;
-	int i[2] = {};
 
 	dsl = dsl_reg(pipe);
 
@@ -1064,9 +1234,7 @@ static void poll_dsl_field(int pipe, uint32_t *min, uint32_t *max, const int cou
 		if (field1 == field2)
 			continue;
 
-		min[field1*count+i[field1]] = dsl1;
-		max[field1*count+i[field1]] = dsl2;
-		if (++i[field1] >= count)
+		if (poll_stats_add(stats, field1, dsl1, dsl2))
 			break;
 	}
 }
@@ -1131,7 +1299,11 @@ static void usage(const char *name)
 		" -b,--bit <bit>\n"
 		" -l,--line <target scanline/pixel>\n"
 		" -f,--fuzz <target fuzz>\n"
-		" -x,--pixel\n",
+		" -x,--pixel\n"
+		" -n,--samples <samples per field, default 128>\n"
+		" -d,--duration <seconds to run, 0 until interrupted>\n"
+		" -i,--interval <seconds between reports with --duration, default 1>\n"
+		" -o,--output <file to dump the histograms to, - for stdout>\n",
 		name);
 	exit(1);
 }
@@ -1142,11 +1314,12 @@ int main(int argc, char *argv[])
 	int pipe = 0, bit = 0, target_scanline = 0, target_fuzz = 1;
 	bool test_pixelcount = false;
 	uint32_t devid;
-	uint32_t min[2*128] = {};
-	uint32_t max[2*128] = {};
-	uint32_t a, b;
+	static struct poll_stats stats;
+	const char *name;
+	double duration = -1, interval = 1;
+	FILE *dump = NULL;
 	enum test test = TEST_INVALID;
-	const int count = ARRAY_SIZE(min)/2;
+	int count = 128;
 
 	for (;;) {
 		static const struct option long_options[] = {
@@ -1156,10 +1329,14 @@ int main(int argc, char *argv[])
 			{ .name = "line", .has_arg = required_argument, },
 			{ .name = "fuzz", .has_arg = required_argument, },
 			{ .name = "pixel", .has_arg = no_argument, },
+			{ .name = "samples", .has_arg = required_argument, },
+			{ .name = "duration", .has_arg = required_argument, },
+			{ .name = "interval", .has_arg = required_argument, },
+			{ .name = "output", .has_arg = required_argument, },
 			{ },
 		};
 
-		int opt = getopt_long(argc, argv, "t:p:b:l:f:x", long_options, NULL);
+		int opt = getopt_long(argc, argv, "t:p:b:l:f:xn:d:i:o:", long_options, NULL);
 		if (opt == -1)
 			break;
 
@@ -1209,6 +1386,29 @@ int main(int argc, char *argv[])
 		case 'x':
 			test_pixelcount = true;
 			break;
+		case 'n':
+			count = atoi(optarg);
+			if (count <= 0)
+				usage(argv[0]);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			if (duration < 0)
+				usage(argv[0]);
+			break;
+		case 'i':
+			interval = atof(optarg);
+			if (interval < 0.001)
+				usage(argv[0]);
+			break;
+		case 'o':
+			if (!strcmp(optarg, "-"))
+				dump = stdout;
+			else
+				dump = fopen(optarg, "w");
+			if (!dump)
+				err(1, "%s", optarg);
+			break;
 		}
 	}
 
@@ -1354,74 +1554,87 @@ int main(int argc, char *argv[])
 
 	intel_register_access_init(intel_get_pci_device(), 0);
 
-	printf("%s?\n", test_name(test, pipe, bit, test_pixelcount));
+	name = test_name(test, pipe, bit, test_pixelcount);
+	printf("%s?\n", name);
 
 	signal(SIGHUP, sighandler);
 	signal(SIGINT, sighandler);
 	signal(SIGTERM, sighandler);
 
+	if (duration >= 0) {
+		/* report every interval from the timer, the polling loops
+		 * only look at a flag */
+		struct itimerval timer = {};
+
+		intervals_left = duration > 0 ? (int)(duration / interval + .999) : 0;
+		timer.it_value.tv_sec = interval;
+		timer.it_value.tv_usec = (interval - (int)interval) * 1000000;
+		timer.it_interval = timer.it_value;
+
+		signal(SIGALRM, alarm_handler);
+		setitimer(ITIMER_REAL, &timer, NULL);
+		poll_stats_init(&stats, name, 0, dump);
+	} else
+		poll_stats_init(&stats, name, count, dump);
+
 	switch (test) {
 	case TEST_PIPESTAT:
 		if (test_pixelcount)
-			poll_pixel_pipestat(pipe, bit, min, max, count);
+			poll_pixel_pipestat(pipe, bit, &stats);
 		else
-			poll_dsl_pipestat(pipe, bit, min, max, count);
+			poll_dsl_pipestat(pipe, bit, &stats);
 		break;
 	case TEST_IIR_GEN2:
 		assert(!test_pixelcount);
-		poll_dsl_iir_gen2(pipe, bit, min, max, count);
+		poll_dsl_iir_gen2(pipe, bit, &stats);
 		break;
 	case TEST_IIR_GEN3:
 		if (test_pixelcount)
-			poll_pixel_iir_gen3(pipe, bit, min, max, count);
+			poll_pixel_iir_gen3(pipe, bit, &stats);
 		else
-			poll_dsl_iir_gen3(pipe, bit, min, max, count);
+			poll_dsl_iir_gen3(pipe, bit, &stats);
 		break;
 	case TEST_DEIIR:
 		assert(!test_pixelcount);
-		poll_dsl_deiir(devid, pipe, bit, min, max, count);
+		poll_dsl_deiir(devid, pipe, bit, &stats);
 		break;
 	case TEST_FRAMECOUNT_GEN3:
 		if (test_pixelcount)
-			poll_pixel_framecount_gen3(pipe, min, max, count);
+			poll_pixel_framecount_gen3(pipe, &stats);
 		else
-			poll_dsl_framecount_gen3(pipe, min, max, count);
+			poll_dsl_framecount_gen3(pipe, &stats);
 		break;
 	case TEST_FRAMECOUNT_G4X:
 		assert(!test_pixelcount);
-		poll_dsl_framecount_g4x(pipe, min, max, count);
+		poll_dsl_framecount_g4x(pipe, &stats);
 		break;
 	case TEST_FLIPCOUNT:
 		assert(!test_pixelcount);
-		poll_dsl_flipcount_g4x(devid, pipe, min, max, count);
+		poll_dsl_flipcount_g4x(devid, pipe, &stats);
 		break;
 	case TEST_PAN:
 		if (test_pixelcount)
-			poll_pixel_pan(devid, pipe, target_scanline, target_fuzz,
-				       min, max, count);
+			poll_pixel_pan(devid, pipe, target_scanline, target_fuzz, &stats);
 		else
-			poll_dsl_pan(devid, pipe, target_scanline, target_fuzz,
-				     min, max, count);
+			poll_dsl_pan(devid, pipe, target_scanline, target_fuzz, &stats);
 		break;
 	case TEST_FLIP:
 		if (test_pixelcount)
-			poll_pixel_flip(devid, pipe, target_scanline, target_fuzz,
-					min, max, count);
+			poll_pixel_flip(devid, pipe, target_scanline, target_fuzz, &stats);
 		else
-			poll_dsl_flip(devid, pipe, target_scanline, target_fuzz,
-				      min, max, count);
+			poll_dsl_flip(devid, pipe, target_scanline, target_fuzz, &stats);
 		break;
 	case TEST_SURFLIVE:
-		poll_dsl_surflive(devid, pipe, min, max, count);
+		poll_dsl_surflive(devid, pipe, &stats);
 		break;
 	case TEST_WRAP:
 		if (test_pixelcount)
-			poll_pixel_wrap(pipe, min, max, count);
+			poll_pixel_wrap(pipe, &stats);
 		else
-			poll_dsl_wrap(pipe, min, max, count);
+			poll_dsl_wrap(pipe, &stats);
 		break;
 	case TEST_FIELD:
-		poll_dsl_field(pipe, min, max, count);
+		poll_dsl_field(pipe, &stats);
 		break;
 	default:
 		assert(0);
@@ -1429,43 +1642,37 @@ int main(int argc, char *argv[])
 
 	intel_register_access_fini();
 
-	if (quit)
+	if (duration < 0 && quit)
 		return 0;
 
-	for (i = 0; i < count; i++) {
-		if (min[0*count+i] == 0 && max[0*count+i] == 0)
-			break;
-		printf("[%u] %4u - %4u (%4u)\n", 0, min[0*count+i], max[0*count+i],
-		       (min[0*count+i] + max[0*count+i] + 1) >> 1);
-	}
-	for (i = 0; i < count; i++) {
-		if (min[1*count+i] == 0 && max[1*count+i] == 0)
-			break;
-		printf("[%u] %4u - %4u (%4u)\n", 1, min[1*count+i], max[1*count+i],
-		       (min[1*count+i] + max[1*count+i] + 1) >> 1);
-	}
+	if (duration >= 0) {
+		struct itimerval timer = {};
+		int field;
 
-	a = 0;
-	b = 0xffffffff;
-	for (i = 0; i < count; i++) {
-		if (min[0*count+i] == 0 && max[0*count+i] == 0)
-			break;
-		a = max(a, min[0*count+i]);
-		b = min(b, max[0*count+i]);
+		setitimer(ITIMER_REAL, &timer, NULL);
+
+		/* the last, partial interval */
+		poll_stats_report(&stats);
+		for (field = 0; field < 2; field++) {
+			stats.before[field] = stats.total_before[field];
+			stats.after[field] = stats.total_after[field];
+		}
+		printf("--- total\n");
 	}
 
-	printf("%s: [%u] %6u - %6u\n", test_name(test, pipe, bit, test_pixelcount), 0, a, b);
+	/* with --duration the intervals have been dumped already */
+	poll_stats_print(&stats, stats.before, stats.after, duration < 0);
 
-	a = 0;
-	b = 0xffffffff;
-	for (i = 0; i < count; i++) {
-		if (min[1*count+i] == 0 && max[1*count+i] == 0)
-			break;
-		a = max(a, min[1*count+i]);
-		b = min(b, max[1*count+i]);
+	/* the window in which the event happens in all of the samples */
+	for (i = 0; i < 2; i++) {
+		uint32_t a = stats.before[i].count ? stats.before[i].max : 0;
+		uint32_t b = stats.after[i].count ? stats.after[i].min : 0xffffffff;
+
+		printf("%s: [%u] %6u - %6u\n", name, i, a, b);
 	}
 
-	printf("%s: [%u] %6u - %6u\n", test_name(test, pipe, bit, test_pixelcount), 1, a, b);
+	if (dump && dump != stdout)
+		fclose(dump);
 
 	return 0;
 }
@@ -37,33 +37,46 @@
 
 #include <intel_bufmgr.h>
 
+#include "intel_io.h"
+
 struct drm_intel_decode *ctx;
 
-static void
-read_bin_file(const char * filename)
+static FILE *
+open_input(const char * filename)
 {
-	uint32_t buf[16384];
-	int fd, offset, ret;
+	FILE *file;
 
 	if (!strcmp(filename, "-"))
-		fd = fileno(stdin);
+		file = stdin;
 	else
-		fd = open (filename, O_RDONLY);
-	if (fd < 0) {
+		file = fopen (filename, "r");
+	if (file == NULL) {
 		fprintf (stderr, "Failed to open %s: %s\n",
 			 filename, strerror (errno));
 		exit (1);
 	}
 
+	return intel_decompress_file(file);
+}
+
+static void
+read_bin_file(const char * filename)
+{
+	uint32_t buf[16384];
+	FILE *file;
+	int offset, ret;
+
+	file = open_input(filename);
+
 	drm_intel_decode_set_dump_past_end(ctx, 1);
 
 	offset = 0;
-	while ((ret = read (fd, buf, sizeof(buf))) > 0) {
+	while ((ret = fread (buf, 1, sizeof(buf), file)) > 0) {
 		drm_intel_decode_set_batch_pointer(ctx, buf, offset, ret/4);
 		drm_intel_decode(ctx);
 		offset += ret;
 	}
-	close (fd);
+	fclose (file);
 }
 
 static void
@@ -77,16 +90,7 @@ read_data_file(const char * filename)
     uint32_t offset, value;
     uint32_t gtt_offset = 0;
 
-	if (!strcmp(filename, "-"))
-		file = stdin;
-	else
-		file = fopen (filename, "r");
-
-    if (file == NULL) {
-	fprintf (stderr, "Failed to open %s: %s\n",
-		 filename, strerror (errno));
-	exit (1);
-    }
+    file = open_input(filename);
 
     while (getline (&line, &line_size, file) > 0) {
 	line_number++;
@@ -129,12 +133,7 @@ read_autodetect_file(const char * filename)
 	int binary = 0, c;
 	FILE *file;
 
-	file = fopen (filename, "r");
-	if (file == NULL) {
-		fprintf (stderr, "Failed to open %s: %s\n",
-			 filename, strerror (errno));
-		exit (1);
-	}
+	file = open_input(filename);
 
 	while ((c = fgetc(file)) != EOF) {
 		/* totally lazy binary detector */
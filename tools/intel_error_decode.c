@@ -46,10 +46,14 @@
 #include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <err.h>
 #include <assert.h>
+#include <getopt.h>
 #include <intel_bufmgr.h>
 
 #include "intel_chipset.h"
@@ -57,10 +61,12 @@
 #include "instdone.h"
 #include "intel_reg.h"
 
+static FILE *out;
+
 static uint32_t
 print_head(unsigned int reg)
 {
-	printf("    head = 0x%08x, wraps = %d\n", reg & (0x7ffff<<2), reg >> 21);
+	fprintf(out, "    head = 0x%08x, wraps = %d\n", reg & (0x7ffff<<2), reg >> 21);
 	return reg & (0x7ffff<<2);
 }
 
@@ -71,10 +77,10 @@ print_ctl(unsigned int reg)
 
 #define BIT_STR(reg, x, on, off) ((1 << (x)) & reg) ? on : off
 
-	printf("    len=%d%s%s%s\n", ring_length,
-	       BIT_STR(reg, 0, ", enabled", ", disabled"),
-	       BIT_STR(reg, 10, ", semaphore wait ", ""),
-	       BIT_STR(reg, 11, ", rb wait ", "")
+	fprintf(out, "    len=%d%s%s%s\n", ring_length,
+		BIT_STR(reg, 0, ", enabled", ", disabled"),
+		BIT_STR(reg, 10, ", semaphore wait ", ""),
+		BIT_STR(reg, 11, ", rb wait ", "")
 		);
 #undef BIT_STR
 	return ring_length;
@@ -84,9 +90,9 @@ static void
 print_acthd(unsigned int reg, unsigned int ring_length)
 {
 	if ((reg & (0x7ffff << 2)) < ring_length)
-		printf("    at ring: 0x%08x\n", reg & (0x7ffff << 2));
+		fprintf(out, "    at ring: 0x%08x\n", reg & (0x7ffff << 2));
 	else
-		printf("    at batch: 0x%08x\n", reg);
+		fprintf(out, "    at batch: 0x%08x\n", reg);
 }
 
 static void
@@ -112,7 +118,7 @@ print_instdone(uint32_t devid, unsigned int instdone, unsigned int instdone1)
 		}
 
 		if (busy)
-			printf("    busy: %s\n", instdone_bits[i].name);
+			fprintf(out, "    busy: %s\n", instdone_bits[i].name);
 	}
 }
 
@@ -138,7 +144,7 @@ print_i830_pgtbl_err(unsigned int reg)
 	}
 
 	if (str)
-		printf("    source = %s\n", str);
+		fprintf(out, "    source = %s\n", str);
 
 	switch(reg & 0x7) {
 	case 0x0: str  = "Invalid GTT"; break;
@@ -150,85 +156,85 @@ print_i830_pgtbl_err(unsigned int reg)
 	case 0x6: str = "Invalid Tiling"; break;
 	case 0x7: str = "Host to CAM"; break;
 	}
-	printf("    error = %s\n", str);
+	fprintf(out, "    error = %s\n", str);
 }
 
 static void
 print_i915_pgtbl_err(unsigned int reg)
 {
 	if (reg & (1 << 29))
-		printf("    Cursor A: Invalid GTT PTE\n");
+		fprintf(out, "    Cursor A: Invalid GTT PTE\n");
 	if (reg & (1 << 28))
-		printf("    Cursor B: Invalid GTT PTE\n");
+		fprintf(out, "    Cursor B: Invalid GTT PTE\n");
 	if (reg & (1 << 27))
-		printf("    MT: Invalid tiling\n");
+		fprintf(out, "    MT: Invalid tiling\n");
 	if (reg & (1 << 26))
-		printf("    MT: Invalid GTT PTE\n");
+		fprintf(out, "    MT: Invalid GTT PTE\n");
 	if (reg & (1 << 25))
-		printf("    LC: Invalid tiling\n");
+		fprintf(out, "    LC: Invalid tiling\n");
 	if (reg & (1 << 24))
-		printf("    LC: Invalid GTT PTE\n");
+		fprintf(out, "    LC: Invalid GTT PTE\n");
 	if (reg & (1 << 23))
-		printf("    BIN VertexData: Invalid GTT PTE\n");
+		fprintf(out, "    BIN VertexData: Invalid GTT PTE\n");
 	if (reg & (1 << 22))
-		printf("    BIN Instruction: Invalid GTT PTE\n");
+		fprintf(out, "    BIN Instruction: Invalid GTT PTE\n");
 	if (reg & (1 << 21))
-		printf("    CS VertexData: Invalid GTT PTE\n");
+		fprintf(out, "    CS VertexData: Invalid GTT PTE\n");
 	if (reg & (1 << 20))
-		printf("    CS Instruction: Invalid GTT PTE\n");
+		fprintf(out, "    CS Instruction: Invalid GTT PTE\n");
 	if (reg & (1 << 19))
-		printf("    CS: Invalid GTT\n");
+		fprintf(out, "    CS: Invalid GTT\n");
 	if (reg & (1 << 18))
-		printf("    Overlay: Invalid tiling\n");
+		fprintf(out, "    Overlay: Invalid tiling\n");
 	if (reg & (1 << 16))
-		printf("    Overlay: Invalid GTT PTE\n");
+		fprintf(out, "    Overlay: Invalid GTT PTE\n");
 	if (reg & (1 << 14))
-		printf("    Display C: Invalid tiling\n");
+		fprintf(out, "    Display C: Invalid tiling\n");
 	if (reg & (1 << 12))
-		printf("    Display C: Invalid GTT PTE\n");
+		fprintf(out, "    Display C: Invalid GTT PTE\n");
 	if (reg & (1 << 10))
-		printf("    Display B: Invalid tiling\n");
+		fprintf(out, "    Display B: Invalid tiling\n");
 	if (reg & (1 << 8))
-		printf("    Display B: Invalid GTT PTE\n");
+		fprintf(out, "    Display B: Invalid GTT PTE\n");
 	if (reg & (1 << 6))
-		printf("    Display A: Invalid tiling\n");
+		fprintf(out, "    Display A: Invalid tiling\n");
 	if (reg & (1 << 4))
-		printf("    Display A: Invalid GTT PTE\n");
+		fprintf(out, "    Display A: Invalid GTT PTE\n");
 	if (reg & (1 << 1))
-		printf("    Host Invalid PTE data\n");
+		fprintf(out, "    Host Invalid PTE data\n");
 	if (reg & (1 << 0))
-		printf("    Host Invalid GTT PTE\n");
+		fprintf(out, "    Host Invalid GTT PTE\n");
 }
 
 static void
 print_i965_pgtbl_err(unsigned int reg)
 {
 	if (reg & (1 << 26))
-		printf("    Invalid Sampler Cache GTT entry\n");
+		fprintf(out, "    Invalid Sampler Cache GTT entry\n");
 	if (reg & (1 << 24))
-		printf("    Invalid Render Cache GTT entry\n");
+		fprintf(out, "    Invalid Render Cache GTT entry\n");
 	if (reg & (1 << 23))
-		printf("    Invalid Instruction/State Cache GTT entry\n");
+		fprintf(out, "    Invalid Instruction/State Cache GTT entry\n");
 	if (reg & (1 << 22))
-		printf("    There is no ROC, this cannot occur!\n");
+		fprintf(out, "    There is no ROC, this cannot occur!\n");
 	if (reg & (1 << 21))
-		printf("    Invalid GTT entry during Vertex Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Vertex Fetch\n");
 	if (reg & (1 << 20))
-		printf("    Invalid GTT entry during Command Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Command Fetch\n");
 	if (reg & (1 << 19))
-		printf("    Invalid GTT entry during CS\n");
+		fprintf(out, "    Invalid GTT entry during CS\n");
 	if (reg & (1 << 18))
-		printf("    Invalid GTT entry during Cursor Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Cursor Fetch\n");
 	if (reg & (1 << 17))
-		printf("    Invalid GTT entry during Overlay Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Overlay Fetch\n");
 	if (reg & (1 << 8))
-		printf("    Invalid GTT entry during Display B Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Display B Fetch\n");
 	if (reg & (1 << 4))
-		printf("    Invalid GTT entry during Display A Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Display A Fetch\n");
 	if (reg & (1 << 1))
-		printf("    Valid PTE references illegal memory\n");
+		fprintf(out, "    Valid PTE references illegal memory\n");
 	if (reg & (1 << 0))
-		printf("    Invalid GTT entry during fetch for host\n");
+		fprintf(out, "    Invalid GTT entry during fetch for host\n");
 }
 
 static void
@@ -246,7 +252,7 @@ print_pgtbl_err(unsigned int reg, unsigned int devid)
 static void
 print_snb_fence(unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<1) ? 'y' : 'x',
 			(int)(((fence>>32)&0xfff)+1)*128,
@@ -257,7 +263,7 @@ print_snb_fence(unsigned int devid, uint64_t fence)
 static void
 print_i965_fence(unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<1) ? 'y' : 'x',
 			(int)(((fence>>2)&0x1ff)+1)*128,
@@ -274,7 +280,7 @@ print_i915_fence(unsigned int devid, uint64_t fence)
 	else
 		tile_width = 512;
 
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<12) ? 'y' : 'x',
 			(1<<((fence>>4)&0xf))*tile_width,
@@ -285,7 +291,7 @@ print_i915_fence(unsigned int devid, uint64_t fence)
 static void
 print_i830_fence(unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<12) ? 'y' : 'x',
 			(1<<((fence>>4)&0xf))*128,
@@ -315,184 +321,1185 @@ static void print_batch(int is_batch, const char *ring_name, uint32_t gtt_offset
 {
 	const char *buffer_type[2] = {  "ringbuffer", "batchbuffer" };
 	if (is_batch || !num_rings)
-		printf("%s (%s) at 0x%08x\n", buffer_type[is_batch], ring_name, gtt_offset);
+		fprintf(out, "%s (%s) at 0x%08x\n", buffer_type[is_batch], ring_name, gtt_offset);
 	else
-		printf("%s (%s) at 0x%08x; HEAD points to: 0x%08x\n", buffer_type[is_batch], ring_name, gtt_offset, head[head_ndx++ % num_rings] + gtt_offset);
+		fprintf(out, "%s (%s) at 0x%08x; HEAD points to: 0x%08x\n", buffer_type[is_batch], ring_name, gtt_offset, head[head_ndx++ % num_rings] + gtt_offset);
 }
 
-static void decode(struct drm_intel_decode *ctx, bool is_batch,
-		   const char *ring_name, uint32_t gtt_offset, uint32_t *data,
-		   int *count)
+/*
+ * The error state is machine generated, so rather than running a battery of
+ * sscanf()s over every line we walk the input once with a few strict prefix
+ * matchers. Regular files are mmapped privately, which lets the dword runs be
+ * converted in place and handed to the decoder without another copy; pipes
+ * are streamed through a small window instead.
+ */
+struct input {
+	FILE *file;	/* NULL if the whole file is in memory */
+	char *base;
+	size_t size;	/* bytes valid in base[] */
+	size_t alloc;	/* size of the read window */
+	size_t pos;
+	bool eof;
+	bool mapped;
+};
+
+struct dwords {
+	uint32_t *data;
+	uint32_t *heap;
+	int count;
+	int heap_size;
+	bool in_place;
+};
+
+static void
+input_init(struct input *in, FILE *file)
 {
-	if (!*count)
-		return;
+	struct stat st;
 
-	print_batch(is_batch, ring_name, gtt_offset);
-	drm_intel_decode_set_batch_pointer(ctx, data, gtt_offset, *count);
-	drm_intel_decode(ctx);
-	*count = 0;
+	memset(in, 0, sizeof(*in));
+
+	if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size > 0) {
+		void *ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE, fileno(file), 0);
+		if (ptr != MAP_FAILED) {
+			madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+			in->base = ptr;
+			in->size = st.st_size;
+			in->mapped = true;
+			return;
+		}
+	}
+
+	in->file = file;
+	in->alloc = 64 * 1024;
+	in->base = malloc(in->alloc);
+	if (in->base == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
 }
 
 static void
-read_data_file(FILE *file)
-{
-	struct drm_intel_decode *decode_ctx = NULL;
-	uint32_t devid = PCI_CHIP_I855_GM;
-	uint32_t *data = NULL;
-	long long unsigned fence;
-	int data_size = 0, count = 0, line_number = 0, matched;
-	char *line = NULL;
-	size_t line_size;
-	uint32_t offset, value, ring_length = 0;
-	uint32_t gtt_offset = 0, new_gtt_offset;
-	char *ring_name = NULL;
-	int is_batch = 1;
-
-	while (getline(&line, &line_size, file) > 0) {
-		char *dashes;
-		line_number++;
-
-		dashes = strstr(line, "---");
-		if (dashes) {
-			char *new_ring_name = malloc(dashes - line);
-			strncpy(new_ring_name, line, dashes - line);
-			new_ring_name[dashes - line - 1] = '\0';
-
-			if (num_rings == -1)
-				num_rings = head_ndx;
-
-			matched = sscanf(dashes, "--- gtt_offset = 0x%08x\n",
-					&new_gtt_offset);
-			if (matched == 1) {
-				decode(decode_ctx, is_batch, ring_name,
-				       gtt_offset, data, &count);
-				gtt_offset = new_gtt_offset;
-				is_batch = 1;
-				free(ring_name);
-				ring_name = new_ring_name;
-				continue;
+input_fini(struct input *in)
+{
+	if (in->mapped)
+		munmap(in->base, in->size);
+	else
+		free(in->base);
+}
+
+/*
+ * Streamed inputs (pipes and compressed files) are pulled into memory to be
+ * indexed. Error states are a few hundred MiB at most, so stop well before a
+ * bogus or hostile input exhausts memory.
+ */
+#define MAX_LOAD_SIZE (1024 * 1024 * 1024)
+
+/* Pulls the rest of a streamed input into memory for random access. */
+static void
+input_load(struct input *in)
+{
+	if (in->file == NULL)
+		return;
+
+	while (!in->eof) {
+		if (in->size == in->alloc) {
+			if (in->alloc >= MAX_LOAD_SIZE) {
+				if (fgetc(in->file) == EOF)
+					break;
+
+				fprintf(stderr,
+					"Input larger than %d MiB, decode it "
+					"without -l, -r, -a or -g.\n",
+					MAX_LOAD_SIZE >> 20);
+				exit(1);
 			}
 
-			matched = sscanf(dashes, "--- ringbuffer = 0x%08x\n",
-					&new_gtt_offset);
-			if (matched == 1) {
-				decode(decode_ctx, is_batch, ring_name,
-				       gtt_offset, data, &count);
-				gtt_offset = new_gtt_offset;
-				is_batch = 0;
-				free(ring_name);
-				ring_name = new_ring_name;
-				continue;
+			in->alloc *= 2;
+			in->base = realloc(in->base, in->alloc);
+			if (in->base == NULL) {
+				fprintf(stderr, "Out of memory.\n");
+				exit(1);
 			}
 		}
 
-		matched = sscanf(line, "%08x : %08x", &offset, &value);
-		if (matched != 2) {
-			unsigned int reg;
+		in->size += fread(in->base + in->size, 1,
+				  in->alloc - in->size, in->file);
+		if (in->size < in->alloc)
+			in->eof = true;
+	}
 
-			/* display reg section is after the ringbuffers, don't mix them */
-			decode(decode_ctx, is_batch, ring_name, gtt_offset,
-			       data, &count);
+	in->file = NULL;
+}
 
-			printf("%s", line);
+/* Sets up sub to iterate over [offset, offset + length) of an input
+ * that is entirely in memory.
+ */
+static void
+input_range(struct input *sub, const struct input *in,
+	    uint64_t offset, uint64_t length)
+{
+	memset(sub, 0, sizeof(*sub));
+	sub->base = in->base + offset;
+	sub->size = length;
+}
 
-			matched = sscanf(line, "PCI ID: 0x%04x\n", &reg);
-			if (matched == 0)
-				matched = sscanf(line, " PCI ID: 0x%04x\n", &reg);
-			if (matched == 0) {
-				const char *pci_id_start = strstr(line, "PCI ID");
-				if (pci_id_start)
-					matched = sscanf(pci_id_start, "PCI ID: 0x%04x\n", &reg);
-			}
-			if (matched == 1) {
-				devid = reg;
-				printf("Detected GEN%i chipset\n",
-						intel_gen(devid));
+/* Returns the next line including its terminating newline, if any. */
+static bool
+input_next_line(struct input *in, char **line, size_t *len)
+{
+	char *nl;
+
+	for (;;) {
+		nl = memchr(in->base + in->pos, '\n', in->size - in->pos);
+		if (nl || in->file == NULL || in->eof)
+			break;
+
+		/* Refill the window, keeping the partial line at its start */
+		memmove(in->base, in->base + in->pos, in->size - in->pos);
+		in->size -= in->pos;
+		in->pos = 0;
 
-				decode_ctx = drm_intel_decode_context_alloc(devid);
+		if (in->size == in->alloc) {
+			in->alloc *= 2;
+			in->base = realloc(in->base, in->alloc);
+			if (in->base == NULL) {
+				fprintf(stderr, "Out of memory.\n");
+				exit(1);
 			}
+		}
+
+		in->size += fread(in->base + in->size, 1,
+				  in->alloc - in->size, in->file);
+		if (in->size < in->alloc)
+			in->eof = true;
+	}
+
+	if (in->pos == in->size)
+		return false;
+
+	*line = in->base + in->pos;
+	*len = nl ? nl - *line + 1 : in->size - in->pos;
+	in->pos += *len;
+	return true;
+}
+
+static inline int
+hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static const char *
+skip_spaces(const char *s, const char *end)
+{
+	while (s < end && (*s == ' ' || *s == '\t'))
+		s++;
+	return s;
+}
+
+/* Parses up to max_digits hex digits, returns NULL if there are none. */
+static const char *
+parse_hex(const char *s, const char *end, int max_digits, uint64_t *value)
+{
+	const char *start = s;
+	uint64_t v = 0;
+	int d;
+
+	while (s < end && s - start < max_digits &&
+	       (d = hex_digit(*s)) >= 0) {
+		v = v << 4 | d;
+		s++;
+	}
+
+	if (s == start)
+		return NULL;
+
+	*value = v;
+	return s;
+}
+
+static const char *
+match(const char *s, const char *end, const char *prefix)
+{
+	size_t len = strlen(prefix);
 
-			matched = sscanf(line, "  CTL: 0x%08x\n", &reg);
-			if (matched == 1)
-				ring_length = print_ctl(reg);
+	if (end - s < len || memcmp(s, prefix, len))
+		return NULL;
 
-			matched = sscanf(line, "  HEAD: 0x%08x\n", &reg);
-			if (matched == 1) {
-				head[num_rings++] = print_head(reg);
+	return s + len;
+}
+
+/* Equivalent of sscanf(line, " <prefix>0x%0<digits>x", &value) */
+static bool
+match_reg(const char *s, const char *end, const char *prefix, int digits,
+	  uint32_t *value)
+{
+	uint64_t v;
+
+	s = match(skip_spaces(s, end), end, prefix);
+	if (s == NULL)
+		return false;
+
+	s = match(s, end, "0x");
+	if (s == NULL || parse_hex(s, end, digits, &v) == NULL)
+		return false;
+
+	*value = v;
+	return true;
+}
+
+/* Equivalent of sscanf(line, "%08x : %08x", &offset, &value) */
+static bool
+match_dword(const char *s, const char *end, uint32_t *value)
+{
+	uint64_t v;
+
+	s = parse_hex(skip_spaces(s, end), end, 8, &v);
+	if (s == NULL)
+		return false;
+
+	s = skip_spaces(s, end);
+	if (s == end || *s++ != ':')
+		return false;
+
+	if (parse_hex(skip_spaces(s, end), end, 8, &v) == NULL)
+		return false;
+
+	*value = v;
+	return true;
+}
+
+static const char *
+find_dashes(const char *s, const char *end)
+{
+	while ((s = memchr(s, '-', end - s)) != NULL) {
+		if (end - s >= 3 && s[1] == '-' && s[2] == '-')
+			return s;
+		s++;
+	}
+
+	return NULL;
+}
+
+static void
+push_dword(struct dwords *dw, const struct input *in,
+	   const char *line, size_t len, uint32_t value)
+{
+	if (dw->count == 0) {
+		dw->in_place = in->file == NULL;
+		if (dw->in_place)
+			dw->data = (uint32_t *)(((uintptr_t)line + 3) & ~(uintptr_t)3);
+		else
+			dw->data = dw->heap;
+	}
+
+	/* The converted dwords trail the text they were parsed from, unless
+	 * the lines are pathologically short; then fall back to a copy.
+	 */
+	if (dw->in_place &&
+	    (char *)(dw->data + dw->count + 1) > line + len) {
+		if (dw->count > dw->heap_size) {
+			dw->heap_size = dw->count;
+			dw->heap = realloc(dw->heap,
+					   dw->heap_size * sizeof(uint32_t));
+			if (dw->heap == NULL) {
+				fprintf(stderr, "Out of memory.\n");
+				exit(1);
 			}
+		}
+		memcpy(dw->heap, dw->data, dw->count * sizeof(uint32_t));
+		dw->data = dw->heap;
+		dw->in_place = false;
+	}
+
+	if (!dw->in_place && dw->count == dw->heap_size) {
+		dw->heap_size = dw->heap_size ? dw->heap_size * 2 : 1024;
+		dw->heap = realloc(dw->heap, dw->heap_size * sizeof(uint32_t));
+		if (dw->heap == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+		dw->data = dw->heap;
+	}
+
+	dw->data[dw->count++] = value;
+}
+
+/*
+ * With -j the batches are queued up while the rest of the error state is
+ * rendered into a memory buffer, and then decoded by a set of worker
+ * processes. libdrm's decoder keeps its state in file-scope variables, so
+ * the workers have to be processes rather than threads. Each worker appends
+ * to its own temporary file and the pieces are stitched back together in
+ * the original order, so the output matches a serial run byte for byte.
+ * Batches whose decoding depends on the previous ones are not queued, see
+ * queue_decode().
+ */
+struct decode_job {
+	struct drm_intel_decode *ctx;
+	uint32_t *data;
+	uint32_t *heap;	/* owned copy of data, NULL if in the mapping */
+	int count;
+	uint32_t gtt_offset;
+	uint32_t acthd;
+	bool has_acthd;
+	long text_offset;
+};
+
+struct decode_result {
+	int worker;
+	long offset;
+	long length;
+};
+
+static int num_workers = 1;
+static struct decode_job *jobs;
+static int num_jobs, max_jobs;
+
+static void
+queue_job(struct drm_intel_decode *ctx, uint32_t gtt_offset,
+	  const uint32_t *acthd, struct dwords *dw)
+{
+	struct decode_job *job;
+
+	if (num_jobs == max_jobs) {
+		max_jobs = max_jobs ? max_jobs * 2 : 64;
+		jobs = realloc(jobs, max_jobs * sizeof(*jobs));
+		if (jobs == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+
+	job = &jobs[num_jobs++];
+	job->ctx = ctx;
+	job->data = dw->data;
+	job->heap = NULL;
+	job->count = dw->count;
+	job->gtt_offset = gtt_offset;
+	job->has_acthd = acthd != NULL;
+	job->acthd = acthd ? *acthd : 0;
+	job->text_offset = ftell(out);
+
+	/* Hand the buffer over to the job, the next run starts afresh */
+	if (!dw->in_place) {
+		job->heap = dw->heap;
+		dw->heap = NULL;
+		dw->heap_size = 0;
+	}
+}
+
+static void
+run_worker(int worker, FILE *file, struct decode_result *results,
+	   int *next_job)
+{
+	int i;
+
+	while ((i = __sync_fetch_and_add(next_job, 1)) < num_jobs) {
+		struct decode_job *job = &jobs[i];
+
+		results[i].worker = worker;
+		results[i].offset = ftell(file);
+
+		drm_intel_decode_set_output_file(job->ctx, file);
+		if (job->has_acthd)
+			drm_intel_decode_set_head_tail(job->ctx, job->acthd,
+						       0xffffffff);
+		drm_intel_decode_set_batch_pointer(job->ctx, job->data,
+						   job->gtt_offset,
+						   job->count);
+		drm_intel_decode(job->ctx);
+
+		fflush(file);
+		results[i].length = ftell(file) - results[i].offset;
+	}
+}
+
+static void
+copy_range(FILE *dst, int fd, long offset, long length)
+{
+	char buf[64 * 1024];
+
+	while (length) {
+		ssize_t len = pread(fd, buf,
+				    length < sizeof(buf) ? length : sizeof(buf),
+				    offset);
+		if (len <= 0) {
+			fprintf(stderr, "Failed to read decoded batch: %s\n",
+				strerror(errno));
+			exit(1);
+		}
+
+		fwrite(buf, 1, len, dst);
+		offset += len;
+		length -= len;
+	}
+}
+
+static void
+run_jobs(const char *text, size_t text_len)
+{
+	struct decode_result *results;
+	size_t shared_size;
+	FILE **files;
+	int *next_job;
+	long pos = 0;
+	int i;
+
+	shared_size = num_jobs * sizeof(*results) + sizeof(*next_job);
+	results = mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (results == MAP_FAILED) {
+		fprintf(stderr, "Failed to allocate job results: %s\n",
+			strerror(errno));
+		exit(1);
+	}
+	next_job = (int *)(results + num_jobs);
+	*next_job = 0;
+
+	/* Don't let the workers inherit anything still to be written */
+	fflush(stdout);
+
+	files = calloc(num_workers, sizeof(*files));
+	for (i = 0; i < num_workers; i++) {
+		pid_t pid;
+
+		files[i] = tmpfile();
+		if (files[i] == NULL) {
+			fprintf(stderr, "Failed to create temporary file: %s\n",
+				strerror(errno));
+			exit(1);
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "Failed to fork worker: %s\n",
+				strerror(errno));
+			exit(1);
+		}
+		if (pid == 0) {
+			run_worker(i, files[i], results, next_job);
+			_exit(0);
+		}
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		int status;
+
+		if (wait(&status) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "Decode worker failed\n");
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < num_jobs; i++) {
+		fwrite(text + pos, 1, jobs[i].text_offset - pos, stdout);
+		pos = jobs[i].text_offset;
+
+		copy_range(stdout, fileno(files[results[i].worker]),
+			   results[i].offset, results[i].length);
+		free(jobs[i].heap);
+	}
+	fwrite(text + pos, 1, text_len - pos, stdout);
+
+	for (i = 0; i < num_workers; i++)
+		fclose(files[i]);
+	free(files);
+	munmap(results, shared_size);
+
+	free(jobs);
+	jobs = NULL;
+	num_jobs = max_jobs = 0;
+}
+
+/*
+ * The gen2/3 decoder remembers S2 and S4 of 3DSTATE_LOAD_STATE_IMMEDIATE_1 to
+ * decode the vertices of later 3DPRIMITIVEs, which may be in the next batch.
+ * Each worker would only carry that state between its own batches, so with
+ * -j those are still decoded here, in order.
+ */
+static bool
+queue_decode(uint32_t devid)
+{
+	return num_workers > 1 && intel_gen(devid) >= 4;
+}
+
+static void decode(struct drm_intel_decode *ctx, uint32_t devid,
+		   bool is_batch, const char *ring_name, uint32_t gtt_offset,
+		   const uint32_t *acthd, struct dwords *dw)
+{
+	if (!dw->count)
+		return;
+
+	print_batch(is_batch, ring_name, gtt_offset);
+	if (queue_decode(devid)) {
+		queue_job(ctx, gtt_offset, acthd, dw);
+	} else {
+		drm_intel_decode_set_output_file(ctx, out);
+		drm_intel_decode_set_batch_pointer(ctx, dw->data, gtt_offset,
+						   dw->count);
+		drm_intel_decode(ctx);
+	}
+	dw->count = 0;
+}
+
+struct parser {
+	struct drm_intel_decode *decode_ctx;
+	uint32_t devid;
+	struct dwords dw;
+	uint32_t ring_length;
+	uint32_t gtt_offset;
+	uint32_t acthd;
+	bool has_acthd;
+	char *ring_name;
+	int is_batch;
+};
+
+static void
+parser_set_acthd(struct parser *p, uint32_t acthd)
+{
+	p->acthd = acthd;
+	p->has_acthd = true;
+	if (!queue_decode(p->devid))
+		drm_intel_decode_set_head_tail(p->decode_ctx, acthd, 0xffffffff);
+}
+
+static void
+parser_flush(struct parser *p)
+{
+	decode(p->decode_ctx, p->devid, p->is_batch, p->ring_name,
+	       p->gtt_offset, p->has_acthd ? &p->acthd : NULL, &p->dw);
+}
+
+static void
+parse_line(struct parser *p, const struct input *in, char *line, size_t len)
+{
+	const char *end = line + len;
+	const char *dashes, *s;
+	uint32_t reg;
+	uint64_t v;
+
+	dashes = find_dashes(line, end);
+	if (dashes) {
+		int new_is_batch = -1;
+
+		if (num_rings == -1)
+			num_rings = head_ndx;
+
+		if ((s = match(dashes, end, "--- gtt_offset = 0x")))
+			new_is_batch = 1;
+		else if ((s = match(dashes, end, "--- ringbuffer = 0x")))
+			new_is_batch = 0;
+
+		if (new_is_batch != -1 && parse_hex(s, end, 8, &v)) {
+			parser_flush(p);
+			p->gtt_offset = v;
+			p->is_batch = new_is_batch;
+			free(p->ring_name);
+			p->ring_name = dashes > line ?
+				strndup(line, dashes - line - 1) :
+				strdup("");
+			return;
+		}
+	}
 
-			matched = sscanf(line, "  ACTHD: 0x%08x\n", &reg);
-			if (matched == 1) {
-				print_acthd(reg, ring_length);
-				drm_intel_decode_set_head_tail(decode_ctx, reg, 0xffffffff);
+	if (match_dword(line, end, &reg)) {
+		push_dword(&p->dw, in, line, len, reg);
+		return;
+	}
+
+	/* display reg section is after the ringbuffers, don't mix them */
+	parser_flush(p);
+
+	fwrite(line, 1, len, out);
+
+	s = memmem(line, len, "PCI ID", 6);
+	if (s && match_reg(s, end, "PCI ID: ", 4, &reg)) {
+		p->devid = reg;
+		fprintf(out, "Detected GEN%i chipset\n",
+				intel_gen(p->devid));
+
+		p->decode_ctx = drm_intel_decode_context_alloc(p->devid);
+		p->has_acthd = false;
+		return;
+	}
+
+	if (match_reg(line, end, "CTL: ", 8, &reg))
+		p->ring_length = print_ctl(reg);
+	else if (match_reg(line, end, "HEAD: ", 8, &reg))
+		head[num_rings++] = print_head(reg);
+	else if (match_reg(line, end, "ACTHD: ", 8, &reg)) {
+		print_acthd(reg, p->ring_length);
+		parser_set_acthd(p, reg);
+	} else if (match_reg(line, end, "PGTBL_ER: ", 8, &reg)) {
+		if (reg)
+			print_pgtbl_err(reg, p->devid);
+	} else if (match_reg(line, end, "INSTDONE: ", 8, &reg))
+		print_instdone(p->devid, reg, -1);
+	else if (match_reg(line, end, "INSTDONE1: ", 8, &reg))
+		print_instdone(p->devid, -1, reg);
+	else if ((s = match(skip_spaces(line, end), end, "fence["))) {
+		s = memchr(s, ']', end - s);
+		if (s && (s = match(s, end, "] = ")) &&
+		    parse_hex(s, end, 16, &v))
+			print_fence(p->devid, v);
+	}
+}
+
+/*
+ * Section index: a single pass over the error state recording where each
+ * ring's registers, the fence list and every buffer dump start and end,
+ * so that the filters can jump straight to the interesting parts. The
+ * index can be cached next to the error state (<file>.idx).
+ */
+enum section_type {
+	SECTION_TEXT,
+	SECTION_RING,
+	SECTION_FENCES,
+	SECTION_BATCH,
+	SECTION_RINGBUFFER,
+	SECTION_OBJECT,
+};
+
+static const char *section_type_names[] = {
+	[SECTION_TEXT] = "text",
+	[SECTION_RING] = "ring",
+	[SECTION_FENCES] = "fences",
+	[SECTION_BATCH] = "batch",
+	[SECTION_RINGBUFFER] = "ringbuffer",
+	[SECTION_OBJECT] = "object",
+};
+
+#define SECTION_HAS_HEAD	(1 << 0)
+#define SECTION_HAS_ACTHD	(1 << 1)
+
+struct section {
+	uint64_t offset;
+	uint64_t length;
+	uint32_t type;
+	uint32_t flags;
+	uint32_t gtt_offset;	/* buffers only */
+	uint32_t count;		/* dwords in the buffer */
+	uint32_t head;		/* ring registers only */
+	uint32_t acthd;
+	char name[32];
+};
+
+struct section_index {
+	uint32_t devid;
+	int num_sections;
+	int max_sections;
+	struct section *sections;
+};
+
+#define INDEX_MAGIC "IGTERRI3"
+
+/* file_* identify the file on disk, which may be compressed, data_size is
+ * the length of the error state it holds.
+ */
+struct index_header {
+	char magic[8];
+	uint64_t file_size;
+	uint64_t data_size;
+	int64_t file_mtime;
+	int64_t file_mtime_nsec;
+	uint32_t devid;
+	uint32_t num_sections;
+};
+
+static struct {
+	const char *ring;
+	uint32_t gtt_offset;
+	bool has_gtt_offset;
+	bool only_active;
+	bool list;
+	bool cache;
+} filter;
+
+static bool
+filter_active(void)
+{
+	return filter.ring || filter.has_gtt_offset || filter.only_active ||
+		filter.list;
+}
+
+static struct section *
+index_add(struct section_index *idx, enum section_type type,
+	  uint64_t offset, const char *name, size_t name_len)
+{
+	struct section *s;
+
+	if (idx->num_sections == idx->max_sections) {
+		idx->max_sections = idx->max_sections ?
+			idx->max_sections * 2 : 64;
+		idx->sections = realloc(idx->sections,
+					idx->max_sections * sizeof(*s));
+		if (idx->sections == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+
+	s = &idx->sections[idx->num_sections++];
+	memset(s, 0, sizeof(*s));
+	s->type = type;
+	s->offset = offset;
+	if (name_len >= sizeof(s->name))
+		name_len = sizeof(s->name) - 1;
+	memcpy(s->name, name, name_len);
+
+	return s;
+}
+
+static void
+build_index(struct section_index *idx, struct input *in)
+{
+	struct section *cur = NULL;
+	struct input all;
+	char *line;
+	size_t len;
+
+	input_range(&all, in, 0, in->size);
+
+	while (input_next_line(&all, &line, &len)) {
+		const char *end = line + len;
+		uint64_t offset = line - in->base;
+		const char *dashes, *s;
+		uint32_t reg;
+		uint64_t v;
+
+		dashes = find_dashes(line, end);
+		if (dashes) {
+			size_t name_len = dashes > line ? dashes - line - 1 : 0;
+			enum section_type type = SECTION_OBJECT;
+
+			if ((s = match(dashes, end, "--- gtt_offset = 0x")))
+				type = SECTION_BATCH;
+			else if ((s = match(dashes, end, "--- ringbuffer = 0x")))
+				type = SECTION_RINGBUFFER;
+
+			cur = index_add(idx, type, offset, line, name_len);
+			if (type != SECTION_OBJECT && parse_hex(s, end, 8, &v))
+				cur->gtt_offset = v;
+		} else if (match_dword(line, end, &reg) && cur &&
+			   cur->type >= SECTION_BATCH) {
+			cur->count++;
+		} else if (line[0] != ' ' && len > 17 &&
+			   memcmp(end - 17, " command stream:\n", 17) == 0) {
+			cur = index_add(idx, SECTION_RING, offset,
+					line, len - 17);
+		} else if (match(skip_spaces(line, end), end, "fence[")) {
+			if (cur == NULL || cur->type != SECTION_FENCES)
+				cur = index_add(idx, SECTION_FENCES, offset,
+						"", 0);
+		} else if (cur && cur->type == SECTION_RING && line[0] == ' ') {
+			if (match_reg(line, end, "HEAD: ", 8, &reg)) {
+				cur->head = reg & (0x7ffff << 2);
+				cur->flags |= SECTION_HAS_HEAD;
+			} else if (match_reg(line, end, "ACTHD: ", 8, &reg)) {
+				cur->acthd = reg;
+				cur->flags |= SECTION_HAS_ACTHD;
 			}
+		} else {
+			if (cur == NULL || cur->type != SECTION_TEXT)
+				cur = index_add(idx, SECTION_TEXT, offset,
+						"", 0);
 
-			matched = sscanf(line, "  PGTBL_ER: 0x%08x\n", &reg);
-			if (matched == 1 && reg)
-				print_pgtbl_err(reg, devid);
+			s = memmem(line, len, "PCI ID", 6);
+			if (s && match_reg(s, end, "PCI ID: ", 4, &reg))
+				idx->devid = reg;
+		}
 
-			matched = sscanf(line, "  INSTDONE: 0x%08x\n", &reg);
-			if (matched == 1)
-				print_instdone(devid, reg, -1);
+		cur->length = offset + len - cur->offset;
+	}
+}
 
-			matched = sscanf(line, "  INSTDONE1: 0x%08x\n", &reg);
-			if (matched == 1)
-				print_instdone(devid, -1, reg);
+static char *
+index_path(const char *path)
+{
+	char *filename;
+
+	if (asprintf(&filename, "%s.idx", path) < 0)
+		return NULL;
+
+	return filename;
+}
+
+/* A stale or corrupt index must not send us outside of the input */
+static bool
+section_valid(const struct section *s, size_t size)
+{
+	return s->type < sizeof(section_type_names) / sizeof(section_type_names[0]) &&
+		s->offset <= size && s->length <= size - s->offset &&
+		memchr(s->name, '\0', sizeof(s->name)) != NULL;
+}
+
+static bool
+load_index(struct section_index *idx, const char *path, const struct stat *st,
+	   size_t size)
+{
+	struct index_header hdr;
+	char *filename;
+	FILE *file;
+	uint32_t i;
+	bool ret = false;
+
+	filename = index_path(path);
+	file = filename ? fopen(filename, "r") : NULL;
+	free(filename);
+	if (file == NULL)
+		return false;
+
+	/* Every section spans at least one line, so no more than there are
+	 * bytes.
+	 */
+	if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+	    memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.file_size != st->st_size || hdr.data_size != size ||
+	    hdr.file_mtime != st->st_mtim.tv_sec ||
+	    hdr.file_mtime_nsec != st->st_mtim.tv_nsec ||
+	    hdr.num_sections > size ||
+	    hdr.num_sections > INT_MAX / sizeof(*idx->sections))
+		goto out;
+
+	idx->sections = malloc(hdr.num_sections * sizeof(*idx->sections));
+	if (idx->sections == NULL)
+		goto out;
+
+	if (fread(idx->sections, sizeof(*idx->sections), hdr.num_sections,
+		  file) != hdr.num_sections)
+		goto invalid;
+
+	for (i = 0; i < hdr.num_sections; i++) {
+		if (!section_valid(&idx->sections[i], size))
+			goto invalid;
+	}
 
-			matched = sscanf(line, "  fence[%i] = %Lx\n", &reg, &fence);
-			if (matched == 2)
-				print_fence(devid, fence);
+	idx->devid = hdr.devid;
+	idx->num_sections = idx->max_sections = hdr.num_sections;
+	ret = true;
+	goto out;
 
+invalid:
+	free(idx->sections);
+	idx->sections = NULL;
+out:
+	fclose(file);
+	return ret;
+}
+
+static void
+save_index(const struct section_index *idx, const char *path,
+	   const struct stat *st, size_t size)
+{
+	struct index_header hdr;
+	char *filename;
+	FILE *file;
+
+	filename = index_path(path);
+	file = filename ? fopen(filename, "w") : NULL;
+	if (file == NULL) {
+		fprintf(stderr, "Failed to write index %s.idx: %s\n",
+			path, strerror(errno));
+		free(filename);
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.file_size = st->st_size;
+	hdr.data_size = size;
+	hdr.file_mtime = st->st_mtim.tv_sec;
+	hdr.file_mtime_nsec = st->st_mtim.tv_nsec;
+	hdr.devid = idx->devid;
+	hdr.num_sections = idx->num_sections;
+
+	fwrite(&hdr, sizeof(hdr), 1, file);
+	fwrite(idx->sections, sizeof(*idx->sections), idx->num_sections, file);
+	fclose(file);
+	free(filename);
+}
+
+static void
+list_sections(const struct section_index *idx)
+{
+	int i;
+
+	fprintf(out, "%12s %12s  %-10s %s\n",
+		"offset", "length", "type", "name");
+
+	for (i = 0; i < idx->num_sections; i++) {
+		const struct section *s = &idx->sections[i];
+
+		fprintf(out, "%12" PRIu64 " %12" PRIu64 "  %-10s %-24s",
+			s->offset, s->length, section_type_names[s->type],
+			s->name);
+		if (s->type == SECTION_BATCH || s->type == SECTION_RINGBUFFER)
+			fprintf(out, " gtt_offset 0x%08x, %u dwords",
+				s->gtt_offset, s->count);
+		else if (s->type == SECTION_RING &&
+			 s->flags & SECTION_HAS_ACTHD)
+			fprintf(out, " acthd 0x%08x", s->acthd);
+		fprintf(out, "\n");
+	}
+}
+
+static bool
+ring_matches(const char *name)
+{
+	return !filter.ring ||
+		strncasecmp(name, filter.ring, strlen(filter.ring)) == 0;
+}
+
+/* Buffers are named after their ring ("render ring"), the register
+ * blocks after the short ring name ("render").
+ */
+static const struct section *
+find_ring(const struct section_index *idx, const char *name)
+{
+	int i;
+
+	for (i = 0; i < idx->num_sections; i++) {
+		const struct section *s = &idx->sections[i];
+		size_t len = strlen(s->name);
+
+		if (s->type == SECTION_RING && len &&
+		    strncmp(name, s->name, len) == 0 &&
+		    (name[len] == ' ' || name[len] == '\0'))
+			return s;
+	}
+
+	return NULL;
+}
+
+static bool
+buffer_contains(const struct section *s, uint32_t addr)
+{
+	return addr >= s->gtt_offset &&
+		addr - s->gtt_offset < (uint64_t)s->count * 4;
+}
+
+static bool
+section_selected(const struct section_index *idx, const struct section *s)
+{
+	const struct section *ring;
+
+	switch (s->type) {
+	case SECTION_RING:
+		return !filter.has_gtt_offset && ring_matches(s->name);
+	case SECTION_BATCH:
+	case SECTION_RINGBUFFER:
+		if (!ring_matches(s->name))
+			return false;
+
+		if (filter.has_gtt_offset &&
+		    !buffer_contains(s, filter.gtt_offset))
+			return false;
+
+		if (filter.only_active) {
+			ring = find_ring(idx, s->name);
+			if (ring == NULL || !(ring->flags & SECTION_HAS_ACTHD) ||
+			    !buffer_contains(s, ring->acthd))
+				return false;
+		}
+
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void
+decode_sections(struct parser *p, struct input *in,
+		const struct section_index *idx)
+{
+	int i;
+
+	if (idx->devid)
+		p->devid = idx->devid;
+	p->decode_ctx = drm_intel_decode_context_alloc(p->devid);
+
+	for (i = 0; i < idx->num_sections; i++) {
+		const struct section *s = &idx->sections[i];
+		const struct section *ring;
+		struct input sub;
+		char *line;
+		size_t len;
+
+		if (!section_selected(idx, s))
 			continue;
+
+		if (s->type != SECTION_RING) {
+			/* The ring's registers may have been filtered out,
+			 * so take its ACTHD and HEAD from the index instead.
+			 */
+			ring = find_ring(idx, s->name);
+			if (ring && ring->flags & SECTION_HAS_ACTHD)
+				parser_set_acthd(p, ring->acthd);
+
+			num_rings = 0;
+			head_ndx = 0;
+			if (ring && ring->flags & SECTION_HAS_HEAD)
+				head[num_rings++] = ring->head;
 		}
 
-		count++;
+		input_range(&sub, in, s->offset, s->length);
+		while (input_next_line(&sub, &line, &len))
+			parse_line(p, &sub, line, len);
+		parser_flush(p);
+	}
+}
 
-		if (count > data_size) {
-			data_size = data_size ? data_size * 2 : 1024;
-			data = realloc(data, data_size * sizeof (uint32_t));
-			if (data == NULL) {
-				fprintf(stderr, "Out of memory.\n");
-				exit(1);
-			}
+static void
+read_data_file(FILE *file, const char *path)
+{
+	struct parser p = { .devid = PCI_CHIP_I855_GM, .is_batch = 1 };
+	struct input in;
+	char *line;
+	size_t len;
+	char *text = NULL;
+	size_t text_len = 0;
+
+	input_init(&in, file);
+
+	if (num_workers > 1) {
+		out = open_memstream(&text, &text_len);
+		if (out == NULL) {
+			fprintf(stderr, "Failed to allocate output buffer\n");
+			exit(1);
 		}
+	}
+
+	if (filter_active()) {
+		struct section_index idx = { 0 };
+		struct stat st;
+		bool cached = false;
+
+		input_load(&in);
 
-		data[count-1] = value;
+		if (filter.cache && path && stat(path, &st) == 0 &&
+		    S_ISREG(st.st_mode))
+			cached = load_index(&idx, path, &st, in.size);
+		else
+			path = NULL;
+
+		if (!cached) {
+			build_index(&idx, &in);
+			if (filter.cache && path)
+				save_index(&idx, path, &st, in.size);
+		}
+
+		if (filter.list)
+			list_sections(&idx);
+		else
+			decode_sections(&p, &in, &idx);
+
+		free(idx.sections);
+	} else {
+		while (input_next_line(&in, &line, &len))
+			parse_line(&p, &in, line, len);
+		parser_flush(&p);
 	}
 
-	decode(decode_ctx, is_batch, ring_name, gtt_offset, data, &count);
+	if (num_workers > 1) {
+		fclose(out);
+		out = stdout;
+		run_jobs(text, text_len);
+		free(text);
+	}
 
-	free(data);
-	free(line);
-	free(ring_name);
+	input_fini(&in);
+	free(p.dw.heap);
+	free(p.ring_name);
+}
+
+static void __attribute__((noreturn))
+usage(const char *name)
+{
+	fprintf(stderr,
+			"intel_gpu_decode: Parse an Intel GPU i915_error_state\n"
+			"Usage:\n"
+			"\t%s [options] [<file>]\n"
+			"\n"
+			"With no arguments, debugfs-dri-directory is probed for in "
+			"/debug and \n"
+			"/sys/kernel/debug.  Otherwise, it may be "
+			"specified.  If a file is given,\n"
+			"it is parsed as an GPU dump in the format of "
+			"/debug/dri/0/i915_error_state.\n"
+			"\n"
+			"  -j, --jobs=N\t\tdecode the batches using N parallel workers\n"
+			"  -l, --list\t\tlist the sections of the error state\n"
+			"  -r, --ring=NAME\tonly show the rings matching NAME\n"
+			"  -a, --only-active\tonly show the buffers containing ACTHD\n"
+			"  -g, --gtt-offset=ADDR\tonly show the buffers containing ADDR\n"
+			"  -i, --index\t\tcache the section index in <file>.idx\n",
+			name);
+	exit(1);
 }
 
 int
 main(int argc, char *argv[])
 {
+	static const struct option long_options[] = {
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "list", no_argument, NULL, 'l' },
+		{ "ring", required_argument, NULL, 'r' },
+		{ "only-active", no_argument, NULL, 'a' },
+		{ "gtt-offset", required_argument, NULL, 'g' },
+		{ "index", no_argument, NULL, 'i' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
 	FILE *file;
 	const char *path;
 	char *filename = NULL;
 	struct stat st;
-	int error;
-
-	if (argc > 2) {
-		fprintf(stderr,
-				"intel_gpu_decode: Parse an Intel GPU i915_error_state\n"
-				"Usage:\n"
-				"\t%s [<file>]\n"
-				"\n"
-				"With no arguments, debugfs-dri-directory is probed for in "
-				"/debug and \n"
-				"/sys/kernel/debug.  Otherwise, it may be "
-				"specified.  If a file is given,\n"
-				"it is parsed as an GPU dump in the format of "
-				"/debug/dri/0/i915_error_state.\n",
-				argv[0]);
-		return 1;
-	}
-
-	if (argc == 1) {
+	int error, c;
+
+	while ((c = getopt_long(argc, argv, "j:lr:ag:ih",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'j':
+			num_workers = atoi(optarg);
+			if (num_workers < 1)
+				num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+			break;
+		case 'l':
+			filter.list = true;
+			break;
+		case 'r':
+			filter.ring = optarg;
+			break;
+		case 'a':
+			filter.only_active = true;
+			break;
+		case 'g':
+			filter.gtt_offset = strtoul(optarg, NULL, 0);
+			filter.has_gtt_offset = true;
+			break;
+		case 'i':
+			filter.cache = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (argc - optind > 1)
+		usage(argv[0]);
+
+	out = stdout;
+
+	if (optind == argc) {
 		if (isatty(0)) {
 			path = "/sys/class/drm/card0/error";
 			error = stat(path, &st);
@@ -511,11 +1518,11 @@ main(int argc, char *argv[])
 				     "\tsudo mount -t debugfs debugfs /sys/kernel/debug\n");
 			}
 		} else {
-			read_data_file(stdin);
+			read_data_file(intel_decompress_file(stdin), NULL);
 			exit(0);
 		}
 	} else {
-		path = argv[1];
+		path = argv[optind];
 		error = stat(path, &st);
 		if (error != 0) {
 			fprintf(stderr, "Error opening %s: %s\n",
@@ -556,7 +1563,8 @@ main(int argc, char *argv[])
 		}
 	}
 
-	read_data_file(file);
+	file = intel_decompress_file(file);
+	read_data_file(file, filename ? filename : path);
 	fclose(file);
 
 	if (filename != path)
@@ -26,10 +26,17 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
@@ -37,8 +44,29 @@
 #include "intel_io.h"
 #include "intel_chipset.h"
 #include "intel_reg.h"
+#include "drmtest.h"
 
 #define SAMPLES_PER_SEC             10000
+#define CPU_SAMPLE_INTERVAL         100	/* ring samples, i.e. 10ms */
+
+#define NSEC_PER_SEC                1000000000ull
+
+struct ring {
+	const char *name;
+	uint32_t mmio;
+	bool present;
+	int index;	/* among the present rings, as in the recording */
+	int slot;	/* of RING_HEAD in the sample set, RING_TAIL follows */
+	bool busy;
+	uint64_t idle;
+};
+
+static struct ring rings[] = {
+	{ "render", LP_RING },
+	{ "bsd", 0x4030 },
+	{ "blt", 0x22030 },
+	{ "vebox", 0x1a030 },
+};
 
 static volatile int goddo;
 
@@ -59,41 +87,439 @@ static void sighandler(int sig)
 	goddo = sig;
 }
 
+static uint64_t gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static double timeval_secs(const struct timeval *tv)
+{
+	return tv->tv_sec + 1e-6 * tv->tv_usec;
+}
+
+/*
+ * Recordings start with the magic "IGTGPUT1", the sample period in ns as a
+ * little endian u32, the number of rings as a byte and their NUL terminated
+ * names. Records follow, each a LEB128 varint of the nanoseconds since the
+ * previous record shifted left by REC_SHIFT and or'ed with one of:
+ *
+ *   ring << 1 | busy	the ring went busy or idle, all rings start idle
+ *   REC_CPU		followed by a varint of the cpu time, in ns, the child
+ *			used since the previous REC_CPU
+ *   REC_END		end of the recording
+ *
+ * Only transitions are stored, so an idle or steadily busy GPU costs next to
+ * nothing however long the recording.
+ */
+#define REC_MAGIC	"IGTGPUT1"
+#define REC_SHIFT	4
+#define REC_CPU		14
+#define REC_END		15
+#define REC_MAX_RINGS	7
+
+struct recorder {
+	FILE *file;
+	uint64_t start;
+	uint64_t last;	/* time of the previous record */
+	uint64_t cpu;	/* child cpu time recorded so far, ns */
+	int stat_fd;
+	long ticks_per_sec;
+};
+
+static void put_varint(FILE *file, uint64_t v)
+{
+	while (v >= 0x80) {
+		putc((v & 0x7f) | 0x80, file);
+		v >>= 7;
+	}
+	putc(v, file);
+}
+
+static bool get_varint(FILE *file, uint64_t *v)
+{
+	int shift = 0, c;
+
+	*v = 0;
+	do {
+		c = getc(file);
+		if (c == EOF || shift > 63)
+			return false;
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return true;
+}
+
+static void record(struct recorder *rec, uint64_t time, int code)
+{
+	put_varint(rec->file, (time - rec->last) << REC_SHIFT | code);
+	rec->last = time;
+}
+
+static void record_start(struct recorder *rec, const char *path, pid_t child)
+{
+	uint32_t period = NSEC_PER_SEC / SAMPLES_PER_SEC;
+	char stat[64];
+	int i, n = 0;
+
+	rec->file = fopen(path, "w");
+	if (rec->file == NULL)
+		err(1, "%s", path);
+
+	/* the child may have exited already, that only costs us cpu records */
+	snprintf(stat, sizeof(stat), "/proc/%d/stat", child);
+	rec->stat_fd = open(stat, O_RDONLY);
+	rec->ticks_per_sec = sysconf(_SC_CLK_TCK);
+
+	for (i = 0; i < ARRAY_SIZE(rings); i++)
+		n += rings[i].present;
+
+	fwrite(REC_MAGIC, 1, strlen(REC_MAGIC), rec->file);
+	for (i = 0; i < 4; i++)
+		putc(period >> (8 * i), rec->file);
+	putc(n, rec->file);
+	for (i = 0; i < ARRAY_SIZE(rings); i++)
+		if (rings[i].present)
+			fwrite(rings[i].name, 1, strlen(rings[i].name) + 1,
+			       rec->file);
+
+	rec->start = rec->last = gettime();
+}
+
+static void record_cpu(struct recorder *rec, uint64_t time, uint64_t cpu)
+{
+	if (cpu <= rec->cpu)
+		return;
+
+	record(rec, time, REC_CPU);
+	put_varint(rec->file, cpu - rec->cpu);
+	rec->cpu = cpu;
+}
+
+/* utime and stime of the child and of its reaped children, from /proc */
+static void record_child_cpu(struct recorder *rec, uint64_t time)
+{
+	unsigned long utime, stime;
+	long cutime, cstime;
+	char buf[512], *p;
+	ssize_t len;
+
+	if (rec->stat_fd < 0)
+		return;
+
+	len = pread(rec->stat_fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return;
+	buf[len] = '\0';
+
+	/* the command name may contain anything, skip past it */
+	p = strrchr(buf, ')');
+	if (p == NULL ||
+	    sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld",
+		   &utime, &stime, &cutime, &cstime) != 4)
+		return;
+
+	record_cpu(rec, time,
+		   (utime + stime + cutime + cstime) * NSEC_PER_SEC / rec->ticks_per_sec);
+}
+
+static void record_end(struct recorder *rec, uint64_t time,
+		       const struct rusage *rusage)
+{
+	/* rusage is finer grained than the clock ticks in /proc */
+	record_cpu(rec, time,
+		   (uint64_t)(timeval_secs(&rusage->ru_utime) * NSEC_PER_SEC) +
+		   (uint64_t)(timeval_secs(&rusage->ru_stime) * NSEC_PER_SEC));
+	record(rec, time, REC_END);
+
+	if (rec->stat_fd >= 0)
+		close(rec->stat_fd);
+	if (fclose(rec->file))
+		err(1, "writing the recording");
+}
+
+#define NUM_GAP_BUCKETS	6
+
+static const char *gap_buckets[NUM_GAP_BUCKETS] = {
+	"<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"
+};
+
+struct ring_summary {
+	char name[32];
+	bool busy, was_busy;
+	uint64_t since;	/* time of the last transition */
+	uint64_t busy_time;
+	unsigned long transitions;
+	unsigned long gaps[NUM_GAP_BUCKETS];
+};
+
+static int gap_bucket(uint64_t gap)
+{
+	uint64_t limit = 100000;
+	int i;
+
+	for (i = 0; i < NUM_GAP_BUCKETS - 1; i++, limit *= 10)
+		if (gap < limit)
+			break;
+
+	return i;
+}
+
+/*
+ * Replays a recording, keeping per ring busy time and a histogram of the idle
+ * gaps between busy periods. The time any ring was busy is accumulated too,
+ * and the part of it inside each cpu sample interval, weighted by the share
+ * of that interval the child spent on the cpu, estimates how much of the
+ * child's cpu time overlapped with gpu work.
+ */
+static int summarize(const char *path)
+{
+	struct ring_summary summary[REC_MAX_RINGS];
+	char magic[sizeof(REC_MAGIC) - 1];
+	uint64_t time = 0, v, any_busy = 0, cpu = 0, overlap = 0;
+	uint64_t cpu_time = 0, cpu_any_busy = 0;
+	uint32_t period = 0;
+	int num_rings, num_busy = 0, i, c;
+	bool ended = false;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (file == NULL)
+		err(1, "%s", path);
+	file = intel_decompress_file(file);
+
+	if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+	    memcmp(magic, REC_MAGIC, sizeof(magic)))
+		errx(1, "%s: not an intel_gpu_time recording", path);
+	for (i = 0; i < 4; i++)
+		period |= (uint32_t)getc(file) << (8 * i);
+	num_rings = getc(file);
+	if (num_rings < 0 || num_rings > REC_MAX_RINGS)
+		errx(1, "%s: corrupt header", path);
+
+	memset(summary, 0, sizeof(summary));
+	for (i = 0; i < num_rings; i++) {
+		int len = 0;
+
+		while ((c = getc(file)) > 0)
+			if (len < sizeof(summary[i].name) - 1)
+				summary[i].name[len++] = c;
+		if (c == EOF)
+			errx(1, "%s: corrupt header", path);
+	}
+
+	while (!ended && get_varint(file, &v)) {
+		uint64_t now = time + (v >> REC_SHIFT);
+		int code = v & ((1 << REC_SHIFT) - 1);
+		struct ring_summary *ring;
+
+		for (i = 0; i < num_rings; i++)
+			if (summary[i].busy)
+				summary[i].busy_time += now - time;
+		if (num_busy)
+			any_busy += now - time;
+		time = now;
+
+		switch (code) {
+		case REC_CPU:
+			if (!get_varint(file, &v))
+				goto truncated;
+			cpu += v;
+			/* a multithreaded child can spend more than the wall time */
+			if (time > cpu_time) {
+				double share = (double)v / (time - cpu_time);
+
+				overlap += (any_busy - cpu_any_busy) *
+					(share < 1 ? share : 1);
+			}
+			cpu_time = time;
+			cpu_any_busy = any_busy;
+			break;
+		case REC_END:
+			ended = true;
+			break;
+		default:
+			if ((code >> 1) >= num_rings)
+				errx(1, "%s: corrupt record at %.6fs", path,
+				     time / 1e9);
+			ring = &summary[code >> 1];
+			if (ring->busy == (code & 1))
+				break;
+
+			if (ring->busy) {
+				num_busy--;
+			} else {
+				/* only gaps between busy periods count */
+				if (ring->was_busy)
+					ring->gaps[gap_bucket(time - ring->since)]++;
+				num_busy++;
+			}
+			ring->busy = code & 1;
+			ring->was_busy |= ring->busy;
+			ring->since = time;
+			ring->transitions++;
+			break;
+		}
+	}
+truncated:
+	if (!ended)
+		fprintf(stderr, "%s: recording truncated at %.6fs\n",
+			path, time / 1e9);
+	fclose(file);
+
+	printf("duration: %.6fs, sample period: %uus\n\n",
+	       time / 1e9, period / 1000);
+
+	printf("%10s %12s %6s %12s\n", "ring", "busy", "%", "transitions");
+	for (i = 0; i < num_rings; i++)
+		printf("%10s %11.6fs %5.1f%% %12lu\n",
+		       summary[i].name, summary[i].busy_time / 1e9,
+		       time ? 100. * summary[i].busy_time / time : 0.,
+		       summary[i].transitions);
+
+	printf("\n%10s", "idle gaps");
+	for (c = 0; c < NUM_GAP_BUCKETS; c++)
+		printf(" %8s", gap_buckets[c]);
+	printf("\n");
+	for (i = 0; i < num_rings; i++) {
+		printf("%10s", summary[i].name);
+		for (c = 0; c < NUM_GAP_BUCKETS; c++)
+			printf(" %8lu", summary[i].gaps[c]);
+		printf("\n");
+	}
+
+	printf("\ngpu busy (any ring): %.6fs, cpu: %.6fs, overlap: %.6fs (%.1f%% of cpu)\n",
+	       any_busy / 1e9, cpu / 1e9, overlap / 1e9,
+	       cpu ? 100. * overlap / cpu : 0.);
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-r FILE] cmd [args...]\n"
+		"       %s -s FILE\n"
+		"\n"
+		"  -r, --record FILE     record ring busy/idle transitions to FILE\n"
+		"  -s, --summarize FILE  summarize a recording, no GPU access needed\n",
+		name, name);
+	exit(1);
+}
+
 int main(int argc, char **argv)
 {
+	static const struct option long_options[] = {
+		{ "record", required_argument, NULL, 'r' },
+		{ "summarize", required_argument, NULL, 's' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct pci_device *pci_dev;
+	struct intel_register_set *set;
+	uint32_t regs[2 * ARRAY_SIZE(rings)], vals[ARRAY_SIZE(regs)];
+	struct recorder rec;
+	const char *record_path = NULL;
 	pid_t child;
-	uint64_t ring_idle = 0, ring_time = 0;
+	uint64_t ring_time = 0, next;
 	struct timeval start, end;
 	static struct rusage rusage;
-	int status;
+	int status, num_regs = 0, i, c;
+	uint32_t devid;
+
+	/* stop at the command, its options are its own */
+	while ((c = getopt_long(argc, argv, "+r:s:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'r':
+			record_path = optarg;
+			break;
+		case 's':
+			return summarize(optarg);
+		default:
+			usage(argv[0]);
+		}
+	}
 
-	intel_mmio_use_pci_bar(intel_get_pci_device());
+	if (optind == argc)
+		usage(argv[0]);
 
-	if (argc == 1) {
-		fprintf(stderr, "usage: %s cmd [args...]\n", argv[0]);
-		return 1;
+	pci_dev = intel_get_pci_device();
+	devid = pci_dev->device_id;
+	/* no forcewake, holding it for the whole run would keep the GT out
+	 * of rc6 and skew what is being timed; rings in rc6 read as idle
+	 */
+	intel_mmio_use_pci_bar(pci_dev);
+
+	if (IS_GEN6(devid) || IS_GEN7(devid) || IS_GEN8(devid))
+		rings[1].mmio = 0x12030;
+	rings[0].present = true;
+	rings[1].present = HAS_BSD_RING(devid);
+	rings[2].present = HAS_BLT_RING(devid);
+	rings[3].present = HAS_VEBOX_RING(devid);
+
+	/* all rings are read together, in one batch per sample */
+	for (i = 0; i < ARRAY_SIZE(rings); i++) {
+		if (!rings[i].present)
+			continue;
+		rings[i].index = num_regs / 2;
+		rings[i].slot = num_regs;
+		regs[num_regs++] = rings[i].mmio + RING_HEAD;
+		regs[num_regs++] = rings[i].mmio + RING_TAIL;
 	}
+	set = intel_register_set_create(regs, num_regs);
 
 	signal(SIGCHLD, sighandler);
 	signal(SIGINT, SIG_IGN);
 	signal(SIGQUIT, SIG_IGN);
 
 	gettimeofday(&start, NULL);
-	child = spawn(argv+1);
+	child = spawn(argv + optind);
 	if (child < 0)
 		return 127;
 
+	if (record_path)
+		record_start(&rec, record_path, child);
+
+	next = gettime();
 	while (!goddo) {
-		uint32_t ring_head, ring_tail;
+		struct timespec ts;
+		uint64_t now;
+
+		intel_register_set_read(set, vals);
+		now = gettime();
+
+		for (i = 0; i < ARRAY_SIZE(rings); i++) {
+			struct ring *ring = &rings[i];
+			bool busy;
+
+			if (!ring->present)
+				continue;
 
-		ring_head = INREG(LP_RING + RING_HEAD) & HEAD_ADDR;
-		ring_tail = INREG(LP_RING + RING_TAIL) & TAIL_ADDR;
+			busy = (vals[ring->slot] & HEAD_ADDR) !=
+				(vals[ring->slot + 1] & TAIL_ADDR);
+			if (!busy)
+				ring->idle++;
 
-		if (ring_tail == ring_head)
-			ring_idle++;
+			if (record_path && busy != ring->busy)
+				record(&rec, now, ring->index << 1 | busy);
+			ring->busy = busy;
+		}
 		ring_time++;
 
-		usleep(1000000 / SAMPLES_PER_SEC);
+		if (record_path && ring_time % CPU_SAMPLE_INTERVAL == 0)
+			record_child_cpu(&rec, now);
+
+		/* keep to the sampling timeline, without bursts once behind */
+		next += NSEC_PER_SEC / SAMPLES_PER_SEC;
+		if (next < now)
+			next = now;
+		ts.tv_sec = next / NSEC_PER_SEC;
+		ts.tv_nsec = next % NSEC_PER_SEC;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
 	}
 	gettimeofday(&end, NULL);
 	timersub(&end, &start, &end);
@@ -101,12 +527,30 @@ int main(int argc, char **argv)
 	waitpid(child, &status, 0);
 
 	getrusage(RUSAGE_CHILDREN, &rusage);
+	if (record_path)
+		record_end(&rec, gettime(), &rusage);
+
 	printf("user: %ld.%06lds, sys: %ld.%06lds, elapsed: %ld.%06lds, CPU: %.1f%%, GPU: %.1f%%\n",
 	       rusage.ru_utime.tv_sec, rusage.ru_utime.tv_usec,
 	       rusage.ru_stime.tv_sec, rusage.ru_stime.tv_usec,
 	       end.tv_sec, end.tv_usec,
-	       100*(rusage.ru_utime.tv_sec + 1e-6*rusage.ru_utime.tv_usec + rusage.ru_stime.tv_sec + 1e-6*rusage.ru_stime.tv_usec) / (end.tv_sec + 1e-6*end.tv_usec),
-	       100 - ring_idle * 100. / ring_time);
+	       100*(timeval_secs(&rusage.ru_utime) + timeval_secs(&rusage.ru_stime)) / timeval_secs(&end),
+	       100 - rings[0].idle * 100. / ring_time);
+
+	if (num_regs > 2) {
+		const char *sep = "";
+
+		for (i = 0; i < ARRAY_SIZE(rings); i++) {
+			if (!rings[i].present)
+				continue;
+			printf("%s%s: %.1f%%", sep, rings[i].name,
+			       100 - rings[i].idle * 100. / ring_time);
+			sep = ", ";
+		}
+		printf("\n");
+	}
+
+	intel_register_set_destroy(set);
 
 	return WEXITSTATUS(status);
 }
@@ -34,9 +34,14 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <err.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/ioctl.h>
-#include <sys/time.h>
 #include <sys/wait.h>
 #include <string.h>
 #ifdef HAVE_TERMIOS_H
@@ -46,12 +51,19 @@
 #include "instdone.h"
 #include "intel_reg.h"
 #include "intel_chipset.h"
+#include "drmtest.h"
 
 #define  FORCEWAKE	    0xA18C
 #define  FORCEWAKE_ACK	    0x130090
 
 #define SAMPLES_PER_SEC             10000
 #define SAMPLES_TO_PERCENT_RATIO    (SAMPLES_PER_SEC / 100)
+#define MAX_SAMPLES_PER_SEC         100000
+
+#define NSEC_PER_SEC                1000000000ull
+
+/* INSTDONE and INSTDONE_1, plus HEAD and TAIL of up to four rings */
+#define MAX_SAMPLE_REGS             (2 + 2 * 4)
 
 #define MAX_NUM_TOP_BITS            100
 
@@ -117,12 +129,64 @@ const char *stats_reg_names[STATS_COUNT] = {
 uint64_t stats[STATS_COUNT];
 uint64_t last_stats[STATS_COUNT];
 
-static unsigned long
+static struct intel_register_set *
+stats_set_create(void)
+{
+	uint32_t regs[3 * STATS_COUNT];
+	int i;
+
+	/* high dword, low dword and the high dword again to catch carries */
+	for (i = 0; i < STATS_COUNT; i++) {
+		regs[3 * i + 0] = stats_regs[i] + 4;
+		regs[3 * i + 1] = stats_regs[i];
+		regs[3 * i + 2] = stats_regs[i] + 4;
+	}
+
+	return intel_register_set_create(regs, 3 * STATS_COUNT);
+}
+
+static void
+stats_read(const struct intel_register_set *set, uint64_t *values)
+{
+	uint32_t vals[3 * STATS_COUNT];
+	int i;
+
+	intel_register_set_read(set, vals);
+
+	for (i = 0; i < STATS_COUNT; i++) {
+		uint32_t stats_high = vals[3 * i + 0];
+		uint32_t stats_low = vals[3 * i + 1];
+		uint32_t stats_high_2 = vals[3 * i + 2];
+
+		while (stats_high != stats_high_2) {
+			stats_high = INREG(stats_regs[i] + 4);
+			stats_low = INREG(stats_regs[i]);
+			stats_high_2 = INREG(stats_regs[i] + 4);
+		}
+
+		values[i] = (uint64_t)stats_high << 32 | stats_low;
+	}
+}
+
+static uint64_t
 gettime(void)
 {
-    struct timeval t;
-    gettimeofday(&t, NULL);
-    return (t.tv_usec + (t.tv_sec * 1000000));
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void
+sleep_until(uint64_t deadline)
+{
+	struct timespec ts = {
+		.tv_sec = deadline / NSEC_PER_SEC,
+		.tv_nsec = deadline % NSEC_PER_SEC,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
 }
 
 static int
@@ -313,6 +377,7 @@ print_percentage_bar(float percent, int cur_line_len)
 struct ring {
 	const char *name;
 	uint32_t mmio;
+	int slot;	/* of RING_HEAD in the sample set, RING_TAIL follows */
 	int head, tail, size;
 	uint64_t full;
 	int idle;
@@ -333,15 +398,25 @@ static void ring_reset(struct ring *ring)
 	ring->idle = ring->full = 0;
 }
 
-static void ring_sample(struct ring *ring)
+static void ring_add_regs(struct ring *ring, uint32_t *regs, int *n)
+{
+	if (!ring->size)
+		return;
+
+	ring->slot = *n;
+	regs[(*n)++] = ring->mmio + RING_HEAD;
+	regs[(*n)++] = ring->mmio + RING_TAIL;
+}
+
+static void ring_sample(struct ring *ring, const uint32_t *vals)
 {
 	int full;
 
 	if (!ring->size)
 		return;
 
-	ring->head = ring_read(ring, RING_HEAD) & HEAD_ADDR;
-	ring->tail = ring_read(ring, RING_TAIL) & TAIL_ADDR;
+	ring->head = vals[ring->slot] & HEAD_ADDR;
+	ring->tail = vals[ring->slot + 1] & TAIL_ADDR;
 
 	if (ring->tail == ring->head)
 		ring->idle++;
@@ -387,6 +462,166 @@ static void ring_log(struct ring *ring, unsigned long samples_per_sec,
 		fprintf(output, "-1\t-1\t");
 }
 
+/*
+ * Sampling runs in its own thread, woken on an absolute timeline so neither
+ * the time taken by a read nor the aggregation and printing done once a
+ * second shift later samples. Each sample is timestamped and pushed into a
+ * single producer, single consumer queue, which the main thread drains.
+ */
+struct sample {
+	uint64_t time;	/* CLOCK_MONOTONIC, ns */
+	uint32_t vals[MAX_SAMPLE_REGS];
+};
+
+struct sampler {
+	const struct intel_register_set *set;
+	uint64_t period;
+	pthread_t thread;
+	bool stop;
+
+	struct sample *queue;
+	unsigned long size;	/* power of two */
+	unsigned long head __attribute__((aligned(64)));	/* producer */
+	unsigned long tail __attribute__((aligned(64)));	/* consumer */
+
+	/* written by the producer only */
+	unsigned long missed;	/* ticks skipped after falling behind */
+	unsigned long dropped;	/* samples lost to a full queue */
+};
+
+static void *sampler_thread(void *arg)
+{
+	struct sampler *s = arg;
+	uint64_t next = gettime();
+
+	while (!__atomic_load_n(&s->stop, __ATOMIC_RELAXED)) {
+		unsigned long head = s->head;
+		uint64_t now;
+
+		sleep_until(next);
+
+		if (head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) < s->size) {
+			struct sample *sample = &s->queue[head & (s->size - 1)];
+
+			sample->time = gettime();
+			intel_register_set_read(s->set, sample->vals);
+			__atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+		} else
+			__atomic_store_n(&s->dropped, s->dropped + 1,
+					 __ATOMIC_RELAXED);
+
+		/* Skip the ticks we slept through instead of catching up in
+		 * a burst of back to back samples. */
+		next += s->period;
+		now = gettime();
+		if (now > next + s->period) {
+			uint64_t behind = (now - next) / s->period;
+
+			next += behind * s->period;
+			__atomic_store_n(&s->missed, s->missed + behind,
+					 __ATOMIC_RELAXED);
+		}
+	}
+
+	return NULL;
+}
+
+static void sampler_start(struct sampler *s,
+			  const struct intel_register_set *set,
+			  int samples_per_sec)
+{
+	struct sched_param param;
+	int ret;
+
+	memset(s, 0, sizeof(*s));
+	s->set = set;
+	s->period = NSEC_PER_SEC / samples_per_sec;
+
+	/* room for two seconds of samples, the queue is drained every second */
+	s->size = 1;
+	while (s->size < 2 * samples_per_sec)
+		s->size <<= 1;
+	s->queue = malloc(s->size * sizeof(*s->queue));
+	if (s->queue == NULL)
+		errx(1, "failed to allocate the sample queue");
+
+	ret = pthread_create(&s->thread, NULL, sampler_thread, s);
+	if (ret)
+		errx(1, "failed to start the sampling thread: %s", strerror(ret));
+
+	/* best effort, running as root we can keep the sampler on time */
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	pthread_setschedparam(s->thread, SCHED_FIFO, &param);
+}
+
+static void sampler_stop(struct sampler *s)
+{
+	__atomic_store_n(&s->stop, true, __ATOMIC_RELAXED);
+	pthread_join(s->thread, NULL);
+	free(s->queue);
+}
+
+static const struct sample *sampler_peek(struct sampler *s)
+{
+	if (s->tail == __atomic_load_n(&s->head, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &s->queue[s->tail & (s->size - 1)];
+}
+
+static void sampler_pop(struct sampler *s)
+{
+	__atomic_store_n(&s->tail, s->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Achieved sampling rate and the deviation of sample intervals from the
+ * period, over one reporting interval or the whole run. */
+struct sample_timing {
+	uint64_t start;
+	unsigned long count;
+	unsigned long intervals;
+	double jitter_sq;	/* sum of squared deviations, ns^2 */
+	uint64_t jitter_max;	/* ns */
+};
+
+static void timing_reset(struct sample_timing *t, uint64_t start)
+{
+	memset(t, 0, sizeof(*t));
+	t->start = start;
+}
+
+static void timing_add(struct sample_timing *t, uint64_t period,
+		       uint64_t last, uint64_t time)
+{
+	t->count++;
+
+	if (last) {
+		uint64_t interval = time - last;
+		uint64_t dev = interval > period ? interval - period : period - interval;
+
+		t->intervals++;
+		t->jitter_sq += (double)dev * dev;
+		if (dev > t->jitter_max)
+			t->jitter_max = dev;
+	}
+}
+
+static double timing_rate(const struct sample_timing *t, uint64_t now)
+{
+	if (now == t->start)
+		return 0;
+
+	return t->count * (double)NSEC_PER_SEC / (now - t->start);
+}
+
+static double timing_jitter_us(const struct sample_timing *t)
+{
+	if (!t->intervals)
+		return 0;
+
+	return sqrt(t->jitter_sq / t->intervals) / 1000;
+}
+
 static void
 usage(const char *appname)
 {
@@ -395,14 +630,15 @@ usage(const char *appname)
 			"usage: %s [parameters]\n"
 			"\n"
 			"The following parameters apply:\n"
-			"[-s <samples>]       samples per seconds (default %d)\n"
+			"[-s <samples>]       samples per seconds (default %d, max %d)\n"
 			"[-e <command>]       command to profile\n"
 			"[-o <file>]          output statistics to file. If file is '-',"
 			"                     run in batch mode and output statistics to stdio only \n"
 			"[-h]                 show this help screen\n"
 			"\n",
 			appname,
-			SAMPLES_PER_SEC
+			SAMPLES_PER_SEC,
+			MAX_SAMPLES_PER_SEC
 		  );
 	return;
 }
@@ -424,6 +660,15 @@ int main(int argc, char **argv)
 		.name = "blitter",
 		.mmio = 0x22030,
 	};
+	struct ring *rings[] = {
+		&render_ring, &bsd_ring, &bsd6_ring, &blt_ring
+	};
+	struct intel_register_set *sample_set, *stats_set = NULL;
+	uint32_t sample_regs[MAX_SAMPLE_REGS];
+	int num_sample_regs = 0;
+	struct sampler sampler;
+	struct sample_timing timing, total_timing;
+	uint64_t last_sample_time = 0, start_time, t1, t2;
 	int i, ch;
 	int samples_per_sec = SAMPLES_PER_SEC;
 	FILE *output = NULL;
@@ -440,8 +685,10 @@ int main(int argc, char **argv)
 		case 'e': cmd = strdup(optarg);
 			break;
 		case 's': samples_per_sec = atoi(optarg);
-			if (samples_per_sec < 100) {
-				fprintf(stderr, "Error: samples per second must be >= 100\n");
+			if (samples_per_sec < 100 ||
+			    samples_per_sec > MAX_SAMPLES_PER_SEC) {
+				fprintf(stderr, "Error: samples per second must be between 100 and %d\n",
+					MAX_SAMPLES_PER_SEC);
 				exit(1);
 			}
 			break;
@@ -521,27 +768,30 @@ int main(int argc, char **argv)
 		ring_init(&blt_ring);
 	}
 
+	/* Everything read per sample goes into a single register set */
+	if (IS_965(devid)) {
+		sample_regs[num_sample_regs++] = INSTDONE_I965;
+		sample_regs[num_sample_regs++] = INSTDONE_1;
+	} else
+		sample_regs[num_sample_regs++] = INSTDONE;
+	for (i = 0; i < ARRAY_SIZE(rings); i++)
+		ring_add_regs(rings[i], sample_regs, &num_sample_regs);
+	sample_set = intel_register_set_create(sample_regs, num_sample_regs);
+
 	/* Initialize GPU stats */
 	if (HAS_STATS_REGS(devid)) {
-		for (i = 0; i < STATS_COUNT; i++) {
-			uint32_t stats_high, stats_low, stats_high_2;
-
-			do {
-				stats_high = INREG(stats_regs[i] + 4);
-				stats_low = INREG(stats_regs[i]);
-				stats_high_2 = INREG(stats_regs[i] + 4);
-			} while (stats_high != stats_high_2);
-
-			last_stats[i] = (uint64_t)stats_high << 32 |
-				stats_low;
-		}
+		stats_set = stats_set_create();
+		stats_read(stats_set, last_stats);
 	}
 
+	sampler_start(&sampler, sample_set, samples_per_sec);
+	start_time = t1 = gettime();
+	timing_reset(&total_timing, start_time);
+
 	for (;;) {
+		const struct sample *sample;
 		int j;
-		unsigned long long t1, ti, tf, t2;
-		unsigned long long def_sleep = 1000000 / samples_per_sec;
-		unsigned long long last_samples_per_sec = samples_per_sec;
+		unsigned long last_samples_per_sec;
 		unsigned short int max_lines;
 		struct winsize ws;
 		char clear_screen[] = {0x1b, '[', 'H',
@@ -550,55 +800,39 @@ int main(int argc, char **argv)
 		int percent;
 		int len;
 
-		t1 = gettime();
-
 		ring_reset(&render_ring);
 		ring_reset(&bsd_ring);
 		ring_reset(&bsd6_ring);
 		ring_reset(&blt_ring);
+		timing_reset(&timing, t1);
 
-		for (i = 0; i < samples_per_sec; i++) {
-			long long interval;
-			ti = gettime();
-			if (IS_965(devid)) {
-				instdone = INREG(INSTDONE_I965);
-				instdone1 = INREG(INSTDONE_1);
-			} else
-				instdone = INREG(INSTDONE);
+		sleep_until(t1 + NSEC_PER_SEC);
+		t2 = gettime();
+
+		while ((sample = sampler_peek(&sampler))) {
+			instdone = sample->vals[0];
+			if (IS_965(devid))
+				instdone1 = sample->vals[1];
 
 			for (j = 0; j < num_instdone_bits; j++)
 				update_idle_bit(&top_bits[j]);
 
-			ring_sample(&render_ring);
-			ring_sample(&bsd_ring);
-			ring_sample(&bsd6_ring);
-			ring_sample(&blt_ring);
+			for (j = 0; j < ARRAY_SIZE(rings); j++)
+				ring_sample(rings[j], sample->vals);
 
-			tf = gettime();
-			if (tf - t1 >= 1000000) {
-				/* We are out of sync, bail out */
-				last_samples_per_sec = i+1;
-				break;
-			}
-			interval = def_sleep - (tf - ti);
-			if (interval > 0)
-				usleep(interval);
-		}
+			timing_add(&timing, sampler.period,
+				   last_sample_time, sample->time);
+			timing_add(&total_timing, sampler.period,
+				   last_sample_time, sample->time);
+			last_sample_time = sample->time;
 
-		if (HAS_STATS_REGS(devid)) {
-			for (i = 0; i < STATS_COUNT; i++) {
-				uint32_t stats_high, stats_low, stats_high_2;
+			sampler_pop(&sampler);
+		}
 
-				do {
-					stats_high = INREG(stats_regs[i] + 4);
-					stats_low = INREG(stats_regs[i]);
-					stats_high_2 = INREG(stats_regs[i] + 4);
-				} while (stats_high != stats_high_2);
+		last_samples_per_sec = timing.count ?: 1;
 
-				stats[i] = (uint64_t)stats_high << 32 |
-					stats_low;
-			}
-		}
+		if (HAS_STATS_REGS(devid))
+			stats_read(stats_set, stats);
 
 		qsort(top_bits_sorted, num_instdone_bits,
 		      sizeof(struct top_bit *), top_bits_sort);
@@ -607,16 +841,21 @@ int main(int argc, char **argv)
 		 * most important info (at the top) will stay on screen. */
 		max_lines = -1;
 		if (ioctl(0, TIOCGWINSZ, &ws) != -1)
-			max_lines = ws.ws_row - 6; /* exclude header lines */
+			max_lines = ws.ws_row - 7; /* exclude header lines */
 		if (max_lines >= num_instdone_bits)
 			max_lines = num_instdone_bits;
 
-		t2 = gettime();
-		elapsed_time += (t2 - t1) / 1000000.0;
+		elapsed_time += (t2 - t1) / (double)NSEC_PER_SEC;
 
 		if (interactive) {
 			printf("%s", clear_screen);
 			print_clock_info(pci_dev);
+			printf("sampling: %.0f/%d Hz, jitter %.1f us rms, %.1f us max, "
+			       "%lu missed, %lu dropped\n",
+			       timing_rate(&timing, t2), samples_per_sec,
+			       timing_jitter_us(&timing), timing.jitter_max / 1000.0,
+			       __atomic_load_n(&sampler.missed, __ATOMIC_RELAXED),
+			       __atomic_load_n(&sampler.dropped, __ATOMIC_RELAXED));
 
 			ring_print(&render_ring, last_samples_per_sec);
 			ring_print(&bsd_ring, last_samples_per_sec);
@@ -704,15 +943,32 @@ int main(int argc, char **argv)
 				perror("waitpid");
 				exit(1);
 			}
-			if (res == 0)
+			if (res == 0) {
+				t1 = t2;
 				continue;
+			}
 			if (WIFEXITED(child_stat))
 				break;
 		}
+
+		t1 = t2;
 	}
 
-	fclose(output);
+	sampler_stop(&sampler);
+
+	if (output) {
+		fprintf(output, "# sampled at %.0f/%d Hz, jitter %.1f us rms, "
+			"%.1f us max, %lu missed, %lu dropped\n",
+			timing_rate(&total_timing, gettime()), samples_per_sec,
+			timing_jitter_us(&total_timing),
+			total_timing.jitter_max / 1000.0,
+			sampler.missed, sampler.dropped);
+		fclose(output);
+	}
 
+	intel_register_set_destroy(sample_set);
+	if (stats_set)
+		intel_register_set_destroy(stats_set);
 	intel_register_access_fini();
 	return 0;
 }
@@ -0,0 +1,427 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Compiled counterpart of quick_dump.py: dumps the quick_dump register lists
+ * from the builtin register database, either from the running hardware or
+ * offline from a register dump or snapshot.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <err.h>
+#include "intel_io.h"
+#include "intel_chipset.h"
+#include "intel_reg_db.h"
+
+struct dump {
+	bool offline;
+	FILE *snapshot;
+	/* MMIO registers read so far, for the snapshot */
+	uint32_t *offsets, *values;
+	unsigned int count, size;
+};
+
+static const char *autodetect_profile(uint32_t devid)
+{
+	if (IS_GEN6(devid))
+		return "sandybridge";
+	else if (IS_IVYBRIDGE(devid))
+		return "ivybridge";
+	else if (IS_CHERRYVIEW(devid))
+		return "cherryview";
+	else if (IS_VALLEYVIEW(devid))
+		return "valleyview";
+	else if (IS_HASWELL(devid))
+		return "haswell";
+	else if (IS_BROADWELL(devid))
+		return "broadwell";
+
+	return NULL;
+}
+
+/* don't be clever, just try all possibilities */
+static void get_wake(void)
+{
+	intel_register_write(0xa18c, 0x1);
+	intel_register_read(0xa180);
+	intel_register_write(0xa188, 0x10001);
+	intel_register_read(0xa180);
+	intel_register_write(0x1300b0, 0x10001);
+	intel_register_read(0x1300b4);
+}
+
+static void print_centered(const char *str, int width)
+{
+	int len = strlen(str);
+	int left = len < width ? (width - len) / 2 : 0;
+	int right = len < width ? width - len - left : 0;
+
+	printf("%*s%s%*s", left, "", str, right, "");
+}
+
+static void remember(struct dump *dump, uint32_t offset, uint32_t value)
+{
+	if (dump->count == dump->size) {
+		dump->size = dump->size ? 2 * dump->size : 1024;
+		dump->offsets = realloc(dump->offsets,
+					dump->size * sizeof(*dump->offsets));
+		dump->values = realloc(dump->values,
+				       dump->size * sizeof(*dump->values));
+		if (!dump->offsets || !dump->values)
+			errx(1, "out of memory");
+	}
+
+	dump->offsets[dump->count] = offset;
+	dump->values[dump->count] = value;
+	dump->count++;
+}
+
+static void dump_group(struct dump *dump, const struct intel_reg_group *group)
+{
+	const struct intel_reg_desc *regs = group->regs;
+	uint32_t *offsets, *vals;
+	unsigned int i, n = 0;
+	char title[64];
+
+	offsets = malloc(group->count * sizeof(*offsets));
+	vals = malloc(group->count * sizeof(*vals));
+	if (group->count && (!offsets || !vals))
+		errx(1, "out of memory");
+
+	/* all mmio registers of the group are read in one batch */
+	for (i = 0; i < group->count; i++)
+		if (regs[i].port == INTEL_REG_PORT_MMIO)
+			offsets[n++] = regs[i].offset;
+	intel_register_read_batch(offsets, vals, n);
+
+	if (!dump->snapshot) {
+		snprintf(title, sizeof(title), "%s.txt", group->name);
+		print_centered("offset", 10);
+		printf(" | ");
+		print_centered(title, 33);
+		printf(" | ");
+		print_centered("value", 10);
+		printf("\n");
+		printf("%.59s\n", "-----------------------------------------------------------");
+	}
+
+	for (i = 0, n = 0; i < group->count; i++) {
+		const struct intel_reg_desc *reg = &regs[i];
+		bool valid = true;
+		uint32_t val = 0;
+
+		switch (reg->port) {
+		case INTEL_REG_PORT_MMIO:
+			val = vals[n++];
+			if (dump->snapshot)
+				remember(dump, reg->offset, val);
+			break;
+		case INTEL_REG_PORT_DPIO:
+		case INTEL_REG_PORT_DPIO2:
+			valid = !dump->offline;
+			if (valid)
+				val = intel_dpio_reg_read(reg->offset,
+							  reg->port == INTEL_REG_PORT_DPIO2);
+			break;
+		case INTEL_REG_PORT_FLISDSI:
+			valid = !dump->offline;
+			if (valid)
+				val = intel_flisdsi_reg_read(reg->offset);
+			break;
+		}
+
+		if (dump->snapshot)
+			continue;
+
+		if (valid)
+			printf("0x%08x | %-33s | 0x%08x\n",
+			       reg->offset, reg->name, val);
+		else
+			printf("0x%08x | %-33s | %10s\n",
+			       reg->offset, reg->name, "n/a");
+	}
+
+	if (!dump->snapshot)
+		printf("\n");
+
+	free(offsets);
+	free(vals);
+}
+
+static int cmp_offset(const void *a, const void *b)
+{
+	uint32_t x = *(const uint64_t *)a >> 32, y = *(const uint64_t *)b >> 32;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Writes the mmio registers dumped as a snapshot in the intel_reg_snapshot
+ * format, one range per run of consecutive registers, which
+ * intel_mmio_use_dump_file() and so quick_dump -m can read back.
+ */
+static void write_snapshot(struct dump *dump, uint32_t devid)
+{
+	struct intel_snapshot_header hdr;
+	struct intel_snapshot_range *ranges;
+	uint64_t *sorted, offset;
+	uint32_t *data;
+	unsigned int i, n = 0, num_ranges = 0;
+
+	sorted = malloc((dump->count + 1) * sizeof(*sorted));
+	ranges = calloc(dump->count + 1, sizeof(*ranges));
+	data = malloc((dump->count + 1) * sizeof(*data));
+	if (!sorted || !ranges || !data)
+		errx(1, "out of memory");
+
+	/* sort by offset, with the value riding along in the low bits */
+	for (i = 0; i < dump->count; i++)
+		sorted[i] = (uint64_t)dump->offsets[i] << 32 | dump->values[i];
+	qsort(sorted, dump->count, sizeof(*sorted), cmp_offset);
+
+	for (i = 0; i < dump->count; i++) {
+		uint32_t reg = sorted[i] >> 32;
+
+		/* registers listed in several groups are only saved once */
+		if (i && reg == sorted[i - 1] >> 32)
+			continue;
+
+		if (num_ranges && ranges[num_ranges - 1].base +
+		    ranges[num_ranges - 1].size == reg) {
+			ranges[num_ranges - 1].size += 4;
+		} else {
+			ranges[num_ranges].base = reg;
+			ranges[num_ranges].size = 4;
+			ranges[num_ranges].offset = n * 4;
+			num_ranges++;
+		}
+		data[n++] = sorted[i];
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, INTEL_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	hdr.devid = devid;
+	hdr.gen = intel_gen(devid);
+	hdr.timestamp = time(NULL);
+	hdr.mmio_size = intel_gen(devid) < 5 ? 512*1024 : 2*1024*1024;
+	hdr.num_ranges = num_ranges;
+
+	offset = sizeof(hdr) + num_ranges * sizeof(*ranges);
+	for (i = 0; i < num_ranges; i++) {
+		ranges[i].length = ranges[i].size;
+		ranges[i].offset += offset;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, dump->snapshot) != 1 ||
+	    fwrite(ranges, sizeof(*ranges), num_ranges, dump->snapshot) != num_ranges ||
+	    fwrite(data, sizeof(*data), n, dump->snapshot) != n ||
+	    fflush(dump->snapshot))
+		err(1, "failed to write the snapshot");
+
+	free(sorted);
+	free(ranges);
+	free(data);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [profile]\n"
+		"  -b, --baseless        ignore the base_ register lists\n"
+		"  -f, --file LIST       only dump the given register list\n"
+		"  -m, --mmio FILE       read the registers from a dump or snapshot\n"
+		"  -d, --devid ID        device id to assume for raw dumps (in hex)\n"
+		"  -s, --snapshot FILE   write a register snapshot instead of text\n"
+		"  -l, --list            list the known profiles and register lists\n"
+		"\n"
+		"The profile (sandybridge, haswell, ...) defaults to the one for the\n"
+		"device.\n",
+		name);
+}
+
+static const struct intel_reg_group *find_group(const char *name)
+{
+	const struct intel_reg_group *group;
+	char *base = strdup(name), *ext;
+
+	/* accept both "base_display" and "base_display.txt" */
+	ext = strrchr(base, '.');
+	if (ext && strcmp(ext, ".txt") == 0)
+		*ext = '\0';
+
+	group = intel_reg_db_find_group(&intel_reg_db_builtin, base);
+	if (group == NULL)
+		errx(1, "unknown register list %s", name);
+
+	free(base);
+	return group;
+}
+
+static void list(void)
+{
+	const struct intel_reg_db *db = &intel_reg_db_builtin;
+	unsigned int i, j;
+
+	printf("profiles:\n");
+	for (i = 0; i < db->num_profiles; i++) {
+		printf("  %-12s", db->profiles[i].name);
+		for (j = 0; j < db->profiles[i].num_groups; j++)
+			printf(" %s", db->profiles[i].groups[j]->name);
+		printf("\n");
+	}
+
+	printf("register lists:\n");
+	for (i = 0; i < db->num_groups; i++)
+		printf("  %-28s %4u registers\n",
+		       db->groups[i].name, db->groups[i].count);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "baseless", no_argument, NULL, 'b' },
+		{ "file", required_argument, NULL, 'f' },
+		{ "mmio", required_argument, NULL, 'm' },
+		{ "devid", required_argument, NULL, 'd' },
+		{ "snapshot", required_argument, NULL, 's' },
+		{ "list", no_argument, NULL, 'l' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const struct intel_reg_db *db = &intel_reg_db_builtin;
+	const struct intel_reg_profile *profile = NULL;
+	const char *file = NULL, *mmio_file = NULL, *profile_name = NULL;
+	struct pci_device *pci_dev = NULL;
+	struct dump dump = { 0 };
+	bool baseless = false;
+	uint32_t devid = 0;
+	unsigned int i;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "bf:m:d:s:lh",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			baseless = true;
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'm':
+			mmio_file = optarg;
+			break;
+		case 'd':
+			devid = strtoul(optarg, NULL, 16);
+			break;
+		case 's':
+			dump.snapshot = fopen(optarg, "w");
+			if (dump.snapshot == NULL)
+				err(1, "failed to open %s", optarg);
+			break;
+		case 'l':
+			list();
+			return 0;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc)
+		profile_name = argv[optind];
+
+	if (mmio_file) {
+		uint32_t snapshot_devid = intel_mmio_use_dump_file((char *)mmio_file);
+
+		if (!devid)
+			devid = snapshot_devid;
+		dump.offline = true;
+	} else {
+		pci_dev = intel_get_pci_device();
+		devid = pci_dev->device_id;
+
+		if (intel_register_access_init(pci_dev, 0))
+			errx(1, "register access init failed");
+
+		if (intel_register_access_needs_fakewake()) {
+			fprintf(stderr, "Forcing forcewake. Don't expect your "
+				"system to work after this.\n");
+			get_wake();
+		}
+	}
+
+	if (dump.snapshot && !devid)
+		errx(1, "a device id is needed to write a snapshot, use -d");
+
+	/* specifying a file trumps all other things */
+	if (file) {
+		dump_group(&dump, find_group(file));
+		goto out;
+	}
+
+	/* base_ lists are assumed to apply for all gens */
+	if (!baseless)
+		for (i = 0; i < db->num_groups; i++)
+			if (strncmp(db->groups[i].name, "base_", 5) == 0)
+				dump_group(&dump, &db->groups[i]);
+
+	if (profile_name == NULL && devid)
+		profile_name = autodetect_profile(devid);
+
+	if (profile_name)
+		profile = intel_reg_db_find_profile(db, profile_name);
+
+	if (profile) {
+		for (i = 0; i < profile->num_groups; i++)
+			dump_group(&dump, profile->groups[i]);
+	} else if (profile_name) {
+		fprintf(stderr, "Unknown profile %s\n", profile_name);
+	} else {
+		fprintf(stderr, "Autodetect of devid 0x%04x failed\n", devid);
+	}
+
+out:
+	if (dump.snapshot) {
+		write_snapshot(&dump, devid);
+		fclose(dump.snapshot);
+	}
+
+	if (pci_dev)
+		intel_register_access_fini();
+
+	free(dump.offsets);
+	free(dump.values);
+
+	return 0;
+}
@@ -36,6 +36,7 @@
 #include "intel_io.h"
 #include "intel_chipset.h"
 #include "intel_reg.h"
+#include "intel_reg_db.h"
 #include "drmtest.h"
 
 static uint32_t devid = 0;
@@ -2513,13 +2514,23 @@ _intel_dump_reg(struct reg_debug *reg, uint32_t val)
 static void
 _intel_dump_regs(struct reg_debug *regs, int count)
 {
+	uint32_t *offsets, *vals;
 	int i;
 
-	for (i = 0; i < count; i++) {
-		uint32_t val = INREG(regs[i].reg);
+	offsets = malloc(2 * count * sizeof(*offsets));
+	if (offsets == NULL)
+		err(1, "Failed to allocate register values");
+	vals = offsets + count;
 
-		_intel_dump_reg(&regs[i], val);
-	}
+	for (i = 0; i < count; i++)
+		offsets[i] = regs[i].reg;
+
+	intel_register_read_batch(offsets, vals, count);
+
+	for (i = 0; i < count; i++)
+		_intel_dump_reg(&regs[i], vals[i]);
+
+	free(offsets);
 }
 
 DEBUGSTRING(gen6_rp_control)
@@ -2569,17 +2580,17 @@ static struct {
 #undef DECLARE_REGS
 
 static void
-dump_reg(struct reg_debug *reg, uint32_t val, const char *prefix)
+dump_reg(const struct intel_reg_desc *reg, uint32_t val)
 {
 	char debug[1024];
 
-	if (reg->debug_output != NULL) {
-		reg->debug_output(debug, sizeof(debug), reg->reg, val);
+	if (reg->decode != NULL) {
+		reg->decode(debug, sizeof(debug), reg->offset, val);
 		printf("%s: %s (0x%x): 0x%08x (%s)\n",
-		       prefix, reg->name, reg->reg, val, debug);
+		       reg->group, reg->name, reg->offset, val, debug);
 	} else {
 		printf("%s: %s (0x%x): 0x%08x\n",
-		       prefix, reg->name, reg->reg, val);
+		       reg->group, reg->name, reg->offset, val);
 	}
 }
 
@@ -2592,41 +2603,95 @@ str_to_upper(char *str)
 	}
 }
 
-static void
-decode_register_name(char *name, uint32_t val)
+/* indexes known_registers, *out is the backing store to free */
+static struct intel_reg_db *
+known_registers_db(struct intel_reg_desc **out)
 {
-	int i, j;
+	struct intel_reg_desc *descs;
+	struct intel_reg_db *db;
+	int i, j, n = 0;
 
-	str_to_upper(name);
+	for (i = 0; i < ARRAY_SIZE(known_registers); i++)
+		n += known_registers[i].count;
 
+	descs = malloc(n * sizeof(*descs));
+	if (descs == NULL)
+		err(1, "Failed to allocate register database");
+
+	n = 0;
 	for (i = 0; i < ARRAY_SIZE(known_registers); i++) {
 		struct reg_debug *regs = known_registers[i].regs;
 
-		for (j = 0; j < known_registers[i].count; j++)
-			if (strstr(regs[j].name, name))
-				dump_reg(&regs[j], val,
-					 known_registers[i].description);
+		for (j = 0; j < known_registers[i].count; j++, n++) {
+			descs[n].name = regs[j].name;
+			descs[n].offset = regs[j].reg;
+			descs[n].port = INTEL_REG_PORT_MMIO;
+			descs[n].group = known_registers[i].description;
+			descs[n].decode = regs[j].debug_output;
+		}
 	}
+
+	db = intel_reg_db_create(descs, n);
+	if (db == NULL)
+		err(1, "Failed to allocate register database");
+
+	*out = descs;
+	return db;
 }
 
 static void
-decode_register_address(int address, uint32_t val)
+dump_matches(const struct intel_reg_desc *const *matches, int n, uint32_t val)
 {
-	int i, j;
+	int i;
 
-	for (i = 0; i < ARRAY_SIZE(known_registers); i++) {
-		struct reg_debug *regs = known_registers[i].regs;
+	for (i = 0; i < n; i++)
+		dump_reg(matches[i], val);
+}
+
+static void
+decode_register_name(const struct intel_reg_db *db, char *name, uint32_t val)
+{
+	const struct intel_reg_desc *const *matches;
+	int i, n;
 
-		for (j = 0; j < known_registers[i].count; j++)
-			if (regs[j].reg == address)
-				dump_reg(&regs[j], val,
-					 known_registers[i].description);
+	str_to_upper(name);
+
+	n = intel_reg_db_find_name(db, name, &matches);
+	if (n == 0)
+		n = intel_reg_db_find_name(&intel_reg_db_builtin, name,
+					   &matches);
+	if (n) {
+		dump_matches(matches, n, val);
+		return;
 	}
+
+	/* no exact match, list every register containing name */
+	for (i = 0; i < db->count; i++)
+		if (strstr(db->by_name[i]->name, name))
+			dump_reg(db->by_name[i], val);
+}
+
+static void
+decode_register_address(const struct intel_reg_db *db, int address,
+			uint32_t val)
+{
+	const struct intel_reg_desc *const *matches;
+	int n;
+
+	n = intel_reg_db_find_offset(db, INTEL_REG_PORT_MMIO, address,
+				     &matches);
+	if (n == 0)
+		n = intel_reg_db_find_offset(&intel_reg_db_builtin,
+					     INTEL_REG_PORT_MMIO, address,
+					     &matches);
+	dump_matches(matches, n, val);
 }
 
 static void
 decode_register(char *name, uint32_t val)
 {
+	struct intel_reg_desc *descs;
+	struct intel_reg_db *db = known_registers_db(&descs);
 	long int address;
 	char *end;
 
@@ -2634,9 +2699,12 @@ decode_register(char *name, uint32_t val)
 
 	/* found a register address */
 	if (address && *end == '\0')
-		decode_register_address(address, val);
+		decode_register_address(db, address, val);
 	else
-		decode_register_name(name, val);
+		decode_register_name(db, name, val);
+
+	intel_reg_db_destroy(db);
+	free(descs);
 }
 
 static void
@@ -2888,6 +2956,7 @@ static void print_usage(void)
 	       "Options:\n"
 	       "  -d id   when a dump file is used, use 'id' as device id (in "
 	       "hex)\n"
+	       "          instead of the one recorded in the snapshot\n"
 	       "  -h      prints this help\n");
 }
 
@@ -2931,7 +3000,10 @@ int main(int argc, char** argv)
 	}
 
 	if (file) {
-		intel_mmio_use_dump_file(file);
+		uint32_t dump_devid = intel_mmio_use_dump_file(file);
+
+		if (!devid)
+			devid = dump_devid;
 		if (devid) {
 			if (IS_GEN5(devid))
 				intel_pch = PCH_IBX;
@@ -2951,7 +3023,9 @@ int main(int argc, char** argv)
 		pci_dev = intel_get_pci_device();
 		devid = pci_dev->device_id;
 
-		intel_register_access_init(pci_dev, 1);
+		/* Most of what we dump lives in the display and PCH ranges
+		 * which the white list doesn't cover, so read unchecked. */
+		intel_register_access_init(pci_dev, 0);
 
 		if (HAS_PCH_SPLIT(devid))
 			intel_check_pch();
@@ -26,12 +26,14 @@
  */
 
 #include <unistd.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <err.h>
 #include <string.h>
 #include "intel_io.h"
 #include "intel_chipset.h"
+#include "intel_reg_db.h"
 
 static void bit_decode(uint32_t reg)
 {
@@ -55,6 +57,112 @@ static void dump_range(uint32_t start, uint32_t end)
 		       *(volatile uint32_t *)((volatile char*)mmio + i));
 }
 
+/* The quick_dump profile of the platform, as quick_dump.py picks it */
+static const char *platform_profile(uint32_t devid)
+{
+	if (IS_GEN6(devid))
+		return "sandybridge";
+	if (IS_IVYBRIDGE(devid))
+		return "ivybridge";
+	if (IS_CHERRYVIEW(devid))
+		return "cherryview";
+	if (IS_VALLEYVIEW(devid))
+		return "valleyview";
+	if (IS_HASWELL(devid))
+		return "haswell";
+	if (IS_BROADWELL(devid))
+		return "broadwell";
+	return NULL;
+}
+
+static bool in_profile(const struct intel_reg_profile *profile,
+		       const char *group)
+{
+	unsigned int i;
+
+	if (profile == NULL)
+		return false;
+
+	for (i = 0; i < profile->num_groups; i++)
+		if (strcmp(profile->groups[i]->name, group) == 0)
+			return true;
+
+	return false;
+}
+
+/*
+ * Names are looked up in the groups of the platform first, then in the
+ * base_ groups that apply to all of them, and only then anywhere.
+ */
+enum reg_scope {
+	SCOPE_PLATFORM,
+	SCOPE_BASE,
+	SCOPE_ANY,
+};
+
+static bool reg_in_scope(const struct intel_reg_desc *desc,
+			 const struct intel_reg_profile *profile,
+			 enum reg_scope scope)
+{
+	if (desc->port != INTEL_REG_PORT_MMIO)
+		return false;
+
+	switch (scope) {
+	case SCOPE_PLATFORM:
+		return in_profile(profile, desc->group);
+	case SCOPE_BASE:
+		return strncmp(desc->group, "base_", 5) == 0;
+	default:
+		return true;
+	}
+}
+
+static int lookup_reg(const char *arg, uint32_t devid, uint32_t *reg)
+{
+	const struct intel_reg_desc *const *matches;
+	const struct intel_reg_profile *profile = NULL;
+	const char *profile_name;
+	enum reg_scope scope;
+	int i, n, found;
+
+	if (sscanf(arg, "0x%x", reg) == 1)
+		return 0;
+
+	profile_name = platform_profile(devid);
+	if (profile_name)
+		profile = intel_reg_db_find_profile(&intel_reg_db_builtin,
+						    profile_name);
+
+	n = intel_reg_db_find_name(&intel_reg_db_builtin, arg, &matches);
+	for (scope = SCOPE_PLATFORM; scope <= SCOPE_ANY; scope++) {
+		found = 0;
+		for (i = 0; i < n; i++) {
+			if (!reg_in_scope(matches[i], profile, scope))
+				continue;
+
+			if (found && matches[i]->offset != *reg)
+				goto ambiguous;
+
+			*reg = matches[i]->offset;
+			found = 1;
+		}
+
+		if (found)
+			return 0;
+	}
+
+	fprintf(stderr, "Unknown register %s\n", arg);
+	return -1;
+
+ambiguous:
+	fprintf(stderr, "Ambiguous register %s, give one of:\n", arg);
+	for (i = 0; i < n; i++)
+		if (reg_in_scope(matches[i], profile, scope))
+			fprintf(stderr, "\t0x%05x (%s)\n",
+				matches[i]->offset, matches[i]->group);
+	return -1;
+}
+
 static void usage(char *cmdname)
 {
 	printf("Usage: %s [-f|-d] [addr1] [addr2] .. [addrN]\n", cmdname);
@@ -62,13 +170,14 @@ static void usage(char *cmdname)
 	printf("\t      WARNING! This option may result in a machine hang!\n");
 	printf("\t -d : decode register bits.\n");
 	printf("\t -c : number of dwords to dump (can't be used with -f/-d).\n");
-	printf("\t addr : in 0xXXXX format\n");
+	printf("\t addr : in 0xXXXX format, or a register name of this platform\n");
 }
 
 int main(int argc, char** argv)
 {
 	int ret = 0;
 	uint32_t reg;
+	struct pci_device *dev;
 	int i, ch;
 	char *cmdname = strdup(argv[0]);
 	int full_dump = 0;
@@ -107,7 +216,8 @@ int main(int argc, char** argv)
 		goto out;
 	}
 
-	intel_register_access_init(intel_get_pci_device(), 0);
+	dev = intel_get_pci_device();
+	intel_register_access_init(dev, 0);
 
 	if (full_dump) {
 		dump_range(0x00000, 0x00fff);   /* VGA registers */
@@ -126,7 +236,10 @@ int main(int argc, char** argv)
 		dump_range(0x73000, 0x73fff);   /* performance counters */
 	} else {
 		for (i=0; i < argc; i++) {
-			sscanf(argv[i], "0x%x", &reg);
+			if (lookup_reg(argv[i], dev->device_id, &reg)) {
+				ret = 1;
+				continue;
+			}
 			dump_range(reg, reg + (dwords * 4));
 
 			if (decode_bits)
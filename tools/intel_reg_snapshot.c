@@ -25,16 +25,118 @@
  */
 
 #include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
 #include <assert.h>
+#include "config.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 #include "intel_io.h"
 #include "intel_chipset.h"
 
+#define MAX_RANGES 256
+
+static struct intel_snapshot_range ranges[MAX_RANGES];
+static int num_ranges;
+
+static void add_range(uint32_t base, uint32_t size)
+{
+	if (num_ranges &&
+	    ranges[num_ranges - 1].base + ranges[num_ranges - 1].size == base) {
+		ranges[num_ranges - 1].size += size;
+		return;
+	}
+
+	assert(num_ranges < MAX_RANGES);
+	ranges[num_ranges].base = base;
+	ranges[num_ranges].size = size;
+	num_ranges++;
+}
+
+/* Only the readable ranges of the register map are worth saving, the rest
+ * of the BAR is reserved holes and the GTT.
+ */
+static uint32_t get_ranges(uint32_t devid, uint32_t mmio_size)
+{
+	struct intel_register_map map;
+	struct intel_register_range *range;
+
+	if (intel_gen(devid) < 4) {
+		add_range(0, mmio_size);
+		return 0;
+	}
+
+	map = intel_get_register_map(devid);
+	for (range = map.map; !(range->flags & INTEL_RANGE_END); range++) {
+		if (!(range->flags & INTEL_RANGE_READ))
+			continue;
+		if (range->base >= mmio_size)
+			break;
+		add_range(range->base, range->size + 1);
+	}
+
+	return INTEL_SNAPSHOT_REGISTER_MAP;
+}
+
+static void write_all(const void *data, size_t size)
+{
+	const char *ptr = data;
+
+	while (size) {
+		ssize_t ret = write(1, ptr, size);
+		assert(ret > 0);
+		ptr += ret;
+		size -= ret;
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] > snapshot\n"
+		"  -r, --raw       write a raw dump of the whole MMIO BAR\n"
+		"  -z, --compress  compress the register ranges\n",
+		name);
+}
+
 int main(int argc, char** argv)
 {
+	static const struct option long_options[] = {
+		{ "raw", no_argument, NULL, 'r' },
+		{ "compress", no_argument, NULL, 'z' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct intel_snapshot_header hdr;
 	struct pci_device *pci_dev;
-	uint32_t devid;
+	uint32_t devid, mmio_size;
+	void **data;
+	bool raw = false, compress = false;
+	uint64_t offset;
 	int mmio_bar;
-	int ret;
+	int ret, c, i;
+
+	while ((c = getopt_long(argc, argv, "rzh", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'r':
+			raw = true;
+			break;
+		case 'z':
+			compress = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
 	pci_dev = intel_get_pci_device();
 	devid = pci_dev->device_id;
@@ -45,8 +147,77 @@ int main(int argc, char** argv)
 	else
 		mmio_bar = 0;
 
-	ret = write(1, mmio, pci_dev->regions[mmio_bar].size);
-	assert(ret > 0);
+	if (raw) {
+		ret = write(1, mmio, pci_dev->regions[mmio_bar].size);
+		assert(ret > 0);
+		return 0;
+	}
+
+	/* Keep the GT awake while we sample, if the kernel lets us */
+	intel_register_access_init(pci_dev, 0);
+
+	mmio_size = intel_gen(devid) < 5 ? 512*1024 : 2*1024*1024;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, INTEL_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	hdr.devid = devid;
+	hdr.gen = intel_gen(devid);
+	hdr.timestamp = time(NULL);
+	hdr.mmio_size = mmio_size;
+	hdr.flags = get_ranges(devid, mmio_size);
+	if (!intel_register_access_needs_fakewake())
+		hdr.flags |= INTEL_SNAPSHOT_FORCEWAKE;
+	hdr.num_ranges = num_ranges;
+
+	data = calloc(num_ranges, sizeof(*data));
+	assert(data);
+
+	offset = sizeof(hdr) + num_ranges * sizeof(ranges[0]);
+	for (i = 0; i < num_ranges; i++) {
+		struct intel_snapshot_range *r = &ranges[i];
+		uint32_t *regs, reg;
+
+		regs = malloc(r->size);
+		assert(regs);
+		for (reg = 0; reg < r->size; reg += 4)
+			regs[reg / 4] = INREG(r->base + reg);
+
+		data[i] = regs;
+		r->length = r->size;
+#ifdef HAVE_ZLIB
+		if (compress) {
+			uLongf len = compressBound(r->size);
+			void *buf = malloc(len);
+
+			assert(buf);
+			if (compress2(buf, &len, (Bytef *)regs, r->size,
+				      Z_BEST_COMPRESSION) == Z_OK &&
+			    len < r->size) {
+				free(regs);
+				data[i] = buf;
+				r->length = len;
+				r->flags |= INTEL_SNAPSHOT_RANGE_ZLIB;
+			} else
+				free(buf);
+		}
+#else
+		if (compress && i == 0)
+			fprintf(stderr, "Built without zlib, "
+				"writing an uncompressed snapshot\n");
+#endif
+		r->offset = offset;
+		offset += r->length;
+	}
+
+	intel_register_access_fini();
+
+	write_all(&hdr, sizeof(hdr));
+	write_all(ranges, num_ranges * sizeof(ranges[0]));
+	for (i = 0; i < num_ranges; i++) {
+		write_all(data[i], ranges[i].length);
+		free(data[i]);
+	}
+	free(data);
 
 	return 0;
 }
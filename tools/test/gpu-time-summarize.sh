@@ -0,0 +1,12 @@
+#!/bin/sh
+
+SRCDIR=${srcdir-`pwd`/..}
+BUILDDIR=${top_builddir-`pwd`/../..}
+
+# gpu-time.rec has render and blt transitions and cpu records over 2s
+${BUILDDIR}/tools/intel_gpu_time -s $SRCDIR/test/gpu-time.rec > gpu-time.out
+if cmp gpu-time.out ${SRCDIR}/test/gpu-time.expected 2> /dev/null; then : ; else
+  echo "Output comparison for intel_gpu_time --summarize"
+  diff -u ${SRCDIR}/test/gpu-time.expected gpu-time.out
+  exit 1;
+fi